@@ -746,6 +746,11 @@ static void core1_handler() {
     }
 }
 
+void platform_run_on_core1(void (*func)())
+{
+    multicore_fifo_push_blocking((uintptr_t) func);
+}
+
 static bool is2023a = false;
 bool checkIs2023a() {
 #if defined(BLUESCSI_ULTRA) || defined(BLUESCSI_ULTRA_WIDE)
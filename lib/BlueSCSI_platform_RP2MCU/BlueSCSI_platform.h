@@ -255,6 +255,11 @@ bool platform_rebooted_into_mass_storage();
 typedef void (*sd_callback_t)(uint32_t bytes_complete);
 void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer);
 
+// Queue a function to run on core1 while core0 continues. The function
+// takes no parameters and works via side-effects, the caller is responsible
+// for waiting until it is done.
+void platform_run_on_core1(void (*func)());
+
 // Reprogram firmware in main program area.
 #ifndef RP2040_DISABLE_BOOTLOADER
 #define PLATFORM_BOOTLOADER_SIZE (128 * 1024)
@@ -40,6 +40,7 @@ extern "C" {
 #include "BlueSCSI_settings.h"
 #include <class/msc/msc.h>
 #include <class/msc/msc_device.h>
+#include <scsi.h>
 
 #include <pico/mutex.h>
 extern mutex_t __usb_mutex;
@@ -47,6 +48,15 @@ extern mutex_t __usb_mutex;
 #if CFG_TUD_MSC_EP_BUFSIZE < SD_SECTOR_SIZE
   #error "CFG_TUD_MSC_EP_BUFSIZE is too small! It needs to be at least 512 (SD_SECTOR_SIZE)"
 #endif
+#if CFG_TUD_MSC_EP_BUFSIZE % SD_SECTOR_SIZE != 0
+  #error "CFG_TUD_MSC_EP_BUFSIZE must be a multiple of 512 (SD_SECTOR_SIZE)"
+#endif
+
+// Smallest read-ahead after a sequential access is seen, doubles on every
+// further sequential refill up to the cache size.
+#ifndef MSC_READAHEAD_MIN
+#define MSC_READAHEAD_MIN 4096
+#endif
 
 // external global SD variable
 extern SdFs SD;
@@ -61,6 +71,11 @@ static bool g_msc_usb_mutex_held;
 static struct {
   uint8_t lun_unitReady[S2S_MAX_TARGETS];
   image_config_t * lun_config[S2S_MAX_TARGETS];
+  // Set up when the LUN is attached, so the read/write path needs no lookups
+  uint32_t lun_bytesPerSector[S2S_MAX_TARGETS];
+  uint64_t lun_size[S2S_MAX_TARGETS];     // bytes, whole sectors only
+  uint32_t lun_sdSector[S2S_MAX_TARGETS]; // first SD sector if lun_direct
+  bool lun_direct[S2S_MAX_TARGETS];       // accessed with raw SD sector commands
   uint8_t lun_count = 0;
   uint8_t unitReady = 0;
   uint8_t SDMode = 1;
@@ -109,6 +124,238 @@ public:
   ~MSCScopedLock() { platform_msc_lock_set(false); }
 };
 
+/* Read-ahead and write coalescing
+ *
+ * TinyUSB hands over at most CFG_TUD_MSC_EP_BUFSIZE bytes per callback, which
+ * makes a separate small card access for every chunk. The SCSI device buffer
+ * is idle in card reader mode, so it is used as a single cache shared by all
+ * LUNs: either read-ahead data for a sequential reader, or write data that is
+ * collected until it reaches an aligned boundary or the command completes.
+ * Positions are bytes from the start of the LUN.
+ */
+static struct {
+  uint8_t *buf;
+  uint32_t size;
+  uint8_t lun;
+  bool valid;           // buf holds read data for [start, start + len)
+  bool dirty;           // buf holds write data for [start, start + len)
+  bool write_error;     // a deferred write failed, fail the next command
+  uint64_t start;
+  uint32_t len;
+  uint8_t next_lun;     // sequential read detection
+  uint64_t next_pos;
+  uint32_t readahead;   // current read-ahead length
+
+  uint32_t read_chunks;
+  uint32_t read_hits;
+  uint32_t write_chunks;
+  uint32_t flushes;
+} g_msc_cache;
+
+static uint64_t msc_lun_size(uint8_t lun)
+{
+  return g_MSC.lun_size[lun];
+}
+
+static uint64_t msc_lun_pos(uint8_t lun, uint32_t lba, uint32_t offset)
+{
+  return (uint64_t)lba * g_MSC.lun_bytesPerSector[lun] + offset;
+}
+
+// Direct LUNs only have sector multiples for bytesPerSector, and the
+// endpoint buffer and cache are sector multiples, so positions and
+// lengths are always SD sector aligned on that path.
+static bool msc_storage_read(uint8_t lun, uint64_t pos, void *buf, uint32_t len)
+{
+  if (g_MSC.lun_direct[lun])
+    return SD.card()->readSectors(g_MSC.lun_sdSector[lun] + (uint32_t)(pos / SD_SECTOR_SIZE),
+                                  (uint8_t*)buf, len / SD_SECTOR_SIZE);
+
+  ImageBackingStore &file = g_MSC.lun_config[lun]->file;
+  return file.seek(pos) && file.read(buf, len) == (ssize_t)len;
+}
+
+static bool msc_storage_write(uint8_t lun, uint64_t pos, const void *buf, uint32_t len)
+{
+  // raw sector access would bypass the read-only attribute of the image
+  if (g_MSC.lun_config[lun] && !g_MSC.lun_config[lun]->file.isWritable())
+    return false;
+
+  if (g_MSC.lun_direct[lun])
+    return SD.card()->writeSectors(g_MSC.lun_sdSector[lun] + (uint32_t)(pos / SD_SECTOR_SIZE),
+                                   (const uint8_t*)buf, len / SD_SECTOR_SIZE);
+
+  ImageBackingStore &file = g_MSC.lun_config[lun]->file;
+  return file.seek(pos) && file.write(buf, len) == (ssize_t)len;
+}
+
+/* work out how a LUN maps to the SD card */
+static void msc_attach_lun(uint8_t lun, image_config_t *img)
+{
+  g_MSC.lun_config[lun] = img;
+  g_MSC.lun_direct[lun] = false;
+  g_MSC.lun_sdSector[lun] = 0;
+
+  if (!img) {
+    // whole SD card
+    g_MSC.lun_bytesPerSector[lun] = SD_SECTOR_SIZE;
+    g_MSC.lun_size[lun] = (uint64_t)SD.card()->sectorCount() * SD_SECTOR_SIZE;
+    g_MSC.lun_direct[lun] = true;
+    return;
+  }
+
+  uint32_t bytesPerSector = img->bytesPerSector;
+  g_MSC.lun_bytesPerSector[lun] = bytesPerSector;
+  g_MSC.lun_size[lun] = img->file.size() / bytesPerSector * bytesPerSector;
+
+  // ROM drives report a contiguous range but are not on the SD card.
+  // Sector sizes below 512 bytes could split SD sectors between commands.
+  uint32_t begin = 0, end = 0;
+  if (!img->file.isRom() && (bytesPerSector % SD_SECTOR_SIZE) == 0 &&
+      img->file.contiguousRange(&begin, &end) &&
+      g_MSC.lun_size[lun] / SD_SECTOR_SIZE <= (uint64_t)end - begin + 1)
+  {
+    g_MSC.lun_direct[lun] = true;
+    g_MSC.lun_sdSector[lun] = begin;
+    dbgmsg("USB LUN ", (int)lun, " uses SD card sectors ", begin, " to ", end, " directly");
+  }
+  else
+  {
+    dbgmsg("USB LUN ", (int)lun, " is not contiguous, using file access");
+  }
+}
+
+static void msc_cache_init()
+{
+  memset(&g_msc_cache, 0, sizeof(g_msc_cache));
+  g_msc_cache.buf = scsiDev.data;
+  g_msc_cache.size = sizeof(scsiDev.data);
+  g_msc_cache.readahead = MSC_READAHEAD_MIN;
+}
+
+static bool msc_cache_flush()
+{
+  if (!g_msc_cache.dirty)
+    return true;
+
+  g_msc_cache.dirty = false;
+  g_msc_cache.flushes++;
+  if (!msc_storage_write(g_msc_cache.lun, g_msc_cache.start, g_msc_cache.buf, g_msc_cache.len))
+  {
+    logmsg("USB LUN ", (int)g_msc_cache.lun, " write of ", (int)g_msc_cache.len,
+           " bytes at byte offset ", g_msc_cache.start, " failed");
+    g_msc_cache.write_error = true;
+    return false;
+  }
+  return true;
+}
+
+// Reports a write that failed after its command had already completed
+static bool msc_cache_check_error(uint8_t lun)
+{
+  if (!g_msc_cache.write_error)
+    return true;
+
+  g_msc_cache.write_error = false;
+  tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0C, 0x00); // WRITE ERROR
+  return false;
+}
+
+static int32_t msc_cache_read(uint8_t lun, uint64_t pos, uint8_t *buffer, uint32_t bufsize)
+{
+  if (!msc_cache_flush() || !msc_cache_check_error(lun))
+    return -1;
+
+  bool sequential = (lun == g_msc_cache.next_lun && pos == g_msc_cache.next_pos);
+  g_msc_cache.next_lun = lun;
+  g_msc_cache.next_pos = pos + bufsize;
+  g_msc_cache.read_chunks++;
+
+  if (g_msc_cache.valid && lun == g_msc_cache.lun &&
+      pos >= g_msc_cache.start && pos + bufsize <= g_msc_cache.start + g_msc_cache.len)
+  {
+    memcpy(buffer, g_msc_cache.buf + (uint32_t)(pos - g_msc_cache.start), bufsize);
+    g_msc_cache.read_hits++;
+    return bufsize;
+  }
+
+  if (!sequential)
+  {
+    // Random access, e.g. filesystem metadata, gets no read-ahead
+    g_msc_cache.readahead = MSC_READAHEAD_MIN;
+    return msc_storage_read(lun, pos, buffer, bufsize) ? (int32_t)bufsize : -1;
+  }
+
+  uint64_t lun_size = msc_lun_size(lun);
+  uint32_t len = g_msc_cache.readahead;
+  if (len < bufsize) len = bufsize;
+  if (pos + len > lun_size) len = (pos < lun_size) ? (uint32_t)(lun_size - pos) : 0;
+  if (len < bufsize)
+    return msc_storage_read(lun, pos, buffer, bufsize) ? (int32_t)bufsize : -1;
+
+  g_msc_cache.valid = false;
+  if (!msc_storage_read(lun, pos, g_msc_cache.buf, len))
+    return -1;
+
+  g_msc_cache.valid = true;
+  g_msc_cache.lun = lun;
+  g_msc_cache.start = pos;
+  g_msc_cache.len = len;
+  if (g_msc_cache.readahead < g_msc_cache.size / 2)
+    g_msc_cache.readahead *= 2;
+  else
+    g_msc_cache.readahead = g_msc_cache.size;
+
+  memcpy(buffer, g_msc_cache.buf, bufsize);
+  return bufsize;
+}
+
+static int32_t msc_cache_write(uint8_t lun, uint64_t pos, const uint8_t *buffer, uint32_t bufsize)
+{
+  if (!msc_cache_check_error(lun))
+    return -1;
+
+  // The buffer is shared, any read-ahead data is gone or stale now
+  g_msc_cache.valid = false;
+  g_msc_cache.next_lun = 0xFF;
+  g_msc_cache.write_chunks++;
+
+  // Flushes end on a multiple of the cache size, so after the first flush
+  // of a long write the card sees full size writes on aligned offsets.
+  if (g_msc_cache.dirty)
+  {
+    uint32_t limit = g_msc_cache.size - (uint32_t)(g_msc_cache.start % g_msc_cache.size);
+    if (lun != g_msc_cache.lun ||
+        pos != g_msc_cache.start + g_msc_cache.len ||
+        g_msc_cache.len + bufsize > limit)
+    {
+      if (!msc_cache_flush())
+        return -1;
+    }
+  }
+
+  if (!g_msc_cache.dirty)
+  {
+    if (bufsize > g_msc_cache.size - (uint32_t)(pos % g_msc_cache.size))
+      return msc_storage_write(lun, pos, buffer, bufsize) ? (int32_t)bufsize : -1;
+
+    g_msc_cache.dirty = true;
+    g_msc_cache.lun = lun;
+    g_msc_cache.start = pos;
+    g_msc_cache.len = 0;
+  }
+
+  memcpy(g_msc_cache.buf + g_msc_cache.len, buffer, bufsize);
+  g_msc_cache.len += bufsize;
+
+  if (g_msc_cache.start + g_msc_cache.len == (g_msc_cache.start / g_msc_cache.size + 1) * g_msc_cache.size)
+  {
+    if (!msc_cache_flush())
+      return -1;
+  }
+  return bufsize;
+}
+
 /* return true if USB presence detected / eligible to enter CR mode */
 bool platform_sense_msc() {
 #if defined(BLUESCSI_PICO) || defined(BLUESCSI_PICO_2) || defined(BLUESCSI_V2)
@@ -179,7 +426,8 @@ bool msc_image_eligble(uint8_t t) {
 
 /* perform MSC class preinit tasks */
 void platform_enter_msc() {
-  dbgmsg("USB MSC buffer size: ", CFG_TUD_MSC_EP_BUFSIZE);
+  dbgmsg("USB MSC buffer size: ", CFG_TUD_MSC_EP_BUFSIZE, ", cache size: ", (int)sizeof(scsiDev.data));
+  msc_cache_init();
   g_MSC.lun_count = 0;
     
   if (!g_MSC.SDMode) {
@@ -193,7 +441,7 @@ void platform_enter_msc() {
               logmsg("Warning: USB LUN ",(int)g_MSC.lun_count," uses a sector size of ",g_DiskImages[i].bytesPerSector,". Not all OS can deal with this!");
           }
 
-          g_MSC.lun_config[g_MSC.lun_count] = &g_DiskImages[i];
+          msc_attach_lun(g_MSC.lun_count, &g_DiskImages[i]);
           g_MSC.lun_unitReady[g_MSC.lun_count] = 1;       
           g_MSC.lun_count ++;  
       }
@@ -210,6 +458,7 @@ void platform_enter_msc() {
     logmsg("Presenting SD card as USB storage device");
     g_MSC.lun_count = 1;
     g_MSC.lun_unitReady[0] = 1;
+    msc_attach_lun(0, nullptr);
   }
 
   // MSC is ready for read/write
@@ -230,7 +479,20 @@ void platform_enter_msc() {
 
 /* perform any cleanup tasks for the MSC-specific functionality */
 void platform_exit_msc() {
-   g_MSC.unitReady = 0;
+  MSCScopedLock lock;
+  msc_cache_flush();
+  g_MSC.unitReady = 0;
+
+  // SCSI device mode owns the buffer again
+  g_msc_cache.valid = false;
+  g_msc_cache.buf = nullptr;
+
+  if (g_msc_cache.read_chunks || g_msc_cache.write_chunks)
+  {
+    logmsg("USB MSC cache: ", (int)g_msc_cache.read_hits, " of ", (int)g_msc_cache.read_chunks,
+           " reads from read-ahead, ", (int)g_msc_cache.write_chunks, " writes in ",
+           (int)g_msc_cache.flushes, " card accesses");
+  }
 }
 
 /* TinyUSB mass storage callbacks follow */
@@ -305,6 +567,8 @@ extern "C" bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool
       // load disk storage
       // do nothing as we started "loaded"
     } else {
+      if (g_msc_cache.lun == lun)
+        msc_cache_flush();
       g_MSC.lun_unitReady[lun] = false;
 
       if (g_MSC.unitReady) // no more active LUNs -> global not ready flag
@@ -331,13 +595,9 @@ extern "C" void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count,
   MSCScopedLock lock;
   if (g_msc_initiator) return init_msc_capacity_cb(lun, block_count, block_size);
 
-  if (g_MSC.SDMode) {
-    *block_count = g_MSC.unitReady ? (SD.card()->sectorCount()) : 0;
-    *block_size = SD_SECTOR_SIZE;
-  } else { // present the bytesPerSector of file, though it remains to be seen if host will like this
-    *block_count = (g_MSC.unitReady && g_MSC.lun_unitReady[lun]) ? (g_MSC.lun_config[lun]->file.size() / g_MSC.lun_config[lun]->bytesPerSector) : 0;
-    *block_size = g_MSC.lun_config[lun]->bytesPerSector;
-  }
+  // image LUNs present the bytesPerSector of the file, though it remains to be seen if host will like this
+  *block_count = (g_MSC.unitReady && g_MSC.lun_unitReady[lun]) ? (g_MSC.lun_size[lun] / g_MSC.lun_bytesPerSector[lun]) : 0;
+  *block_size = g_MSC.lun_bytesPerSector[lun];
 }
 
 // Callback invoked when received an SCSI command not in built-in list (below) which have their own callbacks
@@ -387,24 +647,19 @@ extern "C" int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset,
   MSCScopedLock lock;
   if (g_msc_initiator) return init_msc_read10_cb(lun, lba, offset, buffer, bufsize);
 
-  bool rc = 0;
+  int32_t rc = -1;
 
-  if (g_MSC.SDMode) {
-    rc = SD.card()->readSectors(lba, (uint8_t*) buffer, bufsize/SD_SECTOR_SIZE);
+  if (g_MSC.SDMode || g_MSC.lun_unitReady[lun]) {
+    rc = msc_cache_read(lun, msc_lun_pos(lun, lba, offset), (uint8_t*) buffer, bufsize);
   } else {
-    if (g_MSC.lun_unitReady[lun]) {
-      g_MSC.lun_config[lun]->file.seek(lba * g_MSC.lun_config[lun]->bytesPerSector);
-      rc = g_MSC.lun_config[lun]->file.read(buffer, bufsize);
-    } else {
-      logmsg("Attempted read to non-ready LUN ",lun);
-    }
+    logmsg("Attempted read to non-ready LUN ",lun);
   }
 
   // only blink fast on reads; writes will override this
   if (MSC_LEDMode == LED_SOLIDON)
     MSC_LEDMode = LED_BLINK_FAST;
   
-  return rc ? bufsize : -1;
+  return rc;
 }
 
 // Callback invoked when receive WRITE10 command.
@@ -415,23 +670,18 @@ extern "C" int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset
   MSCScopedLock lock;
   if (g_msc_initiator) return init_msc_write10_cb(lun, lba, offset, buffer, bufsize);
 
-  bool rc = 0;
+  int32_t rc = -1;
 
-  if (g_MSC.SDMode) {
-    rc = SD.card()->writeSectors(lba, buffer, bufsize/SD_SECTOR_SIZE); 
+  if (g_MSC.SDMode || g_MSC.lun_unitReady[lun]) {
+    rc = msc_cache_write(lun, msc_lun_pos(lun, lba, offset), buffer, bufsize);
   } else {
-    if (g_MSC.lun_unitReady[lun]) {
-      g_MSC.lun_config[lun]->file.seek(lba * g_MSC.lun_config[lun]->bytesPerSector);
-      rc = g_MSC.lun_config[lun]->file.write(buffer, bufsize);
-    } else {
-      logmsg("Attempted write to non-ready LUN ",lun);
-    }
+    logmsg("Attempted write to non-ready LUN ",lun);
   }
 
   // always slow blink
   MSC_LEDMode = LED_BLINK_SLOW;
 
-  return rc ? bufsize : -1;
+  return rc;
 }
 
 // Callback invoked when WRITE10 command is completed (status received and accepted by host).
@@ -440,5 +690,9 @@ extern "C" void tud_msc_write10_complete_cb(uint8_t lun)
 {
   MSCScopedLock lock;
   if (g_msc_initiator) return init_msc_write10_complete_cb(lun);
+
+  // Errors are reported on the next command, see msc_cache_check_error()
+  if (g_msc_cache.lun == lun)
+    msc_cache_flush();
 }
 #endif
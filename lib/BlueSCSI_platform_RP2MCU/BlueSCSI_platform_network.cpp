@@ -133,7 +133,7 @@ int platform_network_init(char *mac)
 		// retain Dayna vendor but use a device id specific to this board
 		pico_get_unique_board_id(&board_id);
 
-		dbgmsg("Unique board id: ", board_id.id[0], " ", board_id.id[1], " ", board_id.id[2], " ", board_id.id[3], " ",
+		dbgmsg<LOG_SUBSYS_NET>("Unique board id: ", board_id.id[0], " ", board_id.id[1], " ", board_id.id[2], " ", board_id.id[3], " ",
 									board_id.id[4], " ", board_id.id[5], " ", board_id.id[6], " ", board_id.id[7]);
 
 		if (board_id.id[3] != 0 && board_id.id[4] != 0 && board_id.id[5] != 0)
@@ -447,7 +447,7 @@ char * platform_network_wifi_bssid()
 	int ret = cyw43_wifi_get_bssid(&cyw43_state, (uint8_t *)bssid);
 	if (ret)
 	{
-		dbgmsg("Failed getting Wi-Fi BSSID: ", ret);
+		dbgmsg<LOG_SUBSYS_NET>("Failed getting Wi-Fi BSSID: ", ret);
 		return NULL;
 	}
 
@@ -485,6 +485,10 @@ int cyw43_tcpip_link_status(cyw43_t *self, int itf)
 
 void cyw43_cb_process_ethernet(void *cb_data, int itf, size_t len, const uint8_t *buf)
 {
+	// Drop multicast the host did not ask for before it is copied and CRCed
+	if (len < 6 || !scsiNetworkFilterAccept(buf))
+		return;
+
 	scsiNetworkEnqueue(buf, len);
 }
 
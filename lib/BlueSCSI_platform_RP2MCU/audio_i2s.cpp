@@ -29,6 +29,8 @@
 #include <CUEParser.h>
 #include "timings_RP2MCU.h"
 #include "BlueSCSI_audio.h"
+#include "BlueSCSI_sd_arbiter.h"
+#include "BlueSCSI_audio_file.h"
 // #include "BlueIDE_config.h"
 #include "BlueSCSI_log.h"
 #include "BlueSCSI_platform.h"
@@ -86,6 +88,14 @@ static bool last_track_reached = false;
 static bool within_gap = false;
 static uint32_t gap_read = 0;
 static CUETrackInfo current_track = {0};
+// container of audio_file, WAVE and FLAC positions are in decoded PCM bytes
+static audio_file_info_t audio_info = {AUDIO_CONTAINER_RAW, 0, 0};
+#if ENABLE_AUDIO_FLAC
+// FLAC: compressed data read on core0 per poll, decoded on core1
+#define FLAC_FILL_CHUNK 4096
+static bool flac_active = false;
+static uint64_t flac_pos; // PCM offset the next decode job starts at
+#endif
 
 // historical playback status information
 static audio_status_code audio_last_status[S2S_MAX_TARGETS] = {ASC_NO_STATUS, ASC_NO_STATUS, ASC_NO_STATUS, ASC_NO_STATUS,
@@ -104,48 +114,153 @@ static volatile uint16_t channel[S2S_MAX_TARGETS] = {
 // mechanism for cleanly stopping DMA units
 static volatile bool audio_stopping = false;
 
+// Per channel gains in Q16 fixed point, SND_GAIN_UNITY passes samples unchanged.
+// Recalculated only when the owner's volume, channel mask or MaxVolume changes,
+// so the per sample work is a single multiply and shift.
+#define SND_GAIN_UNITY 0x10000
+static struct {
+    bool valid;
+    uint8_t owner;
+    uint16_t volume;
+    uint16_t channel;
+    uint8_t max_volume;
+    int32_t gain_l;
+    int32_t gain_r;
+} snd_gain;
+
+static void snd_update_gain()
+{
+    uint16_t vol = volumes[audio_owner];
+    uint16_t chn = channel[audio_owner] & AUDIO_CHANNEL_ENABLE_MASK;
+    uint8_t max_volume = g_scsi_settings.getSystem()->maxVolume;
+    if (snd_gain.valid && snd_gain.owner == audio_owner && snd_gain.volume == vol
+        && snd_gain.channel == chn && snd_gain.max_volume == max_volume)
+    {
+        return;
+    }
+
+    snd_gain.owner = audio_owner;
+    snd_gain.volume = vol;
+    snd_gain.channel = chn;
+    snd_gain.max_volume = max_volume;
+
+    // MaxVolume is a percentage, values above 100 would overflow the sample
+    if (max_volume > 100) max_volume = 100;
+    uint32_t vol_l = (chn & 0xFF) ? (vol & 0xFF) : 0;
+    uint32_t vol_r = (chn >> 8) ? (vol >> 8) : 0;
+
+    // Volume 255 at MaxVolume 100 is unity gain
+    snd_gain.gain_l = (vol_l * max_volume * (uint64_t)SND_GAIN_UNITY + 12750) / 25500;
+    snd_gain.gain_r = (vol_r * max_volume * (uint64_t)SND_GAIN_UNITY + 12750) / 25500;
+    snd_gain.valid = true;
+}
+
+// Scale one stereo pair. Input has left in the low halfword, the I2S
+// output wants right in the low halfword, so the channels are also swapped.
+static inline uint32_t snd_scale_pair(uint32_t in, int32_t gain_l, int32_t gain_r)
+{
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+    // RP2350: 32x16 multiplies select the halfword directly and the pack
+    // instruction merges the results, no sign extension or masking needed
+    int32_t l, r;
+    uint32_t out;
+    asm ("smulwb %0, %1, %2" : "=r" (l) : "r" (gain_l), "r" (in));
+    asm ("smulwt %0, %1, %2" : "=r" (r) : "r" (gain_r), "r" (in));
+    asm ("pkhbt %0, %1, %2, lsl #16" : "=r" (out) : "r" (r), "r" (l));
+    return out;
+#else
+    int32_t l = ((int32_t)(int16_t)(in & 0xFFFF) * gain_l) >> 16;
+    int32_t r = ((int32_t)(int16_t)(in >> 16) * gain_r) >> 16;
+    return ((uint32_t)l << 16) | ((uint32_t)r & 0xFFFF);
+#endif
+}
+
 /*
  * I2S format is directly compatible to CD 16-bit audio with left and right channels
  * The only encoding needed is adjusting the volume and muting if one of the channels
- * is disabled.
+ * is disabled. Samples are processed in place, one 32-bit stereo pair at a time.
  */
-static void snd_encode(int16_t* samples, int16_t* output_buf, uint16_t len) {
-    uint8_t vol_r = 0, vol_l = 0;
-    vol_l = (uint8_t)volumes[audio_owner];
-    vol_r = (uint8_t)(volumes[audio_owner] >> 8);
-    uint16_t chn = channel[audio_owner] & AUDIO_CHANNEL_ENABLE_MASK;
-    if (!(chn >> 8))   vol_r = 0;   // right
-    if (!(chn & 0xFF)) vol_l = 0; // left
-    int16_t temp = 0;
-    for (uint16_t i = 0; i < len; i++ )
+__attribute__((section(".time_critical.snd_encode")))
+static void snd_encode(uint32_t* buf, uint32_t pairs) {
+    snd_update_gain();
+    const int32_t gain_l = snd_gain.gain_l;
+    const int32_t gain_r = snd_gain.gain_r;
+
+    if (gain_l == 0 && gain_r == 0)
     {
-        if (samples == nullptr)
-            output_buf[i] = 0;
-        else
+        memset(buf, 0, pairs * sizeof(uint32_t));
+    }
+    else if (gain_l == SND_GAIN_UNITY && gain_r == SND_GAIN_UNITY)
+    {
+        for (uint32_t i = 0; i < pairs; i++)
         {
-            if (i % 2 == 0)
-            {
-                temp = output_buf[i+1];
-                output_buf[i+1] = (int16_t)(((int64_t)samples[i]) * (vol_l) * g_scsi_settings.getSystem()->maxVolume / 25500) ;
-            }
-            else
-            {
-                output_buf[i-1] = (int16_t)(((int64_t)temp) * (vol_r) * g_scsi_settings.getSystem()->maxVolume / 25500);
-            }
+            uint32_t w = buf[i];
+            buf[i] = (w >> 16) | (w << 16);
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < pairs; i++)
+        {
+            buf[i] = snd_scale_pair(buf[i], gain_l, gain_r);
         }
     }
 }
 
 // functions for passing to Core1
 static void snd_process_a() {
-    snd_encode((int16_t *)(sample_buf_a), (int16_t*)(output_buf_a), AUDIO_BUFFER_SIZE/2);
+    snd_encode(output_buf_a, AUDIO_OUT_BUFFER_SIZE);
     sbufst_a = READY;
 }
 static void snd_process_b() {
-    snd_encode((int16_t *)sample_buf_b, (int16_t*)(output_buf_b), AUDIO_BUFFER_SIZE/2);
+    snd_encode(output_buf_b, AUDIO_OUT_BUFFER_SIZE);
+    sbufst_b = READY;
+}
+
+#if ENABLE_AUDIO_FLAC
+static void snd_decode_a() {
+    flac_stream_decode(output_buf_a, out_len_a / 4);
+    snd_encode(output_buf_a, AUDIO_OUT_BUFFER_SIZE);
+    sbufst_a = READY;
+}
+static void snd_decode_b() {
+    flac_stream_decode(output_buf_b, out_len_b / 4);
+    snd_encode(output_buf_b, AUDIO_OUT_BUFFER_SIZE);
     sbufst_b = READY;
 }
 
+// Keeps the compressed data ring topped up for the decoder on core1.
+// Waits for an ongoing SCSI read unless the decoder is about to run dry.
+static void snd_flac_fill(uint32_t deadline_us)
+{
+    if (!flac_stream_starving() && !sd_arbiter_audio_refill_now(deadline_us, FLAC_FILL_CHUNK))
+        return;
+
+    uint32_t read_start = time_us_32();
+    uint32_t total = 0;
+    uint32_t got;
+    while (total < AUDIO_BUFFER_SIZE && (got = flac_stream_fill(FLAC_FILL_CHUNK)) > 0)
+        total += got;
+    if (total > 0)
+        sd_arbiter_audio_refill_done(total, time_us_32() - read_start, deadline_us);
+}
+
+// Lets core1 finish any queued decode before the stream is moved or closed
+static void snd_flac_idle()
+{
+    while (sbufst_a == PROCESSING || sbufst_b == PROCESSING)
+        flac_stream_fill(FLAC_FILL_CHUNK);
+}
+
+static void snd_flac_close()
+{
+    if (!flac_active) return;
+    snd_flac_idle();
+    flac_stream_close();
+    flac_active = false;
+}
+#endif
+
 
 
 /**********************************************************************************************
@@ -187,10 +302,16 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
     // here through the seek path before any playback has created the parser.
     if (g_cue_parser == nullptr)
     {
-        dbgmsg("------ Audio setup - no cue sheet loaded, nothing to do");
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio setup - no cue sheet loaded, nothing to do");
         return false;
     }
 
+#if ENABLE_AUDIO_FLAC
+    // audio_file gets reopened below, the decoder must let go of it first
+    if (!single_bin_file)
+        snd_flac_close();
+#endif
+
     g_cue_parser->restart();
 
     while ((find_track_info = g_cue_parser->next_track(file_size)) != nullptr )
@@ -203,14 +324,14 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
             {
                 if (!(audio_parent.isDir() && audio_file.open(&audio_parent, find_track_info->filename, O_RDONLY)))
                 {
-                    dbgmsg("------ Audio playback - could not open the next track's bin file: ", find_track_info->filename);
+                    dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - could not open the next track's bin file: ", find_track_info->filename);
                     audio_file.close();
                     return false;
                 }
                 file_index = find_track_info->file_index;
             }
         }
-        file_size = audio_file.size();
+        file_size = audio_file_pcm_size(audio_file);
 
 
         if (continued)
@@ -240,7 +361,7 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
     {
         if (!(audio_parent.isDir() && audio_file.open(&audio_parent, track_info.filename, O_RDONLY)))
         {
-            dbgmsg("------ Audio playback - could not open the current track's bin file: ", track_info.filename);
+            dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - could not open the current track's bin file: ", track_info.filename);
             audio_file.close();
             return false;
         }
@@ -252,7 +373,7 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
         last_track_reached = true;
         if (track_info.track_number == 0)
         {
-            dbgmsg("------ Audio continued playback could not find specified track");
+            dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio continued playback could not find specified track");
             return false;
         }
     }
@@ -260,13 +381,13 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
     // test if the current or new audio file is open or can be opened
     if (single_bin_file && !audio_file.isOpen())
     {
-        dbgmsg("------ Audio playback - CD's bin file is not open");
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - CD's bin file is not open");
         return false;
     }
 
     if (track_info.track_mode != CUETrack_AUDIO)
     {
-        dbgmsg("------ Audio playback - track not CD Audio");
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - track not CD Audio");
         return false;
     }
 
@@ -342,7 +463,7 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
         volatile uint64_t size_of_playback;
         volatile uint32_t start_lba = start;
         size_of_playback = (start_lba + length - track_info.data_start) * (uint64_t)track_info.sector_length ;
-        volatile uint64_t last_track_byte_length = audio_file.size() - track_info.file_offset;
+        volatile uint64_t last_track_byte_length = audio_file_pcm_size(audio_file) - track_info.file_offset;
         if (size_of_playback <= last_track_byte_length)
         {
             if (within_gap)
@@ -353,10 +474,16 @@ static bool setup_playback(uint8_t id, uint32_t start, uint32_t length, bool con
         }
         else
         {
-            dbgmsg("------ Audio playback - length ", (int) length ,", beyond the last file in cue ");
+            dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - length ", (int) length ,", beyond the last file in cue ");
             return false;
         }
     }
+    if (!audio_file_probe(audio_file, &audio_info) || audio_info.container == AUDIO_CONTAINER_UNSUPPORTED)
+    {
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - unsupported audio file format");
+        return false;
+    }
+
     current_track = track_info;
     fpos = offset;
     return true;
@@ -372,6 +499,9 @@ void audio_dma_irq() {
     if (dma_hw->intr & (1 << dma_channel_a)) {
         dma_hw->ints2 = (1 << dma_channel_a);
         sbufst_a = STALE;
+        if (sbufst_b != READY && !audio_stopping && !(last_track_reached && fleft == 0)) {
+            sd_arbiter_audio_underrun();
+        }
         if (audio_stopping) {
             channel_config_set_chain_to(&snd_dma_a_cfg, dma_channel_a);
         }
@@ -384,6 +514,9 @@ void audio_dma_irq() {
     } else if (dma_hw->intr & (1 << dma_channel_b)) {
         dma_hw->ints2 = (1 <<  dma_channel_b);
         sbufst_b = STALE;
+        if (sbufst_a != READY && !audio_stopping && !(last_track_reached && fleft == 0)) {
+            sd_arbiter_audio_underrun();
+        }
         if (audio_stopping) {
             channel_config_set_chain_to(&snd_dma_b_cfg, dma_channel_b);
         }
@@ -428,7 +561,7 @@ void audio_setup() {
 
     dma_channel_a = dma_claim_unused_channel(true);
     dma_channel_b = dma_claim_unused_channel(true);
-    dbgmsg("Claimed Audio DMA Channels: ", dma_channel_a, " , ", dma_channel_b);
+    dbgmsg<LOG_SUBSYS_AUDIO>("Claimed Audio DMA Channels: ", dma_channel_a, " , ", dma_channel_b);
 
     irq_set_exclusive_handler(I2S_DMA_IRQ_NUM, audio_dma_irq);
     irq_set_enabled(I2S_DMA_IRQ_NUM, true);
@@ -473,6 +606,11 @@ void audio_poll() {
     }
     set_pause_buf = true;
 
+#if ENABLE_AUDIO_FLAC
+    // core1 may still be decoding the last buffers after all reads are queued
+    if (flac_active)
+        snd_flac_fill(audio_refill_deadline_us());
+#endif
 
     if (last_track_reached && fleft == 0 && sbufst_a == STALE && sbufst_b == STALE) {
         // out of data and ready to stop
@@ -483,7 +621,7 @@ void audio_poll() {
         return;
     } else if (!audio_file.isOpen()) {
         // closed elsewhere, maybe disk ejected?
-        dbgmsg("------ Playback stop due to closed file");
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Playback stop due to closed file");
         audio_stop(audio_owner);
         return;
     }
@@ -493,13 +631,25 @@ void audio_poll() {
     {
         if (!setup_playback(audio_owner, 0, 0, true))
         {
-            dbgmsg("------ Playback stopped because of error loading next track");
+            dbgmsg<LOG_SUBSYS_AUDIO>("------ Playback stopped because of error loading next track");
             audio_stop(audio_owner);
             return;
         }
     }
 
     // are new audio samples needed from the memory card?
+    if (sbufst_a != STALE && sbufst_b != STALE) {
+        return;
+    }
+
+    // Leave the SD card to an ongoing SCSI read while enough samples are queued
+    uint32_t deadline_us = audio_refill_deadline_us();
+    // FLAC reads happen in snd_flac_fill(), queuing a decode needs no SD access
+    if (!within_gap && audio_info.container != AUDIO_CONTAINER_FLAC
+        && !sd_arbiter_audio_refill_now(deadline_us, AUDIO_BUFFER_SIZE)) {
+        return;
+    }
+
     uint8_t* audiobuf;
     if (sbufst_a == STALE) {
         sbufst_a = FILLING;
@@ -516,6 +666,9 @@ void audio_poll() {
 
 
     platform_set_sd_callback(NULL, NULL);
+#if ENABLE_AUDIO_FLAC
+    bool decode = false;
+#endif
     uint16_t toRead = AUDIO_BUFFER_SIZE;
     uint16_t gap_to_read = AUDIO_BUFFER_SIZE;
     if (within_gap)
@@ -531,21 +684,52 @@ void audio_poll() {
             gap_length = 0;
         }
     }
+#if ENABLE_AUDIO_FLAC
+    else if (audio_info.container == AUDIO_CONTAINER_FLAC)
+    {
+        if (fleft < toRead) toRead = fleft;
+        if (!flac_active || flac_pos != fpos) {
+            dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio FLAC seek required");
+            snd_flac_idle();
+            flac_active = flac_stream_open(audio_file, fpos);
+            if (!flac_active) {
+                logmsg("------ Audio error, unable to seek FLAC stream to ", fpos);
+                memset(audiobuf, 0, AUDIO_BUFFER_SIZE);
+            }
+            flac_pos = fpos;
+        }
+        snd_flac_fill(deadline_us);
+        decode = flac_active;
+        *out_len = toRead;
+        fpos += toRead;
+        fleft -= toRead;
+        flac_pos += toRead;
+    }
+#endif
     else
     {
+        uint64_t file_pos = audio_info.data_offset + fpos;
         if (fleft < toRead) toRead = fleft;
-        if (audio_file.position() != fpos) {
+        if (audio_file.position() != file_pos) {
             // should be uncommon due to SCSI command restrictions on devices
             // playing audio; if this is showing up in logs a different approach
             // will be needed to avoid seek performance issues on FAT32 vols
-            dbgmsg("------ Audio seek required");
-            if (!audio_file.seek(fpos)) {
-                logmsg("------ Audio error, unable to seek to ", fpos);
+            dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio seek required");
+            if (!audio_file.seek(file_pos)) {
+                logmsg("------ Audio error, unable to seek to ", file_pos);
             }
         }
-        if (audio_file.read(audiobuf, toRead) != toRead) {
+        // Anything after the WAVE data chunk is not audio, play silence
+        uint16_t fileRead = toRead;
+        if (fpos + fileRead > audio_info.pcm_size) {
+            fileRead = (fpos < audio_info.pcm_size) ? audio_info.pcm_size - fpos : 0;
+            memset(audiobuf + fileRead, 0, toRead - fileRead);
+        }
+        uint32_t read_start = time_us_32();
+        if (fileRead && audio_file.read(audiobuf, fileRead) != fileRead) {
             logmsg("------ Audio sample data read error");
         }
+        sd_arbiter_audio_refill_done(toRead, time_us_32() - read_start, deadline_us);
         *out_len = toRead;
         fpos += toRead;
         fleft -= toRead;
@@ -554,9 +738,21 @@ void audio_poll() {
 
     if (sbufst_a == FILLING) {
         sbufst_a = PROCESSING;
+#if ENABLE_AUDIO_FLAC
+        if (decode) {
+            multicore_fifo_push_blocking((uintptr_t) &snd_decode_a);
+            return;
+        }
+#endif
         multicore_fifo_push_blocking((uintptr_t) &snd_process_a);
     } else if (sbufst_b == FILLING) {
         sbufst_b = PROCESSING;
+#if ENABLE_AUDIO_FLAC
+        if (decode) {
+            multicore_fifo_push_blocking((uintptr_t) &snd_decode_b);
+            return;
+        }
+#endif
         multicore_fifo_push_blocking((uintptr_t) &snd_process_b);
     }
 }
@@ -570,6 +766,9 @@ bool  audio_play_track_index(uint8_t owner,      image_config_t* img,
         logmsg("Error attempting to play CD Audio with no cue/bin image(s)");
         return false;
     }
+    // audio_file is replaced below, stop whatever is playing from it
+    if (!audio_idle)
+        audio_stop();
     if (img->bin_container.isOpen() && img->bin_container.isDir())
     {
         audio_parent.close();
@@ -626,14 +825,14 @@ bool  audio_play_track_index(uint8_t owner,      image_config_t* img,
             {
                 if (!(audio_parent.isDir() && audio_file.open(&audio_parent, find_track_info->filename, O_RDONLY)))
                 {
-                    dbgmsg("------ Audio playback - could not open the next track's bin file: ", find_track_info->filename);
+                    dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - could not open the next track's bin file: ", find_track_info->filename);
                     audio_file.close();
                     return false;
                 }
                 file_index = find_track_info->file_index;
             }
         }
-        file_size = audio_file.size();
+        file_size = audio_file_pcm_size(audio_file);
 
         if (!found_start && start_track == find_track_info->track_number)
         {
@@ -674,7 +873,7 @@ bool  audio_play_track_index(uint8_t owner,      image_config_t* img,
 
     if (!found_start)
     {
-        dbgmsg("------ Audio playback - could not find starting track");
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback - could not find starting track");
         return false;
     }
     
@@ -691,7 +890,7 @@ bool audio_play(uint8_t owner, image_config_t* img, const CUETrackInfo *trackinf
     // trackinfo is informational on I2S — the backend walks its own g_cue_parser
     // in setup_playback() and ignores the caller-supplied track.
     (void)trackinfo;
-    dbgmsg("------ Audio playback lba start ", (int) start, ", length ", (int)(length));
+    dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio playback lba start ", (int) start, ", length ", (int)(length));
     // Per Annex C terminate playback immediately if already in progress on
     // the current target. Non-current targets may also get their audio
     // interrupted later due to hardware limitations
@@ -731,7 +930,7 @@ bool audio_play(uint8_t owner, image_config_t* img, const CUETrackInfo *trackinf
         delete g_cue_parser;
         g_cue_parser = new CUEParser(g_cuesheet);
     }
-    // dbgmsg("Request to play ('", file, "':", start, ":", end, ")");
+    // dbgmsg<LOG_SUBSYS_AUDIO>("Request to play ('", file, "':", start, ":", end, ")");
 
     // verify audio file is present and inputs are (somewhat) sane
     platform_set_sd_callback(NULL, NULL);
@@ -740,7 +939,7 @@ bool audio_play(uint8_t owner, image_config_t* img, const CUETrackInfo *trackinf
     // we will not consider this to be an error at the moment
     // \todo reimplement
     // if (end > len) {
-    //     dbgmsg("------ Truncate audio play request end ", end, " to file size ", len);
+    //     dbgmsg<LOG_SUBSYS_AUDIO>("------ Truncate audio play request end ", end, " to file size ", len);
     //     end = len;
     //
     audio_owner = owner;
@@ -826,6 +1025,11 @@ void audio_stop(uint8_t id) {
     if (id != 0xFF && (audio_idle || (id & S2S_CFG_TARGET_ID_BITS) != audio_owner)) return;
 
     memset(&current_track, 0, sizeof(current_track));
+#if ENABLE_AUDIO_FLAC
+    // don't let core1 wait for data that is no longer coming
+    flac_stream_abort();
+    snd_flac_close();
+#endif
     memset(output_buf_a, 0, sizeof(output_buf_a));
     memset(output_buf_b, 0, sizeof(output_buf_b));
 
@@ -847,6 +1051,30 @@ void audio_stop(uint8_t id) {
     audio_playing = false;
     audio_idle = true;
     audio_file.close();
+    sd_arbiter_report();
+}
+
+uint32_t audio_refill_deadline_us()
+{
+    if (audio_idle || audio_paused || (sbufst_a != STALE && sbufst_b != STALE))
+        return UINT32_MAX;
+
+    // The buffer that is not stale is the one the DMA is playing,
+    // its remaining transfer count tells how long until it runs dry.
+    int playing;
+    if (dma_channel_is_busy(dma_channel_a))
+        playing = dma_channel_a;
+    else if (dma_channel_is_busy(dma_channel_b))
+        playing = dma_channel_b;
+    else
+        return 0;
+
+    if (sbufst_a == STALE && sbufst_b == STALE)
+        return 0;
+
+    // 32-bit stereo words at 44.1 kHz
+    uint32_t words_left = dma_channel_hw_addr(playing)->transfer_count;
+    return (uint32_t)((uint64_t)words_left * 1000000 / 44100);
 }
 
 audio_status_code audio_get_status_code(uint8_t id) {
@@ -883,7 +1111,9 @@ uint32_t audio_get_lba_position()
         // index0_offset is the adjustment to current_track.file_offset
         // to make it equivalent to current_track.track_start (index 0 in cue file)
         uint64_t index0_offset = (current_track.data_start -  current_track.track_start) * current_track.sector_length;
-        return current_track.track_start + (audio_file.position() - (current_track.file_offset - index0_offset)) / current_track.sector_length;
+        // WAVE and FLAC reads do not map directly to the file position
+        uint64_t pcm_pos = (audio_info.container == AUDIO_CONTAINER_RAW) ? audio_file.position() : fpos;
+        return current_track.track_start + (pcm_pos - (current_track.file_offset - index0_offset)) / current_track.sector_length;
     }
     else
     {
@@ -27,6 +27,8 @@
 #include <CUEParser.h>
 #include "audio_spdif.h"
 #include "BlueSCSI_audio.h"
+#include "BlueSCSI_sd_arbiter.h"
+#include "BlueSCSI_audio_file.h"
 #include "BlueSCSI_config.h"
 #include "BlueSCSI_log.h"
 #include "BlueSCSI_platform.h"
@@ -279,6 +281,13 @@ static void snd_encode(uint8_t* samples, uint16_t* wire_patterns, uint16_t len,
     }
 }
 
+// Sample buffer was not refilled in time, silence is output instead
+static inline void snd_note_underrun() {
+    if (fleft != 0 && !audio_paused && !audio_stopping) {
+        sd_arbiter_audio_underrun();
+    }
+}
+
 // functions for passing to Core1
 static void snd_process_a() {
     if (sbufsel == A) {
@@ -291,6 +300,7 @@ static void snd_process_a() {
                 sbufst_a = STALE;
             }
         } else {
+            snd_note_underrun();
             snd_encode(NULL, wire_buf_a, SAMPLE_CHUNK_SIZE, sbufswap);
         }
     } else {
@@ -303,6 +313,7 @@ static void snd_process_a() {
                 sbufst_b = STALE;
             }
         } else {
+            snd_note_underrun();
             snd_encode(NULL, wire_buf_a, SAMPLE_CHUNK_SIZE, sbufswap);
         }
     }
@@ -319,6 +330,7 @@ static void snd_process_b() {
                 sbufst_a = STALE;
             }
         } else {
+            snd_note_underrun();
             snd_encode(NULL, wire_buf_b, SAMPLE_CHUNK_SIZE, sbufswap);
         }
     } else {
@@ -331,6 +343,7 @@ static void snd_process_b() {
                 sbufst_b = STALE;
             }
         } else {
+            snd_note_underrun();
             snd_encode(NULL, wire_buf_b, SAMPLE_CHUNK_SIZE, sbufswap);
         }
     }
@@ -457,12 +470,22 @@ void audio_poll() {
         return;
     } else if (!audio_file->isOpen()) {
         // closed elsewhere, maybe disk ejected?
-        dbgmsg("------ Playback stop due to closed file");
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Playback stop due to closed file");
         audio_stop(audio_owner);
         return;
     }
 
     // are new audio samples needed from the memory card?
+    if (sbufst_a != STALE && sbufst_b != STALE) {
+        return;
+    }
+
+    // Leave the SD card to an ongoing SCSI read while enough samples are queued
+    uint32_t deadline_us = audio_refill_deadline_us();
+    if (!sd_arbiter_audio_refill_now(deadline_us, AUDIO_BUFFER_SIZE)) {
+        return;
+    }
+
     uint8_t* audiobuf;
     if (sbufst_a == STALE) {
         sbufst_a = FILLING;
@@ -482,14 +505,16 @@ void audio_poll() {
         // should be uncommon due to SCSI command restrictions on devices
         // playing audio; if this is showing up in logs a different approach
         // will be needed to avoid seek performance issues on FAT32 vols
-        dbgmsg("------ Audio seek required on ", audio_owner);
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio seek required on ", audio_owner);
         if (!audio_file->seek(fpos)) {
             logmsg("Audio error, unable to seek to ", fpos, ", ID:", audio_owner);
         }
     }
+    uint32_t read_start = time_us_32();
     if (audio_file->read(audiobuf, toRead) != toRead) {
         logmsg("Audio sample data underrun");
     }
+    sd_arbiter_audio_refill_done(toRead, time_us_32() - read_start, deadline_us);
     fpos += toRead;
     fleft -= toRead;
 
@@ -540,6 +565,13 @@ bool audio_play(uint8_t owner, image_config_t* img, const CUETrackInfo *trackinf
         logmsg("File not open for audio playback, ", owner);
         return false;
     }
+    audio_file_info_t audio_info;
+    FsFile *fsfile = audio_file->getFsFile();
+    if (fsfile && audio_file_probe(*fsfile, &audio_info) && audio_info.container != AUDIO_CONTAINER_RAW) {
+        // The S/PDIF encoder already keeps core1 busy, no time left for decoding
+        logmsg("WAVE and FLAC audio tracks are only supported with I2S audio output");
+        return false;
+    }
     uint64_t len = audio_file->size();
     if (start > len) {
         logmsg("File playback request start (", start, ":", len, ") outside file bounds");
@@ -548,7 +580,7 @@ bool audio_play(uint8_t owner, image_config_t* img, const CUETrackInfo *trackinf
     // truncate playback end to end of file
     // we will not consider this to be an error at the moment
     if (end > len) {
-        dbgmsg("------ Truncate audio play request end ", end, " to file size ", len);
+        dbgmsg<LOG_SUBSYS_AUDIO>("------ Truncate audio play request end ", end, " to file size ", len);
         end = len;
     }
     fleft = end - start;
@@ -662,6 +694,23 @@ void audio_stop(uint8_t id) {
     // Drop cached track metadata so subsequent READ SUB-CHANNEL / seek
     // queries fall back to the legacy path instead of reading stale state.
     current_track_pos = {};
+    sd_arbiter_report();
+}
+
+uint32_t audio_refill_deadline_us()
+{
+    if (!audio_is_active() || audio_paused || (sbufst_a != STALE && sbufst_b != STALE))
+        return UINT32_MAX;
+
+    // Core1 consumes the selected sample buffer one chunk per wire buffer,
+    // the stale one is needed once the rest of the selected buffer is encoded.
+    bufstate selected = (sbufsel == A) ? sbufst_a : sbufst_b;
+    if (selected != READY)
+        return 0;
+
+    // 16-bit stereo at 44.1 kHz is 176400 bytes per second
+    uint32_t bytes_left = AUDIO_BUFFER_SIZE - sbufpos;
+    return (uint32_t)((uint64_t)bytes_left * 1000000 / 176400);
 }
 
 audio_status_code audio_get_status_code(uint8_t id) {
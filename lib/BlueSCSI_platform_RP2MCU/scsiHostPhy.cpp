@@ -102,7 +102,7 @@ bool scsiHostPhySelect(int target_id, uint8_t initiator_id)
 
         if (SCSI_IN_DATA() != 0)
         {
-            dbgmsg("scsiHostPhySelect: bus is busy");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsiHostPhySelect: bus is busy");
             scsiLogInitiatorPhaseChange(BUS_FREE);
             SCSI_RELEASE_OUTPUTS();
             return false;
@@ -111,7 +111,7 @@ bool scsiHostPhySelect(int target_id, uint8_t initiator_id)
 
     // Selection phase
     scsiLogInitiatorPhaseChange(SELECTION);
-    dbgmsg("------ SELECTING ", target_id, " with initiator ID ", (int)initiator_id);
+    dbgmsg<LOG_SUBSYS_INITIATOR>("------ SELECTING ", target_id, " with initiator ID ", (int)initiator_id);
     SCSI_OUT(SEL, 1);
     platform_delay_us(5);
     SCSI_OUT_DATA((1 << target_id) | (1 << initiator_id));
@@ -241,7 +241,7 @@ int scsiHostPhyGetPhase()
         misread_count++;
         if (misread_count <= 20 || (misread_count % 100) == 0)
         {
-            dbgmsg("Initiator phase misread #", (int)misread_count,
+            dbgmsg<LOG_SUBSYS_INITIATOR>("Initiator phase misread #", (int)misread_count,
                    ": first ", phase, " REQ ", (int)req_in,
                    ", confirm ", phase_confirm, " REQ ", (int)req_confirm);
         }
@@ -354,6 +354,20 @@ uint32_t scsiHostWrite(const uint8_t *data, uint32_t count)
     int cd_start = SCSI_IN(CD);
     int msg_start = SCSI_IN(MSG);
 
+#ifndef BLUESCSI_ULTRA_WIDE
+    if (!cd_start && !msg_start && g_scsiHostBusWidth == 0)
+    {
+        // DATA OUT phase, use accelerated routine.
+        // Commands and messages are short and stay on the byte loop below.
+        uint32_t written = scsi_accel_host_write(data, count, &g_scsiHostPhyReset);
+        if (written != count)
+        {
+            logmsg("scsiHostWrite: sent ", (int)written, " bytes, expected ", (int)count);
+        }
+        return written;
+    }
+#endif
+
     for (uint32_t i = 0; i < count; i++)
     {
         while (!SCSI_IN(REQ))
@@ -416,13 +430,13 @@ uint32_t scsiHostRead(uint8_t *data, uint32_t count)
 
             if (g_scsiHostPhyReset)
             {
-                dbgmsg("sciHostRead: aborting due to reset request");
+                dbgmsg<LOG_SUBSYS_INITIATOR>("sciHostRead: aborting due to reset request");
                 count = i;
                 break;
             }
             else if (!io || cd != cd_start || msg != msg_start)
             {
-                dbgmsg("scsiHostRead: aborting because target switched transfer phase (IO: ", io, ", CD: ", cd, ", MSG: ", msg, ")");
+                dbgmsg<LOG_SUBSYS_INITIATOR>("scsiHostRead: aborting because target switched transfer phase (IO: ", io, ", CD: ", cd, ", MSG: ", msg, ")");
                 count = i;
                 break;
             }
@@ -510,7 +524,7 @@ void scsiHostWaitBusFree()
 
     if (extra_bytes > 0)
     {
-        dbgmsg("---- Target requested ", extra_bytes, " extra bytes after command complete");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("---- Target requested ", extra_bytes, " extra bytes after command complete");
     }
 
     scsiHostPhyRelease();
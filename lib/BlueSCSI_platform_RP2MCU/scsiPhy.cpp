@@ -60,6 +60,7 @@ extern "C" bool scsiStatusBSY()
 static SCSI_PHASE g_scsi_phase;
 volatile uint8_t g_scsi_sts_selection;
 volatile uint8_t g_scsi_ctrl_bsy;
+static volatile int8_t g_scsi_initiator_id = -1;
 
 void scsi_bsy_deassert_interrupt()
 {
@@ -85,6 +86,17 @@ void scsi_bsy_deassert_interrupt()
 
         if (sel_id >= 0)
         {
+            // The other bit is the initiator, SCSI1 hosts may not assert one.
+            uint16_t initiator_bits = sel_bits & ~(1u << sel_id);
+            if (initiator_bits != 0 && (initiator_bits & (initiator_bits - 1)) == 0)
+            {
+                g_scsi_initiator_id = __builtin_ctz(initiator_bits);
+            }
+            else
+            {
+                g_scsi_initiator_id = -1;
+            }
+
             // Set ATN flag here unconditionally, real value is only known after
             // OUT_BSY is enabled in scsiStatusSEL() below.
             g_scsi_sts_selection = SCSI_STS_SELECTION_SUCCEEDED | SCSI_STS_SELECTION_ATN | sel_id;
@@ -342,6 +354,98 @@ void scsiEnterBusFree(void)
     SCSI_RELEASE_OUTPUTS();
 }
 
+/***************************/
+/* Reselection of the host */
+/***************************/
+
+extern "C" int scsiPhyInitiatorId(void)
+{
+    return g_scsi_initiator_id;
+}
+
+extern "C" bool scsiReselect(int initiatorId)
+{
+#ifdef PLATFORM_SCSIPHY_HAS_RESELECT
+    if (initiatorId < 0 || SCSI_IN(BSY) || SCSI_IN(SEL))
+    {
+        return false;
+    }
+
+    // Arbitration: BSY and our own ID bit on the data bus for the arbitration
+    // delay. The data transceiver drives all lines together, so the bus is
+    // released again to look for other IDs at the end of the delay. We yield
+    // to anyone else arbitrating, whatever their priority.
+    uint32_t own_id = 1u << scsiDev.target->targetId;
+    g_scsi_phase = ARBITRATION;
+    SCSI_OUT(BSY, 1);
+    SCSI_OUT_DATA(own_id);
+    delay_ns(2400); // Arbitration delay
+    SCSI_RELEASE_DATA_REQ();
+    delay_ns(400); // Bus settle
+    if ((SCSI_IN_DATA() & ~own_id) != 0 || SCSI_IN(SEL) || g_scsi_sts_selection)
+    {
+        SCSI_OUT(BSY, 0);
+        g_scsi_phase = BUS_FREE;
+        return false;
+    }
+
+    // Our own SEL with BSY released looks like a selection to the
+    // BSY / SEL interrupt, only what it latches from here on is dropped.
+    uint8_t sts_selection = g_scsi_sts_selection;
+    int sel_flag = scsiDev.selFlag;
+
+    // Reselection phase: SEL, I/O and both IDs, then release BSY.
+    // SEL is an input in target mode, the RST interrupt is masked while
+    // it is driven.
+    g_scsi_phase = RESELECTION;
+    SCSI_OUT(SEL, 1);
+    sio_hw->gpio_oe_set = (1 << SCSI_OUT_SEL);
+    delay_ns(1200); // Bus clear + bus settle
+    SCSI_OUT(IO, 1);
+    SCSI_OUT_DATA((1 << scsiDev.target->targetId) | (1 << initiatorId));
+    delay_ns(400); // 2 deskew delays + bus settle
+    SCSI_OUT(BSY, 0);
+    delay_ns(400);
+
+    // Initiator answers by asserting BSY within the selection timeout
+    uint32_t start = platform_millis();
+    while (!SCSI_IN(BSY) && !scsiDev.resetFlag &&
+           (uint32_t)(platform_millis() - start) < 250)
+    {
+    }
+
+    bool answered = SCSI_IN(BSY) && !scsiDev.resetFlag;
+    if (answered)
+    {
+        SCSI_OUT(BSY, 1);
+        delay_ns(400);
+        SCSI_OUT(SEL, 0);
+        sio_hw->gpio_oe_clr = (1 << SCSI_OUT_SEL);
+        SCSI_RELEASE_DATA_REQ();
+
+        // Same as scsiStatusSEL(), take over the shared CD / MSG pins.
+        SCSI_OUT(CD, 0);
+        SCSI_OUT(MSG, 0);
+        SCSI_ENABLE_CONTROL_OUT();
+    }
+    else
+    {
+        SCSI_RELEASE_DATA_REQ();
+        SCSI_OUT(IO, 0);
+        SCSI_OUT(SEL, 0);
+        sio_hw->gpio_oe_clr = (1 << SCSI_OUT_SEL);
+        g_scsi_phase = BUS_FREE;
+    }
+
+    // Drop only what the interrupt latched from our own SEL
+    g_scsi_sts_selection = sts_selection;
+    scsiDev.selFlag = sel_flag;
+    return answered;
+#else
+    return false;
+#endif
+}
+
 /********************/
 /* Transmit to host */
 /********************/
@@ -65,6 +65,15 @@ uint32_t scsiEnterPhaseImmediate(int phase);
 // Release all signals
 void scsiEnterBusFree(void);
 
+// ID the initiator asserted during the latest selection of one of our
+// targets, -1 if it only asserted the target ID.
+int scsiPhyInitiatorId(void);
+
+// Reselect the initiator after a DISCONNECT message has released the bus.
+// Yields to any other device arbitrating for the bus.
+// Returns true when the initiator has answered and BSY is driven again.
+bool scsiReselect(int initiatorId);
+
 // Blocking data transfer
 void scsiWrite(const uint8_t* data, uint32_t count);
 void scsiRead(uint8_t* data, uint32_t count, int* parityError);
@@ -91,6 +100,12 @@ bool scsiIsReadFinished(const uint8_t *data);
 
 #define PLATFORM_SCSIPHY_HAS_NONBLOCKING_READ 1
 
+// On Ultra boards the SEL output is behind the initiator signal buffer,
+// which can't be enabled in target mode.
+#if !(defined(BLUESCSI_ULTRA) || defined(BLUESCSI_ULTRA_WIDE))
+#define PLATFORM_SCSIPHY_HAS_RESELECT 1
+#endif
+
 #define s2s_getScsiRateKBs() 0
 
 #ifdef __cplusplus
@@ -40,10 +40,13 @@ static struct {
     // PIO configurations
     uint32_t pio_offset_async_read;
     pio_sm_config pio_cfg_async_read;
+    uint32_t pio_offset_async_write;
+    pio_sm_config pio_cfg_async_write;
 } g_scsi_host;
 
 enum scsidma_state_t { SCSIHOST_IDLE = 0,
-                       SCSIHOST_READ };
+                       SCSIHOST_READ,
+                       SCSIHOST_WRITE };
 static volatile scsidma_state_t g_scsi_host_state;
 
 static void scsi_accel_host_config_gpio()
@@ -84,6 +87,28 @@ static void scsi_accel_host_config_gpio()
         iobank0_hw->io[SCSI_IN_REQ].ctrl  = GPIO_FUNC_SIO;
         iobank0_hw->io[SCSI_OUT_ACK].ctrl = GPIO_FUNC_PIO0;
     }
+    else if (g_scsi_host_state == SCSIHOST_WRITE)
+    {
+        // Data bus and ACK are driven by PIO, released state until first byte
+        pio_sm_set_pins(SCSI_PIO, SCSI_SM, SCSI_IO_DATA_MASK | 1 << SCSI_OUT_ACK);
+        pio_sm_set_consecutive_pindirs(SCSI_PIO, SCSI_SM, SCSI_IO_DB0, 9, true);  // DBP Output
+        pio_sm_set_consecutive_pindirs(SCSI_PIO, SCSI_SM, SCSI_OUT_ACK, 1, true);  // ACK Output
+
+        iobank0_hw->io[SCSI_IO_DB0].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB1].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB2].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB3].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB4].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB5].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB6].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DB7].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IO_DBP].ctrl  = GPIO_FUNC_PIO0;
+        iobank0_hw->io[SCSI_IN_REQ].ctrl  = GPIO_FUNC_SIO;
+        iobank0_hw->io[SCSI_OUT_ACK].ctrl = GPIO_FUNC_PIO0;
+
+        // Turn the data bus transceiver around last
+        SCSI_ENABLE_DATA_OUT();
+    }
 }
 
 uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, int busWidth, volatile int *resetFlag)
@@ -128,12 +153,12 @@ uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, in
             bool abort = false;
             if (*resetFlag)
             {
-                dbgmsg("scsi_accel_host_read: Aborting due to reset request");
+                dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_read: Aborting due to reset request");
                 abort = true;
             }
             else if ((platform_millis() - prev_rx_time) > 10000)
             {
-                dbgmsg("scsi_accel_host_read: Aborting due to timeout");
+                dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_read: Aborting due to timeout");
                 abort = true;
             }
             else
@@ -152,7 +177,7 @@ uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, in
 
                 if (debounce == 0)
                 {
-                    dbgmsg("scsi_accel_host_read: aborting because target switched transfer phase (IO: ",
+                    dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_read: aborting because target switched transfer phase (IO: ",
                         (int)SCSI_IN(IO), ", CD: ", (int)SCSI_IN(CD), ", MSG: ", (int)SCSI_IN(MSG), ")");
                     abort = true;
                 }
@@ -227,6 +252,103 @@ uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, in
     return count;
 }
 
+#ifndef BLUESCSI_ULTRA_WIDE
+uint32_t scsi_accel_host_write(const uint8_t *buf, uint32_t count, volatile int *resetFlag)
+{
+    // Same as the read path, the PIO TX fifo is fed from a software loop.
+    // The fifo is joined to 8 entries, which covers the time the CPU spends
+    // in abort checks between refills.
+    g_scsi_host_state = SCSIHOST_WRITE;
+
+    int cd_start = SCSI_IN(CD);
+    int msg_start = SCSI_IN(MSG);
+
+    uint32_t offset = g_scsi_host.pio_offset_async_write;
+    pio_sm_init(SCSI_PIO, SCSI_SM, offset, &g_scsi_host.pio_cfg_async_write);
+    scsi_accel_host_config_gpio();
+    pio_sm_set_enabled(SCSI_PIO, SCSI_SM, true);
+
+    const uint8_t *src = buf;
+    const uint8_t *end = buf + count;
+    uint32_t prev_tx_time = platform_millis();
+    while (true)
+    {
+        if (src < end && !pio_sm_is_tx_fifo_full(SCSI_PIO, SCSI_SM))
+        {
+            do
+            {
+                pio_sm_put(SCSI_PIO, SCSI_SM, g_scsi_parity_lookup[*src++]);
+            } while (src < end && !pio_sm_is_tx_fifo_full(SCSI_PIO, SCSI_SM));
+
+            prev_tx_time = platform_millis();
+            continue;
+        }
+
+        if (src == end && pio_sm_is_tx_fifo_empty(SCSI_PIO, SCSI_SM) &&
+            pio_sm_get_pc(SCSI_PIO, SCSI_SM) == offset)
+        {
+            // Last byte has been acknowledged and PIO is waiting for more
+            break;
+        }
+
+        // Target is not taking data, check if there is a need to abort.
+        // C/D and MSG glitches are debounced the same way as in scsi_accel_host_read(),
+        // I/O is not: the target drives the data bus as soon as it asserts I/O.
+        bool abort = false;
+        int debounce = 100;
+        while (debounce > 0 && !SCSI_IN(IO) && (SCSI_IN(CD) != cd_start || SCSI_IN(MSG) != msg_start))
+        {
+            debounce--;
+            platform_delay_us(100);
+        }
+
+        if (SCSI_IN(IO))
+        {
+            // Stop driving the data bus before anything else
+            pio_sm_set_enabled(SCSI_PIO, SCSI_SM, false);
+            pio_sm_set_consecutive_pindirs(SCSI_PIO, SCSI_SM, SCSI_IO_DB0, 9, false);
+            SCSI_RELEASE_DATA_REQ();
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_write: aborting because target switched to an input phase");
+            abort = true;
+        }
+        else if (debounce == 0)
+        {
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_write: aborting because target switched transfer phase (CD: ",
+                (int)SCSI_IN(CD), ", MSG: ", (int)SCSI_IN(MSG), ")");
+            abort = true;
+        }
+        else if (*resetFlag)
+        {
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_write: Aborting due to reset request");
+            abort = true;
+        }
+        else if ((platform_millis() - prev_tx_time) > 10000)
+        {
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsi_accel_host_write: Aborting due to timeout");
+            abort = true;
+        }
+
+        if (abort)
+        {
+            // Bytes still in the fifo or in the OSR were never acknowledged.
+            // The last instruction of the program runs with ACK asserted.
+            uint32_t pc = pio_sm_get_pc(SCSI_PIO, SCSI_SM) - offset;
+            uint32_t unsent = pio_sm_get_tx_fifo_level(SCSI_PIO, SCSI_SM);
+            if (pc != 0 && pc != scsi_host_async_write_wrap) unsent++;
+            count = (src - buf) - unsent;
+            break;
+        }
+    }
+
+    pio_sm_set_enabled(SCSI_PIO, SCSI_SM, false);
+    g_scsi_host_state = SCSIHOST_IDLE;
+    SCSI_RELEASE_DATA_REQ();
+    scsi_accel_host_config_gpio();
+    pio_sm_clear_fifos(SCSI_PIO, SCSI_SM);
+
+    return count;
+}
+#endif
 
 void scsi_accel_host_init()
 {
@@ -252,6 +374,23 @@ void scsi_accel_host_init()
     sm_config_set_sideset_pins(&g_scsi_host.pio_cfg_async_read, SCSI_OUT_ACK);
     sm_config_set_out_shift(&g_scsi_host.pio_cfg_async_read, true, false, 32);
     sm_config_set_in_shift(&g_scsi_host.pio_cfg_async_read, true, true, 32);
+
+#ifndef BLUESCSI_ULTRA_WIDE
+    // Asynchronous SCSI write
+    g_scsi_host.pio_offset_async_write = pio_add_program(SCSI_PIO, &scsi_host_async_write_program);
+    //    wait 0 gpio REQ             side 1  ; Wait for REQ low
+    instr = pio_encode_wait_gpio(false, SCSI_IN_REQ) | pio_encode_sideset(1, 1);
+    SCSI_PIO->instr_mem[g_scsi_host.pio_offset_async_write + 1] = instr;
+    //    wait 1 gpio REQ             side 0  ; Assert ACK, wait for REQ high
+    instr = pio_encode_wait_gpio(true, SCSI_IN_REQ) | pio_encode_sideset(1, 0);
+    SCSI_PIO->instr_mem[g_scsi_host.pio_offset_async_write + 6] = instr;
+    g_scsi_host.pio_cfg_async_write = scsi_host_async_write_program_get_default_config(g_scsi_host.pio_offset_async_write);
+    sm_config_set_out_pins(&g_scsi_host.pio_cfg_async_write, SCSI_IO_DB0, 9);
+    sm_config_set_sideset_pins(&g_scsi_host.pio_cfg_async_write, SCSI_OUT_ACK);
+    sm_config_set_jmp_pin(&g_scsi_host.pio_cfg_async_write, SCSI_IN_IO);
+    sm_config_set_fifo_join(&g_scsi_host.pio_cfg_async_write, PIO_FIFO_JOIN_TX);
+    sm_config_set_out_shift(&g_scsi_host.pio_cfg_async_write, true, false, 32);
+#endif
 }
 
 #endif // PLATFORM_HAS_INITIATOR_MODE
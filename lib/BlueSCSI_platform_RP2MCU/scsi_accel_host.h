@@ -30,3 +30,8 @@ void scsi_accel_host_init();
 // Read data from SCSI bus.
 // Number of bytes to read must be divisible by two.
 uint32_t scsi_accel_host_read(uint8_t *buf, uint32_t count, int *parityError, int busWidth, volatile int *resetFlag);
+
+// Write data to SCSI bus in 8-bit mode.
+// Returns the number of bytes acknowledged by the target, which is less than
+// count if the target changes phase, the reset flag is set or it times out.
+uint32_t scsi_accel_host_write(const uint8_t *buf, uint32_t count, volatile int *resetFlag);
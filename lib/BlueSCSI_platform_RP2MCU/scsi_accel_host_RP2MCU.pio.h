@@ -85,3 +85,42 @@ static inline pio_sm_config scsi_host_async_read_wide_program_get_default_config
     return c;
 }
 #endif
+
+// --------------------- //
+// scsi_host_async_write //
+// --------------------- //
+
+#define scsi_host_async_write_wrap_target 0
+#define scsi_host_async_write_wrap 6
+#define scsi_host_async_write_pio_version 0
+
+static const uint16_t scsi_host_async_write_program_instructions[] = {
+            //     .wrap_target
+    0x90a0, //  0: pull   block           side 1     
+    0x3009, //  1: wait   0 gpio, 9       side 1     
+    0x10c4, //  2: jmp    pin, 4          side 1     
+    0x1003, //  3: jmp    3               side 1     
+    0x7009, //  4: out    pins, 9         side 1     
+    0x7777, //  5: out    null, 23        side 1 [7] 
+    0x2089, //  6: wait   1 gpio, 9       side 0     
+            //     .wrap
+};
+
+#if !PICO_NO_HARDWARE
+static const struct pio_program scsi_host_async_write_program = {
+    .instructions = scsi_host_async_write_program_instructions,
+    .length = 7,
+    .origin = -1,
+    .pio_version = scsi_host_async_write_pio_version,
+#if PICO_PIO_VERSION > 0
+    .used_gpio_ranges = 0x1
+#endif
+};
+
+static inline pio_sm_config scsi_host_async_write_program_get_default_config(uint offset) {
+    pio_sm_config c = pio_get_default_sm_config();
+    sm_config_set_wrap(&c, offset + scsi_host_async_write_wrap_target, offset + scsi_host_async_write_wrap);
+    sm_config_set_sideset(&c, 1, false, false);
+    return c;
+}
+#endif
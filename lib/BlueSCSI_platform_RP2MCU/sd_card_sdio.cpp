@@ -143,7 +143,7 @@ struct cmd6_response_t {
 static bool logSDError(int line)
 {
     g_sdio_error_line = line;
-    dbgmsg("SDIO SD card error on line ", line, ", error code ", (int)g_sdio_error);
+    dbgmsg<LOG_SUBSYS_SDIO>("SDIO SD card error on line ", line, ", error code ", (int)g_sdio_error);
     return false;
 }
 
@@ -174,7 +174,7 @@ static sd_callback_t get_stream_callback(const uint8_t *buf, uint32_t count, con
         }
         else
         {
-            dbgmsg("SD card ", accesstype, "(", (int)sector,
+            dbgmsg<LOG_SUBSYS_SDIO>("SD card ", accesstype, "(", (int)sector,
                   ") slow transfer, buffer", (uint32_t)buf, " vs. ", (uint32_t)(m_stream_buffer + m_stream_count));
             return NULL;
         }
@@ -403,7 +403,7 @@ bool SdioCard::begin(SdioConfig sdioConfig)
 
         if (reply != 0x1AA || status != SDIO_OK)
         {
-            // dbgmsg("SDIO not responding to CMD8 SEND_IF_COND, status ", (int)status, " reply ", reply);
+            // dbgmsg<LOG_SUBSYS_SDIO>("SDIO not responding to CMD8 SEND_IF_COND, status ", (int)status, " reply ", reply);
             continue;
         }
 
@@ -479,7 +479,7 @@ sdio_status_t rp2040_sdio_command_R2(uint8_t command, uint32_t arg, uint8_t resp
     {
         if ((uint32_t)(platform_millis() - start) > 2)
         {
-            dbgmsg("Timeout : rp2040_sdio_command_R2(", (int)command, "), ",
+            dbgmsg<LOG_SUBSYS_SDIO>("Timeout : rp2040_sdio_command_R2(", (int)command, "), ",
                   "PIO PC: ", (int)pio_sm_get_pc(SDIO_PIO, SDIO_CMD_SM) - (int)g_sdio.pio_cmd_rsp_clk_offset,
                   " RXF: ", (int)pio_sm_get_rx_fifo_level(SDIO_PIO, SDIO_CMD_SM),
                   " TXF: ", (int)pio_sm_get_tx_fifo_level(SDIO_PIO, SDIO_CMD_SM));
@@ -541,7 +541,7 @@ sdio_status_t rp2040_sdio_command_R2(uint8_t command, uint32_t arg, uint8_t resp
     if (response_cmd != 0x3F)
     {
         if (g_record_sdio_errors) {
-            dbgmsg("rp2040_sdio_command_R2(", (int)command, "): Expected reply code 0x3F");
+            dbgmsg<LOG_SUBSYS_SDIO>("rp2040_sdio_command_R2(", (int)command, "): Expected reply code 0x3F");
         }
         return SDIO_ERR_RESPONSE_CODE;
     }
@@ -568,7 +568,7 @@ sdio_status_t rp2040_sdio_command_R3(uint8_t command, uint32_t arg, uint32_t *re
     {
         if ((uint32_t)(platform_millis() - start) > 2)
         {
-            dbgmsg("Timeout: rp2040_sdio_command_R3(", (int)command, "), ",
+            dbgmsg<LOG_SUBSYS_SDIO>("Timeout: rp2040_sdio_command_R3(", (int)command, "), ",
                   "PIO PC: ", (int)pio_sm_get_pc(SDIO_PIO, SDIO_CMD_SM) - (int)g_sdio.pio_cmd_rsp_clk_offset,
                   " RXF: ", (int)pio_sm_get_rx_fifo_level(SDIO_PIO, SDIO_CMD_SM),
                   " TXF: ", (int)pio_sm_get_tx_fifo_level(SDIO_PIO, SDIO_CMD_SM));
@@ -760,7 +760,7 @@ sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete)
     }
     else if ((uint32_t)(platform_millis() - g_sdio.transfer_start_time) > 1000)
     {
-        dbgmsg("rp2040_sdio_rx_poll() timeout, "
+        dbgmsg<LOG_SUBSYS_SDIO>("rp2040_sdio_rx_poll() timeout, "
             "PIO PC: ", (int)pio_sm_get_pc(SDIO_PIO, SDIO_DATA_SM) - (int)g_sdio.pio_data_rx_offset,
             " RXF: ", (int)pio_sm_get_rx_fifo_level(SDIO_PIO, SDIO_DATA_SM),
             " TXF: ", (int)pio_sm_get_tx_fifo_level(SDIO_PIO, SDIO_DATA_SM),
@@ -1039,7 +1039,7 @@ sdio_status_t rp2040_sdio_tx_poll(uint32_t *bytes_complete)
     }
     else if ((uint32_t)(platform_millis() - g_sdio.transfer_start_time) > 1000)
     {
-        dbgmsg("rp2040_sdio_tx_poll() timeout, "
+        dbgmsg<LOG_SUBSYS_SDIO>("rp2040_sdio_tx_poll() timeout, "
             "PIO PC: ", (int)pio_sm_get_pc(SDIO_PIO, SDIO_CMD_SM) - (int)g_sdio.pio_data_tx_offset,
             " RXF: ", (int)pio_sm_get_rx_fifo_level(SDIO_PIO, SDIO_CMD_SM),
             " TXF: ", (int)pio_sm_get_tx_fifo_level(SDIO_PIO, SDIO_CMD_SM),
@@ -11,14 +11,14 @@
 // SDIO error messages are logged only to debug log, because normally
 // the problem can be reported through SCSI status.
 #ifdef SDIO_BREAKPOINT_ON_ERROR
-#define SDIO_ERRMSG(txt, arg1, arg2) do{dbgmsg(txt, " ", (uint32_t)(arg1), " ", (uint32_t)(arg2)); asm("bkpt");} while(0)
+#define SDIO_ERRMSG(txt, arg1, arg2) do{dbgmsg<LOG_SUBSYS_SDIO>(txt, " ", (uint32_t)(arg1), " ", (uint32_t)(arg2)); asm("bkpt");} while(0)
 #else
-#define SDIO_ERRMSG(txt, arg1, arg2) dbgmsg(txt, " ", (uint32_t)(arg1), " ", (uint32_t)(arg2))
+#define SDIO_ERRMSG(txt, arg1, arg2) dbgmsg<LOG_SUBSYS_SDIO>(txt, " ", (uint32_t)(arg1), " ", (uint32_t)(arg2))
 #endif
 
 // SDIO debug messages are normally disabled because they are very verbose
 #ifdef BLUESCSI_DEBUG_SDIO
-#define SDIO_DBGMSG(txt, arg1, arg2) dbgmsg(txt, " ", (uint32_t)(arg1), " ", (uint32_t)(arg2))
+#define SDIO_DBGMSG(txt, arg1, arg2) dbgmsg<LOG_SUBSYS_SDIO>(txt, " ", (uint32_t)(arg1), " ", (uint32_t)(arg2))
 #endif
 
 // PIO block to use
@@ -27,7 +27,6 @@
 
 // Share with the original network code
 extern bool scsiNetworkEnabled;
-extern struct scsiNetworkPacketQueue scsiNetworkInboundQueue;
 
 #define AMIGASCSI_PATCH_24BYTE_BLOCKSIZE 	0xA8   // In this mode, data written is rounded up to the nearest 24-byte boundary
 #define AMIGASCSI_PATCH_SINGLEWRITE_ONLY 	0xA9   // In this mode, data written is always ONLY as one single write command
@@ -83,7 +82,7 @@ int amigaWifiCommand()
 			}
 
 			if (scsiDev.cdb[2] & AMIGASCSI_BATCHMODE) {
-				if (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex) {
+				if (scsiNetworkQueueEmpty()) {
 					// No data
 					memset(scsiDev.data, 0, 4);
 					scsiDev.dataLen = 4;
@@ -91,58 +90,60 @@ int amigaWifiCommand()
 					uint16_t packets = 0;
 					uint8_t* dataPos = scsiDev.data;
 					uint32_t bufferUsed = 4; dataPos += 4; // skip header
-					psize = scsiNetworkInboundQueue.sizes[scsiNetworkInboundQueue.readIndex];
+					// Only pin a packet once it is known to fit
+					uint16_t qsize = scsiNetworkPeekLen();
+					psize = qsize;
 					if (psize>4) psize-=4; // remove checksum
 
 					while (size-bufferUsed>psize+2) {
+						uint8_t* packet = scsiNetworkPeek(&qsize);
 						bufferUsed += psize + 2;
 						dataPos[0] = psize >> 8;
 						dataPos[1] = psize & 0xff;
-						memcpy(&dataPos[2], scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.readIndex], psize);
+						memcpy(&dataPos[2], packet, psize);
 
 						dataPos += psize+2;
 						packets++;
 
 						// Next packet
-						if (scsiNetworkInboundQueue.readIndex == NETWORK_PACKET_QUEUE_SIZE - 1)
-							scsiNetworkInboundQueue.readIndex = 0;
-						else scsiNetworkInboundQueue.readIndex++;
-						if (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex) break;
-						psize = scsiNetworkInboundQueue.sizes[scsiNetworkInboundQueue.readIndex];
+						scsiNetworkDequeue();
+						if (scsiNetworkQueueEmpty()) break;
+						qsize = scsiNetworkPeekLen();
+						psize = qsize;
 						if (psize>4) psize-=4; // remove checksum
 					}
 
 					// Encode the header
 					scsiDev.data[0] = packets >> 8;
 					scsiDev.data[1] = packets & 0xFF;
-					scsiDev.data[2] = (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex) ? 0 : 1;
+					scsiDev.data[2] = scsiNetworkQueueEmpty() ? 0 : 1;
 					scsiDev.data[3] = 0;
 						
 					scsiDev.dataLen = bufferUsed;
 					//DBGMSG_BUF(scsiDev.data, scsiDev.dataLen);
 				}				
 			} else {
-				if (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex) {
+				if (scsiNetworkQueueEmpty()) {
 					memset(scsiDev.data, 0, 6);
 					scsiDev.dataLen = 6;
 				} else {
-					psize = scsiNetworkInboundQueue.sizes[scsiNetworkInboundQueue.readIndex];
+					uint16_t qsize;
+					uint8_t* packet = scsiNetworkPeek(&qsize);
+					psize = qsize;
 					if (psize < 64) psize = 64;
 					else if (psize + 6 > size) {
 						LOGMSG_F("%s: packet size too big (%d)", __func__, psize);
 						psize = size - 6;
 					}
-					DBGMSG_F("%s: sending packet[%d] to host of size %zu + 6", __func__, scsiNetworkInboundQueue.readIndex, psize);
+					DBGMSG_F("%s: sending packet to host of size %zu + 6", __func__, psize);
 					scsiDev.dataLen = psize + 6; // 2-byte length + 4-byte flag + packet
-					memcpy(scsiDev.data + 6, scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.readIndex], psize);
+					memcpy(scsiDev.data + 6, packet, psize);
 					scsiDev.data[0] = (psize >> 8) & 0xff;
 					scsiDev.data[1] = psize & 0xff;
-					if (scsiNetworkInboundQueue.readIndex == NETWORK_PACKET_QUEUE_SIZE - 1)
-						scsiNetworkInboundQueue.readIndex = 0;
-					else scsiNetworkInboundQueue.readIndex++;
+					scsiNetworkDequeue();
 					scsiDev.data[2] = 0; scsiDev.data[3] = 0; scsiDev.data[4] = 0;
 					// more data to read?
-					scsiDev.data[5] = (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex ? 0 : 0x10);
+					scsiDev.data[5] = (scsiNetworkQueueEmpty() ? 0 : 0x10);
 					DBGMSG_BUF(scsiDev.data, scsiDev.dataLen);
 				}
 			}
@@ -246,7 +247,7 @@ int amigaWifiCommand()
 
 				if (packetSize <= size) {
 					size -= packetSize;
-					platform_network_send(bufferPosition, packetSize);	
+					scsiNetworkSend(bufferPosition, packetSize);	
 					bufferPosition += packetSize;
 				} else {
 					DBGMSG_F("------ Packet size %d larger than remaining buffer %d", __func__, packetSize, size);
@@ -262,7 +263,7 @@ int amigaWifiCommand()
 			scsiRead(scsiDev.data, size, &parityError);
 			if (parityError) { DBGMSG_F("%s: read packet from host of size %zu (parity error %d)", __func__, size, parityError); }
 				else DBGMSG_F("------ %s: read packet from host of size %zu", __func__, size);
-			platform_network_send(scsiDev.data, size);	
+			scsiNetworkSend(scsiDev.data, size);	
 			scsiDev.status = GOOD;
 			scsiDev.phase = STATUS;
 		}
@@ -280,6 +281,7 @@ int amigaWifiCommand()
 		scsiRead(scsiDev.data, size, &parityError);
 		DBGMSG_F("%s: adding multicast address %02x:%02x:%02x:%02x:%02x:%02x", __func__, scsiDev.data[0], scsiDev.data[1], scsiDev.data[2], scsiDev.data[3], scsiDev.data[4], scsiDev.data[5]);
 
+		scsiNetworkAddMulticast(scsiDev.data);
 		platform_network_add_multicast_address(scsiDev.data);
 
 		scsiDev.status = GOOD;
@@ -296,11 +298,12 @@ int amigaWifiCommand()
 		if (scsiDev.cdb[5] & 0x80) {
 			DBGMSG_F("%s: enable interface", __func__);
 			scsiNetworkEnabled = true;
-			memset(&scsiNetworkInboundQueue, 0, sizeof(scsiNetworkInboundQueue));
+			scsiNetworkQueueReset();
 		}
 		else {
 			DBGMSG_F("%s: disable interface", __func__);
 			scsiNetworkEnabled = false;
+			scsiNetworkQueueReset();
 		}
 		scsiDev.status = GOOD;
 		scsiDev.phase = STATUS;
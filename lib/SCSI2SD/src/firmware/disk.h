@@ -54,6 +54,16 @@ void scsiDiskInit(void);
 void scsiDiskReset(void);
 void scsiDiskPoll(void);
 int scsiDiskCommand(void);
+int scsiDiskDisconnectAllowed(void);
+int scsiDiskQueueDepth(void);
+
+// Read the start of a disconnected read into the prefetch buffer before
+// the initiator is reselected.
+void scsiDiskPrepareRead(uint32_t lba, uint32_t blocks);
+
+// State storage for a logical unit of the target, or NULL if the LUN has
+// no image. LUN 0 only has storage when the target has other LUNs.
+LunState* scsiDiskLunState(int targetId, int lun);
 int doTestUnitReady();
 
 #endif
@@ -24,6 +24,7 @@
 #include "scsi.h"
 #include "config.h"
 #include "inquiry.h"
+#include "disk.h"
 #include "BlueSCSI_config.h"
 
 #include <string.h>
@@ -239,7 +240,7 @@ void s2s_scsiInquiry()
 	}
 
 	// Set the first byte to indicate LUN presence.
-	if (scsiDev.lun) // We only support lun 0
+	if (scsiDev.lun != scsiDev.target->lun) // No image for this lun
 	{
 		scsiDev.data[0] = 0x7F;
 	}
@@ -282,6 +283,11 @@ uint32_t s2s_getStandardInquiry(
 		out[7] |= 0x20;
 	}
 
+	if (scsiDev.compatMode >= COMPAT_SCSI2 && scsiDiskQueueDepth() > 0)
+	{
+		out[7] |= 0x02; // CmdQue
+	}
+
 	if(cfg->deviceType == S2S_CFG_ZIP100)
 	{
 		memcpy(&out[size], IomegaVendorInquiry, sizeof(IomegaVendorInquiry));
@@ -298,14 +298,284 @@ static const uint8_t IomegaZip100VendorPage[] =
 	0x5c, 0xf, 0x3c, 0xf
 };*/
 
-static void pageIn(int pc, int dataIdx, const uint8_t* pageData, int pageLen)
+// Settings the compiled mode pages of a target depend on. The pages are
+// rebuilt when any of them changes, eg. by MODE SELECT or an image switch.
+typedef struct
 {
-	memcpy(&scsiDev.data[dataIdx], pageData, pageLen);
+	const S2S_TargetCfg* cfg;
+	uint32_t sdSectorStart;
+	uint32_t scsiSectors;
+	uint16_t bytesPerSector;
+	uint16_t sectorsPerTrack;
+	uint16_t headsPerCylinder;
+	uint16_t quirks;
+	uint8_t deviceType;
+	uint8_t scsi2;
+	uint8_t unitAttention;
+	uint8_t toolbox;
+} ModePageKey;
+
+typedef struct
+{
+	ModePageKey key;
+	uint8_t valid;
+	ModePageImage image;
+} ModePageCache;
+
+static ModePageCache modePageCache[S2S_MAX_TARGETS];
+
+uint8_t* modePageAdd(ModePageImage* image, const uint8_t* page, int len, uint8_t flags)
+{
+	int offset = image->length;
+	if (image->pageCount >= MODE_PAGE_MAX_PAGES ||
+		offset + len > MODE_PAGE_IMAGE_SIZE)
+	{
+		return NULL;
+	}
+
+	memcpy(&image->current[offset], page, len);
+	memcpy(&image->changeable[offset], page, 2);
+	memset(&image->changeable[offset + 2], 0, len - 2);
+
+	ModePageEntry* entry = &image->pages[image->pageCount++];
+	entry->code = page[0] & 0x3F;
+	entry->flags = flags;
+	entry->offset = offset;
+	entry->length = len;
+
+	image->length += len;
+	if (!(flags & MODE_PAGE_NOT_IN_ALL))
+	{
+		image->allPagesLength = image->length;
+	}
+	return &image->current[offset];
+}
+
+uint8_t* modePageMask(ModePageImage* image, uint8_t* page)
+{
+	return &image->changeable[page - image->current];
+}
+
+static const ModePageEntry* modePageFind(const ModePageImage* image, int pageCode)
+{
+	int i;
+	for (i = 0; i < image->pageCount; ++i)
+	{
+		if (image->pages[i].code == pageCode)
+		{
+			return &image->pages[i];
+		}
+	}
+	return NULL;
+}
+
+static void modePageBuild(ModePageImage* image)
+{
+	uint8_t* page;
+	uint8_t* mask;
+
+	memset(image, 0, sizeof(*image));
+
+	// The PC-9801-55 SCSI-1 controller, and its first party derivatives
+	// will ask for all pages (0x3F), expecting only these pages back:
+	// 0x01 - Read-write error recovery page
+	// 0x03 - Format device page
+	// 0x04 - Rigid disk geometry page
+	// This quirk is expected to be used with SCSI-1 mode only
+	int oldNecHddMode = scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_PC98_55;
+
+	if ((scsiDev.compatMode >= COMPAT_SCSI2))
+	{
+		modePageAdd(image, ReadWriteErrorRecoveryPage, sizeof(ReadWriteErrorRecoveryPage), 0);
+	}
+	else
+	{
+		modePageAdd(image, ReadWriteErrorRecoveryPage_SCSI1, sizeof(ReadWriteErrorRecoveryPage_SCSI1), 0);
+	}
+
+	if (!oldNecHddMode)
+	{
+		if ((scsiDev.compatMode >= COMPAT_SCSI2))
+		{
+			modePageAdd(image, DisconnectReconnectPage, sizeof(DisconnectReconnectPage), 0);
+		}
+		else
+		{
+			modePageAdd(image, DisconnectReconnectPage_SCSI1, sizeof(DisconnectReconnectPage_SCSI1), 0);
+		}
+	}
+
+	if (scsiDev.target->cfg->deviceType != S2S_CFG_OPTICAL)
+	{
+		page = modePageAdd(image, FormatDevicePage, sizeof(FormatDevicePage), 0);
+		if (page)
+		{
+			if (oldNecHddMode)
+			{
+				// This mimics ArdSCSino-stm32 behavior, setting
+				// "Tracks per zone" to the heads per cylinder value.
+				// If left as 0, PC-9801FA doesn't detect the drive
+				// properly.
+				page[2] = 0x00;
+				page[3] = scsiDev.target->cfg->headsPerCylinder;
+				// Interleave field
+				page[15] = 0x00;
+			}
+			uint16_t sectorsPerTrack = scsiDev.target->cfg->sectorsPerTrack;
+			page[10] = sectorsPerTrack >> 8;
+			page[11] = sectorsPerTrack & 0xFF;
+
+			// Fill out the configured bytes-per-sector
+			uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
+			page[12] = bytesPerSector >> 8;
+			page[13] = bytesPerSector & 0xFF;
+
+			// Set a mask for the changeable values.
+			mask = modePageMask(image, page);
+			mask[12] = 0xFF;
+			mask[13] = 0xFF;
+		}
+
+		if ((scsiDev.compatMode >= COMPAT_SCSI2))
+		{
+			page = modePageAdd(image, RigidDiskDriveGeometry, sizeof(RigidDiskDriveGeometry), 0);
+		}
+		else
+		{
+			page = modePageAdd(image, RigidDiskDriveGeometry_SCSI1, sizeof(RigidDiskDriveGeometry_SCSI1), 0);
+		}
+
+		if (page)
+		{
+			// Need to fill out the number of cylinders.
+			uint32_t cyl;
+			uint8_t head;
+			uint32_t sector;
+			LBA2CHS(
+				getScsiCapacity(
+					scsiDev.target->cfg->sdSectorStart,
+					scsiDev.target->liveCfg.bytesPerSector,
+					scsiDev.target->cfg->scsiSectors),
+				&cyl,
+				&head,
+				&sector,
+				scsiDev.target->cfg->headsPerCylinder,
+				scsiDev.target->cfg->sectorsPerTrack);
+
+			page[2] = cyl >> 16;
+			page[3] = cyl >> 8;
+			page[4] = cyl;
+
+			memcpy(&page[6], &page[2], 3);
+			memcpy(&page[9], &page[2], 3);
+
+			page[5] = scsiDev.target->cfg->headsPerCylinder;
+		}
+	}
+
+	if (scsiDev.target->cfg->deviceType == S2S_CFG_FLOPPY_14MB)
+	{
+		modePageAdd(image, FlexibleDiskDriveGeometry, sizeof(FlexibleDiskDriveGeometry), 0);
+	}
+
+	// DON'T output the following pages for SCSI1 hosts. They get upset when
+	// we have more data to send than the allocation length provided.
+	// (ie. Try not to output any more pages below this comment)
+
+	if ((scsiDev.compatMode >= COMPAT_SCSI2))
+	{
+		modePageAdd(image, VerifyErrorRecoveryPage, sizeof(VerifyErrorRecoveryPage), 0);
+		modePageAdd(image, CachingPage, sizeof(CachingPage), 0);
+		modePageAdd(image, ControlModePage, sizeof(ControlModePage), 0);
+
+		if ((scsiDev.target->cfg->deviceType != S2S_CFG_OPTICAL) &&
+			(scsiDev.target->cfg->deviceType != S2S_CFG_SEQUENTIAL))
+		{
+			modePageAdd(image, NotchPage, sizeof(NotchPage), 0);
+		}
+	}
+
+	modeSenseCDDevicePage(image);
+	modeSenseCDAudioControlPage(image);
+
+	if (scsiDev.target->cfg->deviceType == S2S_CFG_ZIP100)
+	{
+		modePageAdd(image, IomegaZip100VendorPage, sizeof(IomegaZip100VendorPage), 0);
+	}
+
+	if (scsiDev.target->cfg->deviceType == S2S_CFG_SEQUENTIAL)
+	{
+		modePageAdd(image, SequentialDeviceConfigPage, sizeof(SequentialDeviceConfigPage), 0);
+	}
 
-	if (pc == 0x01) // Mask out (un)changable values
+	modeSenseCDCapabilitiesPage(image);
+
+	if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE)
 	{
-		memset(&scsiDev.data[dataIdx+2], 0, pageLen - 2);
+		modePageAdd(image, AppleVendorPage, sizeof(AppleVendorPage), 0);
 	}
+
+	// Hide the toolbox vendor page from all-pages responses under the
+	// PC-9801-55 quirk, but still answer a client probing for it directly.
+	if (scsiToolboxEnabled() && !oldNecHddMode)
+	{
+		modePageAdd(image, BlueSCSIVendorPage, sizeof(BlueSCSIVendorPage), 0);
+	}
+
+	// SCSI 2 standard says page 0 is always last.
+	if (!oldNecHddMode)
+	{
+		page = modePageAdd(image, OperatingPage, sizeof(OperatingPage), 0);
+		if (page)
+		{
+			// Note inverted logic for the flag.
+			page[2] = (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION) ? 0x80 : 0x90;
+			page[3] = getDeviceTypeQualifier();
+
+			// Also reported for page control 01b, never parsed by MODE SELECT
+			mask = modePageMask(image, page);
+			mask[2] = page[2];
+			mask[3] = page[3];
+		}
+	}
+
+	// Pages below are not part of the 0x3F response
+	if (scsiToolboxEnabled() && oldNecHddMode)
+	{
+		modePageAdd(image, BlueSCSIVendorPage, sizeof(BlueSCSIVendorPage), MODE_PAGE_NOT_IN_ALL);
+	}
+
+	modePageAdd(image, CCSCachingPage, sizeof(CCSCachingPage), MODE_PAGE_NOT_IN_ALL);
+}
+
+// The compiled mode pages of the current target, rebuilt if the settings
+// they were built for have changed.
+static const ModePageImage* modePageImage(void)
+{
+	ModePageCache* cache = &modePageCache[scsiDev.target - scsiDev.targets];
+	const S2S_TargetCfg* cfg = scsiDev.target->cfg;
+
+	ModePageKey key;
+	memset(&key, 0, sizeof(key)); // Padding is compared too
+	key.cfg = cfg;
+	key.sdSectorStart = cfg->sdSectorStart;
+	key.scsiSectors = cfg->scsiSectors;
+	key.bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
+	key.sectorsPerTrack = cfg->sectorsPerTrack;
+	key.headsPerCylinder = cfg->headsPerCylinder;
+	key.quirks = cfg->quirks;
+	key.deviceType = cfg->deviceType;
+	key.scsi2 = scsiDev.compatMode >= COMPAT_SCSI2;
+	key.unitAttention = (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION) != 0;
+	key.toolbox = scsiToolboxEnabled() != 0;
+
+	if (!cache->valid || memcmp(&key, &cache->key, sizeof(key)) != 0)
+	{
+		modePageBuild(&cache->image);
+		cache->key = key;
+		cache->valid = 1;
+	}
+	return &cache->image;
 }
 
 static void doModeSense(
@@ -403,12 +673,7 @@ static void doModeSense(
 		}
 	}
 
-	// The PC-9801-55 SCSI-1 controller, and its first party derivatives
-	// will ask for all pages (0x3F), expecting only these pages back:
-	// 0x01 - Read-write error recovery page
-	// 0x03 - Format device page
-	// 0x04 - Rigid disk geometry page
-	// This quirk is expected to be used with SCSI-1 mode only
+	// NEC PC-9801-55, see modePageBuild()
 	int oldNecHddMode = scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_PC98_55;
 
 	////////////// Block Descriptor
@@ -448,235 +713,47 @@ static void doModeSense(
 	}
 
 	int pageFound = 0;
+	int start = 0;
+	int len = 0;
+	const ModePageImage* image = modePageImage();
 
-	if (pageCode == 0x01 || pageCode == 0x3F)
+	if (pageCode == 0x3F)
 	{
 		pageFound = 1;
-		if ((scsiDev.compatMode >= COMPAT_SCSI2))
-		{
-			pageIn(pc, idx, ReadWriteErrorRecoveryPage, sizeof(ReadWriteErrorRecoveryPage));
-			idx += sizeof(ReadWriteErrorRecoveryPage);
-		}
-		else
-		{
-			pageIn(pc, idx, ReadWriteErrorRecoveryPage_SCSI1, sizeof(ReadWriteErrorRecoveryPage_SCSI1));
-			idx += sizeof(ReadWriteErrorRecoveryPage_SCSI1);
-		}
+		len = image->allPagesLength;
 	}
-
-	if (!oldNecHddMode && (pageCode == 0x02 || pageCode == 0x3F))
+	else
 	{
-		pageFound = 1;
-		if ((scsiDev.compatMode >= COMPAT_SCSI2))
-		{
-			pageIn(pc, idx, DisconnectReconnectPage, sizeof(DisconnectReconnectPage));
-			idx += sizeof(DisconnectReconnectPage);
-		}
-		else
+		const ModePageEntry* entry = modePageFind(image, pageCode);
+		if (entry)
 		{
-			pageIn(pc, idx, DisconnectReconnectPage_SCSI1, sizeof(DisconnectReconnectPage_SCSI1));
-			idx += sizeof(DisconnectReconnectPage_SCSI1);
+			pageFound = 1;
+			start = entry->offset;
+			len = entry->length;
 		}
 	}
 
-	if ((pageCode == 0x03 || pageCode == 0x3F) &&
-		(scsiDev.target->cfg->deviceType != S2S_CFG_OPTICAL))
+	if (pageFound)
 	{
-		pageFound = 1;
-		pageIn(pc, idx, FormatDevicePage, sizeof(FormatDevicePage));
-		if (pc != 0x01)
+		// Page control 01b reports the changeable mask. Default and saved
+		// values are the same as the current ones.
+		const uint8_t* pages = (pc == 0x01) ? image->changeable : image->current;
+		memcpy(&scsiDev.data[idx], &pages[start], len);
+
+		if (pc == 0x00)
 		{
-			if (oldNecHddMode)
+			int i;
+			for (i = 0; i < image->pageCount; ++i)
 			{
-				// This mimics ArdSCSino-stm32 behavior, setting
-				// "Tracks per zone" to the heads per cylinder value.
-				// If left as 0, PC-9801FA doesn't detect the drive
-				// properly.
-				scsiDev.data[idx+2] = 0x00;
-				scsiDev.data[idx+3] = scsiDev.target->cfg->headsPerCylinder;
-				// Interleave field
-				scsiDev.data[idx+15] = 0x00;
+				const ModePageEntry* entry = &image->pages[i];
+				if ((entry->flags & MODE_PAGE_VOLATILE) &&
+					entry->offset >= start && entry->offset < start + len)
+				{
+					modeSenseCDAudioControlCurrent(&scsiDev.data[idx + entry->offset - start]);
+				}
 			}
-			uint16_t sectorsPerTrack = scsiDev.target->cfg->sectorsPerTrack;
-			scsiDev.data[idx+10] = sectorsPerTrack >> 8;
-			scsiDev.data[idx+11] = sectorsPerTrack & 0xFF;
-
-			// Fill out the configured bytes-per-sector
-			uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
-			scsiDev.data[idx+12] = bytesPerSector >> 8;
-			scsiDev.data[idx+13] = bytesPerSector & 0xFF;
-		}
-		else
-		{
-			// Set a mask for the changeable values.
-			scsiDev.data[idx+12] = 0xFF;
-			scsiDev.data[idx+13] = 0xFF;
-		}
-
-		idx += sizeof(FormatDevicePage);
-	}
-
-	if ((pageCode == 0x04 || pageCode == 0x3F) &&
-		(scsiDev.target->cfg->deviceType != S2S_CFG_OPTICAL))
-	{
-		pageFound = 1;
-		if ((scsiDev.compatMode >= COMPAT_SCSI2))
-		{
-			pageIn(pc, idx, RigidDiskDriveGeometry, sizeof(RigidDiskDriveGeometry));
-		}
-		else
-		{
-			pageIn(pc, idx, RigidDiskDriveGeometry_SCSI1, sizeof(RigidDiskDriveGeometry_SCSI1));
-		}
-
-		if (pc != 0x01)
-		{
-			// Need to fill out the number of cylinders.
-			uint32_t cyl;
-			uint8_t head;
-			uint32_t sector;
-			LBA2CHS(
-				getScsiCapacity(
-					scsiDev.target->cfg->sdSectorStart,
-					scsiDev.target->liveCfg.bytesPerSector,
-					scsiDev.target->cfg->scsiSectors),
-				&cyl,
-				&head,
-				&sector,
-				scsiDev.target->cfg->headsPerCylinder,
-				scsiDev.target->cfg->sectorsPerTrack);
-
-			scsiDev.data[idx+2] = cyl >> 16;
-			scsiDev.data[idx+3] = cyl >> 8;
-			scsiDev.data[idx+4] = cyl;
-
-			memcpy(&scsiDev.data[idx+6], &scsiDev.data[idx+2], 3);
-			memcpy(&scsiDev.data[idx+9], &scsiDev.data[idx+2], 3);
-
-			scsiDev.data[idx+5] = scsiDev.target->cfg->headsPerCylinder;
-		}
-
-		if ((scsiDev.compatMode >= COMPAT_SCSI2))
-		{
-			idx += sizeof(RigidDiskDriveGeometry);
-		}
-		else
-		{
-			idx += sizeof(RigidDiskDriveGeometry_SCSI1);
 		}
-	}
-
-	if ((pageCode == 0x05 || pageCode == 0x3F) &&
-		(scsiDev.target->cfg->deviceType == S2S_CFG_FLOPPY_14MB))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, FlexibleDiskDriveGeometry, sizeof(FlexibleDiskDriveGeometry));
-		idx += sizeof(FlexibleDiskDriveGeometry);
-	}
-
-	// DON'T output the following pages for SCSI1 hosts. They get upset when
-	// we have more data to send than the allocation length provided.
-	// (ie. Try not to output any more pages below this comment)
-
-
-	if ((scsiDev.compatMode >= COMPAT_SCSI2) &&
-		(pageCode == 0x07 || pageCode == 0x3F))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, VerifyErrorRecoveryPage, sizeof(VerifyErrorRecoveryPage));
-		idx += sizeof(VerifyErrorRecoveryPage);
-	}
-
-	if ((scsiDev.compatMode >= COMPAT_SCSI2) &&
-		(pageCode == 0x08 || pageCode == 0x3F))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, CachingPage, sizeof(CachingPage));
-		idx += sizeof(CachingPage);
-	}
-
-	if ((scsiDev.compatMode >= COMPAT_SCSI2)
-		&& (pageCode == 0x0A || pageCode == 0x3F))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, ControlModePage, sizeof(ControlModePage));
-		idx += sizeof(ControlModePage);
-	}
-
-	if ((scsiDev.compatMode >= COMPAT_SCSI2) &&
-		(pageCode == 0x0C || pageCode == 0x3F) &&
-		(scsiDev.target->cfg->deviceType != S2S_CFG_OPTICAL) &&
-		(scsiDev.target->cfg->deviceType != S2S_CFG_SEQUENTIAL))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, NotchPage, sizeof(NotchPage));
-		idx += sizeof(NotchPage);
-	}
-
-	idx += modeSenseCDDevicePage(pc, idx, pageCode, &pageFound);
-	idx += modeSenseCDAudioControlPage(pc, idx, pageCode, &pageFound);
-
-	
-	if ((scsiDev.target->cfg->deviceType == S2S_CFG_ZIP100) &&
-		(pageCode == 0x2f || pageCode == 0x3f))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, IomegaZip100VendorPage, sizeof(IomegaZip100VendorPage));
-		idx += sizeof(IomegaZip100VendorPage);
-	}
-
-	if ((scsiDev.target->cfg->deviceType == S2S_CFG_SEQUENTIAL) &&
-		(pageCode == 0x10 || pageCode == 0x3F))
-	{
-		pageFound = 1;
-		pageIn(
-			pc,
-			idx,
-			SequentialDeviceConfigPage,
-			sizeof(SequentialDeviceConfigPage));
-		idx += sizeof(SequentialDeviceConfigPage);
-	}
-
-	idx += modeSenseCDCapabilitiesPage(pc, idx, pageCode, &pageFound);
-
-	if ((scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE) &&
-		(pageCode == 0x30 || pageCode == 0x3F))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, AppleVendorPage, sizeof(AppleVendorPage));
-		idx += sizeof(AppleVendorPage);
-	}
-
-	// Hide the toolbox vendor page from all-pages responses under the
-	// PC-9801-55 quirk, but still answer a client probing for it directly.
-	if (scsiToolboxEnabled() &&
-		(pageCode == 0x31 || (pageCode == 0x3F && !oldNecHddMode)))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, BlueSCSIVendorPage, sizeof(BlueSCSIVendorPage));
-		idx += sizeof(BlueSCSIVendorPage);
-	}
-
-	if (pageCode == 0x38) // Don't send unless requested
-	{
-		pageFound = 1;
-		pageIn(pc, idx, CCSCachingPage, sizeof(CCSCachingPage));
-		idx += sizeof(CCSCachingPage);
-	}
-
-	// SCSI 2 standard says page 0 is always last.
-	if (!oldNecHddMode && (pageCode == 0x00 || pageCode == 0x3F))
-	{
-		pageFound = 1;
-		pageIn(pc, idx, OperatingPage, sizeof(OperatingPage));
-
-		// Note inverted logic for the flag.
-		scsiDev.data[idx+2] =
-			(scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION) ? 0x80 : 0x90;
-
-		scsiDev.data[idx+3] = getDeviceTypeQualifier();
-
-		idx += sizeof(OperatingPage);
+		idx += len;
 	}
 
 	if (!pageFound)
@@ -708,6 +785,29 @@ static void doModeSense(
 }
 
 
+// True if the page at scsiDev.data[idx] sets a changeable field to a new
+// value. A page of unexpected length goes to its handler to be rejected.
+static int modePageChanged(
+	const ModePageImage* image, const ModePageEntry* entry, int idx, int pageLen)
+{
+	if (pageLen + 2 != entry->length)
+	{
+		return 1;
+	}
+
+	const uint8_t* current = &image->current[entry->offset];
+	const uint8_t* mask = &image->changeable[entry->offset];
+	int i;
+	for (i = 2; i < entry->length; ++i)
+	{
+		if ((scsiDev.data[idx + i] ^ current[i]) & mask[i])
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
 // Callback after the DATA OUT phase is complete.
 static void doModeSelect(void)
 {
@@ -763,6 +863,7 @@ static void doModeSelect(void)
 		}
 		idx += blockDescLen;
 
+		const ModePageImage* image = modePageImage();
 		while (idx < scsiDev.dataLen)
 		{
 			// Change from SCSI2SD: if code page is 0x0 (vendor-specific) it
@@ -776,6 +877,20 @@ static void doModeSelect(void)
 			int pageLen = scsiDev.data[idx + 1];
 			if (idx + 2 + pageLen > scsiDev.dataLen) goto badLength;
 
+			// Pages we don't have, and pages that leave the changeable
+			// fields as they are, need no further checks. The image does not
+			// hold the live values of volatile pages, and page 0x03 with the
+			// SP bit set must still save the block size.
+			const ModePageEntry* entry = modePageFind(image, pageCode);
+			int alwaysApply = entry &&
+				((entry->flags & MODE_PAGE_VOLATILE) ||
+				(pageCode == 0x03 && (scsiDev.cdb[1] & 1)));
+			if (!entry || (!alwaysApply && !modePageChanged(image, entry, idx, pageLen)))
+			{
+				idx += 2 + pageLen;
+				continue;
+			}
+
 			switch (pageCode)
 			{
 			case 0x03: // Format Device Page
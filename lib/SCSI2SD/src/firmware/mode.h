@@ -17,6 +17,49 @@
 #ifndef MODE_H
 #define MODE_H
 
+#include <stdint.h>
+
+// Big enough for all pages of a floppy drive with the Apple and toolbox pages
+#define MODE_PAGE_IMAGE_SIZE 256
+#define MODE_PAGE_MAX_PAGES 16
+
+// Page is only returned when asked for by its page code, never for 0x3F.
+// These pages have to be added after all others.
+#define MODE_PAGE_NOT_IN_ALL 0x01
+// Current values change at runtime, MODE SENSE fills them in.
+#define MODE_PAGE_VOLATILE 0x02
+
+typedef struct
+{
+	uint8_t code;
+	uint8_t flags; // MODE_PAGE_*
+	uint8_t offset;
+	uint8_t length; // Including the page code and length bytes
+} ModePageEntry;
+
+// The mode pages of a target in MODE SENSE format, in the order they are
+// returned for page code 0x3F. Built once for the target settings and
+// reused until they change.
+typedef struct
+{
+	ModePageEntry pages[MODE_PAGE_MAX_PAGES];
+	uint8_t pageCount;
+	uint16_t length;
+	uint16_t allPagesLength; // Bytes returned for page code 0x3F
+
+	// Current values, also reported as the default and saved values.
+	uint8_t current[MODE_PAGE_IMAGE_SIZE];
+	// Bits that MODE SELECT may change, reported for page control 01b.
+	uint8_t changeable[MODE_PAGE_IMAGE_SIZE];
+} ModePageImage;
+
 int scsiModeCommand(void);
 
+// Adds a page to the image with none of its fields changeable.
+// Returns the page in image->current, or NULL if the image is full.
+uint8_t* modePageAdd(ModePageImage* image, const uint8_t* page, int len, uint8_t flags);
+
+// The changeable mask of a page returned by modePageAdd()
+uint8_t* modePageMask(ModePageImage* image, uint8_t* page);
+
 #endif
@@ -22,73 +22,76 @@
 #include "scsiPhy.h"
 #include "config.h"
 #include "network.h"
+#include "BlueSCSI_crc32.h"
 
 extern int platform_network_send(uint8_t *buf, size_t len);
 
+static int scsiNetworkPlatformSend(const uint8_t *buf, size_t len)
+{
+	return platform_network_send((uint8_t *)buf, len);
+}
+
+const struct scsiNetworkBackend scsiNetworkPlatformBackend = {
+	"wifi", scsiNetworkPlatformSend, NULL, NULL
+};
+
+static const struct scsiNetworkBackend *scsiNetworkActiveBackend = &scsiNetworkPlatformBackend;
+
 bool scsiNetworkEnabled = false;
 struct scsiNetworkPacketQueue scsiNetworkInboundQueue;
 
-struct __attribute__((packed)) wifi_network_entry wifi_network_list[WIFI_NETWORK_LIST_ENTRY_COUNT] = { 0 };
+uint16_t g_scsi_networkHeaderDelayUs = NETWORK_DELAY_AUTO;
+uint16_t g_scsi_networkPacketDelayUs = NETWORK_DELAY_AUTO;
+
+// Pacing of multi-packet READ(6) transfers per host quirks. The DaynaPort Mac
+// driver needs a short delay after reading size and flags, and between packets.
+// Timing matches real DaynaPORT SCSI/Link-3 behavior observed on a SCSI bus analyzer.
+// With Apple quirks the host is known to be a Mac, so blind mode transfers are
+// filled up to the allocation length within a bus hold budget. Other hosts keep
+// the two packet limit.
+struct scsiNetworkTiming {
+	uint16_t quirks;
+	uint16_t headerDelayUs;
+	uint16_t packetDelayUs;
+	uint16_t maxPackets;	// per READ(6) in blind mode
+	uint16_t maxHoldUs;	// no more packets after holding the bus this long
+};
 
-static const uint32_t crc32_tab[] = {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-	0xf3b97148, 0x84be41de,	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,	0x14015c4f, 0x63066cd9,
-	0xfa0f3d63, 0x8d080df5,	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,	0x35b5a8fa, 0x42b2986c,
-	0xdbbbc9d6, 0xacbcf940,	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,	0x76dc4190, 0x01db7106,
-	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+static const struct scsiNetworkTiming scsiNetworkTimings[] = {
+	{ S2S_CFG_QUIRKS_APPLE, 75, 300, 0xffff, 10000 },
+	{ S2S_CFG_QUIRKS_NONE, 75, 300, 2, 0xffff },	// default, keep last
 };
 
-uint32_t crc32(const void *buf, size_t size)
-{
-	const uint8_t *p = buf;
-	uint32_t crc;
+static struct {
+	uint8_t exact[NETWORK_MULTICAST_EXACT_COUNT][6];
+	uint8_t exactCount;
+	uint64_t hash;
+} scsiNetworkMulticast;
+
+struct scsiNetworkReadStats {
+	uint32_t commands;	// READ(6) commands that returned packets
+	uint32_t packets;
+	uint16_t maxPackets;
+	uint32_t holdUs;	// total time spent in DATA IN
+	uint32_t maxHoldUs;
+	uint64_t latencyUs;	// total time packets spent queued
+	uint32_t maxLatencyUs;
+};
 
-	crc = ~0U;
-	while (size--)
-	{
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-	}
-	return crc ^ ~0U;
+static struct scsiNetworkReadStats scsiNetworkReadStats;
+
+static uint16_t networkQueueNextLen(void);
+
+static const struct scsiNetworkTiming *scsiNetworkHostTiming(void)
+{
+	const struct scsiNetworkTiming *t = scsiNetworkTimings;
+	while (t->quirks != S2S_CFG_QUIRKS_NONE && t->quirks != scsiDev.target->cfg->quirks)
+		t++;
+	return t;
 }
 
+struct __attribute__((packed)) wifi_network_entry wifi_network_list[WIFI_NETWORK_LIST_ENTRY_COUNT] = { 0 };
+
 void scsiNetworkWifiScan(void)
 {
 	// initiate wi-fi scan
@@ -216,8 +219,9 @@ void scsiNetworkWifiJoin(uint32_t size)
 
 int scsiNetworkCommand()
 {
-	int parityError, done, idx, total;
+	int parityError, done, total;
 	long len;
+	uint8_t *packet;
 	uint32_t size = (scsiDev.cdb[3] << 8) + scsiDev.cdb[4];
 	uint8_t command = scsiDev.cdb[0];
 
@@ -242,7 +246,7 @@ int scsiNetworkCommand()
 		}
 
 		// if we have nothing to send, just return early
-		if (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex)
+		if (scsiNetworkQueueEmpty())
 		{
 			scsiDev.data[0] = 0;
 			scsiDev.data[1] = 0;
@@ -252,7 +256,7 @@ int scsiNetworkCommand()
 			scsiDev.data[5] = 0;
 			scsiEnterPhase(DATA_IN);
 			scsiWrite(scsiDev.data, 6);
-			while (!scsiIsWriteFinished(NULL))
+			while (!scsiIsWriteFinished(NULL) && !scsiDev.resetFlag)
 			{
 				platform_poll();
 			}
@@ -262,42 +266,70 @@ int scsiNetworkCommand()
 			break;
 		}
 
+		const struct scsiNetworkTiming *timing = scsiNetworkHostTiming();
+		uint32_t headerDelay = (g_scsi_networkHeaderDelayUs != NETWORK_DELAY_AUTO ? g_scsi_networkHeaderDelayUs : timing->headerDelayUs);
+		uint32_t packetDelay = (g_scsi_networkPacketDelayUs != NETWORK_DELAY_AUTO ? g_scsi_networkPacketDelayUs : timing->packetDelayUs);
+		uint32_t maxPackets = (multiPacket ? timing->maxPackets : 1);
+
+		// Without pacing the whole batch goes out in as few writes as possible
+		int coalesce = (headerDelay == 0 && packetDelay == 0);
+		uint32_t staged = 0;
+		uint32_t packets = 0;
+
 		scsiEnterPhase(DATA_IN);
+		uint32_t start = time_us_32();
 
 		for (done = 0, total = 0; !done; )
 		{
-			idx = scsiNetworkInboundQueue.readIndex;
-			len = scsiNetworkInboundQueue.sizes[idx];
+			uint16_t plen = 0;
+			uint32_t age = scsiNetworkQueueAgeUs();
+			packet = scsiNetworkPeek(&plen);
+			len = plen;
 			total += len + 6;  // packet data + 6-byte header
+			packets++;
 
-			if (scsiNetworkInboundQueue.readIndex == NETWORK_PACKET_QUEUE_SIZE - 1)
-			{
-				scsiNetworkInboundQueue.readIndex = 0;
-			}
-			else
-			{
-				scsiNetworkInboundQueue.readIndex++;
-			}
-
-			done = (scsiNetworkInboundQueue.readIndex == scsiNetworkInboundQueue.writeIndex);
+			scsiNetworkReadStats.latencyUs += age;
+			if (age > scsiNetworkReadStats.maxLatencyUs)
+				scsiNetworkReadStats.maxLatencyUs = age;
 
+			// Packets that arrive while this one is sent wait for the next
+			// READ(6), the flags below are final once written.
 			// In polled mode (bit 6 clear), only send one packet per READ(6)
 			// to avoid holding the SCSI bus while the VM pager needs it.
-			if (!done && !multiPacket)
-			{
-				done = 1;
-			}
-
-			// Don't exceed the transfer size requested by the host
-			if (!done && total + DAYNAPORT_SCSI_PACKET_MAX + 6 > size)
+			// In blind mode, add packets while they fit the transfer size
+			// requested by the host and the bus hold budget allows.
+			uint16_t next = networkQueueNextLen();
+			done = (next == 0
+				|| packets >= maxPackets
+				|| total + next + 6 > size
+				|| (uint32_t)(time_us_32() - start) >= timing->maxHoldUs);
+
+			if (coalesce)
 			{
-				done = 1;
-			}
-
-			// Don't tie up the SCSI bus too long even in multi-packet mode
-			if (!done && total >= (DAYNAPORT_SCSI_PACKET_MAX + 6) * 2)
-			{
-				done = 1;
+				uint8_t *hdr = scsiDev.data + staged;
+				hdr[0] = (len >> 8) & 0xff;
+				hdr[1] = len & 0xff;
+				hdr[2] = 0;
+				hdr[3] = 0;
+				hdr[4] = 0;
+				hdr[5] = (done ? 0 : 0x10);
+				memcpy(hdr + 6, packet, len);
+				staged += len + 6;
+				scsiNetworkDequeue();
+
+				if (done || staged + next + 6 > sizeof(scsiDev.data))
+				{
+					scsiWrite(scsiDev.data, staged);
+					while (!scsiIsWriteFinished(NULL) && !scsiDev.resetFlag)
+					{
+						platform_poll();
+					}
+					scsiFinishWrite();
+					staged = 0;
+					if (unlikely(scsiDev.resetFlag))
+						break;
+				}
+				continue;
 			}
 
 			scsiDev.data[0] = (len >> 8) & 0xff;
@@ -308,31 +340,53 @@ int scsiNetworkCommand()
 			scsiDev.data[5] = (done ? 0 : 0x10);
 
 			scsiWrite(scsiDev.data, 6);
-			while (!scsiIsWriteFinished(NULL))
+			while (!scsiIsWriteFinished(NULL) && !scsiDev.resetFlag)
 			{
 				platform_poll();
 			}
 			scsiFinishWrite();
+			if (unlikely(scsiDev.resetFlag))
+			{
+				scsiNetworkAbort();
+				break;
+			}
 
-			// DaynaPort Mac driver needs a short delay after reading size and flags.
-			// Timing matches real DaynaPORT SCSI/Link-3 behavior observed on a SCSI bus analyzer.
-			sleep_us(75);
+			if (headerDelay)
+			{
+				sleep_us(headerDelay);
+			}
 
-			scsiWrite(scsiNetworkInboundQueue.packets[idx], len);
-			while (!scsiIsWriteFinished(NULL))
+			scsiWrite(packet, len);
+			while (!scsiIsWriteFinished(NULL) && !scsiDev.resetFlag)
 			{
 				platform_poll();
 			}
 			scsiFinishWrite();
+			if (unlikely(scsiDev.resetFlag))
+			{
+				// The host did not get the packet, send it again next time
+				scsiNetworkAbort();
+				break;
+			}
+			scsiNetworkDequeue();
 
-			if (!done)
+			if (!done && packetDelay)
 			{
-				// DaynaPort Mac driver needs a delay between packets.
-				// Timing matches real DaynaPORT SCSI/Link-3 behavior observed on a SCSI bus analyzer.
-				sleep_us(300);
+				sleep_us(packetDelay);
 			}
 		}
 
+		uint32_t hold = time_us_32() - start;
+		struct scsiNetworkReadStats *rs = &scsiNetworkReadStats;
+		rs->commands++;
+		rs->packets += packets;
+		rs->holdUs += hold;
+		if (packets > rs->maxPackets)
+			rs->maxPackets = packets;
+		if (hold > rs->maxHoldUs)
+			rs->maxHoldUs = hold;
+		DBGMSG_F("%s: sent %lu packets, %d bytes in %lu us", __func__, (unsigned long)packets, total, (unsigned long)hold);
+
 		scsiDev.status = GOOD;
 		scsiDev.phase = STATUS;
 		break;
@@ -344,18 +398,38 @@ int scsiNetworkCommand()
 		memset(scsiDev.data + sizeof(scsiDev.boardCfg.wifiMACAddress), 0,
 			sizeof(scsiDev.data) - sizeof(scsiDev.boardCfg.wifiMACAddress));
 
-		// three 32-bit counters expected to follow, just return zero for all
+		// three 32-bit counters follow: frame alignment errors, CRC errors
+		// and frames lost, only the last one applies here
+		{
+			uint32_t lost = scsiNetworkInboundQueue.stats.droppedFull + scsiNetworkInboundQueue.stats.droppedTooLarge;
+			scsiDev.data[14] = (lost >> 24) & 0xff;
+			scsiDev.data[15] = (lost >> 16) & 0xff;
+			scsiDev.data[16] = (lost >> 8) & 0xff;
+			scsiDev.data[17] = lost & 0xff;
+		}
 		scsiDev.dataLen = 18;
 		scsiDev.phase = DATA_IN;
 		break;
 
 	case 0x0a:
+	{
 		// write(6)
+		// With a preamble the host sends frames back to back, each behind a
+		// 4-byte header, until a zero length. Frames alternate between two
+		// halves of the SCSI buffer so the next one is read from the bus
+		// while the previous one is handed to the network.
+		int preamble = (scsiDev.cdb[5] != 0x0);
+		uint8_t *slots[2] = { scsiDev.data, scsiDev.data + NETWORK_PACKET_MAX_SIZE };
+		uint8_t *pending = NULL;
+		long pendingLen = 0;
+		int slot = 0;
+		uint8_t hdr[4];
+
 		scsiEnterPhase(DATA_OUT);
 
 		for (;;)
 		{
-			if (scsiDev.cdb[5] == 0x0)
+			if (!preamble)
 			{
 				// no preamble, single packet
 				len = size;
@@ -365,13 +439,13 @@ int scsiNetworkCommand()
 			else
 			{
 				// read size of this packet
-				scsiRead(scsiDev.data, 4, &parityError);
+				scsiRead(hdr, 4, &parityError);
 				if (parityError)
 				{
 					DBGMSG_F("%s: read of size from host had parity error %d", __func__, parityError);
 				}
 
-				len = (scsiDev.data[0] << 8) + scsiDev.data[1];
+				len = (hdr[0] << 8) + hdr[1];
 				if (len == 0)
 				{
 					// final packet was read in previous iteration
@@ -385,24 +459,41 @@ int scsiNetworkCommand()
 				len = NETWORK_PACKET_MAX_SIZE;
 			}
 
-			scsiRead(scsiDev.data, len, &parityError);
+			uint8_t *buf = slots[slot];
+			slot ^= 1;
+			parityError = 0;
+			scsiStartRead(buf, len, &parityError);
+
+			if (pending)
+			{
+				scsiNetworkSend(pending, pendingLen);
+			}
+
+			scsiFinishRead(buf, len, &parityError);
 			if (parityError)
 			{
 				DBGMSG_F("%s: read from host of size %zu had parity error %d", __func__, size, parityError);
 			}
 
-			platform_network_send(scsiDev.data, len);      
+			pending = buf;
+			pendingLen = len;
 
-			if (scsiDev.cdb[5] == 0x0)
+			if (!preamble)
 			{
 				// single-packet mode
 				break;
 			}
 		}
 
+		if (pending)
+		{
+			scsiNetworkSend(pending, pendingLen);
+		}
+
 		scsiDev.status = GOOD;
 		scsiDev.phase = STATUS;
 		break;
+	}
 
 	case 0x0c:
 		// set interface mode (ignored)
@@ -420,6 +511,7 @@ int scsiNetworkCommand()
 			  scsiDev.data[0], scsiDev.data[1], scsiDev.data[2], scsiDev.data[3], scsiDev.data[4], scsiDev.data[5]);
 
 
+		scsiNetworkAddMulticast(scsiDev.data);
 		platform_network_add_multicast_address(scsiDev.data);
 
 		scsiDev.status = GOOD;
@@ -432,12 +524,13 @@ int scsiNetworkCommand()
 		{
 			DBGMSG_F("%s: enable interface", __func__);
 			scsiNetworkEnabled = true;
-			memset(&scsiNetworkInboundQueue, 0, sizeof(scsiNetworkInboundQueue));
+			scsiNetworkQueueReset();
 		}
 		else
 		{
 			DBGMSG_F("%s: disable interface", __func__);
 			scsiNetworkEnabled = false;
+			scsiNetworkQueueReset();
 		}
 		break;
 
@@ -482,44 +575,331 @@ int scsiNetworkCommand()
 	return 1;
 }
 
+// A header length of NETWORK_QUEUE_WRAP marks the unused end of the ring,
+// the next entry starts at offset 0. Packets never straddle the end so they
+// can be handed to scsiWrite() in one piece.
+#define NETWORK_QUEUE_WRAP 0xffff
+
+static inline uint32_t networkQueueEntrySize(uint32_t len)
+{
+	return (NETWORK_QUEUE_ENTRY_HEADER + len + 3) & ~3;
+}
+
+// Arrival time of a packet in 64 us units, wraps after about 4 seconds
+static inline uint16_t networkQueueTimestamp(void)
+{
+	return (time_us_32() >> 6) & 0xffff;
+}
+
+static inline uint16_t networkQueueEntryLen(uint32_t offset)
+{
+	const uint8_t *hdr = &scsiNetworkInboundQueue.buf[offset];
+	return hdr[0] | (hdr[1] << 8);
+}
+
+// Skips a wrap marker at the tail so that it points at a packet
+static void networkQueueSkipWrap(void)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	if (q->count > 0 && (q->tail == NETWORK_QUEUE_BYTES || networkQueueEntryLen(q->tail) == NETWORK_QUEUE_WRAP))
+	{
+		q->used -= NETWORK_QUEUE_BYTES - q->tail;
+		q->tail = 0;
+	}
+}
+
+// Drops the oldest packet, including any wrap padding after it
+static void networkQueueDropOldest(void)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	uint32_t size = networkQueueEntrySize(networkQueueEntryLen(q->tail));
+	q->tail += size;
+	q->used -= size;
+	q->count--;
+	q->pinned = 0;
+	if (q->count == 0)
+	{
+		// Restart at the beginning to keep the free space contiguous
+		q->head = q->tail = q->used = 0;
+	}
+	else
+	{
+		networkQueueSkipWrap();
+	}
+}
+
+// Length of the packet queued after the oldest one, 0 if there is none
+static uint16_t networkQueueNextLen(void)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	if (q->count < 2)
+		return 0;
+
+	uint32_t next = q->tail + networkQueueEntrySize(networkQueueEntryLen(q->tail));
+	if (next == NETWORK_QUEUE_BYTES || networkQueueEntryLen(next) == NETWORK_QUEUE_WRAP)
+		next = 0;
+	return networkQueueEntryLen(next);
+}
+
+// Finds a contiguous spot for an entry of the given size, returns -1 if full
+static int32_t networkQueueReserve(uint32_t size)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	if (q->count == 0)
+		return 0;
+
+	if (q->head > q->tail)
+	{
+		// Free space is after the head and before the tail
+		if (NETWORK_QUEUE_BYTES - q->head >= size)
+			return q->head;
+		if (q->tail >= size)
+		{
+			if (q->head < NETWORK_QUEUE_BYTES)
+			{
+				q->buf[q->head] = NETWORK_QUEUE_WRAP & 0xff;
+				q->buf[q->head + 1] = NETWORK_QUEUE_WRAP >> 8;
+			}
+			q->used += NETWORK_QUEUE_BYTES - q->head;
+			q->head = 0;
+			return 0;
+		}
+		return -1;
+	}
+
+	// Head has wrapped, free space is between head and tail
+	if (q->head < q->tail && q->tail - q->head >= size)
+		return q->head;
+	return -1;
+}
+
 int scsiNetworkEnqueue(const uint8_t *buf, size_t len)
 {
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+
 	if (!scsiNetworkEnabled)
 		return 0;
 
-	if (len + 4 > sizeof(scsiNetworkInboundQueue.packets[0]))
+	if (len + 4 > NETWORK_PACKET_MAX_SIZE)
 	{
-		DBGMSG_F("%s: dropping incoming network packet, too large (%zu > %zu)", __func__, len, sizeof(scsiNetworkInboundQueue.packets[0]));
+		DBGMSG_F("%s: dropping incoming network packet, too large (%zu > %d)", __func__, len, NETWORK_PACKET_MAX_SIZE - 4);
+		q->stats.droppedTooLarge++;
 		return 0;
 	}
 
-	memcpy(scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex], buf, len);
+	// packets the host reads have to be at least 64 bytes, so pad before we CRC and add to queue
+	uint32_t plen = (len < 60 ? 60 : len);
+	uint32_t size = networkQueueEntrySize(plen + 4);
 
-	if (len < 60) {
-		// packets the host reads have to be at least 64 bytes, so pad before we CRC and add to queue
-		memset(scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex] + len, 0, 60 - len);
-		len += (60 - len);
+	int32_t offset = networkQueueReserve(size);
+#if NETWORK_QUEUE_DROP_POLICY == NETWORK_QUEUE_DROP_OLDEST
+	// A packet that is being sent to the host can't be dropped, dropping the
+	// ones queued behind it would not free contiguous space either
+	while (offset < 0 && q->count > 0 && !q->pinned)
+	{
+		networkQueueDropOldest();
+		q->stats.droppedFull++;
+		offset = networkQueueReserve(size);
+	}
+#endif
+	if (offset < 0)
+	{
+		DBGMSG_F("%s: dropping incoming network packet, queue full (%d packets)", __func__, q->count);
+		q->stats.droppedFull++;
+		return 0;
 	}
 
-	uint32_t crc = crc32(scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex], len);
-	scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex][len] = crc & 0xff;
-	scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex][len + 1] = (crc >> 8) & 0xff;
-	scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex][len + 2] = (crc >> 16) & 0xff;
-	scsiNetworkInboundQueue.packets[scsiNetworkInboundQueue.writeIndex][len + 3] = (crc >> 24) & 0xff;
+	uint8_t *entry = &q->buf[offset];
+	uint8_t *packet = entry + NETWORK_QUEUE_ENTRY_HEADER;
+	memcpy(packet, buf, len);
+	if (len < plen)
+		memset(packet + len, 0, plen - len);
+
+	uint32_t crc = crc32(packet, plen);
+	packet[plen] = crc & 0xff;
+	packet[plen + 1] = (crc >> 8) & 0xff;
+	packet[plen + 2] = (crc >> 16) & 0xff;
+	packet[plen + 3] = (crc >> 24) & 0xff;
+
+	uint16_t stamp = networkQueueTimestamp();
+	entry[0] = (plen + 4) & 0xff;
+	entry[1] = (plen + 4) >> 8;
+	entry[2] = stamp & 0xff;
+	entry[3] = stamp >> 8;
+
+	q->head = offset + size;
+	q->used += size;
+	q->count++;
+
+	q->stats.enqueued++;
+	if (q->count > q->stats.maxPackets)
+		q->stats.maxPackets = q->count;
+	if (q->used > q->stats.maxBytes)
+		q->stats.maxBytes = q->used;
+
+	return 1;
+}
 
-	scsiNetworkInboundQueue.sizes[scsiNetworkInboundQueue.writeIndex] = len + 4;
+uint8_t *scsiNetworkPeek(uint16_t *len)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	if (q->count == 0)
+		return NULL;
+
+	q->pinned = 1;
+	*len = networkQueueEntryLen(q->tail);
+	return &q->buf[q->tail + NETWORK_QUEUE_ENTRY_HEADER];
+}
+
+uint16_t scsiNetworkPeekLen(void)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	if (q->count == 0)
+		return 0;
 
-	if (scsiNetworkInboundQueue.writeIndex == NETWORK_PACKET_QUEUE_SIZE - 1)
-		scsiNetworkInboundQueue.writeIndex = 0;
+	return networkQueueEntryLen(q->tail);
+}
+
+void scsiNetworkDequeue(void)
+{
+	if (scsiNetworkInboundQueue.count == 0)
+		return;
+
+	networkQueueDropOldest();
+	scsiNetworkInboundQueue.stats.dequeued++;
+}
+
+uint32_t scsiNetworkQueueAgeUs(void)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	if (q->count == 0)
+		return 0;
+
+	const uint8_t *hdr = &q->buf[q->tail];
+	uint16_t stamp = hdr[2] | (hdr[3] << 8);
+	return (uint16_t)(networkQueueTimestamp() - stamp) << 6;
+}
+
+int scsiNetworkQueueEmpty(void)
+{
+	return scsiNetworkInboundQueue.count == 0;
+}
+
+void scsiNetworkQueueReset(void)
+{
+	struct scsiNetworkPacketQueue *q = &scsiNetworkInboundQueue;
+	struct scsiNetworkQueueStats *s = &q->stats;
+
+	if (s->enqueued)
+	{
+		LOGMSG_F("Network inbound queue: %lu packets received, %lu filtered, %lu sent to host, %lu dropped (full), %lu dropped (too large), max %u packets / %lu bytes queued",
+			(unsigned long)s->enqueued, (unsigned long)s->filtered, (unsigned long)s->dequeued, (unsigned long)s->droppedFull,
+			(unsigned long)s->droppedTooLarge, s->maxPackets, (unsigned long)s->maxBytes);
+	}
+
+	struct scsiNetworkReadStats *rs = &scsiNetworkReadStats;
+	if (rs->commands)
+	{
+		LOGMSG_F("Network READ(6): %lu commands, %lu packets, max %u packets per command, average %lu us / max %lu us bus hold",
+			(unsigned long)rs->commands, (unsigned long)rs->packets, rs->maxPackets,
+			(unsigned long)(rs->holdUs / rs->commands), (unsigned long)rs->maxHoldUs);
+		LOGMSG_F("Network queue latency: average %lu us, max %lu us",
+			(unsigned long)(rs->latencyUs / rs->packets), (unsigned long)rs->maxLatencyUs);
+	}
+
+	if (scsiNetworkActiveBackend->logStats)
+		scsiNetworkActiveBackend->logStats();
+
+	q->head = q->tail = q->used = 0;
+	q->count = 0;
+	q->pinned = 0;
+
+	// A host driver that enables the interface registers its own addresses
+	memset(&scsiNetworkMulticast, 0, sizeof(scsiNetworkMulticast));
+}
+
+void scsiNetworkAbort(void)
+{
+	scsiNetworkInboundQueue.pinned = 0;
+}
+
+void scsiNetworkReset(void)
+{
+	scsiNetworkAbort();
+	memset(&scsiNetworkMulticast, 0, sizeof(scsiNetworkMulticast));
+}
+
+static inline uint32_t scsiNetworkMulticastHash(const uint8_t *mac)
+{
+	// Top 6 bits of the Ethernet CRC, as used by most NIC hash filters
+	return crc32(mac, 6) >> 26;
+}
+
+void scsiNetworkAddMulticast(const uint8_t *mac)
+{
+	for (int i = 0; i < scsiNetworkMulticast.exactCount; i++)
+	{
+		if (memcmp(scsiNetworkMulticast.exact[i], mac, 6) == 0)
+			return;
+	}
+
+	if (scsiNetworkMulticast.exactCount < NETWORK_MULTICAST_EXACT_COUNT)
+	{
+		memcpy(scsiNetworkMulticast.exact[scsiNetworkMulticast.exactCount++], mac, 6);
+	}
 	else
-		scsiNetworkInboundQueue.writeIndex++;
+	{
+		scsiNetworkMulticast.hash |= (uint64_t)1 << scsiNetworkMulticastHash(mac);
+	}
+}
+
+int scsiNetworkFilterAccept(const uint8_t *dst)
+{
+	// Unicast is already filtered by the Wi-Fi chip
+	if (!(dst[0] & 1))
+		return 1;
+
+	static const uint8_t broadcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	if (memcmp(dst, broadcast, 6) == 0)
+		return 1;
 
-	if (scsiNetworkInboundQueue.writeIndex == scsiNetworkInboundQueue.readIndex)
+	// Until the host driver registers an address it gets all multicast,
+	// as it did before there was a filter
+	if (scsiNetworkMulticast.exactCount == 0)
+		return 1;
+
+	for (int i = 0; i < scsiNetworkMulticast.exactCount; i++)
 	{
-		DBGMSG_F("%s: dropping packets in ring, write index caught up to read index", __func__);
+		if (memcmp(scsiNetworkMulticast.exact[i], dst, 6) == 0)
+			return 1;
 	}
 
-	return 1;
+	if (scsiNetworkMulticast.hash && (scsiNetworkMulticast.hash & ((uint64_t)1 << scsiNetworkMulticastHash(dst))))
+		return 1;
+
+	scsiNetworkInboundQueue.stats.filtered++;
+	return 0;
+}
+
+void scsiNetworkSetBackend(const struct scsiNetworkBackend *backend)
+{
+	scsiNetworkActiveBackend = backend;
+}
+
+const struct scsiNetworkBackend *scsiNetworkGetBackend(void)
+{
+	return scsiNetworkActiveBackend;
+}
+
+int scsiNetworkSend(const uint8_t *buf, size_t len)
+{
+	return scsiNetworkActiveBackend->send(buf, len);
+}
+
+void scsiNetworkPoll(void)
+{
+	if (scsiNetworkActiveBackend->poll)
+		scsiNetworkActiveBackend->poll();
 }
 
 #endif // BLUESCSI_NETWORK
@@ -23,8 +23,10 @@
 extern "C" {
 #endif
 
+// Inbound queue RAM budget, in maximum size packets. Packets are stored
+// back to back in a byte ring, so small packets take much less room.
 #ifndef NETWORK_PACKET_QUEUE_SIZE
-# define NETWORK_PACKET_QUEUE_SIZE   20		// must be <= 255
+# define NETWORK_PACKET_QUEUE_SIZE   20
 #endif
 
 #define NETWORK_PACKET_MAX_SIZE     1520
@@ -33,13 +35,36 @@ extern "C" {
 // plus 6-byte DaynaPort SCSI packet header
 #define DAYNAPORT_SCSI_PACKET_MAX   1524
 
-struct scsiNetworkPacketQueue {
-	uint8_t packets[NETWORK_PACKET_QUEUE_SIZE][NETWORK_PACKET_MAX_SIZE];
-	uint16_t sizes[NETWORK_PACKET_QUEUE_SIZE];
-	uint8_t writeIndex;
-	uint8_t readIndex;
+// Each packet in the ring has a 4-byte header and is padded to 4 bytes
+#define NETWORK_QUEUE_ENTRY_HEADER  4
+#define NETWORK_QUEUE_BYTES         (NETWORK_PACKET_QUEUE_SIZE * (NETWORK_PACKET_MAX_SIZE + NETWORK_QUEUE_ENTRY_HEADER))
+
+// What to do with an incoming packet when the ring is full
+#define NETWORK_QUEUE_DROP_NEWEST   0	// discard the incoming packet
+#define NETWORK_QUEUE_DROP_OLDEST   1	// discard queued packets until it fits
+#ifndef NETWORK_QUEUE_DROP_POLICY
+# define NETWORK_QUEUE_DROP_POLICY  NETWORK_QUEUE_DROP_OLDEST
+#endif
+
+struct scsiNetworkQueueStats {
+	uint32_t filtered;		// group frames the host did not ask for
+	uint32_t enqueued;
+	uint32_t dequeued;
+	uint32_t droppedFull;		// lost to the drop policy
+	uint32_t droppedTooLarge;
+	uint16_t maxPackets;		// high water marks
+	uint32_t maxBytes;
 };
 
+struct scsiNetworkPacketQueue {
+	uint8_t buf[NETWORK_QUEUE_BYTES] __attribute__((aligned(4)));
+	uint32_t head;		// offset of the next entry to write
+	uint32_t tail;		// offset of the oldest entry
+	uint32_t used;		// bytes in use including headers and wrap padding
+	uint16_t count;		// packets queued
+	uint8_t pinned;		// the oldest packet is being sent to the host
+	struct scsiNetworkQueueStats stats;
+};
 struct __attribute__((packed)) wifi_network_entry {
 	char ssid[64];
 	char bssid[6];
@@ -67,9 +92,67 @@ struct __attribute__((packed)) wifi_join_request {
 #define SCSI_NETWORK_WIFI_CMD_INFO			0x04
 #define SCSI_NETWORK_WIFI_CMD_JOIN			0x05
 
+// Receive filter for group addresses, like the multicast filter of a real
+// NIC: broadcast always passes, multicast addresses added by the host are
+// matched exactly, and once that list is full by a 64-bit CRC hash. Before
+// the host has added any address all multicast passes. The addresses are
+// forgotten when the interface is enabled or disabled and on bus reset.
+#define NETWORK_MULTICAST_EXACT_COUNT 8
+void scsiNetworkAddMulticast(const uint8_t *mac);
+// Nonzero if a frame for this destination address should reach the host
+int scsiNetworkFilterAccept(const uint8_t *dst);
+
+// Moves Ethernet frames between the emulated adapter and a network.
+// Frames from the network are handed to scsiNetworkEnqueue().
+struct scsiNetworkBackend {
+	const char *name;
+	int (*send)(const uint8_t *buf, size_t len);
+	void (*poll)(void);	// optional, called from the main loop
+	void (*logStats)(void);	// optional
+};
+
+// Wi-Fi through platform_network_send(), the default
+extern const struct scsiNetworkBackend scsiNetworkPlatformBackend;
+
+// Test backend without a network: frames from the host are sent back to it
+// with the addresses swapped, and broadcast frames can be generated at a
+// fixed rate, to measure throughput, drops and latency from the host side.
+extern const struct scsiNetworkBackend scsiNetworkLoopbackBackend;
+void scsiNetworkLoopbackConfig(uint32_t packetsPerSecond, uint16_t packetSize);
+// Frames the generator has produced so far, queued or not
+uint32_t scsiNetworkLoopbackGenerated(void);
+
+void scsiNetworkSetBackend(const struct scsiNetworkBackend *backend);
+const struct scsiNetworkBackend *scsiNetworkGetBackend(void);
+int scsiNetworkSend(const uint8_t *buf, size_t len);
+void scsiNetworkPoll(void);
+
+// DaynaPORT READ(6) pacing overrides from the ini file, 0xffff = by host quirks
+#define NETWORK_DELAY_AUTO 0xffff
+extern uint16_t g_scsi_networkHeaderDelayUs;
+extern uint16_t g_scsi_networkPacketDelayUs;
+
 int scsiNetworkCommand(void);
 int scsiNetworkEnqueue(const uint8_t *buf, size_t len);
 
+// Inbound queue access for the SCSI command handlers. scsiNetworkPeek()
+// returns the oldest packet, CRC included, or NULL if the queue is empty.
+// The packet is pinned in place until scsiNetworkDequeue(), so it can be
+// sent straight from the ring while platform_poll() receives more.
+// scsiNetworkPeekLen() only returns the length, without pinning the packet.
+uint8_t *scsiNetworkPeek(uint16_t *len);
+uint16_t scsiNetworkPeekLen(void);
+void scsiNetworkDequeue(void);
+int scsiNetworkQueueEmpty(void);
+// Time the oldest packet has been queued
+uint32_t scsiNetworkQueueAgeUs(void);
+void scsiNetworkQueueReset(void);
+// The command sending the pinned packet was aborted, it stays queued
+// for the next READ(6)
+void scsiNetworkAbort(void);
+// SCSI bus reset, the host driver starts over
+void scsiNetworkReset(void);
+
 // Shared WiFi subcommand handlers (used by both DaynaPort and AmigaWIFI)
 void scsiNetworkWifiScan(void);
 void scsiNetworkWifiComplete(void);
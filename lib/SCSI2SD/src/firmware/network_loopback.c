@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2026 Eric Helgeson <eric@bluescsi.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// Loopback network backend for testing the DaynaPORT emulation without
+// Wi-Fi. Every frame the host sends comes back to it with the source and
+// destination swapped, so a host side tool can measure round trip time,
+// packets per second and loss. Optionally broadcast frames are generated
+// at a fixed rate to load the receive path on its own.
+
+#ifdef BLUESCSI_NETWORK
+#include <string.h>
+#include "scsi.h"
+#include "scsi2sd_time.h"
+#include "config.h"
+#include "network.h"
+
+// Stands in for the other end of the link, locally administered
+static const uint8_t loopbackPeerMAC[6] = { 0x02, 0x00, 0x5e, 0x10, 0x00, 0x01 };
+
+// IEEE 802 local experimental EtherType for generated frames
+#define LOOPBACK_ETHERTYPE 0x88b5
+
+// Limits catching up after the main loop was busy
+#define LOOPBACK_MAX_BURST 16
+
+static struct {
+	uint32_t rate;		// generated packets per second, 0 = off
+	uint16_t size;
+	uint32_t lastUs;
+	uint32_t creditUs;
+	uint32_t sequence;
+
+	uint32_t reflected;
+	uint32_t generated;
+	uint32_t rejected;	// not accepted by the inbound queue
+} loopback;
+
+static uint8_t loopbackFrame[NETWORK_PACKET_MAX_SIZE];
+
+void scsiNetworkLoopbackConfig(uint32_t packetsPerSecond, uint16_t packetSize)
+{
+	if (packetSize < 60)
+		packetSize = 60;
+	if (packetSize > NETWORK_PACKET_MAX_SIZE - 4)
+		packetSize = NETWORK_PACKET_MAX_SIZE - 4;
+	// At most one frame per microsecond, the interval must not become zero
+	if (packetsPerSecond > 1000000)
+		packetsPerSecond = 1000000;
+
+	loopback.rate = packetsPerSecond;
+	loopback.size = packetSize;
+	loopback.lastUs = time_us_32();
+	loopback.creditUs = 0;
+}
+
+uint32_t scsiNetworkLoopbackGenerated(void)
+{
+	return loopback.sequence;
+}
+
+static int loopbackSend(const uint8_t *buf, size_t len)
+{
+	if (len < 12 || len > sizeof(loopbackFrame))
+		return -1;
+
+	// Reply to the sender, group addresses are answered by the peer
+	memcpy(loopbackFrame, buf + 6, 6);
+	if (buf[0] & 1)
+		memcpy(loopbackFrame + 6, loopbackPeerMAC, 6);
+	else
+		memcpy(loopbackFrame + 6, buf, 6);
+	memcpy(loopbackFrame + 12, buf + 12, len - 12);
+
+	if (scsiNetworkEnqueue(loopbackFrame, len))
+		loopback.reflected++;
+	else
+		loopback.rejected++;
+	return 0;
+}
+
+static void loopbackPoll(void)
+{
+	if (loopback.rate == 0)
+		return;
+
+	uint32_t now = time_us_32();
+	uint32_t interval = 1000000 / loopback.rate;
+	loopback.creditUs += now - loopback.lastUs;
+	loopback.lastUs = now;
+	if (loopback.creditUs > interval * LOOPBACK_MAX_BURST)
+		loopback.creditUs = interval * LOOPBACK_MAX_BURST;
+
+	while (loopback.creditUs >= interval)
+	{
+		loopback.creditUs -= interval;
+
+		// Broadcast frame carrying a sequence number and the send time
+		uint8_t *f = loopbackFrame;
+		memset(f, 0xff, 6);
+		memcpy(f + 6, loopbackPeerMAC, 6);
+		f[12] = LOOPBACK_ETHERTYPE >> 8;
+		f[13] = LOOPBACK_ETHERTYPE & 0xff;
+		uint32_t seq = loopback.sequence++;
+		f[14] = seq >> 24;
+		f[15] = seq >> 16;
+		f[16] = seq >> 8;
+		f[17] = seq;
+		f[18] = now >> 24;
+		f[19] = now >> 16;
+		f[20] = now >> 8;
+		f[21] = now;
+		memset(f + 22, 0, loopback.size - 22);
+
+		if (scsiNetworkEnqueue(f, loopback.size))
+			loopback.generated++;
+		else
+			loopback.rejected++;
+	}
+}
+
+static void loopbackLogStats(void)
+{
+	LOGMSG_F("Network loopback: %lu frames reflected, %lu generated, %lu not queued",
+		(unsigned long)loopback.reflected, (unsigned long)loopback.generated, (unsigned long)loopback.rejected);
+}
+
+const struct scsiNetworkBackend scsiNetworkLoopbackBackend = {
+	"loopback", loopbackSend, loopbackPoll, loopbackLogStats
+};
+
+#endif // BLUESCSI_NETWORK
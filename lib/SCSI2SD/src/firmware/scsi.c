@@ -65,6 +65,17 @@ STATIC_TESTABLE void enter_DataIn(int len);
 static void process_DataIn(void);
 static void process_DataOut(void);
 static void process_Command(void);
+static void scsiExecuteCommand(int parityError);
+static int scsiQueueCommand(int slow);
+static void scsiRunQueuedCommand(void);
+static void scsiQueueRemove(TargetState *target, int idx);
+static void scsiQueueClear(TargetState *target, int initiatorId, int lun);
+static int queueReadRange(const uint8_t *cdb, uint32_t *lba, uint32_t *blocks);
+static void scsiSelectLun(int lun);
+static void scsiResetOtherLuns(TargetState *target, uint16_t unitAttention);
+
+// Commands waiting in all target queues
+static int queuedCommands = 0;
 
 /* doReserveRelease is now public for unit testing - declared in scsi.h */
 
@@ -240,6 +251,13 @@ void process_Status()
 	scsiDev.lastSense = scsiDev.target->sense.code;
 	scsiDev.lastSenseASC = scsiDev.target->sense.asc;
 
+	if (scsiDev.status == CHECK_CONDITION && scsiDev.target->queueCount > 0)
+	{
+		// Contingent allegiance: hold the queued commands so the sense
+		// data is still there when the initiator asks for it.
+		scsiDev.target->queueFrozen = 1;
+	}
+
 	// Command Complete occurs AFTER a valid status has been
 	// sent. then we go bus-free.
 	enter_MessageIn(message);
@@ -390,7 +408,7 @@ void s2s_scsiRequestSense(void)
 
 		// If we receive a stand-alone REQUEST SENSE to a bad LUN we still need to respond
 		// with LUN not supported. SCSI-2 Spec 7.5.3.
-		if (scsiDev.lun && scsiDev.lastStatus != CHECK_CONDITION)
+		if (scsiDev.lun != scsiDev.target->lun && scsiDev.lastStatus != CHECK_CONDITION)
 		{
 			scsiDev.target->sense.code = ILLEGAL_REQUEST;
 			scsiDev.target->sense.asc = LOGICAL_UNIT_NOT_SUPPORTED;
@@ -405,6 +423,7 @@ void s2s_scsiRequestSense(void)
 			scsiDev.data[0] = 0xF0; // Valid=1, tape always has meaningful info
 			scsiDev.data[2] |= scsiDev.target->sense.filemark ? 1 << 7 : 0;
 			scsiDev.data[2] |= scsiDev.target->sense.eom ? 1 << 6 : 0;
+			scsiDev.data[2] |= scsiDev.target->sense.ili ? 1 << 5 : 0;
 			scsiDev.data[3] = scsiDev.target->sense.info >> 24;
 			scsiDev.data[4] = scsiDev.target->sense.info >> 16;
 			scsiDev.data[5] = scsiDev.target->sense.info >> 8;
@@ -440,6 +459,41 @@ void s2s_scsiRequestSense(void)
 	memset(&scsiDev.target->sense, 0, sizeof(ScsiSense));
 }
 
+static void s2s_scsiReportLuns()
+{
+	uint32_t allocLength =
+		(((uint32_t) scsiDev.cdb[6]) << 24) |
+		(((uint32_t) scsiDev.cdb[7]) << 16) |
+		(((uint32_t) scsiDev.cdb[8]) << 8) |
+		scsiDev.cdb[9];
+
+	int len = 8;
+	int lun;
+	memset(scsiDev.data, 0, 8 + 8 * S2S_MAX_LUNS);
+	for (lun = 0; lun < S2S_MAX_LUNS; ++lun)
+	{
+		// LUN 0 only has separate state storage on multi-LUN targets
+		if (lun == 0 || scsiDiskLunState(scsiDev.target->targetId, lun))
+		{
+			// Peripheral device addressing, single level
+			scsiDev.data[len + 1] = lun;
+			len += 8;
+		}
+	}
+
+	uint32_t listLength = len - 8;
+	scsiDev.data[0] = listLength >> 24;
+	scsiDev.data[1] = listLength >> 16;
+	scsiDev.data[2] = listLength >> 8;
+	scsiDev.data[3] = listLength;
+
+	if (len > allocLength)
+	{
+		len = allocLength;
+	}
+	enter_DataIn(len);
+}
+
 static void process_DataIn()
 {
 	uint32_t len;
@@ -548,7 +602,6 @@ size_t scsiGetCdbGroupBytesSize(void) {
 static void process_Command()
 {
 	uint8_t command;
-	uint8_t control;
 
 	scsiEnterPhase(COMMAND);
 
@@ -612,11 +665,47 @@ static void process_Command()
 		}
 	}
 
-	control = scsiDev.cdb[scsiDev.cdbLen - 1];
+	scsiSelectLun(scsiDev.lun);
+
+	// A new command from the initiator ends the contingent allegiance
+	// of a queued command that failed, the queue may run again.
+	scsiDev.target->queueFrozen = 0;
+
+	// Commands that wait on the SD card, and tagged commands while the
+	// target has others disconnected, go to the target queue with the bus
+	// released. scsiPoll() keeps answering selections and reselects the
+	// initiator when it is their turn.
+	if (!parityError && !scsiDev.resetFlag)
+	{
+		int slow = scsiDev.discPriv && scsiDiskDisconnectAllowed();
+		if ((slow || (scsiDev.tagType && scsiDev.target->queueCount > 0)) &&
+			scsiQueueCommand(slow))
+		{
+			return;
+		}
+	}
+
+	scsiExecuteCommand(parityError);
+}
+
+// Run the command in scsiDev.cdb, either straight after the command phase
+// or after reselecting the initiator for a queued command.
+static void scsiExecuteCommand(int parityError)
+{
+	uint8_t command = scsiDev.cdb[0];
+	uint8_t control = scsiDev.cdb[scsiDev.cdbLen - 1];
 
 	scsiDev.cmdCount++;
 	const S2S_TargetCfg* cfg = scsiDev.target->cfg;
 
+	// Queued reads are picked to continue from where this one ends.
+	uint32_t lba;
+	uint32_t blocks;
+	if (queueReadRange(scsiDev.cdb, &lba, &blocks))
+	{
+		scsiDev.target->queueNextLba = lba + blocks;
+	}
+
 	if (unlikely(scsiDev.resetFlag))
 	{
 		// Don't log bogus commands
@@ -666,6 +755,11 @@ static void process_Command()
 		// REQUEST SENSE
 		s2s_scsiRequestSense();
 	}
+	else if (command == 0xA0)
+	{
+		// REPORT LUNS, answered for any LUN like INQUIRY
+		s2s_scsiReportLuns();
+	}
 	// Some old SCSI drivers do NOT properly support
 	// unitAttention. eg. the Mac Plus would trigger a SCSI reset
 	// on receiving the unit attention response on boot, thus
@@ -689,7 +783,7 @@ static void process_Command()
 
 		enter_Status(CHECK_CONDITION);
 	}
-	else if (scsiDev.lun && (command < 0xD0))
+	else if (scsiDev.lun != scsiDev.target->lun && (command < 0xD0))
 	{
 		scsiDev.target->sense.code = ILLEGAL_REQUEST;
 		scsiDev.target->sense.asc = LOGICAL_UNIT_NOT_SUPPORTED;
@@ -860,6 +954,7 @@ static void scsiReset()
 		scsiDev.target->reserverId = -1;
 		scsiDev.target->sense.code = NO_SENSE;
 		scsiDev.target->sense.asc = NO_ADDITIONAL_SENSE_INFORMATION;
+		scsiResetOtherLuns(scsiDev.target, SCSI_BUS_RESET);
 	}
 	scsiDev.target = NULL;
 
@@ -876,10 +971,15 @@ static void scsiReset()
 			scsiDev.targets[i].syncPeriod = 0;
 		}
 		scsiDev.targets[i].busWidth = 0;
+		scsiQueueClear(&scsiDev.targets[i], -1, -1);
+		scsiDev.targets[i].queueFrozen = 0;
 	}
 	scsiDev.minSyncPeriod = 0;
 
 	scsiDiskReset();
+#ifdef BLUESCSI_NETWORK
+	scsiNetworkReset();
+#endif // BLUESCSI_NETWORK
 
 	scsiDev.postDataOutHook = NULL;
 
@@ -908,6 +1008,7 @@ static void enter_SelectionPhase()
 	scsiDev.phase = SELECTION;
 	scsiDev.lun = -1;
 	scsiDev.discPriv = 0;
+	scsiDev.tagType = 0;
 
 	scsiDev.initiatorId = -1;
 	scsiDev.target = NULL;
@@ -1071,6 +1172,7 @@ static void process_MessageOut()
 	else if (scsiDev.msgOut == 0x06)
 	{
 		// ABORT
+		scsiQueueClear(scsiDev.target, scsiPhyInitiatorId(), scsiDev.lun);
 		scsiDiskReset();
 		enter_BusFree();
 	}
@@ -1078,6 +1180,7 @@ static void process_MessageOut()
 	{
 		// BUS DEVICE RESET
 
+		scsiQueueClear(scsiDev.target, -1, -1);
 		scsiDiskReset();
 
 		scsiDev.target->unitAttention = SCSI_BUS_RESET;
@@ -1085,6 +1188,7 @@ static void process_MessageOut()
 		// ANY initiator can reset the reservation state via this message.
 		scsiDev.target->reservedId = -1;
 		scsiDev.target->reserverId = -1;
+		scsiResetOtherLuns(scsiDev.target, SCSI_BUS_RESET);
 
 		// Cancel any sync negotiation
 		scsiDev.target->syncOffset = 0;
@@ -1092,6 +1196,33 @@ static void process_MessageOut()
 
 		enter_BusFree();
 	}
+	else if (scsiDev.msgOut == MSG_ABORT_TAG)
+	{
+		// The queue tag message before this one names the command.
+		int i;
+		int queued = 0;
+		for (i = 0; i < SCSI_QUEUE_DEPTH; ++i)
+		{
+			QueuedCommand *q = &scsiDev.target->queue[i];
+			if (q->inUse && q->tagType && q->tag == scsiDev.tag &&
+				q->initiatorId == scsiPhyInitiatorId())
+			{
+				scsiQueueRemove(scsiDev.target, i);
+				queued = 1;
+			}
+		}
+		if (!queued)
+		{
+			scsiDiskReset();
+		}
+		enter_BusFree();
+	}
+	else if (scsiDev.msgOut == MSG_CLEAR_QUEUE)
+	{
+		scsiQueueClear(scsiDev.target, -1, -1);
+		scsiDiskReset();
+		enter_BusFree();
+	}
 	else if (scsiDev.msgOut == 0x05)
 	{
 		// Initiator Detected Error
@@ -1151,11 +1282,15 @@ static void process_MessageOut()
 	}
 	else if (scsiDev.msgOut >= 0x20 && scsiDev.msgOut <= 0x2F)
 	{
-		// Two byte message. We don't support these. read and discard.
-		scsiReadByte();
+		// Two byte message. Only queue tags are supported.
+		uint8_t msgArg = scsiReadByte();
 
 		if (scsiDev.msgOut == 0x23) {
 			// Ignore Wide Residue. We're only 8 bit anyway.
+		} else if (scsiDev.msgOut <= MSG_ORDERED_QUEUE_TAG &&
+			scsiDiskQueueDepth() > 0) {
+			scsiDev.tagType = scsiDev.msgOut;
+			scsiDev.tag = msgArg;
 		} else {
 			messageReject();
 		}
@@ -1326,6 +1461,10 @@ void scsiPoll(void)
 		{
 			enter_SelectionPhase();
 		}
+		else if (queuedCommands > 0)
+		{
+			scsiRunQueuedCommand();
+		}
 	break;
 
 	case BUS_BUSY:
@@ -1488,113 +1627,436 @@ void scsiInit()
 		// LOGICAL_UNIT_NOT_READY_INITIALIZING_COMMAND_REQUIRED sense
 		// code
 		scsiDev.targets[i].started = 1;
+
+		// Other LUNs of the target start out in the same state
+		scsiDev.targets[i].lun = 0;
+		int lun;
+		for (lun = 1; lun < S2S_MAX_LUNS; ++lun)
+		{
+			LunState *state = scsiDiskLunState(scsiDev.targets[i].targetId, lun);
+			if (state)
+			{
+				state->liveCfg.bytesPerSector = state->cfg->bytesPerSector;
+				state->sense = scsiDev.targets[i].sense;
+				state->unitAttention = scsiDev.targets[i].unitAttention;
+				state->unitAttentionStop = 0;
+				state->reservedId = -1;
+				state->reserverId = -1;
+				state->started = 1;
+				state->tapeMarkCount = 0;
+			}
+		}
 	}
 	firstInit = 0;
 }
 
-/* TODO REENABLE
-void scsiDisconnect()
+// Copy the per-LUN part of the target state to or from LUN storage
+static void scsiSaveLunState(const TargetState *target, LunState *state)
+{
+	state->cfg = target->cfg;
+	state->liveCfg = target->liveCfg;
+	state->sense = target->sense;
+	state->unitAttention = target->unitAttention;
+	state->unitAttentionStop = target->unitAttentionStop;
+	state->reservedId = target->reservedId;
+	state->reserverId = target->reserverId;
+	state->started = target->started;
+	state->tapeMarkCount = target->tapeMarkCount;
+}
+
+static void scsiLoadLunState(TargetState *target, const LunState *state)
+{
+	target->cfg = state->cfg;
+	target->liveCfg = state->liveCfg;
+	target->sense = state->sense;
+	target->unitAttention = state->unitAttention;
+	target->unitAttentionStop = state->unitAttentionStop;
+	target->reservedId = state->reservedId;
+	target->reserverId = state->reserverId;
+	target->started = state->started;
+	target->tapeMarkCount = state->tapeMarkCount;
+}
+
+// Make the addressed LUN the one loaded in scsiDev.target. A LUN without an
+// image leaves the target as it is, the command is then rejected with
+// LOGICAL UNIT NOT SUPPORTED.
+static void scsiSelectLun(int lun)
 {
+	TargetState *target = scsiDev.target;
+	if (lun < 0 || lun == target->lun)
+	{
+		return;
+	}
+
+	LunState *next = scsiDiskLunState(target->targetId, lun);
+	LunState *current = scsiDiskLunState(target->targetId, target->lun);
+	if (next && current)
+	{
+		scsiSaveLunState(target, current);
+		scsiLoadLunState(target, next);
+		target->lun = lun;
+	}
+}
+
+// Resets for the LUNs of a target that are not loaded at the moment
+static void scsiResetOtherLuns(TargetState *target, uint16_t unitAttention)
+{
+	int lun;
+	for (lun = 0; lun < S2S_MAX_LUNS; ++lun)
+	{
+		LunState *state = (lun != target->lun) ?
+			scsiDiskLunState(target->targetId, lun) : NULL;
+		if (state)
+		{
+			if (state->unitAttention != POWER_ON_RESET)
+			{
+				state->unitAttention = unitAttention;
+			}
+			state->reservedId = -1;
+			state->reserverId = -1;
+			state->sense.code = NO_SENSE;
+			state->sense.asc = NO_ADDITIONAL_SENSE_INFORMATION;
+		}
+	}
+}
+
+int scsiDisconnect()
+{
+#ifdef PLATFORM_SCSIPHY_HAS_RESELECT
+	if (scsiPhyInitiatorId() < 0)
+	{
+		// SCSI1 style selection without the initiator ID, nobody to reselect.
+		return 0;
+	}
+
 	scsiEnterPhase(MESSAGE_IN);
 	scsiWriteByte(0x02); // save data pointer
 	scsiWriteByte(0x04); // disconnect msg.
 
-	// For now, the caller is responsible for tracking the disconnected
-	// state, and calling scsiReconnect.
-	// Ideally the client would exit their loop and we'd implement this
-	// as part of scsiPoll
-	int phase = scsiDev.phase;
+	if (scsiStatusATN())
+	{
+		// The initiator wants to reject the disconnect. Stay connected and
+		// let the next phase read the message.
+		scsiDev.atnFlag = 1;
+		return 0;
+	}
+
+	scsiDev.savedDataPtr = scsiDev.dataPtr;
 	enter_BusFree();
-	scsiDev.phase = phase;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Disconnected and tagged commands */
+
+static uint32_t queueSeq = 0;
+static int queueLastTarget = 0;
+
+// Block range of a read command, reads between ordering barriers may run
+// in any order.
+static int queueReadRange(const uint8_t *cdb, uint32_t *lba, uint32_t *blocks)
+{
+	switch (cdb[0])
+	{
+	case 0x08: // READ(6)
+		*lba = (((uint32_t)cdb[1] & 0x1F) << 16) |
+			(((uint32_t)cdb[2]) << 8) | cdb[3];
+		*blocks = cdb[4] ? cdb[4] : 256;
+		return 1;
+
+	case 0x28: // READ(10)
+		*lba = (((uint32_t)cdb[2]) << 24) | (((uint32_t)cdb[3]) << 16) |
+			(((uint32_t)cdb[4]) << 8) | cdb[5];
+		*blocks = (((uint32_t)cdb[7]) << 8) | cdb[8];
+		return 1;
+
+	case 0xA8: // READ(12)
+		*lba = (((uint32_t)cdb[2]) << 24) | (((uint32_t)cdb[3]) << 16) |
+			(((uint32_t)cdb[4]) << 8) | cdb[5];
+		*blocks = (((uint32_t)cdb[6]) << 24) | (((uint32_t)cdb[7]) << 16) |
+			(((uint32_t)cdb[8]) << 8) | cdb[9];
+		return 1;
+
+	case 0x88: // READ(16), only with 32 bit LBAs
+		if (cdb[2] | cdb[3] | cdb[4] | cdb[5])
+		{
+			return 0;
+		}
+		*lba = (((uint32_t)cdb[6]) << 24) | (((uint32_t)cdb[7]) << 16) |
+			(((uint32_t)cdb[8]) << 8) | cdb[9];
+		*blocks = (((uint32_t)cdb[10]) << 24) | (((uint32_t)cdb[11]) << 16) |
+			(((uint32_t)cdb[12]) << 8) | cdb[13];
+		return 1;
+
+	default:
+		return 0;
+	}
 }
-*/
 
-/* TODO REENABLE
-int scsiReconnect()
+static void scsiQueueRemove(TargetState *target, int idx)
 {
-	int reconnected = 0;
+	if (target->queue[idx].inUse)
+	{
+		target->queue[idx].inUse = 0;
+		target->queueCount--;
+		queuedCommands--;
+	}
+}
 
-	int sel = SCSI_ReadFilt(SCSI_Filt_SEL);
-	int bsy = SCSI_ReadFilt(SCSI_Filt_BSY);
-	if (!sel && !bsy)
+// Drop queued commands, -1 matches any initiator or lun.
+static void scsiQueueClear(TargetState *target, int initiatorId, int lun)
+{
+	int i;
+	for (i = 0; i < SCSI_QUEUE_DEPTH; ++i)
 	{
-		s2s_delay_us(1);
-		sel = SCSI_ReadFilt(SCSI_Filt_SEL);
-		bsy = SCSI_ReadFilt(SCSI_Filt_BSY);
+		QueuedCommand *q = &target->queue[i];
+		if ((initiatorId < 0 || q->initiatorId == initiatorId) &&
+			(lun < 0 || q->lun == lun))
+		{
+			scsiQueueRemove(target, i);
+		}
 	}
+}
 
-	if (!sel && !bsy)
+// Store the command that was just received and release the bus. slow is
+// set for commands that disconnect to wait on the SD card. Returns 0 if
+// the command has to run while still connected.
+static int scsiQueueCommand(int slow)
+{
+	TargetState *target = scsiDev.target;
+	int initiatorId = scsiPhyInitiatorId();
+	if (!scsiDev.discPriv || initiatorId < 0)
 	{
-		// Arbitrate.
-		s2s_ledOn();
-		uint8_t scsiIdMask = 1 << scsiDev.target->targetId;
-		SCSI_Out_Bits_Write(scsiIdMask);
-		SCSI_Out_Ctl_Write(1); // Write bits manually.
-		SCSI_SetPin(SCSI_Out_BSY);
+		return 0;
+	}
+
+	// Only tagged commands count against the advertised queue depth,
+	// disconnected untagged ones take the remaining entries.
+	int idx = -1;
+	int tagged = 0;
+	int i;
+	for (i = 0; i < SCSI_QUEUE_DEPTH; ++i)
+	{
+		if (!target->queue[i].inUse)
+		{
+			if (idx < 0) idx = i;
+		}
+		else if (target->queue[i].tagType)
+		{
+			tagged++;
+		}
+	}
+	if (scsiDev.tagType && (idx < 0 || tagged >= scsiDiskQueueDepth()))
+	{
+		enter_Status(QUEUE_FULL);
+		return 1;
+	}
+	else if (idx < 0)
+	{
+		return 0;
+	}
 
-		s2s_delay_us(3); // arbitrate delay. 2.4us.
+	if (!scsiDisconnect())
+	{
+		// DISCONNECT was rejected, run the command now.
+		return 0;
+	}
+
+	QueuedCommand *q = &target->queue[idx];
+	memcpy(q->cdb, scsiDev.cdb, sizeof(q->cdb));
+	q->cdbLen = scsiDev.cdbLen;
+	q->tagType = scsiDev.tagType;
+	q->tag = scsiDev.tag;
+	q->slow = slow;
+	q->executed = 0;
+	q->status = GOOD;
+	q->lun = scsiDev.lun;
+	q->initiatorId = initiatorId;
+	q->reserveId = scsiDev.initiatorId;
+	q->seq = queueSeq++;
+	q->attempts = 0;
+	q->isRead = queueReadRange(q->cdb, &q->lba, &q->blocks);
+	q->inUse = 1;
+	target->queueCount++;
+	queuedCommands++;
+	return 1;
+}
+
+// Choose the next command of a target. Commands that already ran only
+// need their status sent and go first, then HEAD OF QUEUE. ORDERED,
+// untagged and anything other than a read waits for the older commands
+// and holds back the newer ones. The reads in between run in LBA order,
+// continuing from where the previous read ended so sequential runs stay
+// sequential.
+static int scsiQueuePick(TargetState *target)
+{
+	int i;
+	int oldest = -1;
+	int head = -1;
+	int barrier = -1;
+	for (i = 0; i < SCSI_QUEUE_DEPTH; ++i)
+	{
+		QueuedCommand *q = &target->queue[i];
+		if (!q->inUse) continue;
 
-		uint8_t dbx = scsiReadDBxPins();
-		sel = SCSI_ReadFilt(SCSI_Filt_SEL);
-		if (sel || ((dbx ^ scsiIdMask) > scsiIdMask))
+		if (q->executed)
 		{
-			// Lost arbitration.
-			SCSI_Out_Ctl_Write(0);
-			SCSI_ClearPin(SCSI_Out_BSY);
-			s2s_ledOff();
+			return i;
 		}
-		else
+		if (q->tagType == MSG_HEAD_OF_QUEUE_TAG &&
+			(head < 0 || q->seq < target->queue[head].seq))
 		{
-			// Won arbitration
-			SCSI_SetPin(SCSI_Out_SEL);
-			s2s_delay_us(1); // Bus clear + Bus settle.
-
-			// Reselection phase
-			SCSI_CTL_PHASE_Write(__scsiphase_io);
-			SCSI_Out_Bits_Write(scsiIdMask | (1 << scsiDev.initiatorId));
-			scsiDeskewDelay(); // 2 deskew delays
-			scsiDeskewDelay(); // 2 deskew delays
-			SCSI_ClearPin(SCSI_Out_BSY);
-			s2s_delay_us(1);  // Bus Settle Delay
-
-			uint32_t waitStart_ms = getTime_ms();
-			bsy = SCSI_ReadFilt(SCSI_Filt_BSY);
-			// Wait for initiator.
-			while (
-				!bsy &&
-				!scsiDev.resetFlag &&
-				(elapsedTime_ms(waitStart_ms) < 250))
-			{
-				bsy = SCSI_ReadFilt(SCSI_Filt_BSY);
-			}
+			head = i;
+		}
+		if (oldest < 0 || q->seq < target->queue[oldest].seq)
+		{
+			oldest = i;
+		}
+		if ((q->tagType != MSG_SIMPLE_QUEUE_TAG || !q->isRead) &&
+			(barrier < 0 || q->seq < target->queue[barrier].seq))
+		{
+			barrier = i;
+		}
+	}
 
-			if (bsy)
-			{
-				SCSI_SetPin(SCSI_Out_BSY);
-				scsiDeskewDelay(); // 2 deskew delays
-				scsiDeskewDelay(); // 2 deskew delays
-				SCSI_ClearPin(SCSI_Out_SEL);
+	if (head >= 0) return head;
+	if (oldest < 0 || oldest == barrier) return oldest;
 
-				// Prepare for the initial IDENTIFY message.
-				SCSI_Out_Ctl_Write(0);
-				scsiEnterPhase(MESSAGE_IN);
+	int ahead = -1;
+	int lowest = -1;
+	for (i = 0; i < SCSI_QUEUE_DEPTH; ++i)
+	{
+		QueuedCommand *q = &target->queue[i];
+		if (!q->inUse || !q->isRead || q->tagType != MSG_SIMPLE_QUEUE_TAG) continue;
+		if (barrier >= 0 && q->seq > target->queue[barrier].seq) continue;
+
+		if (q->lba >= target->queueNextLba &&
+			(ahead < 0 || q->lba < target->queue[ahead].lba))
+		{
+			ahead = i;
+		}
+		if (lowest < 0 || q->lba < target->queue[lowest].lba)
+		{
+			lowest = i;
+		}
+	}
+	return ahead >= 0 ? ahead : lowest;
+}
 
-				// Send identify command
-				scsiWriteByte(0x80);
+// Load the state of a queued command into scsiDev.
+static void scsiQueueLoad(TargetState *target, QueuedCommand *q)
+{
+	scsiDev.target = target;
+	scsiDev.atnFlag = 0;
+	scsiDev.dataPtr = 0;
+	scsiDev.savedDataPtr = 0;
+	scsiDev.dataLen = 0;
+	scsiDev.status = GOOD;
+	scsiDev.lun = q->lun;
+	scsiSelectLun(scsiDev.lun);
+	scsiDev.discPriv = 1;
+	scsiDev.initiatorId = q->reserveId;
+	scsiDev.compatMode = (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_SCSI2) ?
+		COMPAT_SCSI2 : COMPAT_SCSI2_DISABLED;
+	scsiDev.postDataOutHook = NULL;
+	scsiDev.needSyncNegotiationAck = 0;
+	transfer.blocks = 0;
+	transfer.currentBlock = 0;
 
-				scsiEnterPhase(scsiDev.phase);
-				reconnected = 1;
-			}
-			else
-			{
-				// reselect timeout.
-				SCSI_Out_Ctl_Write(0);
-				SCSI_ClearPin(SCSI_Out_SEL);
-				SCSI_CTL_PHASE_Write(0);
-				s2s_ledOff();
-			}
+	memcpy(scsiDev.cdb, q->cdb, sizeof(scsiDev.cdb));
+	scsiDev.cdbLen = q->cdbLen;
+	scsiDev.tagType = q->tagType;
+	scsiDev.tag = q->tag;
+}
+
+// Run the next queued command. Commands without a data phase run with the
+// bus released, then the initiator is reselected for the status. Other
+// commands run after reselection, reads first stage their data from the
+// SD card.
+static void scsiRunQueuedCommand()
+{
+	TargetState *target = NULL;
+	int idx = -1;
+	int n;
+	for (n = 1; n <= S2S_MAX_TARGETS && idx < 0; ++n)
+	{
+		int t = (queueLastTarget + n) % S2S_MAX_TARGETS;
+		if (scsiDev.targets[t].queueCount > 0 && !scsiDev.targets[t].queueFrozen)
+		{
+			target = &scsiDev.targets[t];
+			idx = scsiQueuePick(target);
+			queueLastTarget = t;
+		}
+	}
+	if (idx < 0)
+	{
+		return;
+	}
+
+	QueuedCommand *q = &target->queue[idx];
+	scsiQueueLoad(target, q);
+
+	if (q->slow && !q->isRead && !q->executed)
+	{
+		// Selections are answered again before the status is sent.
+		s2s_ledOn();
+		scsiExecuteCommand(0);
+		s2s_ledOff();
+		q->status = scsiDev.status;
+		q->executed = 1;
+		scsiDev.phase = BUS_FREE;
+		return;
+	}
+	else if (q->slow && q->isRead)
+	{
+		scsiDiskPrepareRead(q->lba, q->blocks);
+	}
+
+	uint32_t reselectStart_ms = s2s_getTime_ms();
+	if (!scsiReselect(q->initiatorId))
+	{
+		// Bus busy, or the initiator didn't answer within the selection
+		// timeout. Give up on the command if that keeps happening.
+		if (s2s_elapsedTime_ms(reselectStart_ms) >= 250 && ++q->attempts >= 20)
+		{
+			scsiQueueRemove(target, idx);
+		}
+		return;
+	}
+
+	s2s_ledOn();
+	int executed = q->executed;
+	uint8_t status = q->status;
+	scsiQueueRemove(target, idx);
+
+	// IDENTIFY and the queue tag tell the initiator which command continues.
+	scsiEnterPhase(MESSAGE_IN);
+	scsiWriteByte(0x80 | (scsiDev.lun & 0x7));
+	if (scsiDev.tagType)
+	{
+		scsiWriteByte(MSG_SIMPLE_QUEUE_TAG);
+		scsiWriteByte(scsiDev.tag);
+	}
+
+	// The initiator may answer with ABORT TAG or similar.
+	scsiDev.phase = COMMAND;
+	scsiDev.atnFlag = scsiStatusATN();
+	while (scsiDev.atnFlag && scsiDev.phase == COMMAND && !scsiDev.resetFlag)
+	{
+		process_MessageOut();
+	}
+
+	if (scsiDev.phase == COMMAND && !scsiDev.resetFlag)
+	{
+		if (executed)
+		{
+			enter_Status(status);
+		}
+		else
+		{
+			scsiExecuteCommand(0);
 		}
 	}
-	return reconnected;
 }
-*/
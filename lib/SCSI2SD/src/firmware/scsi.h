@@ -48,7 +48,8 @@ typedef enum
 	CHECK_CONDITION = 2,
 	BUSY = 0x8,
 	INTERMEDIATE = 0x10,
-	CONFLICT = 0x18
+	CONFLICT = 0x18,
+	QUEUE_FULL = 0x28
 } SCSI_STATUS;
 
 typedef enum
@@ -56,7 +57,12 @@ typedef enum
 	MSG_COMMAND_COMPLETE = 0,
 	MSG_REJECT = 0x7,
 	MSG_LINKED_COMMAND_COMPLETE = 0x0A,
-	MSG_LINKED_COMMAND_COMPLETE_WITH_FLAG = 0x0B
+	MSG_LINKED_COMMAND_COMPLETE_WITH_FLAG = 0x0B,
+	MSG_ABORT_TAG = 0x0D,
+	MSG_CLEAR_QUEUE = 0x0E,
+	MSG_SIMPLE_QUEUE_TAG = 0x20,
+	MSG_HEAD_OF_QUEUE_TAG = 0x21,
+	MSG_ORDERED_QUEUE_TAG = 0x22
 } SCSI_MESSAGE;
 
 typedef enum
@@ -84,6 +90,33 @@ typedef enum
 #define SCSI2SD_BUFFER_SIZE (MAX_SECTOR_SIZE * 8)
 #endif
 
+// Commands each target can hold with the bus released, tagged commands
+// and the ones that disconnected.
+#ifndef SCSI_QUEUE_DEPTH
+#define SCSI_QUEUE_DEPTH 4
+#endif
+
+// Command waiting to be run or to report its status after reselection.
+typedef struct
+{
+	uint8_t inUse;
+	uint8_t cdb[20];
+	uint8_t cdbLen;
+	uint8_t tagType; // MSG_*_QUEUE_TAG, 0 if untagged.
+	uint8_t tag;
+	uint8_t slow; // Disconnected to wait on the SD card.
+	uint8_t executed; // Ran with the bus released, status is pending.
+	uint8_t status;
+	int8_t lun;
+	int8_t initiatorId; // As seen by the PHY, used for reselection.
+	int8_t reserveId; // scsiDev.initiatorId for RESERVE / RELEASE checks.
+	uint8_t isRead; // Block read that may be reordered by LBA.
+	uint8_t attempts; // Reselections the initiator didn't answer.
+	uint32_t seq; // Arrival order
+	uint32_t lba;
+	uint32_t blocks;
+} QueuedCommand;
+
 // Shadow parameters, possibly not saved to flash yet.
 // Set via Mode Select
 typedef struct
@@ -91,9 +124,29 @@ typedef struct
 	uint16_t bytesPerSector;
 } LiveCfg;
 
+// LUNs 0 -> 7 addressable with IDENTIFY or the CDB LUN field.
+#define S2S_MAX_LUNS 8
+
+// The parts of TargetState that belong to one logical unit. The state of
+// the addressed LUN is loaded into the TargetState at the start of each
+// command, other LUNs keep theirs here. See scsiDiskLunState().
+typedef struct
+{
+	const S2S_TargetCfg* cfg;
+	LiveCfg liveCfg;
+	ScsiSense sense;
+	uint16_t unitAttention;
+	uint8_t unitAttentionStop;
+	int reservedId;
+	int reserverId;
+	uint8_t started;
+	uint8_t tapeMarkCount;
+} LunState;
+
 typedef struct
 {
 	uint8_t targetId;
+	uint8_t lun; // LUN whose state is currently loaded below
 
 	const S2S_TargetCfg* cfg;
 
@@ -116,6 +169,11 @@ typedef struct
 
 	uint8_t busWidth; // 0: 8-bit, 1: 16-bit, 2: 32-bit
 	uint8_t tapeMarkCount; // Number of times tape mark has been reached
+
+	QueuedCommand queue[SCSI_QUEUE_DEPTH];
+	uint8_t queueCount;
+	uint8_t queueFrozen; // A queued command failed, wait for REQUEST SENSE.
+	uint32_t queueNextLba; // Where the last read ended.
 } TargetState;
 
 typedef struct
@@ -153,6 +211,8 @@ typedef struct
 	uint8_t cdbLen; // 6, 10, or 12 byte message.
 	int8_t lun; // Target lun, set by IDENTIFY message.
 	uint8_t discPriv; // Disconnect priviledge.
+	uint8_t tagType; // Queue tag message of the current command, 0 if untagged.
+	uint8_t tag;
 	uint8_t compatMode; // SCSI_COMPAT_MODE
 
 	// Only let the reserved initiator talk to us.
@@ -203,8 +263,10 @@ void enter_BusFree(void);
 
 void scsiInit(void);
 void scsiPoll(void);
-void scsiDisconnect(void);
-int scsiReconnect(void);
+
+// Send SAVE DATA POINTER + DISCONNECT and release the bus. Returns 0 if
+// the initiator rejected the disconnect.
+int scsiDisconnect(void);
 
 // REQUEST SENSE command handler - formats sense data based on quirks
 // Supports XEBEC (4-byte), OMTI (4/12-byte), and standard SCSI-1/2 formats
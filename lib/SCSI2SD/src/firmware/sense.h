@@ -173,6 +173,7 @@ typedef struct
 {
 	bool filemark;
 	bool eom;
+	bool ili; // Incorrect length of a variable length tape block
 	uint32_t info;
 	uint8_t code;
 	uint16_t asc;
@@ -66,7 +66,9 @@
 #include "BlueSCSI_msc_initiator.h"
 #include "BlueSCSI_msc.h"
 #include "BlueSCSI_blink.h"
+#include "BlueSCSI_crc32.h"
 #include "ROMDrive.h"
+#include <network.h>
 
 /* UNIT_TEST guard: expose static functions for testing */
 #ifdef UNIT_TEST
@@ -621,11 +623,20 @@ bool findHDDImages()
         strcat(fullname, name);
 
         // Check whether this SCSI ID has been configured yet
-        if (s2s_getConfigById(id))
+        if (lun == 0 && s2s_getConfigById(id))
         {
           logmsg("-- Ignoring ", fullname, ", SCSI ID ", id, " is already in use!");
           continue;
         }
+        else if (lun > 0)
+        {
+          image_config_t *lun_img = scsiDiskGetLunImageConfig(id, lun);
+          if (lun_img && lun_img->isTargetEnabled())
+          {
+            logmsg("-- Ignoring ", fullname, ", SCSI ID ", id, " LUN ", lun, " is already in use!");
+            continue;
+          }
+        }
 
         // set the default block size now that we know the device type
         if (g_scsi_settings.getDevice(id)->blockSize == 0)
@@ -697,6 +708,7 @@ bool findHDDImages()
   root.close();
 
   g_romdrive_active = scsiDiskActivateRomDrive();
+  scsiDiskPromoteLunImages();
 
   // Print SCSI drive map
   logmsg(" ");
@@ -726,6 +738,28 @@ bool findHDDImages()
               );
        }
     }
+
+    for (int lun = 1; lun < NUM_SCSILUN; lun++)
+    {
+      image_config_t *lun_img = scsiDiskGetLunImageConfig(i, lun);
+      if (!lun_img || !lun_img->isTargetEnabled())
+      {
+        continue;
+      }
+      else if (!cfg || !s2s_isTargetEnabled(cfg))
+      {
+        logmsg("ID: ", i, ", LUN: ", lun, " ignored, the target has no LUN 0 image");
+        continue;
+      }
+
+      int capacity_kB = ((uint64_t)lun_img->scsiSectors * lun_img->bytesPerSector) / 1024;
+      logmsg("ID: ", i, ", LUN: ", lun,
+            ", BlockSize: ", (int)lun_img->bytesPerSector,
+            ", Type: ", typeToChar((int)lun_img->deviceType),
+            ", Size: ", capacity_kB, "kB",
+            typeIsRemovable((S2S_CFG_TYPE)lun_img->deviceType) ? ", Removable" : ""
+            );
+    }
   }
   // count the removable drives and drive with eject enabled
   for (uint8_t id = 0; id < S2S_MAX_TARGETS; id++)
@@ -943,6 +977,16 @@ STATIC_TESTABLE void reinitSCSI()
       dbgmsg("DebugLogMask set to ", g_scsi_log_mask, " only SCSI ID's matching the bit mask will be logged");
     }
 
+    g_log_subsystem_mask = ini_getl("SCSI", "DebugLogSubsystems", LOG_SUBSYS_ALL, CONFIGFILE) & LOG_SUBSYS_ALL;
+    if (g_log_subsystem_mask != LOG_SUBSYS_ALL)
+    {
+      logmsg("DebugLogSubsystems set to ", g_log_subsystem_mask, ", debug messages of other subsystems are suppressed");
+    }
+    if ((BLUESCSI_LOG_DEBUG_SUBSYSTEMS & LOG_SUBSYS_ALL) != LOG_SUBSYS_ALL)
+    {
+      logmsg("Debug messages compiled in only for subsystems ", (uint32_t)BLUESCSI_LOG_DEBUG_SUBSYSTEMS);
+    }
+
     g_log_ignore_busy_free = ini_getbool("SCSI", "DebugIgnoreBusyFree", 0, CONFIGFILE);
     if (g_log_ignore_busy_free)
     {
@@ -1033,7 +1077,13 @@ STATIC_TESTABLE void reinitSCSI()
   scsiInit();
 
 #ifdef BLUESCSI_NETWORK
-  if (platform_network_supported()) {
+  if (scsiNetworkGetBackend() != &scsiNetworkPlatformBackend)
+  {
+    logmsg("Network backend is ", scsiNetworkGetBackend()->name, ", Wi-Fi is not used");
+    if (platform_network_supported())
+      platform_network_deinit();
+  }
+  else if (platform_network_supported()) {
     if (scsiDiskCheckAnyNetworkDevicesConfigured())
     {
       platform_network_init(scsiDev.boardCfg.wifiMACAddress);
@@ -1083,26 +1133,6 @@ static void check_for_unused_update_files()
   }
 }
 
-// CRC32 nibble table, PKZIP polynomial
-static const uint32_t g_crc32_nibbles[16] = {
-  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
-  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
-  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
-  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
-};
-
-__attribute__((optimize("Os")))
-static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
-{
-  for (size_t i = 0; i < len; i++)
-  {
-    crc ^= data[i];
-    crc = (crc >> 4) ^ g_crc32_nibbles[crc & 0x0F];
-    crc = (crc >> 4) ^ g_crc32_nibbles[crc & 0x0F];
-  }
-  return crc;
-}
-
 // Checks the extracted image against the size and CRC32 from the zip header.
 // Takes an already open file to keep firmware_update()'s stack frame down.
 __attribute__((optimize("Os"), noinline))
@@ -1116,7 +1146,7 @@ static bool verify_extracted_firmware(FsFile &check, uint32_t expected_size,
     return false;
   }
 
-  uint32_t crc = 0xFFFFFFFF;
+  uint32_t crc = 0;
   uint32_t total = 0;
   int bytes_read;
   while ((bytes_read = check.read(buf, bufsize)) > 0)
@@ -1124,7 +1154,6 @@ static bool verify_extracted_firmware(FsFile &check, uint32_t expected_size,
     crc = crc32_update(crc, buf, bytes_read);
     total += bytes_read;
   }
-  crc ^= 0xFFFFFFFF;
 
   if (total != expected_size)
   {
@@ -1601,6 +1630,7 @@ extern "C" void bluescsi_main_loop(void)
 
 #ifdef BLUESCSI_NETWORK
   platform_network_poll();
+  scsiNetworkPoll();
 #endif // BLUESCSI_NETWORK
 
 #ifdef PLATFORM_HAS_INITIATOR_MODE
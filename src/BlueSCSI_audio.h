@@ -204,3 +204,12 @@ uint32_t audio_get_lba_position();
  * \param lba       Absolute CD LBA to seek to.
 */
 void audio_set_file_position(uint8_t id, const CUETrackInfo *trackinfo, uint32_t lba);
+
+/**
+ * Time until the output DMA would run out of queued samples if the sample
+ * buffer that is waiting for a refill is not read from the SD card.
+ *
+ * \return microseconds, 0 if the refill is already late, or UINT32_MAX if
+ *         no refill is pending.
+ */
+uint32_t audio_refill_deadline_us();
@@ -0,0 +1,1031 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - WAVE and FLAC backed CD audio tracks
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_audio_file.h"
+#include "BlueSCSI_log.h"
+#include "BlueSCSI_platform.h"
+#include <string.h>
+
+#define AUDIO_PROBE_CACHE_SIZE 4
+
+static struct {
+    uint32_t first_sector;
+    uint64_t file_size;
+    audio_file_info_t info;
+} g_audio_probe_cache[AUDIO_PROBE_CACHE_SIZE];
+static uint8_t g_audio_probe_next;
+
+static inline uint16_t get_le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+static inline uint32_t get_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint16_t get_be16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+static inline uint32_t get_be24(const uint8_t *p) { return (p[0] << 16) | (p[1] << 8) | p[2]; }
+static inline uint32_t get_be32(const uint8_t *p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static bool read_at(FsFile &file, uint64_t pos, void *buf, uint32_t len)
+{
+    return file.seekSet(pos) && file.read(buf, len) == (int)len;
+}
+
+// Walks the RIFF chunks to find the format and the start of sample data
+static bool wave_probe(FsFile &file, uint64_t size, audio_file_info_t *info)
+{
+    bool fmt_ok = false;
+    uint64_t pos = 12;
+    uint8_t chunk[16];
+
+    info->container = AUDIO_CONTAINER_UNSUPPORTED;
+    while (pos + 8 <= size)
+    {
+        if (!read_at(file, pos, chunk, 8)) return false;
+        uint32_t len = get_le32(chunk + 4);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && len >= 16)
+        {
+            if (!read_at(file, pos + 8, chunk, 16)) return false;
+            uint16_t format = get_le16(chunk);
+            uint16_t channels = get_le16(chunk + 2);
+            uint32_t rate = get_le32(chunk + 4);
+            uint16_t bits = get_le16(chunk + 14);
+            fmt_ok = (format == 1 || format == 0xFFFE) && channels == 2 && rate == 44100 && bits == 16;
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            // Streaming writers leave the length as 0xFFFFFFFF, clamp to the file
+            info->data_offset = pos + 8;
+            uint64_t avail = size - info->data_offset;
+            info->pcm_size = ((uint64_t)len < avail ? len : avail) & ~3ULL;
+            if (fmt_ok) info->container = AUDIO_CONTAINER_WAVE;
+            return true;
+        }
+        pos += 8 + (uint64_t)len + (len & 1);
+    }
+    return true;
+}
+
+/***************/
+/* FLAC stream */
+/***************/
+
+// Largest block size of the FLAC streamable subset at 44.1 kHz
+#define FLAC_MAX_BLOCKSIZE 4608
+#define FLAC_MAX_HEADER_LEN 16
+#define FLAC_MIN_FRAME_LEN 10
+
+struct flac_meta_t {
+    uint32_t min_blocksize;
+    uint32_t max_blocksize;
+    uint32_t max_framesize;
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bps;
+    uint64_t total_samples;
+    uint64_t first_frame;
+    uint64_t seektable_pos;
+    uint32_t seektable_count;
+};
+
+// Finds the "fLaC" marker, skipping an ID3v2 tag some taggers prepend
+static bool flac_locate(FsFile &file, uint64_t *start)
+{
+    uint8_t hdr[10];
+    if (!read_at(file, 0, hdr, 10)) return false;
+
+    *start = 0;
+    if (memcmp(hdr, "ID3", 3) == 0)
+    {
+        // Tag size is stored as 4 x 7 bits
+        *start = 10 + (((uint32_t)hdr[6] << 21) | (hdr[7] << 14) | (hdr[8] << 7) | hdr[9]);
+        if (!read_at(file, *start, hdr, 4)) return false;
+    }
+    return memcmp(hdr, "fLaC", 4) == 0;
+}
+
+static bool flac_read_meta(FsFile &file, uint64_t start, uint64_t size, flac_meta_t *meta)
+{
+    uint8_t hdr[34];
+    uint64_t pos = start + 4;
+    bool have_streaminfo = false;
+    bool last = false;
+
+    memset(meta, 0, sizeof(*meta));
+    while (!last)
+    {
+        if (pos + 4 > size || !read_at(file, pos, hdr, 4)) return false;
+        last = hdr[0] & 0x80;
+        uint8_t type = hdr[0] & 0x7F;
+        uint32_t len = get_be24(hdr + 1);
+        pos += 4;
+
+        if (type == 0 && len >= 34)
+        {
+            if (!read_at(file, pos, hdr, 34)) return false;
+            meta->min_blocksize = get_be16(hdr);
+            meta->max_blocksize = get_be16(hdr + 2);
+            meta->max_framesize = get_be24(hdr + 7);
+            meta->sample_rate = ((uint32_t)hdr[10] << 12) | (hdr[11] << 4) | (hdr[12] >> 4);
+            meta->channels = ((hdr[12] >> 1) & 7) + 1;
+            meta->bps = (((hdr[12] & 1) << 4) | (hdr[13] >> 4)) + 1;
+            meta->total_samples = ((uint64_t)(hdr[13] & 0x0F) << 32) | get_be32(hdr + 14);
+            have_streaminfo = true;
+        }
+        else if (type == 3)
+        {
+            meta->seektable_pos = pos;
+            meta->seektable_count = len / 18;
+        }
+        else if (type == 127)
+        {
+            return false;
+        }
+        pos += len;
+    }
+
+    meta->first_frame = pos;
+    return have_streaminfo;
+}
+
+// Worst case compressed size of one frame, used to decide when the ring
+// holds enough data to decode a frame without running past the written part.
+static uint32_t flac_frame_bound(const flac_meta_t &meta)
+{
+    if (meta.max_framesize != 0)
+    {
+        return meta.max_framesize + FLAC_MAX_HEADER_LEN;
+    }
+
+    // Verbatim subframes, side channel has one extra bit per sample
+    return meta.max_blocksize * (2 * meta.bps + 1) / 8 + 64;
+}
+
+// Compressed data ring, must be a power of two and larger than any frame
+#ifndef FLAC_RING_SIZE
+#define FLAC_RING_SIZE 32768
+#endif
+
+static bool flac_meta_supported(const flac_meta_t &meta)
+{
+#if ENABLE_AUDIO_FLAC
+    return meta.sample_rate == 44100 && meta.channels == 2 && meta.bps == 16
+        && meta.min_blocksize >= 16 && meta.max_blocksize <= FLAC_MAX_BLOCKSIZE
+        && meta.total_samples != 0
+        && flac_frame_bound(meta) <= FLAC_RING_SIZE - 512;
+#else
+    // No decoder on this platform
+    (void)meta;
+    return false;
+#endif
+}
+
+bool audio_file_probe(FsFile &file, audio_file_info_t *info)
+{
+    uint64_t size = file.fileSize();
+    uint32_t first_sector = file.firstSector();
+
+    for (int i = 0; i < AUDIO_PROBE_CACHE_SIZE; i++)
+    {
+        if (first_sector != 0 && g_audio_probe_cache[i].first_sector == first_sector
+            && g_audio_probe_cache[i].file_size == size)
+        {
+            *info = g_audio_probe_cache[i].info;
+            return true;
+        }
+    }
+
+    info->container = AUDIO_CONTAINER_RAW;
+    info->data_offset = 0;
+    info->pcm_size = size;
+
+    if (size < 12)
+    {
+        return true;
+    }
+
+    uint64_t saved_pos = file.curPosition();
+    uint8_t hdr[12];
+    bool ok = read_at(file, 0, hdr, 12);
+    if (ok && memcmp(hdr, "RIFF", 4) == 0 && memcmp(hdr + 8, "WAVE", 4) == 0)
+    {
+        ok = wave_probe(file, size, info);
+    }
+    else if (ok)
+    {
+        uint64_t start;
+        flac_meta_t meta;
+        if (flac_locate(file, &start))
+        {
+            if (flac_read_meta(file, start, size, &meta) && flac_meta_supported(meta))
+            {
+                info->container = AUDIO_CONTAINER_FLAC;
+                info->data_offset = meta.first_frame;
+                info->pcm_size = meta.total_samples * 4;
+            }
+            else
+            {
+                info->container = AUDIO_CONTAINER_UNSUPPORTED;
+            }
+        }
+    }
+    file.seekSet(saved_pos);
+
+    if (ok && first_sector != 0)
+    {
+        g_audio_probe_cache[g_audio_probe_next].first_sector = first_sector;
+        g_audio_probe_cache[g_audio_probe_next].file_size = size;
+        g_audio_probe_cache[g_audio_probe_next].info = *info;
+        g_audio_probe_next = (g_audio_probe_next + 1) % AUDIO_PROBE_CACHE_SIZE;
+    }
+    return ok;
+}
+
+uint64_t audio_file_pcm_size(FsFile &file)
+{
+    audio_file_info_t info;
+    if (!audio_file_probe(file, &info))
+    {
+        return file.fileSize();
+    }
+    return info.pcm_size;
+}
+
+#if ENABLE_AUDIO_FLAC
+
+// Give up waiting for compressed data after this long, the output gets silence
+#define FLAC_WAIT_TIMEOUT_MS 100
+// Chunk size when scanning the file for frame headers
+#define FLAC_SCAN_CHUNK 4096
+// Interpolation search stops when the range is this small and walks frames instead
+#define FLAC_LINEAR_SEEK 65536
+
+struct flac_frame_hdr_t {
+    uint64_t sample;        // Number of the first sample in the frame
+    uint32_t blocksize;
+    uint8_t channel_assignment;
+    uint8_t length;         // Header length including CRC-8
+};
+
+struct flac_crc_tables_t
+{
+    uint8_t crc8[256];
+    uint16_t crc16[256];
+};
+
+static constexpr flac_crc_tables_t flac_make_crc_tables()
+{
+    flac_crc_tables_t t = {};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint8_t c = i;
+        uint16_t d = i << 8;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 0x80) ? (uint8_t)((c << 1) ^ 0x07) : (uint8_t)(c << 1);
+            d = (d & 0x8000) ? (uint16_t)((d << 1) ^ 0x8005) : (uint16_t)(d << 1);
+        }
+        t.crc8[i] = c;
+        t.crc16[i] = d;
+    }
+    return t;
+}
+
+static const flac_crc_tables_t g_flac_crc = flac_make_crc_tables();
+
+static struct {
+    FsFile *file;
+    uint32_t first_sector;
+    uint64_t file_size;
+    flac_meta_t meta;
+    uint32_t frame_bound;
+    bool open;
+    bool sync;                  // Decoding on core0, fill the ring while waiting
+
+    // Ring positions are free running counters. They start at the same
+    // offset modulo 512 as the file position so that SD reads stay aligned.
+    uint64_t file_pos;          // Next compressed byte to read into the ring
+    volatile uint32_t head;     // Written by core0
+    volatile uint32_t tail;     // Written by the decoding core
+    volatile bool eof;
+    volatile bool abort;
+
+    // Decoded block and output position in it
+    uint32_t frame_len;
+    uint32_t frame_pos;
+    uint64_t next_sample;       // Sample number of the next output sample
+    uint64_t expect_sample;     // Sample number of the next frame, UINT64_MAX after seek
+
+    uint32_t damaged;
+    uint32_t starved;
+} g_flac;
+
+__attribute__((aligned(4)))
+static uint8_t g_flac_ring[FLAC_RING_SIZE];
+static int32_t g_flac_block[2][FLAC_MAX_BLOCKSIZE];
+
+#define RING(pos) g_flac_ring[(pos) & (FLAC_RING_SIZE - 1)]
+
+// Parses a frame header, returns false if it is not a valid CD audio frame
+static bool flac_parse_frame_header(const uint8_t *p, uint32_t avail, flac_frame_hdr_t *hdr)
+{
+    if (avail < 6 || p[0] != 0xFF || (p[1] & 0xFE) != 0xF8) return false;
+
+    bool variable = p[1] & 1;
+    uint8_t bs_code = p[2] >> 4;
+    uint8_t sr_code = p[2] & 0x0F;
+    uint8_t chan = p[3] >> 4;
+    uint8_t ss_code = (p[3] >> 1) & 7;
+
+    // Stereo only, 16 bits and 44.1 kHz either explicit or from STREAMINFO
+    if (bs_code == 0 || (p[3] & 1)) return false;
+    if (chan != 1 && (chan < 8 || chan > 10)) return false;
+    if (ss_code != 0 && ss_code != 4) return false;
+    if (sr_code != 0 && sr_code != 9 && sr_code != 13 && sr_code != 14) return false;
+
+    // Frame or sample number, UTF-8 style variable length coding
+    uint32_t pos = 4;
+    uint8_t b = p[pos++];
+    uint64_t num;
+    int extra;
+    if (!(b & 0x80)) { num = b; extra = 0; }
+    else if ((b & 0xE0) == 0xC0) { num = b & 0x1F; extra = 1; }
+    else if ((b & 0xF0) == 0xE0) { num = b & 0x0F; extra = 2; }
+    else if ((b & 0xF8) == 0xF0) { num = b & 0x07; extra = 3; }
+    else if ((b & 0xFC) == 0xF8) { num = b & 0x03; extra = 4; }
+    else if ((b & 0xFE) == 0xFC) { num = b & 0x01; extra = 5; }
+    else if (b == 0xFE && variable) { num = 0; extra = 6; }
+    else return false;
+
+    if (pos + extra + 5 > avail) return false;
+    while (extra--)
+    {
+        b = p[pos++];
+        if ((b & 0xC0) != 0x80) return false;
+        num = (num << 6) | (b & 0x3F);
+    }
+
+    uint32_t blocksize;
+    if (bs_code == 1) blocksize = 192;
+    else if (bs_code <= 5) blocksize = 576 << (bs_code - 2);
+    else if (bs_code == 6) blocksize = p[pos++] + 1;
+    else if (bs_code == 7) { blocksize = get_be16(p + pos) + 1; pos += 2; }
+    else blocksize = 256 << (bs_code - 8);
+
+    if (sr_code == 13) { if (get_be16(p + pos) != 44100) return false; pos += 2; }
+    else if (sr_code == 14) { if (get_be16(p + pos) != 4410) return false; pos += 2; }
+
+    uint8_t crc = 0;
+    for (uint32_t i = 0; i < pos; i++)
+    {
+        crc = g_flac_crc.crc8[crc ^ p[i]];
+    }
+    if (crc != p[pos] || blocksize > FLAC_MAX_BLOCKSIZE) return false;
+
+    hdr->sample = variable ? num : num * g_flac.meta.max_blocksize;
+    hdr->blocksize = blocksize;
+    hdr->channel_assignment = chan;
+    hdr->length = pos + 1;
+    return hdr->sample < g_flac.meta.total_samples;
+}
+
+// Finds the first frame header at or after pos that starts before limit.
+// Uses the ring as scratch, so the stream must not be decoding.
+static bool flac_find_frame(uint64_t pos, uint64_t limit, uint64_t *frame_off, flac_frame_hdr_t *hdr)
+{
+    FsFile &file = *g_flac.file;
+    uint8_t *buf = g_flac_ring;
+
+    while (pos < limit && pos < g_flac.file_size)
+    {
+        uint32_t n = FLAC_SCAN_CHUNK + FLAC_MAX_HEADER_LEN;
+        if (n > g_flac.file_size - pos) n = g_flac.file_size - pos;
+        if (!read_at(file, pos, buf, n)) return false;
+
+        uint32_t scan = FLAC_SCAN_CHUNK;
+        if (scan > limit - pos) scan = limit - pos;
+        for (uint32_t i = 0; i < scan && i + 1 < n; i++)
+        {
+            if (buf[i] == 0xFF && (buf[i + 1] & 0xFE) == 0xF8
+                && flac_parse_frame_header(buf + i, n - i, hdr))
+            {
+                *frame_off = pos + i;
+                return true;
+            }
+        }
+        pos += scan;
+    }
+    return false;
+}
+
+// Locates the frame that contains the target sample. The SEEKTABLE, when
+// present, narrows the range, then interpolation search on frame headers
+// gets close and a short walk over frame headers finds the exact frame.
+static bool flac_seek(uint64_t target, uint64_t *frame_off)
+{
+    const flac_meta_t &meta = g_flac.meta;
+    uint64_t lo_off = meta.first_frame;
+    uint64_t lo_sample = 0;
+    uint64_t hi_off = g_flac.file_size;
+    uint64_t hi_sample = meta.total_samples;
+
+    if (meta.seektable_count > 0)
+    {
+        // Seek points are sorted, placeholders with all ones sample number are at the end
+        FsFile &file = *g_flac.file;
+        uint8_t point[18];
+        uint32_t first = 0, last = meta.seektable_count;
+        while (first < last)
+        {
+            uint32_t mid = (first + last) / 2;
+            if (!read_at(file, meta.seektable_pos + mid * 18, point, 18)) return false;
+            uint64_t sample = ((uint64_t)get_be32(point) << 32) | get_be32(point + 4);
+            uint64_t offset = ((uint64_t)get_be32(point + 8) << 32) | get_be32(point + 12);
+
+            if (sample <= target && meta.first_frame + offset < g_flac.file_size)
+            {
+                lo_off = meta.first_frame + offset;
+                lo_sample = sample;
+                first = mid + 1;
+            }
+            else
+            {
+                if (sample != UINT64_MAX && sample <= meta.total_samples && meta.first_frame + offset < hi_off)
+                {
+                    hi_off = meta.first_frame + offset;
+                    hi_sample = sample;
+                }
+                last = mid;
+            }
+        }
+    }
+
+    flac_frame_hdr_t hdr;
+    uint64_t off;
+    for (int i = 0; i < 32 && hi_off - lo_off > FLAC_LINEAR_SEEK && hi_sample > lo_sample; i++)
+    {
+        uint64_t guess = lo_off + (target - lo_sample) * (hi_off - lo_off) / (hi_sample - lo_sample);
+        if (guess <= lo_off) guess = lo_off + 1;
+        if (guess >= hi_off - FLAC_MIN_FRAME_LEN) guess = hi_off - FLAC_MIN_FRAME_LEN;
+
+        if (!flac_find_frame(guess, hi_off, &off, &hdr))
+        {
+            hi_off = guess;
+        }
+        else if (hdr.sample <= target)
+        {
+            lo_off = off;
+            lo_sample = hdr.sample;
+            if (target < hdr.sample + hdr.blocksize)
+            {
+                *frame_off = off;
+                return true;
+            }
+        }
+        else
+        {
+            // No frame starts between guess and off, so the target frame starts before guess
+            hi_off = guess;
+            hi_sample = hdr.sample;
+        }
+    }
+
+    // Walk the remaining frames
+    uint64_t pos = lo_off;
+    *frame_off = lo_off;
+    while (flac_find_frame(pos, g_flac.file_size, &off, &hdr) && hdr.sample <= target)
+    {
+        *frame_off = off;
+        if (target < hdr.sample + hdr.blocksize) break;
+        pos = off + hdr.length;
+    }
+    return true;
+}
+
+// MSB first bit reader over the ring. Reading past the written part of the
+// ring returns stale data, the frame is then rejected by the length check.
+struct flac_bits_t {
+    uint32_t pos;       // Next ring byte to load
+    uint32_t end;
+    uint64_t cache;     // Left aligned, unused low bits are zero
+    int bits;
+};
+
+static inline void br_refill(flac_bits_t &b)
+{
+    while (b.bits <= 48)
+    {
+        b.cache |= (uint64_t)RING(b.pos) << (56 - b.bits);
+        b.pos++;
+        b.bits += 8;
+    }
+}
+
+static inline uint32_t br_read(flac_bits_t &b, int n)
+{
+    if (n == 0) return 0;
+    if (b.bits < n) br_refill(b);
+    uint32_t v = (uint32_t)(b.cache >> (64 - n));
+    b.cache <<= n;
+    b.bits -= n;
+    return v;
+}
+
+static inline int32_t br_read_signed(flac_bits_t &b, int n)
+{
+    if (n == 0) return 0;
+    uint32_t v = br_read(b, n);
+    return (int32_t)(v << (32 - n)) >> (32 - n);
+}
+
+// Consumed position in bytes, rounded up
+static inline uint32_t br_position(const flac_bits_t &b)
+{
+    return b.pos - b.bits / 8;
+}
+
+static inline bool br_overrun(const flac_bits_t &b)
+{
+    return (int32_t)(br_position(b) - b.end) > 0;
+}
+
+static inline uint32_t br_unary(flac_bits_t &b)
+{
+    uint32_t q = 0;
+    for (;;)
+    {
+        if (b.cache != 0)
+        {
+            int lz = __builtin_clzll(b.cache);
+            b.cache <<= lz + 1;
+            b.bits -= lz + 1;
+            return q + lz;
+        }
+        q += b.bits;
+        b.bits = 0;
+        if (br_overrun(b)) return 0;
+        br_refill(b);
+    }
+}
+
+__attribute__((section(".time_critical.flac_residual")))
+static bool flac_residual(flac_bits_t &b, int32_t *out, uint32_t n, uint32_t order)
+{
+    uint32_t method = br_read(b, 2);
+    if (method > 1) return false;
+
+    int param_bits = method ? 5 : 4;
+    uint32_t escape = method ? 31 : 15;
+    uint32_t porder = br_read(b, 4);
+    uint32_t part_len = n >> porder;
+    if ((part_len << porder) != n || part_len < order) return false;
+
+    uint32_t i = order;
+    for (uint32_t part = 0; part < (1U << porder); part++)
+    {
+        uint32_t end = (part + 1) * part_len;
+        uint32_t param = br_read(b, param_bits);
+        if (param == escape)
+        {
+            int raw = br_read(b, 5);
+            for (; i < end; i++)
+            {
+                out[i] = br_read_signed(b, raw);
+            }
+        }
+        else
+        {
+            for (; i < end; i++)
+            {
+                uint32_t u = (br_unary(b) << param) | br_read(b, param);
+                out[i] = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+            }
+        }
+
+        if (br_overrun(b)) return false;
+    }
+    return true;
+}
+
+__attribute__((section(".time_critical.flac_subframe")))
+static bool flac_subframe(flac_bits_t &b, int32_t *out, uint32_t n, int bps)
+{
+    if (br_read(b, 1) != 0) return false;
+    uint32_t type = br_read(b, 6);
+
+    int wasted = 0;
+    if (br_read(b, 1))
+    {
+        wasted = br_unary(b) + 1;
+        if (wasted >= bps) return false;
+        bps -= wasted;
+    }
+
+    if (type == 0)
+    {
+        // CONSTANT
+        int32_t v = br_read_signed(b, bps);
+        for (uint32_t i = 0; i < n; i++) out[i] = v;
+    }
+    else if (type == 1)
+    {
+        // VERBATIM
+        for (uint32_t i = 0; i < n; i++) out[i] = br_read_signed(b, bps);
+    }
+    else if (type >= 8 && type <= 12)
+    {
+        // FIXED predictor
+        uint32_t order = type - 8;
+        if (order > n) return false;
+        for (uint32_t i = 0; i < order; i++) out[i] = br_read_signed(b, bps);
+        if (!flac_residual(b, out, n, order)) return false;
+
+        switch (order)
+        {
+            case 1:
+                for (uint32_t i = 1; i < n; i++) out[i] += out[i - 1];
+                break;
+            case 2:
+                for (uint32_t i = 2; i < n; i++) out[i] += 2 * out[i - 1] - out[i - 2];
+                break;
+            case 3:
+                for (uint32_t i = 3; i < n; i++) out[i] += 3 * out[i - 1] - 3 * out[i - 2] + out[i - 3];
+                break;
+            case 4:
+                for (uint32_t i = 4; i < n; i++) out[i] += 4 * out[i - 1] - 6 * out[i - 2] + 4 * out[i - 3] - out[i - 4];
+                break;
+        }
+    }
+    else if (type >= 32)
+    {
+        // LPC predictor
+        uint32_t order = type - 31;
+        if (order > n) return false;
+        for (uint32_t i = 0; i < order; i++) out[i] = br_read_signed(b, bps);
+
+        int precision = br_read(b, 4) + 1;
+        int shift = br_read_signed(b, 5);
+        if (precision == 16 || shift < 0) return false;
+
+        int32_t coef[32];
+        for (uint32_t i = 0; i < order; i++) coef[i] = br_read_signed(b, precision);
+        if (!flac_residual(b, out, n, order)) return false;
+
+        for (uint32_t i = order; i < n; i++)
+        {
+            int64_t sum = 0;
+            const int32_t *hist = &out[i - 1];
+            for (uint32_t j = 0; j < order; j++)
+            {
+                sum += (int64_t)coef[j] * hist[-(int32_t)j];
+            }
+            out[i] += (int32_t)(sum >> shift);
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    if (wasted)
+    {
+        for (uint32_t i = 0; i < n; i++) out[i] <<= wasted;
+    }
+    return !br_overrun(b);
+}
+
+// Decodes the frame starting at ring position start into g_flac_block
+__attribute__((section(".time_critical.flac_frame")))
+static bool flac_decode_frame(uint32_t start, uint32_t end, const flac_frame_hdr_t &hdr, uint32_t *consumed)
+{
+    flac_bits_t b = {start + hdr.length, end, 0, 0};
+    uint32_t n = hdr.blocksize;
+    int32_t *ch0 = g_flac_block[0];
+    int32_t *ch1 = g_flac_block[1];
+
+    // The side channel needs one extra bit
+    uint8_t ca = hdr.channel_assignment;
+    if (!flac_subframe(b, ch0, n, 16 + (ca == 9))) return false;
+    if (!flac_subframe(b, ch1, n, 16 + (ca == 8 || ca == 10))) return false;
+
+    // Zero padding to byte boundary, then CRC-16 of the whole frame
+    b.cache <<= (b.bits & 7);
+    b.bits &= ~7;
+    uint32_t crc_pos = br_position(b);
+    uint16_t crc = br_read(b, 16);
+    if ((int32_t)(crc_pos + 2 - end) > 0) return false;
+
+    uint16_t calc = 0;
+    for (uint32_t pos = start; pos != crc_pos; pos++)
+    {
+        calc = (calc << 8) ^ g_flac_crc.crc16[(calc >> 8) ^ RING(pos)];
+    }
+    if (calc != crc) return false;
+
+    if (ca == 8)
+    {
+        // Left, side
+        for (uint32_t i = 0; i < n; i++) ch1[i] = ch0[i] - ch1[i];
+    }
+    else if (ca == 9)
+    {
+        // Side, right
+        for (uint32_t i = 0; i < n; i++) ch0[i] += ch1[i];
+    }
+    else if (ca == 10)
+    {
+        // Mid, side
+        for (uint32_t i = 0; i < n; i++)
+        {
+            int32_t side = ch1[i];
+            int32_t mid = (ch0[i] << 1) | (side & 1);
+            ch0[i] = (mid + side) >> 1;
+            ch1[i] = (mid - side) >> 1;
+        }
+    }
+
+    *consumed = crc_pos + 2 - start;
+    return true;
+}
+
+// Decodes the next frame from the ring, waiting for core0 to supply data
+static bool flac_next_frame()
+{
+    uint32_t wait_start = platform_millis();
+    while (g_flac.head - g_flac.tail < g_flac.frame_bound && !g_flac.eof)
+    {
+        if (g_flac.abort) return false;
+
+        if (g_flac.sync)
+        {
+            if (flac_stream_fill(FLAC_RING_SIZE) == 0 && !g_flac.eof) return false;
+        }
+        else if ((uint32_t)(platform_millis() - wait_start) > FLAC_WAIT_TIMEOUT_MS)
+        {
+            g_flac.starved++;
+            return false;
+        }
+    }
+    if (g_flac.abort) return false;
+    __sync_synchronize();
+    uint32_t end = g_flac.head;
+
+    // Find the next frame header. After a damaged frame this skips over its
+    // payload, accepting only the expected sample number until one full
+    // frame worth of data has been searched.
+    flac_frame_hdr_t hdr;
+    uint8_t h[FLAC_MAX_HEADER_LEN];
+    uint32_t skipped = 0;
+    for (;;)
+    {
+        uint32_t avail = end - g_flac.tail;
+        if (avail < FLAC_MIN_FRAME_LEN) return false;
+        if (avail > FLAC_MAX_HEADER_LEN) avail = FLAC_MAX_HEADER_LEN;
+        for (uint32_t i = 0; i < avail; i++) h[i] = RING(g_flac.tail + i);
+
+        if (flac_parse_frame_header(h, avail, &hdr)
+            && (g_flac.expect_sample == UINT64_MAX || hdr.sample == g_flac.expect_sample
+                || skipped > g_flac.frame_bound))
+        {
+            break;
+        }
+        g_flac.tail = g_flac.tail + 1;
+        skipped++;
+    }
+
+    uint32_t consumed;
+    if (flac_decode_frame(g_flac.tail, end, hdr, &consumed))
+    {
+        g_flac.tail = g_flac.tail + consumed;
+    }
+    else
+    {
+        // Keep the timing with a block of silence
+        g_flac.damaged++;
+        memset(g_flac_block, 0, sizeof(g_flac_block));
+        g_flac.tail = g_flac.tail + hdr.length;
+    }
+
+    g_flac.expect_sample = hdr.sample + hdr.blocksize;
+    g_flac.frame_len = hdr.blocksize;
+    g_flac.frame_pos = 0;
+    if (hdr.sample < g_flac.next_sample)
+    {
+        // Seek target is inside this frame
+        uint64_t skip = g_flac.next_sample - hdr.sample;
+        g_flac.frame_pos = (skip < hdr.blocksize) ? (uint32_t)skip : hdr.blocksize;
+    }
+    else
+    {
+        g_flac.next_sample = hdr.sample;
+    }
+    return true;
+}
+
+bool flac_stream_open(FsFile &file, uint64_t pcm_pos)
+{
+    g_flac.open = false;
+    g_flac.abort = false;
+
+    uint32_t first_sector = file.firstSector();
+    uint64_t size = file.fileSize();
+    if (g_flac.file != &file || g_flac.first_sector != first_sector || g_flac.file_size != size)
+    {
+        uint64_t start;
+        if (!flac_locate(file, &start) || !flac_read_meta(file, start, size, &g_flac.meta)
+            || !flac_meta_supported(g_flac.meta))
+        {
+            g_flac.file = nullptr;
+            return false;
+        }
+        g_flac.file = &file;
+        g_flac.first_sector = first_sector;
+        g_flac.file_size = size;
+        g_flac.frame_bound = flac_frame_bound(g_flac.meta);
+    }
+
+    uint64_t target = pcm_pos / 4;
+    if (target > g_flac.meta.total_samples) target = g_flac.meta.total_samples;
+
+    uint64_t frame_off;
+    if (!flac_seek(target, &frame_off))
+    {
+        logmsg("FLAC: seek to sample ", (int)target, " failed");
+        return false;
+    }
+
+    dbgmsg<LOG_SUBSYS_AUDIO>("------ FLAC seek to sample ", (int)target, " frame at ", frame_off);
+    g_flac.head = g_flac.tail = (uint32_t)(frame_off & 511);
+    g_flac.file_pos = frame_off;
+    g_flac.eof = false;
+    g_flac.frame_len = 0;
+    g_flac.frame_pos = 0;
+    g_flac.next_sample = target;
+    g_flac.expect_sample = UINT64_MAX;
+    g_flac.sync = false;
+    g_flac.open = true;
+    return true;
+}
+
+uint32_t flac_stream_fill(uint32_t max_bytes)
+{
+    if (!g_flac.open || g_flac.eof) return 0;
+
+    uint32_t head = g_flac.head;
+    uint32_t space = FLAC_RING_SIZE - (head - g_flac.tail);
+    uint32_t off = head & (FLAC_RING_SIZE - 1);
+    uint32_t n = FLAC_RING_SIZE - off;
+    uint64_t left = g_flac.file_size - g_flac.file_pos;
+    if (n > space) n = space;
+    if (n > max_bytes) n = max_bytes;
+    if (n > left) n = left;
+    if (n == 0)
+    {
+        if (left == 0) g_flac.eof = true;
+        return 0;
+    }
+
+    FsFile &file = *g_flac.file;
+    if (file.curPosition() != g_flac.file_pos && !file.seekSet(g_flac.file_pos))
+    {
+        g_flac.eof = true;
+        return 0;
+    }
+
+    int got = file.read(&g_flac_ring[off], n);
+    if (got <= 0)
+    {
+        logmsg("FLAC: read error at ", g_flac.file_pos);
+        g_flac.eof = true;
+        return 0;
+    }
+
+    // Ring contents must be visible before the new head
+    __sync_synchronize();
+    g_flac.head = head + got;
+    g_flac.file_pos += got;
+    if (g_flac.file_pos >= g_flac.file_size) g_flac.eof = true;
+    return got;
+}
+
+bool flac_stream_starving()
+{
+    return g_flac.open && !g_flac.eof && g_flac.head - g_flac.tail < g_flac.frame_bound;
+}
+
+__attribute__((section(".time_critical.flac_decode")))
+uint32_t flac_stream_decode(uint32_t *buf, uint32_t count)
+{
+    uint32_t done = 0;
+    while (done < count && g_flac.open)
+    {
+        if (g_flac.frame_pos >= g_flac.frame_len)
+        {
+            if (!flac_next_frame()) break;
+            continue;
+        }
+
+        uint32_t n = g_flac.frame_len - g_flac.frame_pos;
+        if (n > count - done) n = count - done;
+        const int32_t *left = &g_flac_block[0][g_flac.frame_pos];
+        const int32_t *right = &g_flac_block[1][g_flac.frame_pos];
+        uint32_t *out = buf + done;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            out[i] = (uint16_t)left[i] | ((uint32_t)right[i] << 16);
+        }
+        g_flac.frame_pos += n;
+        g_flac.next_sample += n;
+        done += n;
+    }
+
+    if (done < count)
+    {
+        memset(buf + done, 0, (count - done) * sizeof(uint32_t));
+    }
+    return done;
+}
+
+void flac_stream_abort()
+{
+    g_flac.abort = true;
+}
+
+void flac_stream_close()
+{
+    if (g_flac.damaged || g_flac.starved)
+    {
+        logmsg("FLAC: ", (int)g_flac.damaged, " damaged frames, ", (int)g_flac.starved, " data stalls");
+    }
+    g_flac.damaged = 0;
+    g_flac.starved = 0;
+    g_flac.open = false;
+    g_flac.file = nullptr;
+}
+
+#endif // ENABLE_AUDIO_FLAC
+
+ssize_t audio_file_read_pcm(FsFile &file, uint64_t pcm_pos, void *buf, size_t count)
+{
+    audio_file_info_t info;
+    if (!audio_file_probe(file, &info))
+    {
+        return -1;
+    }
+
+    if (info.container == AUDIO_CONTAINER_RAW || info.container == AUDIO_CONTAINER_WAVE)
+    {
+        // Stop at the end of the data chunk, a WAVE file may have other
+        // chunks after it. The rest of the last sector is silence.
+        size_t avail = (pcm_pos < info.pcm_size) ? info.pcm_size - pcm_pos : 0;
+        if (info.container == AUDIO_CONTAINER_RAW || count <= avail)
+        {
+            avail = count;
+        }
+
+        if (!file.seekSet(info.data_offset + pcm_pos))
+        {
+            return -1;
+        }
+        int got = file.read(buf, avail);
+        if (got < 0 || (size_t)got < avail)
+        {
+            return got;
+        }
+        memset((uint8_t*)buf + avail, 0, count - avail);
+        return count;
+    }
+
+#if ENABLE_AUDIO_FLAC
+    if (info.container == AUDIO_CONTAINER_FLAC)
+    {
+        // Sequential reads continue from where the previous one stopped
+        if (!g_flac.open || g_flac.abort || g_flac.file != &file || g_flac.next_sample * 4 != pcm_pos)
+        {
+            if (!flac_stream_open(file, pcm_pos))
+            {
+                return -1;
+            }
+        }
+
+        g_flac.sync = true;
+        flac_stream_decode((uint32_t*)buf, count / 4);
+        g_flac.sync = false;
+        return count & ~3;
+    }
+#endif
+
+    return -1;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - WAVE and FLAC backed CD audio tracks
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// CUE sheets can reference audio tracks stored as RIFF WAVE or FLAC
+// instead of raw 2352 byte sectors. This module detects the container
+// and presents the file as the raw PCM byte stream the CD-ROM code expects.
+// Only CD format audio is accepted: 44.1 kHz, 16-bit, 2 channels.
+
+#pragma once
+
+#include <stdint.h>
+#include <unistd.h>
+#include <SdFat.h>
+
+// The FLAC decoder needs about 70 kB of RAM for the compressed data ring
+// and one decoded block, so it is only enabled on RP2350 by default.
+#ifndef ENABLE_AUDIO_FLAC
+# ifdef BLUESCSI_MCU_RP23XX
+#  define ENABLE_AUDIO_FLAC 1
+# else
+#  define ENABLE_AUDIO_FLAC 0
+# endif
+#endif
+
+enum audio_container_t {
+    AUDIO_CONTAINER_RAW = 0,     // Plain PCM, e.g. .bin
+    AUDIO_CONTAINER_WAVE,        // RIFF WAVE
+    AUDIO_CONTAINER_FLAC,        // FLAC stream
+    AUDIO_CONTAINER_UNSUPPORTED  // WAVE or FLAC that is not CD format audio
+};
+
+struct audio_file_info_t {
+    audio_container_t container;
+    uint64_t data_offset;   // File offset of the first PCM byte or FLAC frame
+    uint64_t pcm_size;      // Length of the audio as raw PCM in bytes
+};
+
+/**
+ * Detects the container from the file contents. The CUE FILE type is not
+ * used because many rips label every file BINARY or WAVE regardless.
+ * Results are cached, so this is cheap to call on every track lookup.
+ * The file position is preserved.
+ *
+ * \param file  Open audio or bin file
+ * \param info  Receives container type, data offset and PCM size
+ * \return      False if the file could not be read
+ */
+bool audio_file_probe(FsFile &file, audio_file_info_t *info);
+
+/**
+ * Size of the file as used for the CUE sheet track layout:
+ * the decoded PCM size for WAVE and FLAC, the file size otherwise.
+ */
+uint64_t audio_file_pcm_size(FsFile &file);
+
+/**
+ * Reads PCM data at an offset in the decoded stream, used by READ CD on
+ * audio tracks. FLAC decoding runs on the calling core and shares the
+ * decoder with playback, so audio output must be stopped first.
+ *
+ * \return Number of bytes read, or negative on error
+ */
+ssize_t audio_file_read_pcm(FsFile &file, uint64_t pcm_pos, void *buf, size_t count);
+
+#if ENABLE_AUDIO_FLAC
+/*
+ * Streaming FLAC decoder for audio playback. Compressed data is read from
+ * the SD card on core0 into a ring buffer and frames are decoded from the
+ * ring on core1, so the SD card and the SCSI bus stay on core0.
+ */
+
+// Opens the stream positioned at a PCM byte offset. The decoder must be idle. core0.
+bool flac_stream_open(FsFile &file, uint64_t pcm_pos);
+
+// Reads up to max_bytes of compressed data into the ring. core0.
+// Returns the number of bytes added.
+uint32_t flac_stream_fill(uint32_t max_bytes);
+
+// True if the ring holds less than a worst case frame and data remains.
+bool flac_stream_starving();
+
+// Decodes count stereo pairs in CD byte order into buf, padding with
+// silence on errors or end of stream. Returns the number of decoded pairs. core1.
+uint32_t flac_stream_decode(uint32_t *buf, uint32_t count);
+
+// Makes a decode that is waiting for data give up. core0.
+void flac_stream_abort();
+
+// Releases the file, the next use has to open the stream again. core0.
+void flac_stream_close();
+#endif
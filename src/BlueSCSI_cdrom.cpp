@@ -30,6 +30,7 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <new>
 #include "BlueSCSI_cdrom.h"
 #include "BlueSCSI_log.h"
 #include "BlueSCSI_config.h"
@@ -39,6 +40,7 @@
 #include <CUEParser.h>
 #include <assert.h>
 #include <minIni.h>
+#include "BlueSCSI_audio_file.h"
 #ifdef ENABLE_AUDIO_OUTPUT
 #include "BlueSCSI_audio.h"
 #endif
@@ -49,6 +51,9 @@ extern "C" {
 
 static const uint16_t AUDIO_CD_SECTOR_LEN = 2352;
 
+// A CUE sheet has at most 99 tracks, so it can't reference more files
+static const int CDROM_MAX_BIN_FILES = 100;
+
 /******************************************/
 /* Basic TOC generation without cue sheet */
 /******************************************/
@@ -267,13 +272,40 @@ static int32_t MSF2LBA(uint8_t m, uint8_t s, uint8_t f, bool relative)
     return lba;
 }
 
+// Size of the currently selected bin file as used for the track layout.
+// WAVE and FLAC files count as their decoded PCM size. The track loops ask
+// for it on every track, so the sizes of multi-file images are kept in
+// img.cdrom_binfile_sizes instead of probing the files again.
+static uint64_t cdromBinFileSize(image_config_t &img)
+{
+    int index = img.cdrom_binfile_index;
+    bool cacheable = (index >= 0 && index < CDROM_MAX_BIN_FILES);
+    if (cacheable && img.cdrom_binfile_sizes && img.cdrom_binfile_sizes[index] != 0)
+    {
+        return img.cdrom_binfile_sizes[index];
+    }
+
+    FsFile *file = img.file.getFsFile();
+    uint64_t size = file ? audio_file_pcm_size(*file) : img.file.size();
+
+    if (cacheable && !img.cdrom_binfile_sizes)
+    {
+        img.cdrom_binfile_sizes = new (std::nothrow) uint64_t[CDROM_MAX_BIN_FILES]();
+    }
+    if (cacheable && img.cdrom_binfile_sizes)
+    {
+        img.cdrom_binfile_sizes[index] = size;
+    }
+    return size;
+}
+
 // Gets the LBA position of the lead-out for the current image
 static uint32_t getLeadOutLBA(const CUETrackInfo* lasttrack)
 {
     if (lasttrack != nullptr && lasttrack->track_number != 0)
     {
         image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-        uint64_t sz = img.file.size();
+        uint64_t sz = cdromBinFileSize(img);
         uint32_t lastTrackBlocks = (sz > lasttrack->file_offset)
                 ? (sz - lasttrack->file_offset) / lasttrack->sector_length : 0;
         return lasttrack->data_start + lastTrackBlocks;
@@ -556,7 +588,7 @@ static void getTrackFromLBA(image_config_t &img, uint32_t lba, CUETrackInfo *res
             }
 
             cdromSelectBinFileForTrack(img, tmptrack);
-            prev_capacity = img.file.size();
+            prev_capacity = cdromBinFileSize(img);
         }
 
         uint32_t track_end_lba_val = 0;
@@ -675,7 +707,7 @@ static void doReadTOC(bool MSF, uint8_t track, uint16_t allocationLength)
         }
 
         cdromSelectBinFileForTrack(img, trackinfo);
-        prev_capacity = img.file.size();
+        prev_capacity = cdromBinFileSize(img);
     }
 
     // Format lead-out track info
@@ -828,7 +860,7 @@ static void doReadFullTOC(uint8_t session, uint16_t allocationLength, bool useBC
         len += 11;
 
         cdromSelectBinFileForTrack(img, trackinfo);
-        prev_capacity = img.file.size();
+        prev_capacity = cdromBinFileSize(img);
     }
 
     // First and last track numbers
@@ -997,7 +1029,7 @@ void doReadTrackInformation(bool track, uint32_t lba, uint16_t allocationLength)
         mtrack = *trackinfo;
 
         cdromSelectBinFileForTrack(img, trackinfo);
-        prev_capacity = img.file.size();
+        prev_capacity = cdromBinFileSize(img);
     }
     // try the last track as a final attempt if no match found beforehand
     if (!trackfound)
@@ -1043,7 +1075,7 @@ void doReadTrackInformation(bool track, uint32_t lba, uint16_t allocationLength)
     scsiDev.data[26] = tracklen >> 8;
     scsiDev.data[27] = tracklen;
 
-    dbgmsg("------ Reporting track ", mtrack.track_number, ", start ", start,
+    dbgmsg<LOG_SUBSYS_CDROM>("------ Reporting track ", mtrack.track_number, ", start ", start,
             ", length ", tracklen);
     if (len > allocationLength)
     {
@@ -1304,27 +1336,47 @@ bool cdromValidateCueSheet(image_config_t &img)
             logmsg("---- Warning: track ", trackinfo->track_number, " has unsupported mode ", (int)trackinfo->track_mode);
         }
 
-        if (trackinfo->file_mode != CUEFile_BINARY)
-        {
-            logmsg("---- Unsupported CUE data file mode ", (int)trackinfo->file_mode);
-        }
-
         // Check that the bin file is available
         if (!cdromSelectBinFileForTrack(img, trackinfo))
         {
             return false;
         }
 
+        // WAVE and FLAC are recognized from the file contents
+        audio_file_info_t audio_info = {AUDIO_CONTAINER_RAW, 0, img.file.size()};
+        FsFile *fsfile = img.file.getFsFile();
+        if (fsfile)
+        {
+            audio_file_probe(*fsfile, &audio_info);
+        }
+
+        if (audio_info.container == AUDIO_CONTAINER_UNSUPPORTED)
+        {
+#if ENABLE_AUDIO_FLAC
+            logmsg("---- Track ", trackinfo->track_number, " audio file is not 44.1 kHz 16-bit stereo");
+#else
+            logmsg("---- Track ", trackinfo->track_number, " audio file is not 44.1 kHz 16-bit stereo WAVE, FLAC is not supported on this hardware");
+#endif
+        }
+        else if (audio_info.container != AUDIO_CONTAINER_RAW && trackinfo->track_mode != CUETrack_AUDIO)
+        {
+            logmsg("---- Track ", trackinfo->track_number, " is a data track stored in a WAVE or FLAC file");
+        }
+        else if (audio_info.container == AUDIO_CONTAINER_RAW && trackinfo->file_mode != CUEFile_BINARY)
+        {
+            logmsg("---- Unsupported CUE data file mode ", (int)trackinfo->file_mode);
+        }
+
         // Verify that the bin file is large enough for the track's offset
-        if (trackinfo->file_offset > 0 && img.file.size() < trackinfo->file_offset)
+        if (trackinfo->file_offset > 0 && audio_info.pcm_size < trackinfo->file_offset)
         {
             logmsg("---- CUE track ", trackinfo->track_number,
                    " offset exceeds bin file size (",
-                   (int)(img.file.size() / 1048576), " MB)");
+                   (int)(audio_info.pcm_size / 1048576), " MB)");
             return false;
         }
 
-        prev_capacity = img.file.size();
+        prev_capacity = cdromBinFileSize(img);
     }
 
     if (trackcount == 0)
@@ -1376,14 +1428,14 @@ void cdromCloseTray(image_config_t &img)
     }
     if (img.ejected)
     {
-        dbgmsg("------ CDROM close tray on ID ", (int)target);
+        dbgmsg<LOG_SUBSYS_CDROM>("------ CDROM close tray on ID ", (int)target);
         img.ejected = false;
         img.cdrom_events = 2; // New media
 
         if (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION)
         {
-            dbgmsg("------ Posting UNIT ATTENTION after medium change");
-            scsiDev.targets[target].unitAttention = NOT_READY_TO_READY_TRANSITION_MEDIUM_MAY_HAVE_CHANGED;
+            dbgmsg<LOG_SUBSYS_CDROM>("------ Posting UNIT ATTENTION after medium change");
+            scsiDiskPostUnitAttention(img, NOT_READY_TO_READY_TRANSITION_MEDIUM_MAY_HAVE_CHANGED);
         }
     }
 }
@@ -1401,7 +1453,7 @@ void cdromPerformEject(image_config_t &img)
     {
         blink_cancel();
         blinkStatus(g_scsi_settings.getDevice(target)->ejectBlinkTimes, g_scsi_settings.getDevice(target)->ejectBlinkPeriod);
-        dbgmsg("------ CDROM open tray on ID ", (int)target);
+        dbgmsg<LOG_SUBSYS_CDROM>("------ CDROM open tray on ID ", (int)target);
         img.ejected = true;
         img.cdrom_events = 3; // Media removal
         switchNextImage(img); // Switch media for next time
@@ -1525,10 +1577,10 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
 #ifdef ENABLE_AUDIO_OUTPUT
     if (!g_scsi_settings.getSystem()->enableCDAudio)
     {
-        dbgmsg("---- Audio disabled in ", CONFIGFILE);
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Audio disabled in ", CONFIGFILE);
 #else
     {
-        dbgmsg("---- Target does not support audio playback");
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Target does not support audio playback");
 #endif
         // per SCSI-2, targets not supporting audio respond to zero-length
         // PLAY AUDIO commands with ILLEGAL REQUEST; this seems to be a check
@@ -1546,7 +1598,7 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
 #endif
 
 #ifdef ENABLE_AUDIO_OUTPUT
-    dbgmsg("------ CD-ROM Play Audio request at ", (int)lba, " for ", (int)length, " sectors");
+    dbgmsg<LOG_SUBSYS_CDROM>("------ CD-ROM Play Audio request at ", (int)lba, " for ", (int)length, " sectors");
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     uint8_t target_id = img.getTargetId();
 
@@ -1585,7 +1637,7 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
 
     if (trackinfo_ptr && trackinfo.track_mode != CUETrack_AUDIO)
     {
-        dbgmsg("---- Host tried audio playback on track type ", (int)trackinfo.track_mode);
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Host tried audio playback on track type ", (int)trackinfo.track_mode);
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
@@ -1600,7 +1652,7 @@ static void doPlayAudio(uint32_t lba, uint32_t length)
     }
     else
     {
-        dbgmsg("---- Request to play audio on non-audio image");
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Request to play audio on non-audio image");
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
@@ -1613,7 +1665,7 @@ static void doPlayAudioTrackIndex(uint8_t start_track, uint8_t start_index, uint
 {
 #if defined(ENABLE_AUDIO_OUTPUT) && defined(ENABLE_AUDIO_OUTPUT_I2S)
 #if defined(BLUESCSI_ULTRA) || defined(BLUESCSI_ULTRA_WIDE)
-    dbgmsg("------ CD-ROM Play Audio request at track:index ", (int)start_track, ":", (int)start_index, " until ", (int)end_track, ":", (int)end_index);
+    dbgmsg<LOG_SUBSYS_CDROM>("------ CD-ROM Play Audio request at track:index ", (int)start_track, ":", (int)start_index, " until ", (int)end_track, ":", (int)end_index);
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     uint8_t target_id = img.getTargetId();
     if (audio_play_track_index(target_id, &img, start_track, start_index, end_track, end_index))
@@ -1632,7 +1684,7 @@ static void doPlayAudioTrackIndex(uint8_t start_track, uint8_t start_index, uint
         // return;
         
         // virtual drive supports audio, just not with this disk image
-        dbgmsg("---- Request to play audio on non-audio image");
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Request to play audio on non-audio image");
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
@@ -1647,7 +1699,7 @@ static void doPlayAudioTrackIndex(uint8_t start_track, uint8_t start_index, uint
 # endif
 
 #else
-    dbgmsg("---- Target does not support audio playback");
+    dbgmsg<LOG_SUBSYS_CDROM>("---- Target does not support audio playback");
     // per SCSI-2, targets not supporting audio respond to zero-length
     // PLAY AUDIO commands with ILLEGAL REQUEST; this seems to be a check
     // performed by at least some audio playback software
@@ -1661,7 +1713,7 @@ static void doPlayAudioTrackIndex(uint8_t start_track, uint8_t start_index, uint
 static void doPauseResumeAudio(bool resume)
 {
 #ifdef ENABLE_AUDIO_OUTPUT
-    dbgmsg("------ CD-ROM ", resume ? "resume" : "pause", " audio playback");
+    dbgmsg<LOG_SUBSYS_CDROM>("------ CD-ROM ", resume ? "resume" : "pause", " audio playback");
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     uint8_t target_id = img.getTargetId();
 
@@ -1679,7 +1731,7 @@ static void doPauseResumeAudio(bool resume)
         scsiDev.phase = STATUS;
     }
 #else
-    dbgmsg("---- Target does not support audio pausing");
+    dbgmsg<LOG_SUBSYS_CDROM>("---- Target does not support audio pausing");
     scsiDev.status = CHECK_CONDITION;
     scsiDev.target->sense.code = ILLEGAL_REQUEST; // assumed from PLAY AUDIO(10)
     scsiDev.target->sense.asc = 0x0000; // NO ADDITIONAL SENSE INFORMATION
@@ -1689,7 +1741,7 @@ static void doPauseResumeAudio(bool resume)
 
 static void doStopAudio()
 {
-    dbgmsg("------ CD-ROM Stop Audio request");
+    dbgmsg<LOG_SUBSYS_CDROM>("------ CD-ROM Stop Audio request");
 #ifdef ENABLE_AUDIO_OUTPUT
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     uint8_t target_id = img.getTargetId();
@@ -1770,7 +1822,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         trackinfo.sector_length = AUDIO_CD_SECTOR_LEN;
         trackinfo.track_mode = CUETrack_AUDIO;
         offset = ((int64_t)lba - 2 - trackinfo.file_start) * trackinfo.sector_length;
-        dbgmsg("------ Read CD Vendor Plextor (0xd8): ", (int)length, " sectors starting at ", (int)lba -2,
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Read CD Vendor Plextor (0xd8): ", (int)length, " sectors starting at ", (int)lba -2,
                ", sector size ", (int) AUDIO_CD_SECTOR_LEN,
                ", data offset in file ", (int)offset);
     }
@@ -1779,24 +1831,45 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         trackinfo.sector_length = AUDIO_CD_SECTOR_LEN;
         trackinfo.track_mode = CUETrack_AUDIO;
         offset = ((int64_t)lba - trackinfo.file_start) * trackinfo.sector_length;
-        dbgmsg("------ Read CD Vendor Apple CDROM 300 plus (0xd8): ", (int)length, " sectors starting at ", (int)lba,
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Read CD Vendor Apple CDROM 300 plus (0xd8): ", (int)length, " sectors starting at ", (int)lba,
                ", sector size ", (int) AUDIO_CD_SECTOR_LEN,
                ", data offset in file ", (int)offset);
     }
     else
     {
         offset = trackinfo.file_offset + trackinfo.sector_length * ((int64_t)lba - trackinfo.data_start);
-        dbgmsg("------ Read CD: ", (int)length, " sectors starting at ", (int)lba,
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Read CD: ", (int)length, " sectors starting at ", (int)lba,
             ", track number ", trackinfo.track_number, ", track mode ", (int) trackinfo.track_mode,", sector size ", (int)trackinfo.sector_length,
             ", main channel ", main_channel, ", sub channel ", sub_channel,
             ", data offset in file ", (int)offset);
     }
 
+    // Audio tracks stored as WAVE or FLAC are read through the decoder
+    FsFile *audio_src = nullptr;
+    uint64_t image_size = img.file.size();
+    if (trackinfo.track_mode == CUETrack_AUDIO && img.cuesheetfile.isOpen())
+    {
+        audio_file_info_t audio_info;
+        FsFile *fsfile = img.file.getFsFile();
+        if (fsfile && audio_file_probe(*fsfile, &audio_info) && audio_info.container != AUDIO_CONTAINER_RAW)
+        {
+            audio_src = fsfile;
+            image_size = audio_info.pcm_size;
+#ifdef ENABLE_AUDIO_OUTPUT
+            // The FLAC decoder is shared with playback on all targets
+            for (uint8_t id = 0; id < S2S_MAX_TARGETS && audio_info.container == AUDIO_CONTAINER_FLAC; id++)
+            {
+                if (audio_is_playing(id)) audio_stop(id);
+            }
+#endif
+        }
+    }
+
     // Ensure read is not out of range of the image
     uint32_t total_length = length;
     if (track_end_lba > lba && length > track_end_lba - lba)
     {
-        dbgmsg("------ Splitting read request at track boundary");
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Splitting read request at track boundary");
         length = track_end_lba - lba;
     }
     uint64_t readend = offset + trackinfo.sector_length * length;
@@ -1805,14 +1878,14 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         // It doesn't really matter what data we give for the unstored pregap
         offset = 0;
     }
-    else if (readend > img.file.size())
+    else if (readend > image_size)
     {
-        uint32_t sectors_available = (img.file.size() - offset) / trackinfo.sector_length;
+        uint32_t sectors_available = (image_size - offset) / trackinfo.sector_length;
         if (!img.file.isFolder() || sectors_available == 0)
         {
             // This is really past the end of the CD
             logmsg("WARNING: Host attempted CD read at sector ", lba, "+", length,
-              ", exceeding image size ", img.file.size());
+              ", exceeding image size ", image_size);
             scsiDev.status = CHECK_CONDITION;
             scsiDev.target->sense.code = ILLEGAL_REQUEST;
             scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
@@ -1822,7 +1895,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         else
         {
             // Read as much as we can and continue with next file
-            dbgmsg("------ Splitting read request at image file end");
+            dbgmsg<LOG_SUBSYS_CDROM>("------ Splitting read request at image file end");
             length = sectors_available;
         }
     }
@@ -1851,7 +1924,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
 
         if (!sector_type_ok)
         {
-            dbgmsg("---- Failed sector type check, host requested ", (int)sector_type, " CUE file has ", (int)trackinfo.track_mode);
+            dbgmsg<LOG_SUBSYS_CDROM>("---- Failed sector type check, host requested ", (int)sector_type, " CUE file has ", (int)trackinfo.track_mode);
             scsiDev.status = CHECK_CONDITION;
             scsiDev.target->sense.code = ILLEGAL_REQUEST;
             scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
@@ -1887,7 +1960,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         // Transfer 2048 bytes of data from file and fake the headers
         sector_length = 2048;
         add_fake_headers = true;
-        dbgmsg("------ Host requested ECC data but image file lacks it, replacing with zeros");
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Host requested ECC data but image file lacks it, replacing with zeros");
     }
     else if (trackinfo.track_mode == CUETrack_MODE1_2352 && main_channel == 0x10)
     {
@@ -1907,7 +1980,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
     }
     else
     {
-        dbgmsg("---- Unsupported channel request for track type ", (int)trackinfo.track_mode);
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Unsupported channel request for track type ", (int)trackinfo.track_mode);
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
@@ -1917,7 +1990,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
 
     if (data_only && sector_length != 2048)
     {
-        dbgmsg("------ Host tried to read non-data sector with standard READ command");
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Host tried to read non-data sector with standard READ command");
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = 0x6400; // ILLEGAL MODE FOR THIS TRACK
@@ -1933,7 +2006,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
     }
     else if (sub_channel != 0)
     {
-        dbgmsg("---- Unsupported subchannel request");
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Unsupported subchannel request");
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
@@ -1962,7 +2035,17 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         scsiDev.phase = STATUS;
     };
 
-    if (sequential_file_read && !img.file.seek(offset))
+    auto readSector = [&](uint32_t idx, uint8_t *dst) -> bool
+    {
+        if (audio_src)
+        {
+            uint64_t pos = offset + (uint64_t)idx * trackinfo.sector_length + skip_begin;
+            return audio_file_read_pcm(*audio_src, pos, dst, sector_length) == sector_length;
+        }
+        return img.file.read(dst, sector_length) == sector_length;
+    };
+
+    if (sequential_file_read && !audio_src && !img.file.seek(offset))
     {
         failRead("seek", lba);
         return;
@@ -1974,7 +2057,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
         platform_poll();
         diskEjectButtonUpdate(false);
 
-        if (!sequential_file_read && sector_length > 0 &&
+        if (!sequential_file_read && !audio_src && sector_length > 0 &&
             !img.file.seek(offset + idx * trackinfo.sector_length + skip_begin))
         {
             failRead("seek", lba + idx);
@@ -2001,7 +2084,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
             if (sector_length > 0)
             {
                 // User data
-                if (img.file.read(buf, sector_length) != sector_length)
+                if (!readSector(idx, buf))
                 {
                     failRead("read", lba + idx);
                     return;
@@ -2030,7 +2113,7 @@ static void doReadCD(uint32_t lba, uint32_t length, uint8_t sector_type,
             if (sector_length > 0)
             {
                 // User data
-                if (img.file.read(buf, sector_length) != sector_length)
+                if (!readSector(idx, buf))
                 {
                     failRead("read", lba + idx);
                     return;
@@ -2097,7 +2180,7 @@ static void doReadSubchannel(bool time, bool subq, uint8_t parameter, uint8_t tr
         uint8_t audiostatus;
         uint32_t lba = 0;
         cdromGetAudioPlaybackStatus(&audiostatus, &lba, false);
-        dbgmsg("------ Get audio playback position: status ", (int)audiostatus, " lba ", (int)lba);
+        dbgmsg<LOG_SUBSYS_CDROM>("------ Get audio playback position: status ", (int)audiostatus, " lba ", (int)lba);
 
         // Fetch current track info
         image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
@@ -2122,7 +2205,7 @@ static void doReadSubchannel(bool time, bool subq, uint8_t parameter, uint8_t tr
             {
                 *buf++ = 0;
                 LBA2MSF(lba, buf, false);
-                dbgmsg("------ ABS M ", *buf, " S ", *(buf+1), " F ", *(buf+2));
+                dbgmsg<LOG_SUBSYS_CDROM>("------ ABS M ", *buf, " S ", *(buf+1), " F ", *(buf+2));
                 buf += 3;
             }
             else
@@ -2138,7 +2221,7 @@ static void doReadSubchannel(bool time, bool subq, uint8_t parameter, uint8_t tr
             {
                 *buf++ = 0;
                 LBA2MSF(relpos, buf, true);
-                dbgmsg("------ REL M ", *buf, " S ", *(buf+1), " F ", *(buf+2));
+                dbgmsg<LOG_SUBSYS_CDROM>("------ REL M ", *buf, " S ", *(buf+1), " F ", *(buf+2));
                 buf += 3;
             }
             else
@@ -2164,7 +2247,7 @@ static void doReadSubchannel(bool time, bool subq, uint8_t parameter, uint8_t tr
     }
     else
     {
-        dbgmsg("---- Unsupported subchannel request");
+        dbgmsg<LOG_SUBSYS_CDROM>("---- Unsupported subchannel request");
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
         scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
@@ -2188,7 +2271,7 @@ static bool doReadCapacity(uint32_t lba, uint8_t pmi)
             // potentially consider treating either out-of-bounds or PMI set as an error
             // for now just ignore this
         }
-        dbgmsg("----- Reporting capacity as ", capacity);
+        dbgmsg<LOG_SUBSYS_CDROM>("----- Reporting capacity as ", capacity);
     }
     else
     {
@@ -2222,327 +2305,388 @@ static void doAppleD8(uint32_t lba, uint32_t blocks)
 /* CD-ROM command dispatching         */
 /**************************************/
 
-// Handle direct-access scsi device commands
-extern "C" int scsiCDRomCommand()
+static int cdromCommandStartStop(image_config_t &img)
 {
-    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    int commandHandled = 1;
-
-    uint8_t command = scsiDev.cdb[0];
     // Start/stop command
-    if (command == 0x1B)
-    {
 #ifdef ENABLE_AUDIO_OUTPUT
-        // terminate audio playback if active on this target (MMC-1 Annex C)
-        audio_stop(img.getTargetId());
+    // terminate audio playback if active on this target (MMC-1 Annex C)
+    audio_stop(img.getTargetId());
 #endif
-        if (scsiDev.cdb[4] & LOAD_EJECT_BIT)
-        {
-            // CD-ROM load & eject
-            if (scsiDev.cdb[4] & START_STOP_BIT)
-            {
-                cdromCloseTray(img);
-            }
-            else
-            {
-                // Eject and switch image
-                cdromPerformEject(img);
-            }
-        }
-    }
-    else if (command == 0x25)
+    if (scsiDev.cdb[4] & LOAD_EJECT_BIT)
     {
-        // READ CAPACITY
-        uint8_t reladdr = scsiDev.cdb[1] & 1;
-        uint32_t lba = (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint8_t pmi = scsiDev.cdb[8] & 1;
-
-        // allow PMI as long as LBA is specified, this is permitted in SCSI-2
-        // we don't link commands, do not allow RELADDR
-        if ((!pmi && lba != 0) || reladdr)
+        // CD-ROM load & eject
+        if (scsiDev.cdb[4] & START_STOP_BIT)
         {
-            scsiDev.status = CHECK_CONDITION;
-            scsiDev.target->sense.code = ILLEGAL_REQUEST;
-            scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
-            scsiDev.phase = STATUS;
+            cdromCloseTray(img);
         }
         else
         {
-            if (!doReadCapacity(lba, pmi))
-            {
-                // allow disk handler to resolve this one
-                commandHandled = 0;
-            }
+            // Eject and switch image
+            cdromPerformEject(img);
         }
     }
-    else if (command == 0x43)
-    {
-        // CD-ROM Read TOC
-        bool MSF = (scsiDev.cdb[1] & 0x02);
-        uint8_t track = scsiDev.cdb[6];
-        uint16_t allocationLength =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
+    return 1;
+}
 
-        // The "format" field is reserved for SCSI-2
-        uint8_t format = scsiDev.cdb[2] & 0x0F;
+static int cdromCommandReadCapacity(image_config_t &img)
+{
+    // READ CAPACITY
+    uint8_t reladdr = scsiDev.cdb[1] & 1;
+    uint32_t lba = (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint8_t pmi = scsiDev.cdb[8] & 1;
+
+    // allow PMI as long as LBA is specified, this is permitted in SCSI-2
+    // we don't link commands, do not allow RELADDR
+    if ((!pmi && lba != 0) || reladdr)
+    {
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
+    }
+    else if (!doReadCapacity(lba, pmi))
+    {
+        // allow disk handler to resolve this one
+        return 0;
+    }
+    return 1;
+}
 
-        bool useBCD = false;
+static int cdromCommandReadTOC(image_config_t &img)
+{
+    // CD-ROM Read TOC
+    bool MSF = (scsiDev.cdb[1] & 0x02);
+    uint8_t track = scsiDev.cdb[6];
+    uint16_t allocationLength =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+
+    // The "format" field is reserved for SCSI-2
+    uint8_t format = scsiDev.cdb[2] & 0x0F;
+
+    bool useBCD = false;
+
+    if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE)
+    {
+        // Matshita SCSI-2 drives appear to use the high 2 bits of the CDB
+        // control byte to switch on session info (0x40) and full toc (0x80)
+        // responses that are very similar to the standard formats described
+        // in MMC-1. These vendor flags must have been pretty common because
+        // even a modern SATA drive (ASUS DRW-24B1ST j) responds to them
+        // (though it always replies in hex rather than bcd)
+        //
+        // The session information page is identical to MMC. The full TOC page
+        // is identical _except_ it returns addresses in bcd rather than hex.
 
-        if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE)
+        if (format == 0 && scsiDev.cdb[9] == 0x80)
         {
-            // Matshita SCSI-2 drives appear to use the high 2 bits of the CDB
-            // control byte to switch on session info (0x40) and full toc (0x80)
-            // responses that are very similar to the standard formats described
-            // in MMC-1. These vendor flags must have been pretty common because
-            // even a modern SATA drive (ASUS DRW-24B1ST j) responds to them
-            // (though it always replies in hex rather than bcd)
-            //
-            // The session information page is identical to MMC. The full TOC page
-            // is identical _except_ it returns addresses in bcd rather than hex.
-
-            if (format == 0 && scsiDev.cdb[9] == 0x80)
-            {
-                format = 2;
-                useBCD = true;
-            }
-            else if (format == 0 && scsiDev.cdb[9] == 0x40)
-            {
-                format = 1;
-            }
+            format = 2;
+            useBCD = true;
         }
-
-        switch (format)
+        else if (format == 0 && scsiDev.cdb[9] == 0x40)
         {
-            case 0: doReadTOC(MSF, track, allocationLength); break; // SCSI-2
-            case 1: doReadSessionInfo(MSF, allocationLength); break; // MMC2
-            case 2: doReadFullTOC(track, allocationLength, useBCD); break; // MMC2
-            default:
-            {
-                scsiDev.status = CHECK_CONDITION;
-                scsiDev.target->sense.code = ILLEGAL_REQUEST;
-                scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
-                scsiDev.phase = STATUS;
-            }
+            format = 1;
         }
     }
-    else if (command == 0x44)
-    {
-        // CD-ROM Read Header
-        bool MSF = (scsiDev.cdb[1] & 0x02);
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint16_t allocationLength =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
-        doReadHeader(MSF, lba, allocationLength);
-    }
-    else if (command == 0x46)
-    {
-        // GET CONFIGURATION
-        uint8_t rt = (scsiDev.cdb[1] & 0x03);
-        uint16_t startFeature =
-            (((uint16_t) scsiDev.cdb[2]) << 8) +
-            scsiDev.cdb[3];
-        uint16_t allocationLength =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
-        doGetConfiguration(rt, startFeature, allocationLength);
-    }
-    else if (command == 0x51)
-    {
-        uint16_t allocationLength =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
-        doReadDiscInformation(allocationLength);
-    }
-    else if (command == 0x52)
-    {
-        // READ TRACK INFORMATION
-        bool track = (scsiDev.cdb[1] & 0x01);
-        uint32_t lba = (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint16_t allocationLength =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
-        doReadTrackInformation(track, lba, allocationLength);
-    }
-    else if (command == 0x4A)
+
+    switch (format)
     {
-        // Get event status notifications (media change notifications)
-        bool immed = scsiDev.cdb[1] & 1;
-        doGetEventStatusNotification(immed);
+        case 0: doReadTOC(MSF, track, allocationLength); break; // SCSI-2
+        case 1: doReadSessionInfo(MSF, allocationLength); break; // MMC2
+        case 2: doReadFullTOC(track, allocationLength, useBCD); break; // MMC2
+        default:
+        {
+            scsiDev.status = CHECK_CONDITION;
+            scsiDev.target->sense.code = ILLEGAL_REQUEST;
+            scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+            scsiDev.phase = STATUS;
+        }
     }
-    else if (command == 0x45)
-    {
-        // PLAY AUDIO (10)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
+    return 1;
+}
 
-        doPlayAudio(lba, blocks);
-    }
-    else if (command == 0xA5)
-    {
-        // PLAY AUDIO (12)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[6]) << 24) +
-            (((uint32_t) scsiDev.cdb[7]) << 16) +
-            (((uint32_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
+static int cdromCommandReadHeader(image_config_t &img)
+{
+    // CD-ROM Read Header
+    bool MSF = (scsiDev.cdb[1] & 0x02);
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint16_t allocationLength =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+    doReadHeader(MSF, lba, allocationLength);
+    return 1;
+}
 
-        doPlayAudio(lba, blocks);
-    }
-    else if (command == 0x47)
-    {
-        // PLAY AUDIO (MSF)
-        uint32_t start = MSF2LBA(scsiDev.cdb[3], scsiDev.cdb[4], scsiDev.cdb[5], false);
-        uint32_t end   = MSF2LBA(scsiDev.cdb[6], scsiDev.cdb[7], scsiDev.cdb[8], false);
+static int cdromCommandGetConfiguration(image_config_t &img)
+{
+    // GET CONFIGURATION
+    uint8_t rt = (scsiDev.cdb[1] & 0x03);
+    uint16_t startFeature =
+        (((uint16_t) scsiDev.cdb[2]) << 8) +
+        scsiDev.cdb[3];
+    uint16_t allocationLength =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+    doGetConfiguration(rt, startFeature, allocationLength);
+    return 1;
+}
 
-        uint32_t lba = start;
-        if (scsiDev.cdb[3] == 0xFF
-                && scsiDev.cdb[4] == 0xFF
-                && scsiDev.cdb[5] == 0xFF)
-        {
-            // request to start playback from 'current position'
-#ifdef ENABLE_AUDIO_OUTPUT
-            lba = 0xFFFFFFFF;
-#endif
-        }
+static int cdromCommandReadDiscInformation(image_config_t &img)
+{
+    // READ DISC INFORMATION
+    uint16_t allocationLength =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+    doReadDiscInformation(allocationLength);
+    return 1;
+}
 
-        uint32_t length = end - lba;
-        doPlayAudio(lba, length);
-    }
-    else if (command == 0x48)
-    {
-        // PLAY AUDIO (Track/Index)
-        uint8_t start_track = scsiDev.cdb[4];
-        uint8_t start_index = scsiDev.cdb[5];
-        uint8_t end_track   = scsiDev.cdb[7];
-        uint8_t end_index   = scsiDev.cdb[8];
+static int cdromCommandReadTrackInformation(image_config_t &img)
+{
+    // READ TRACK INFORMATION
+    bool track = (scsiDev.cdb[1] & 0x01);
+    uint32_t lba = (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint16_t allocationLength =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+    doReadTrackInformation(track, lba, allocationLength);
+    return 1;
+}
 
-        doPlayAudioTrackIndex(start_track, start_index, end_track, end_index);
+static int cdromCommandGetEventStatus(image_config_t &img)
+{
+    // Get event status notifications (media change notifications)
+    bool immed = scsiDev.cdb[1] & 1;
+    doGetEventStatusNotification(immed);
+    return 1;
+}
 
-    }
-    else if (command == 0x4B)
-    {
-        // PAUSE/RESUME AUDIO
-        doPauseResumeAudio(scsiDev.cdb[8] & 1);
-    }
-    else if (command == 0xBD)
-    {
-        // Mechanism status
-        uint16_t allocationLength = (((uint32_t) scsiDev.cdb[8]) << 8) + scsiDev.cdb[9];
-        doMechanismStatus(allocationLength);
-    }
-    else if (command == 0xBB)
+static int cdromCommandPlayAudio10(image_config_t &img)
+{
+    // PLAY AUDIO (10)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+
+    doPlayAudio(lba, blocks);
+    return 1;
+}
+
+static int cdromCommandPlayAudio12(image_config_t &img)
+{
+    // PLAY AUDIO (12)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 24) +
+        (((uint32_t) scsiDev.cdb[7]) << 16) +
+        (((uint32_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+
+    doPlayAudio(lba, blocks);
+    return 1;
+}
+
+static int cdromCommandPlayAudioMSF(image_config_t &img)
+{
+    // PLAY AUDIO (MSF)
+    uint32_t start = MSF2LBA(scsiDev.cdb[3], scsiDev.cdb[4], scsiDev.cdb[5], false);
+    uint32_t end   = MSF2LBA(scsiDev.cdb[6], scsiDev.cdb[7], scsiDev.cdb[8], false);
+
+    uint32_t lba = start;
+    if (scsiDev.cdb[3] == 0xFF
+            && scsiDev.cdb[4] == 0xFF
+            && scsiDev.cdb[5] == 0xFF)
     {
-        // Set CD speed (just ignored)
-        scsiDev.status = 0;
-        scsiDev.phase = STATUS;
+        // request to start playback from 'current position'
+#ifdef ENABLE_AUDIO_OUTPUT
+        lba = 0xFFFFFFFF;
+#endif
     }
-    else if (command == 0xBE)
-    {
-        // ReadCD (in low level format)
-        uint8_t sector_type = (scsiDev.cdb[1] >> 2) & 7;
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[6]) << 16) +
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            (((uint32_t) scsiDev.cdb[8]));
-        uint8_t main_channel = scsiDev.cdb[9];
-        uint8_t sub_channel = scsiDev.cdb[10];
 
-        doReadCD(lba, blocks, sector_type, main_channel, sub_channel, false);
-    }
-    else if (command == 0xB9)
-    {
-        // ReadCD MSF
-        uint8_t sector_type = (scsiDev.cdb[1] >> 2) & 7;
-        uint32_t start = MSF2LBA(scsiDev.cdb[3], scsiDev.cdb[4], scsiDev.cdb[5], false);
-        uint32_t end   = MSF2LBA(scsiDev.cdb[6], scsiDev.cdb[7], scsiDev.cdb[8], false);
-        uint8_t main_channel = scsiDev.cdb[9];
-        uint8_t sub_channel = scsiDev.cdb[10];
+    uint32_t length = end - lba;
+    doPlayAudio(lba, length);
+    return 1;
+}
 
-        doReadCD(start, end - start, sector_type, main_channel, sub_channel, false);
-    }
-    else if (command == 0x42)
-    {
-        // Read subchannel data
-        bool time = (scsiDev.cdb[1] & 0x02);
-        bool subq = (scsiDev.cdb[2] & 0x40);
-        uint8_t parameter = scsiDev.cdb[3];
-        uint8_t track_number = scsiDev.cdb[6];
-        uint16_t allocationLength = (((uint32_t) scsiDev.cdb[7]) << 8) + scsiDev.cdb[8];
+static int cdromCommandPlayAudioTrackIndex(image_config_t &img)
+{
+    // PLAY AUDIO (Track/Index)
+    uint8_t start_track = scsiDev.cdb[4];
+    uint8_t start_index = scsiDev.cdb[5];
+    uint8_t end_track   = scsiDev.cdb[7];
+    uint8_t end_index   = scsiDev.cdb[8];
+
+    doPlayAudioTrackIndex(start_track, start_index, end_track, end_index);
+    return 1;
+}
 
-        doReadSubchannel(time, subq, parameter, track_number, allocationLength);
-    }
-    else if (command == 0x08)
-    {
-        // READ(6) for CDs (may need sector translation for cue file handling)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
-            (((uint32_t) scsiDev.cdb[2]) << 8) +
-            scsiDev.cdb[3];
-        uint32_t blocks = scsiDev.cdb[4];
-        if (blocks == 0) blocks = 256;
+static int cdromCommandPauseResume(image_config_t &img)
+{
+    // PAUSE/RESUME AUDIO
+    doPauseResumeAudio(scsiDev.cdb[8] & 1);
+    return 1;
+}
 
-        doReadCD(lba, blocks, 0, 0x10, 0, true);
-    }
-    else if (command == 0x28)
-    {
-        // READ(10) for CDs (may need sector translation for cue file handling)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
+static int cdromCommandMechanismStatus(image_config_t &img)
+{
+    // Mechanism status
+    uint16_t allocationLength = (((uint32_t) scsiDev.cdb[8]) << 8) + scsiDev.cdb[9];
+    doMechanismStatus(allocationLength);
+    return 1;
+}
 
-        doReadCD(lba, blocks, 0, 0x10, 0, true);
-    }
-    else if (command == 0xA8)
-    {
-        // READ(12) for CDs (may need sector translation for cue file handling)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[6]) << 24) +
-            (((uint32_t) scsiDev.cdb[7]) << 16) +
-            (((uint32_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
+static int cdromCommandSetSpeed(image_config_t &img)
+{
+    // Set CD speed (just ignored)
+    scsiDev.status = 0;
+    scsiDev.phase = STATUS;
+    return 1;
+}
 
-        doReadCD(lba, blocks, 0, 0x10, 0, true);
-    }
-    else if (unlikely(scsiDev.target->cfg->vendorExtensions & VENDOR_EXTENSION_OPTICAL_PLEXTOR) && 
-            command == 0xD8)
+static int cdromCommandReadCD(image_config_t &img)
+{
+    // ReadCD (in low level format)
+    uint8_t sector_type = (scsiDev.cdb[1] >> 2) & 7;
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 16) +
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        (((uint32_t) scsiDev.cdb[8]));
+    uint8_t main_channel = scsiDev.cdb[9];
+    uint8_t sub_channel = scsiDev.cdb[10];
+
+    doReadCD(lba, blocks, sector_type, main_channel, sub_channel, false);
+    return 1;
+}
+
+static int cdromCommandReadCDMSF(image_config_t &img)
+{
+    // ReadCD MSF
+    uint8_t sector_type = (scsiDev.cdb[1] >> 2) & 7;
+    uint32_t start = MSF2LBA(scsiDev.cdb[3], scsiDev.cdb[4], scsiDev.cdb[5], false);
+    uint32_t end   = MSF2LBA(scsiDev.cdb[6], scsiDev.cdb[7], scsiDev.cdb[8], false);
+    uint8_t main_channel = scsiDev.cdb[9];
+    uint8_t sub_channel = scsiDev.cdb[10];
+
+    doReadCD(start, end - start, sector_type, main_channel, sub_channel, false);
+    return 1;
+}
+
+static int cdromCommandReadSubchannel(image_config_t &img)
+{
+    // Read subchannel data
+    bool time = (scsiDev.cdb[1] & 0x02);
+    bool subq = (scsiDev.cdb[2] & 0x40);
+    uint8_t parameter = scsiDev.cdb[3];
+    uint8_t track_number = scsiDev.cdb[6];
+    uint16_t allocationLength = (((uint32_t) scsiDev.cdb[7]) << 8) + scsiDev.cdb[8];
+
+    doReadSubchannel(time, subq, parameter, track_number, allocationLength);
+    return 1;
+}
+
+static int cdromCommandRead6(image_config_t &img)
+{
+    // READ(6) for CDs (may need sector translation for cue file handling)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
+        (((uint32_t) scsiDev.cdb[2]) << 8) +
+        scsiDev.cdb[3];
+    uint32_t blocks = scsiDev.cdb[4];
+    if (blocks == 0) blocks = 256;
+
+    doReadCD(lba, blocks, 0, 0x10, 0, true);
+    return 1;
+}
+
+static int cdromCommandRead10(image_config_t &img)
+{
+    // READ(10) for CDs (may need sector translation for cue file handling)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+
+    doReadCD(lba, blocks, 0, 0x10, 0, true);
+    return 1;
+}
+
+static int cdromCommandRead12(image_config_t &img)
+{
+    // READ(12) for CDs (may need sector translation for cue file handling)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 24) +
+        (((uint32_t) scsiDev.cdb[7]) << 16) +
+        (((uint32_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+
+    doReadCD(lba, blocks, 0, 0x10, 0, true);
+    return 1;
+}
+
+static int cdromCommandStopPlay(image_config_t &img)
+{
+    // STOP PLAY/SCAN
+    doStopAudio();
+    scsiDev.status = 0;
+    scsiDev.phase = STATUS;
+    return 1;
+}
+
+static int cdromCommandRezero(image_config_t &img)
+{
+    // REZERO UNIT
+    // AppleCD Audio Player uses this as a nonstandard
+    // "stop audio playback" command
+    doStopAudio();
+    scsiDev.status = 0;
+    scsiDev.phase = STATUS;
+    return 1;
+}
+
+static int cdromCommandSeek(image_config_t &img)
+{
+    // SEEK
+    // implement Annex C termination requirement and pass to disk handler
+    doStopAudio();
+    return 0;
+}
+
+static int cdromCommandVendorD8(image_config_t &img)
+{
+    if (unlikely(scsiDev.target->cfg->vendorExtensions & VENDOR_EXTENSION_OPTICAL_PLEXTOR))
     {
         uint8_t lun = scsiDev.cdb[1] & 0x7;
         uint8_t subcode = scsiDev.cdb[10];
@@ -2577,46 +2721,7 @@ extern "C" int scsiCDRomCommand()
             doReadPlextorD8(lba, blocks);
         }
     }
-    else if (command == 0x4E)
-    {
-        // STOP PLAY/SCAN
-        doStopAudio();
-        scsiDev.status = 0;
-        scsiDev.phase = STATUS;
-    }
-    else if (command == 0x01)
-    {
-        // REZERO UNIT
-        // AppleCD Audio Player uses this as a nonstandard
-        // "stop audio playback" command
-        doStopAudio();
-        scsiDev.status = 0;
-        scsiDev.phase = STATUS;
-    }
-    else if (command == 0x0B || command == 0x2B)
-    {
-        // SEEK
-        // implement Annex C termination requirement and pass to disk handler
-        doStopAudio();
-        commandHandled = 0;
-    }
-    else if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE
-            && command == 0xCD)
-    {
-        // vendor-specific command issued by the AppleCD Audio Player in
-        // response to fast-forward or rewind commands. Might be seek,
-        // might be reposition. Exact MSF value below is unknown.
-        //
-        // Byte 0: 0xCD
-        // Byte 1: 0x10 for rewind, 0x00 for fast-forward
-        // Byte 2: 0x00
-        // Byte 3: 'M' in hex
-        // Byte 4: 'S' in hex
-        // Byte 5: 'F' in hex
-        commandHandled = 0;
-    }
-    else if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE
-            && command == 0xD8)
+    else if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE)
     {
         // vendor-specific command for Apple 300 plus
         // plays CD audio over the SCSI bus
@@ -2633,39 +2738,102 @@ extern "C" int scsiCDRomCommand()
         uint8_t sub_sector_type = scsiDev.cdb[10];
         if (sub_sector_type != 0)
         {
-            dbgmsg("For Apple CD-ROM 0xD8 command, only 2352 sector length supported (type 0), got subsector type: ", sub_sector_type);
+            dbgmsg<LOG_SUBSYS_CDROM>("For Apple CD-ROM 0xD8 command, only 2352 sector length supported (type 0), got subsector type: ", sub_sector_type);
         }
         doAppleD8(lba, blocks);
     }
-    else if (scsiDev.target->cfg->quirks == S2S_CFG_QUIRKS_APPLE
-            && command == 0xD9)
+    else
     {
-        // vendor-specific command for Apple 300 plus
-        // plays CD audio over the SCSI bus using MSF
+        return 0;
+    }
+    return 1;
+}
 
-        uint8_t m = scsiDev.cdb[3];
-        uint8_t s = scsiDev.cdb[4];
-        uint8_t f = scsiDev.cdb[5];
-        uint32_t lba = MSF2LBA(m, s, f, false);
+static int cdromCommandAppleD9(image_config_t &img)
+{
+    if (scsiDev.target->cfg->quirks != S2S_CFG_QUIRKS_APPLE)
+    {
+        return 0;
+    }
 
-        m = scsiDev.cdb[7];
-        s = scsiDev.cdb[8];
-        f = scsiDev.cdb[9];
-        uint32_t blocks = MSF2LBA(m, s, f, false) - lba;
-        uint8_t sub_sector_type = scsiDev.cdb[10];
-        if (sub_sector_type != 0)
-        {
-            dbgmsg("For Apple CD-ROM 0xD9 command, only 2352 sector length supported (type 0), got subsector type: ", sub_sector_type);
-        }
+    // vendor-specific command for Apple 300 plus
+    // plays CD audio over the SCSI bus using MSF
 
-        doAppleD8(lba, blocks);
-    }
-    else
+    uint8_t m = scsiDev.cdb[3];
+    uint8_t s = scsiDev.cdb[4];
+    uint8_t f = scsiDev.cdb[5];
+    uint32_t lba = MSF2LBA(m, s, f, false);
+
+    m = scsiDev.cdb[7];
+    s = scsiDev.cdb[8];
+    f = scsiDev.cdb[9];
+    uint32_t blocks = MSF2LBA(m, s, f, false) - lba;
+    uint8_t sub_sector_type = scsiDev.cdb[10];
+    if (sub_sector_type != 0)
     {
-        commandHandled = 0;
+        dbgmsg<LOG_SUBSYS_CDROM>("For Apple CD-ROM 0xD9 command, only 2352 sector length supported (type 0), got subsector type: ", sub_sector_type);
     }
 
-    return commandHandled;
+    doAppleD8(lba, blocks);
+    return 1;
+}
+
+static int cdromCommandAppleCD(image_config_t &img)
+{
+    // vendor-specific command issued by the AppleCD Audio Player in
+    // response to fast-forward or rewind commands. Might be seek,
+    // might be reposition. Exact MSF value below is unknown.
+    //
+    // Byte 0: 0xCD
+    // Byte 1: 0x10 for rewind, 0x00 for fast-forward
+    // Byte 2: 0x00
+    // Byte 3: 'M' in hex
+    // Byte 4: 'S' in hex
+    // Byte 5: 'F' in hex
+    return 0;
+}
+
+// Commands that read from the disc are rejected while the tray is open.
+// The vendor commands have no flags, they pass through on drives without
+// the matching quirk.
+static constexpr scsi_opcode_t g_cdrom_opcodes[] = {
+    {0x08, OPCODE_NEEDS_MEDIUM, cdromCommandRead6},
+    {0x28, OPCODE_NEEDS_MEDIUM, cdromCommandRead10},
+    {0xA8, OPCODE_NEEDS_MEDIUM, cdromCommandRead12},
+    {0xBE, OPCODE_NEEDS_MEDIUM, cdromCommandReadCD},
+    {0xB9, OPCODE_NEEDS_MEDIUM, cdromCommandReadCDMSF},
+    {0x45, OPCODE_NEEDS_MEDIUM, cdromCommandPlayAudio10},
+    {0xA5, OPCODE_NEEDS_MEDIUM, cdromCommandPlayAudio12},
+    {0x47, OPCODE_NEEDS_MEDIUM, cdromCommandPlayAudioMSF},
+    {0x48, OPCODE_NEEDS_MEDIUM, cdromCommandPlayAudioTrackIndex},
+    {0x1B, 0, cdromCommandStartStop},
+    {0x25, 0, cdromCommandReadCapacity},
+    {0x43, 0, cdromCommandReadTOC},
+    {0x44, 0, cdromCommandReadHeader},
+    {0x46, 0, cdromCommandGetConfiguration},
+    {0x51, 0, cdromCommandReadDiscInformation},
+    {0x52, 0, cdromCommandReadTrackInformation},
+    {0x4A, 0, cdromCommandGetEventStatus},
+    {0x4B, 0, cdromCommandPauseResume},
+    {0xBD, 0, cdromCommandMechanismStatus},
+    {0xBB, 0, cdromCommandSetSpeed},
+    {0x42, 0, cdromCommandReadSubchannel},
+    {0x4E, 0, cdromCommandStopPlay},
+    {0x01, 0, cdromCommandRezero},
+    {0x0B, 0, cdromCommandSeek},
+    {0x2B, 0, cdromCommandSeek},
+    {0xCD, 0, cdromCommandAppleCD},
+    {0xD8, 0, cdromCommandVendorD8},
+    {0xD9, 0, cdromCommandAppleD9},
+};
+
+static constexpr scsi_opcode_table_t g_cdrom_opcode_table = scsiOpcodeTable(g_cdrom_opcodes);
+
+// Handle direct-access scsi device commands
+extern "C" int scsiCDRomCommand()
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    return scsiOpcodeDispatch(g_cdrom_opcode_table, img);
 }
 
 #ifdef UNIT_TEST
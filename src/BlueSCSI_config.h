@@ -90,7 +90,7 @@
 #else
 #define NUM_SCSIID  8          // Maximum number of supported SCSI-IDs (The minimum is 0)
 #endif
-#define NUM_SCSILUN 1          // Maximum number of LUNs supported     (Currently has to be 1)
+#define NUM_SCSILUN 8          // Maximum number of LUNs supported     (LUN 1-7 memory is allocated on demand)
 
 // SCSI raw fallback configuration when no image files are detected
 // Presents the whole SD card as an SCSI drive
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Shared CRC32 (IEEE 802.3 / PKZIP polynomial) implementation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_crc32.h"
+
+#if CRC32_SLICE_BY != 1 && CRC32_SLICE_BY != 4 && CRC32_SLICE_BY != 8
+#error CRC32_SLICE_BY must be 1, 4 or 8
+#endif
+
+#define CRC32_POLY 0xEDB88320UL
+
+// Lookup tables are generated at compile time.
+// table[0] is the classic byte-wise table, table[n] advances a byte
+// through n additional zero bytes so that several input bytes can be
+// combined with independent lookups.
+struct crc32_tables_t
+{
+    uint32_t table[CRC32_SLICE_BY][256];
+};
+
+static constexpr crc32_tables_t crc32_make_tables()
+{
+    crc32_tables_t t = {};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? (CRC32_POLY ^ (c >> 1)) : (c >> 1);
+        }
+        t.table[0][i] = c;
+    }
+
+    for (int s = 1; s < CRC32_SLICE_BY; s++)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = t.table[s - 1][i];
+            t.table[s][i] = t.table[0][c & 0xFF] ^ (c >> 8);
+        }
+    }
+    return t;
+}
+
+#if CRC32_TABLE_IN_RAM
+__attribute__((section(".time_critical.crc32_table")))
+#endif
+static const crc32_tables_t g_crc32 = crc32_make_tables();
+
+#define T g_crc32.table
+
+extern "C" uint32_t crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t*)buf;
+    crc = ~crc;
+
+#if CRC32_SLICE_BY > 1
+    // Cortex-M0+ cannot do unaligned word loads, get to a word boundary first
+    while (len > 0 && ((uintptr_t)p & 3) != 0)
+    {
+        crc = T[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+
+    const uint32_t *w = (const uint32_t*)p;
+#if CRC32_SLICE_BY == 8
+    while (len >= 8)
+    {
+        uint32_t one = *w++ ^ crc;
+        uint32_t two = *w++;
+        crc = T[7][one & 0xFF] ^ T[6][(one >> 8) & 0xFF] ^
+              T[5][(one >> 16) & 0xFF] ^ T[4][one >> 24] ^
+              T[3][two & 0xFF] ^ T[2][(two >> 8) & 0xFF] ^
+              T[1][(two >> 16) & 0xFF] ^ T[0][two >> 24];
+        len -= 8;
+    }
+#endif
+    while (len >= 4)
+    {
+        uint32_t one = *w++ ^ crc;
+        crc = T[3][one & 0xFF] ^ T[2][(one >> 8) & 0xFF] ^
+              T[1][(one >> 16) & 0xFF] ^ T[0][one >> 24];
+        len -= 4;
+    }
+    p = (const uint8_t*)w;
+#endif
+
+    while (len--)
+    {
+        crc = T[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+extern "C" uint32_t crc32(const void *buf, size_t len)
+{
+    return crc32_update(0, buf, len);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Shared CRC32 (IEEE 802.3 / PKZIP polynomial) implementation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#ifndef BLUESCSI_CRC32_H
+#define BLUESCSI_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Number of bytes processed per table lookup round: 8, 4 or 1.
+ * Each slice costs 1 kB of lookup table. The bootloader defaults to the
+ * byte-wise variant to stay small, the main firmware to slice-by-8.
+ */
+#ifndef CRC32_SLICE_BY
+# ifdef BLUESCSI_BOOTLOADER_MAIN
+#  define CRC32_SLICE_BY 1
+# else
+#  define CRC32_SLICE_BY 8
+# endif
+#endif
+
+/*
+ * Set to 1 to place the lookup tables in RAM instead of flash.
+ * Avoids XIP cache misses on the network receive path at the cost of RAM.
+ */
+#ifndef CRC32_TABLE_IN_RAM
+#define CRC32_TABLE_IN_RAM 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Incremental CRC32, same convention as zlib crc32():
+ * start with crc = 0 and pass the previous return value to continue.
+ * The returned value is always the final (inverted) CRC of all data so far.
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+/* CRC32 of a single buffer */
+uint32_t crc32(const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLUESCSI_CRC32_H */
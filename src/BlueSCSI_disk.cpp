@@ -36,14 +36,18 @@
 #  include "BlueSCSI_audio.h"
 #endif
 #include "BlueSCSI_cdrom.h"
+#include "BlueSCSI_tape_image.h"
 #include "ImageBackingStore.h"
 #include "ROMDrive.h"
 #include "QuirksCheck.h"
 #include "BlueSCSI_vhd.h"
+#include "BlueSCSI_sd_arbiter.h"
+#include "BlueSCSI_audio_file.h"
 #include <minIni.h>
 #include <string.h>
 #include <strings.h>
 #include <assert.h>
+#include <new>
 #include <SdFat.h>
 
 extern "C" {
@@ -51,6 +55,7 @@ extern "C" {
 #include <sd.h>
 #include <mode.h>
 #include <scsi.h>
+#include <network.h>
 }
 
 #ifndef PLATFORM_MAX_SCSI_SPEED
@@ -152,6 +157,8 @@ int scsiDecodeID(char c)
 // one path but out of bounds in the other.
 static_assert(NUM_SCSIID == S2S_MAX_TARGETS,
               "NUM_SCSIID and S2S_MAX_TARGETS must match");
+static_assert(NUM_SCSILUN >= 1 && NUM_SCSILUN <= S2S_MAX_LUNS,
+              "NUM_SCSILUN must be between 1 and S2S_MAX_LUNS");
 
 /************************************************/
 /* ROM drive support (in microcontroller flash) */
@@ -171,7 +178,7 @@ bool scsiDiskActivateRomDrive()
     romdrive_hdr_t hdr = {};
     if (!romDriveCheckPresent(&hdr))
     {
-        dbgmsg("---- ROM drive image not detected");
+        dbgmsg<LOG_SUBSYS_DISK>("---- ROM drive image not detected");
         return false;
     }
 
@@ -221,17 +228,96 @@ SdDevice sdDev = {2, 256 * 1024 * 1024 * 2}; /* For SCSI2SD */
 
 image_config_t g_DiskImages[S2S_MAX_TARGETS];
 
+// Images for LUNs 1 and up. They are allocated when an image is opened for
+// the LUN, so targets with only LUN 0 don't use any memory for them.
+struct lun_unit_t
+{
+    image_config_t img;
+    LunState state;
+    char path[MAX_FILE_PATH * 2 + 2]; // Image file, for moving it to LUN 0
+};
+static lun_unit_t *g_lun_units[S2S_MAX_TARGETS][NUM_SCSILUN > 1 ? NUM_SCSILUN - 1 : 1];
+
+// LUN 0 state while another LUN of the target is loaded in scsiDev.targets[]
+static LunState *g_lun0_states[S2S_MAX_TARGETS];
+
+// Image for the LUN, allocated on first use. Returns nullptr if out of memory.
+static image_config_t *scsiDiskLunImage(int target_idx, int lun)
+{
+    if (lun == 0)
+    {
+        return &g_DiskImages[target_idx];
+    }
+    else if (lun < 0 || lun >= NUM_SCSILUN)
+    {
+        return nullptr;
+    }
+
+    lun_unit_t *&unit = g_lun_units[target_idx][lun - 1];
+    if (!unit)
+    {
+        if (!g_lun0_states[target_idx])
+        {
+            g_lun0_states[target_idx] = new (std::nothrow) LunState();
+        }
+
+        if (g_lun0_states[target_idx])
+        {
+            unit = new (std::nothrow) lun_unit_t();
+        }
+
+        if (!unit)
+        {
+            logmsg("---- Out of memory for ID ", target_idx, " LUN ", lun);
+            return nullptr;
+        }
+        unit->img.lun = lun;
+        unit->state.cfg = &unit->img;
+    }
+    return &unit->img;
+}
+
+extern "C"
+LunState* scsiDiskLunState(int targetId, int lun)
+{
+    if (targetId < 0 || targetId >= S2S_MAX_TARGETS || lun < 0 || lun >= NUM_SCSILUN)
+    {
+        return nullptr;
+    }
+    else if (lun == 0)
+    {
+        return g_lun0_states[targetId];
+    }
+
+    lun_unit_t *unit = g_lun_units[targetId][lun - 1];
+    if (unit && unit->img.isTargetEnabled())
+    {
+        return &unit->state;
+    }
+    return nullptr;
+}
+
 void scsiDiskResetImages()
 {
     for (int i = 0; i < S2S_MAX_TARGETS; i++)
     {
         g_DiskImages[i].clear();
+
+        for (int lun = 1; lun < NUM_SCSILUN; lun++)
+        {
+            delete g_lun_units[i][lun - 1];
+            g_lun_units[i][lun - 1] = nullptr;
+        }
+        delete g_lun0_states[i];
+        g_lun0_states[i] = nullptr;
     }
 }
 
 void image_config_t::clear()
 {
     static const image_config_t empty; // Statically zero-initialized
+    delete[] tape_files;
+    delete[] cdrom_binfile_sizes;
     *this = empty;
 }
 
@@ -258,10 +344,10 @@ uint32_t image_config_t::get_capacity_lba()
                 last_track = *track;
                 if (!bin_file.open(&bin_container, track->filename, O_RDONLY | O_BINARY))
                 {
-                    dbgmsg("Unable to open cue/multi-bin image file \"", track->filename, "\" to determine total capacity");
+                    dbgmsg<LOG_SUBSYS_DISK>("Unable to open cue/multi-bin image file \"", track->filename, "\" to determine total capacity");
                     return 0;
                 }
-                prev_capacity = bin_file.size();
+                prev_capacity = audio_file_pcm_size(bin_file);
                 bin_file.close();
             }
             if (last_track.track_number != 0)
@@ -277,7 +363,7 @@ uint32_t image_config_t::get_capacity_lba()
                 last_track = *track;
             }
             if (last_track.track_number == 0) return 0;
-            uint64_t sz = bin_container.size();
+            uint64_t sz = audio_file_pcm_size(bin_container);
             uint32_t usable = (sz > last_track.file_offset)
                 ? (sz - last_track.file_offset) / last_track.sector_length : 0;
             return last_track.data_start + usable;
@@ -288,16 +374,71 @@ uint32_t image_config_t::get_capacity_lba()
 
 }
 
+static void scsiDiskCloseSDCardImage(image_config_t &img)
+{
+    if (!img.file.isRom())
+    {
+        tapeImageClose(img);
+        delete[] img.tape_files;
+        img.tape_files = nullptr;
+        delete[] img.cdrom_binfile_sizes;
+        img.cdrom_binfile_sizes = nullptr;
+        img.file.close();
+        img.image_directory = false;
+        img.bin_container.close();
+        img.cuesheetfile.close();
+    }
+}
+
 void scsiDiskCloseSDCardImages()
 {
     for (int i = 0; i < S2S_MAX_TARGETS; i++)
     {
-        if (!g_DiskImages[i].file.isRom())
+        scsiDiskCloseSDCardImage(g_DiskImages[i]);
+
+        for (int lun = 1; lun < NUM_SCSILUN; lun++)
         {
-            g_DiskImages[i].file.close();
-            g_DiskImages[i].image_directory = false;
-            g_DiskImages[i].bin_container.close();
-            g_DiskImages[i].cuesheetfile.close();
+            if (g_lun_units[i][lun - 1])
+            {
+                scsiDiskCloseSDCardImage(g_lun_units[i][lun - 1]->img);
+            }
+        }
+    }
+}
+
+void scsiDiskPromoteLunImages()
+{
+    for (int i = 0; i < S2S_MAX_TARGETS; i++)
+    {
+        if (g_DiskImages[i].isTargetEnabled())
+        {
+            continue;
+        }
+
+        for (int lun = 1; lun < NUM_SCSILUN; lun++)
+        {
+            lun_unit_t *&unit = g_lun_units[i][lun - 1];
+            if (!unit || !unit->img.isTargetEnabled())
+            {
+                continue;
+            }
+
+            char path[sizeof(unit->path)];
+            memcpy(path, unit->path, sizeof(path));
+            int blocksize = unit->img.bytesPerSector;
+            S2S_CFG_TYPE type = (S2S_CFG_TYPE)unit->img.deviceType;
+            bool use_prefix = unit->img.use_prefix;
+
+            scsiDiskCloseSDCardImage(unit->img);
+            delete unit;
+            unit = nullptr;
+
+            logmsg("== Moving ", path, " from ID:", i, " LUN:", lun, " to LUN:0, the ID has no LUN 0 image");
+            if (!scsiDiskOpenHDDImage(i, path, 0, blocksize, type, use_prefix))
+            {
+                logmsg("---- Failed to load image");
+            }
+            break;
         }
     }
 }
@@ -336,9 +477,8 @@ void setNameFromImage(image_config_t &img, const char *filename) {
 
 // Load values for target image configuration from given section if they exist.
 // Otherwise keep current settings.
-static void scsiDiskSetImageConfig(uint8_t target_idx)
+static void scsiDiskSetImageConfig(image_config_t &img, uint8_t target_idx)
 {
-    image_config_t &img = g_DiskImages[target_idx];
     scsi_system_settings_t *devSys = g_scsi_settings.getSystem();
     scsi_device_settings_t *devCfg = g_scsi_settings.getDevice(target_idx);
     img.scsiId = target_idx;
@@ -355,6 +495,8 @@ static void scsiDiskSetImageConfig(uint8_t target_idx)
     img.rightAlignStrings = devCfg->rightAlignStrings;
     img.name_from_image = devCfg->nameFromImage;
     img.prefetchbytes = devCfg->prefetchBytes;
+    img.disconnect_mode = devCfg->disconnectMode;
+    img.queue_depth = devCfg->queueDepth;
     img.reinsert_on_inquiry = devCfg->reinsertOnInquiry;
     img.reinsert_after_eject = devCfg->reinsertAfterEject;
     img.ejectButton = devCfg->ejectButton;
@@ -445,14 +587,14 @@ static void autoConfigGeometry(image_config_t &img)
 
     bool divisible = (img.scsiSectors % ((uint32_t)img.sectorsPerTrack * img.headsPerCylinder)) == 0;
     if (!divisible)
-        dbgmsg("---- Geometry set from ", method,
+        dbgmsg<LOG_SUBSYS_DISK>("---- Geometry set from ", method,
                ": SectorsPerTrack=", (int) img.sectorsPerTrack,
                " HeadsPerCylinder=", (int) img.headsPerCylinder,
                " total sectors ", (int) img.scsiSectors,
                " (not divisible)"
         );
     else
-        dbgmsg("---- Geometry set from ", method,
+        dbgmsg<LOG_SUBSYS_DISK>("---- Geometry set from ", method,
                ": SectorsPerTrack=", (int) img.sectorsPerTrack,
                " HeadsPerCylinder=", (int) img.headsPerCylinder,
                " total sectors ", (int) img.scsiSectors,
@@ -502,14 +644,88 @@ static bool tryLoadVhdFooter(ImageBackingStore &file, const char *filename,
     return true;
 }
 
+// Builds the table of the files in a multi-file tape folder, in the name
+// order findNextImageAfter() uses. Returns the number of files.
+static uint32_t scsiDiskLoadTapeFiles(image_config_t &img)
+{
+    FsFile file;
+    char name[MAX_FILE_PATH + 1];
+    uint32_t count = 0;
+    img.bin_container.rewind();
+    while (file.openNext(&img.bin_container))
+    {
+        file.getName(name, sizeof(name));
+        if (!file.isDir() && !file.isHidden() && scsiDiskFilenameValid(name))
+        {
+            count++;
+        }
+    }
+
+    delete[] img.tape_files;
+    img.tape_files = nullptr;
+    img.tape_files_blocksize = 0;
+    img.tape_mark_count = count;
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    img.tape_files = new (std::nothrow) tape_file_t[count];
+    if (!img.tape_files)
+    {
+        logmsg("---- Not enough memory for the table of ", (int)count, " tape files, searching the folder at each filemark");
+        return count;
+    }
+
+    uint32_t n = 0;
+    img.bin_container.rewind();
+    while (n < count && file.openNext(&img.bin_container))
+    {
+        file.getName(name, sizeof(name));
+        if (file.isDir() || file.isHidden() || !scsiDiskFilenameValid(name))
+        {
+            continue;
+        }
+
+        // Insertion sort, tape folders hold tens of files at most
+        uint32_t i = n++;
+        while (i > 0 && strcasecmp(name, img.tape_files[i - 1].name) < 0)
+        {
+            img.tape_files[i] = img.tape_files[i - 1];
+            i--;
+        }
+        strncpy(img.tape_files[i].name, name, sizeof(img.tape_files[i].name));
+        img.tape_files[i].size = file.size();
+    }
+
+    img.tape_mark_count = n;
+    logmsg("---- Multi-file tape with ", (int)n, " files");
+    return n;
+}
+
 bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, int blocksize, S2S_CFG_TYPE type, bool use_prefix)
 {
-    image_config_t &img = g_DiskImages[target_idx];
+    image_config_t *lun_img = scsiDiskLunImage(target_idx, scsi_lun);
+    if (!lun_img)
+    {
+        return false;
+    }
+
+    image_config_t &img = *lun_img;
+    if (scsi_lun > 0)
+    {
+        strlcpy(g_lun_units[target_idx][scsi_lun - 1]->path, filename, sizeof(lun_unit_t::path));
+    }
+    tapeImageClose(img);
+    delete[] img.tape_files;
+    img.tape_files = nullptr;
     img.cuesheetfile.close();
     img.bin_container.close();
     img.cdrom_binfile_index = -1;
+    delete[] img.cdrom_binfile_sizes;
+    img.cdrom_binfile_sizes = nullptr;
     img.cdrom_track_end_lba = 0;
-    scsiDiskSetImageConfig(target_idx);
+    scsiDiskSetImageConfig(img, target_idx);
 
     // Check if this is a .cue file being opened directly for optical devices
     // Handle it before ImageBackingStore which would treat it as a binary image
@@ -623,12 +839,12 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
 #ifdef BLUESCSI_HARDWARE_CONFIG
             if (g_hw_config.is_active())
             {
-                dbgmsg("----  Device spans SD card sectors ", (int)sector_begin, " to ", (int)sector_end);
+                dbgmsg<LOG_SUBSYS_DISK>("----  Device spans SD card sectors ", (int)sector_begin, " to ", (int)sector_end);
             }
             else
 #endif // BLUESCSI_HARDWARE_CONFIG
             {
-                dbgmsg("---- Image file is contiguous, SD card sectors ", (int)sector_begin, " to ", (int)sector_end);
+                dbgmsg<LOG_SUBSYS_DISK>("---- Image file is contiguous, SD card sectors ", (int)sector_begin, " to ", (int)sector_end);
             }
         }
 
@@ -653,7 +869,7 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
                 {
                     img.sectorsPerTrack  = vhd_info.sectors_per_track;
                     img.headsPerCylinder = vhd_info.heads;
-                    dbgmsg("---- VHD CHS applied: SPT=", (int)img.sectorsPerTrack,
+                    dbgmsg<LOG_SUBSYS_DISK>("---- VHD CHS applied: SPT=", (int)img.sectorsPerTrack,
                            " H=", (int)img.headsPerCylinder);
                 }
                 // UUID -> serial, unconditionally overriding INI. Serial follows the file.
@@ -717,6 +933,13 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
             img.tape_mark_index = 0;
             img.tape_mark_block_offset = 0;
             img.tape_load_next_file = true;
+            if (tapeImageIsContainer(filename) && !tapeImageOpen(img, filename))
+            {
+                // Writing raw blocks would overwrite a .tap container that
+                // just failed to parse.
+                logmsg("---- Could not index tape image, accessing it read-only as fixed size blocks");
+                img.file.setReadOnly();
+            }
         }
         else if (type == S2S_CFG_ZIP100)
         {
@@ -768,7 +991,7 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
         }
         else if (img.prefetchbytes > 0)
         {
-            dbgmsg("---- Read prefetch enabled: ", (int)img.prefetchbytes, " bytes");
+            dbgmsg<LOG_SUBSYS_DISK>("---- Read prefetch enabled: ", (int)img.prefetchbytes, " bytes");
         }
         else
         {
@@ -845,23 +1068,13 @@ bool scsiDiskOpenHDDImage(int target_idx, const char *filename, int scsi_lun, in
             char name[MAX_FILE_PATH + 1] = {0};
             img.file.getFoldername(name, sizeof(name));
             img.bin_container.open(name);
-            FsFile file;
-            bool valid = false;
-            img.tape_mark_count = 0;
-            while(file.openNext(&img.bin_container))
-            {
-                file.getName(name, sizeof(name));
-                if(!file.isDir() && !file.isHidden() && scsiDiskFilenameValid(name))
-                {
-                    valid = true;
-                    img.tape_mark_count++;
-                }
-            }
-            if (!valid)
+            if (scsiDiskLoadTapeFiles(img) == 0)
             {
                 // if there are no valid image files, create one
+                FsFile file;
                 file.open(&img.bin_container, TAPE_DEFAULT_NAME, O_CREAT);
                 file.close();
+                scsiDiskLoadTapeFiles(img);
             }
 
         }
@@ -909,6 +1122,7 @@ bool scsiDiskFilenameValid(const char* name)
             ".rom_loaded", ".cue", ".txt", ".rtf", ".md", ".nfo", ".pdf", ".doc", 
 	    ".ini", ".mid", ".midi", ".aiff", ".mp3", ".m4a",
             ".ori", // Kiosk mode original images
+            TAPE_IMAGE_INDEX_EXTENSION, // Record index of .tap images
             NULL
         };
         const char *archive_exts[] = {
@@ -1002,7 +1216,7 @@ static void scsiDiskCheckDir(char * dir_name, int target_idx, image_config_t* im
         {
             img->deviceType = type;
             img->image_directory = true;
-            dbgmsg("== ID ", target_idx, " ", type_name, " image directory '", dir_name, "' ==");
+            dbgmsg<LOG_SUBSYS_DISK>("== ID ", target_idx, " ", type_name, " image directory '", dir_name, "' ==");
         }
     }
 }
@@ -1016,7 +1230,7 @@ static void scsiDiskSetConfig(int target_idx)
     image_config_t &img = g_DiskImages[target_idx];
     img.scsiId = target_idx;
 
-    scsiDiskSetImageConfig(target_idx);
+    scsiDiskSetImageConfig(img, target_idx);
 
     char section[8];
     snprintf(section, sizeof(section), "SCSI%d", target_idx);
@@ -1085,13 +1299,13 @@ static void doCloseTray(image_config_t &img)
     if (img.ejected)
     {
         uint8_t target = img.getTargetId();
-        dbgmsg("------ Device close tray on ID ", (int)target);
+        dbgmsg<LOG_SUBSYS_DISK>("------ Device close tray on ID ", (int)target);
         img.ejected = false;
 
         if (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_UNIT_ATTENTION)
         {
-            dbgmsg("------ Posting UNIT ATTENTION after medium change");
-            scsiDev.targets[target].unitAttention = NOT_READY_TO_READY_TRANSITION_MEDIUM_MAY_HAVE_CHANGED;
+            dbgmsg<LOG_SUBSYS_DISK>("------ Posting UNIT ATTENTION after medium change");
+            scsiDiskPostUnitAttention(img, NOT_READY_TO_READY_TRANSITION_MEDIUM_MAY_HAVE_CHANGED);
         }
     }
 }
@@ -1109,7 +1323,7 @@ static void doPerformEject(image_config_t &img)
     {
         blink_cancel();
         blinkStatus(g_scsi_settings.getDevice(target)->ejectBlinkTimes, g_scsi_settings.getDevice(target)->ejectBlinkPeriod);
-        dbgmsg("------ Device open tray on ID ", (int)target);
+        dbgmsg<LOG_SUBSYS_DISK>("------ Device open tray on ID ", (int)target);
         img.ejected = true;
         switchNextImage(img); // Switch media for next time
     }
@@ -1169,7 +1383,7 @@ int findNextImageAfter(image_config_t &img,
     bool dir_has_cue = (img.deviceType == S2S_CFG_OPTICAL) && scsiDiskFolderContainsCueSheet(&dir);
     if (dir_has_cue)
     {
-        dbgmsg("-- Directory '", dirname, "' contains .cue file(s), will select .cue instead of .bin");
+        dbgmsg<LOG_SUBSYS_DISK>("-- Directory '", dirname, "' contains .cue file(s), will select .cue instead of .bin");
     }
     dir.rewind();
 
@@ -1188,12 +1402,12 @@ int findNextImageAfter(image_config_t &img,
         {
             if (hasExtension(nextname, ".bin"))
             {
-                dbgmsg("-- Skipping .bin file (cue present): ", nextname);
+                dbgmsg<LOG_SUBSYS_DISK>("-- Skipping .bin file (cue present): ", nextname);
                 continue;
             }
             if (hasExtension(nextname, ".cue"))
             {
-                dbgmsg("-- Allowing .cue file: ", nextname);
+                dbgmsg<LOG_SUBSYS_DISK>("-- Allowing .cue file: ", nextname);
                 // .cue files bypass scsiDiskFilenameValid check
             }
             else if (!scsiDiskFilenameValid(nextname))
@@ -1307,13 +1521,13 @@ int scsiDiskGetNextImageName(image_config_t &img, char *buf, size_t buflen)
                     strcpy(dirname, "ZP0");
                 break;
                 default:
-                    dbgmsg("No matching device type for default directory found");
+                    dbgmsg<LOG_SUBSYS_DISK>("No matching device type for default directory found");
                     return 0;
             }
             dirname[2] = scsiEncodeID(target_idx);
             if (!SD.exists(dirname))
             {
-                dbgmsg("Default image directory, ", dirname, " does not exist");
+                dbgmsg<LOG_SUBSYS_DISK>("Default image directory, ", dirname, " does not exist");
                 return 0;
             }
         }
@@ -1428,7 +1642,7 @@ uint32_t getBlockSize(char *filename, uint8_t scsi_id)
         if (8 <= blktmp && blktmp <= 64 * 1024)
         {
             block_size = blktmp;
-            dbgmsg("-- Using block size, ",(int) block_size," from filename: ", filename);
+            dbgmsg<LOG_SUBSYS_DISK>("-- Using block size, ",(int) block_size," from filename: ", filename);
         }
     }
     return block_size;
@@ -1453,6 +1667,11 @@ bool switchNextImage(image_config_t &img, const char* next_filename)
     char filename[MAX_FILE_PATH];
     if (next_filename == nullptr)
     {
+        // Image lists and directories in the ini file are for LUN 0
+        if (img.lun != 0)
+        {
+            return false;
+        }
         scsiDiskGetNextImageName(img, filename, sizeof(filename));
     }
     else
@@ -1474,7 +1693,7 @@ bool switchNextImage(image_config_t &img, const char* next_filename)
 
         // set default blocksize for CDs
         int block_size = getBlockSize(filename, target_idx);
-        bool status = scsiDiskOpenHDDImage(target_idx, filename, 0, block_size, (S2S_CFG_TYPE) img.deviceType, img.use_prefix);
+        bool status = scsiDiskOpenHDDImage(target_idx, filename, img.lun, block_size, (S2S_CFG_TYPE) img.deviceType, img.use_prefix);
 
         if (status)
         {
@@ -1519,6 +1738,34 @@ image_config_t &scsiDiskGetImageConfig(int target_idx)
     return g_DiskImages[target_idx];
 }
 
+image_config_t *scsiDiskGetLunImageConfig(int target_idx, int lun)
+{
+    assert(target_idx >= 0 && target_idx < S2S_MAX_TARGETS);
+    if (lun == 0)
+    {
+        return &g_DiskImages[target_idx];
+    }
+    else if (lun > 0 && lun < NUM_SCSILUN && g_lun_units[target_idx][lun - 1])
+    {
+        return &g_lun_units[target_idx][lun - 1]->img;
+    }
+    return nullptr;
+}
+
+void scsiDiskPostUnitAttention(image_config_t &img, uint16_t asc)
+{
+    TargetState &target = scsiDev.targets[img.getTargetId()];
+    if (img.lun == target.lun)
+    {
+        target.unitAttention = asc;
+    }
+    else
+    {
+        LunState *state = scsiDiskLunState(img.getTargetId(), img.lun);
+        if (state) state->unitAttention = asc;
+    }
+}
+
 static void diskEjectAction(uint8_t buttonId)
 {
     bool found = false;
@@ -1666,6 +1913,10 @@ void s2s_configInit(S2S_BoardCfg* config)
         config->flags |= S2S_CFG_ENABLE_SCSI2;
 
     g_scsi_busFreeDelayUs = sysCfg->busFreeDelayUs;
+#ifdef BLUESCSI_NETWORK
+    g_scsi_networkHeaderDelayUs = sysCfg->networkHeaderDelayUs;
+    g_scsi_networkPacketDelayUs = sysCfg->networkPacketDelayUs;
+#endif
 
     if (sysCfg->enableSelLatch)
         config->flags |= S2S_CFG_ENABLE_SEL_LATCH;
@@ -1734,6 +1985,23 @@ void s2s_configInit(S2S_BoardCfg* config)
         logmsg("-- WiFiSecurity = ", tmp);
     }
 
+#ifdef BLUESCSI_NETWORK
+    memset(tmp, 0, sizeof(tmp));
+    ini_gets("SCSI", "NetworkBackend", "", tmp, sizeof(tmp), CONFIGFILE);
+    if (strcasecmp(tmp, "loopback") == 0)
+    {
+        long rate = ini_getl("SCSI", "NetworkLoopbackRate", 0, CONFIGFILE);
+        long size = ini_getl("SCSI", "NetworkLoopbackSize", 64, CONFIGFILE);
+        scsiNetworkLoopbackConfig(rate < 0 ? 0 : rate, size);
+        scsiNetworkSetBackend(&scsiNetworkLoopbackBackend);
+        logmsg("-- NetworkBackend = loopback, generating ", (int)rate, " packets/s of ", (int)size, " bytes");
+    }
+    else if (tmp[0] && strcasecmp(tmp, "wifi") != 0)
+    {
+        logmsg("-- Unknown NetworkBackend \"", tmp, "\", using Wi-Fi");
+    }
+#endif
+
 }
 
 extern "C"
@@ -2067,7 +2335,7 @@ static void doSeek(uint32_t lba)
                 if (img.bin_container.isOpen())
                     cdromSeekAudio(img, lba);
                 else
-                    dbgmsg("Failed to seek to audio track lba position ", (int) lba);
+                    dbgmsg<LOG_SUBSYS_DISK>("Failed to seek to audio track lba position ", (int) lba);
             }
 #endif
             s2s_delay_us(10);
@@ -2103,6 +2371,7 @@ static struct {
     uint32_t sector;
     uint32_t bytes;
     uint8_t scsiId;
+    uint8_t lun;
 } g_scsi_prefetch;
 #endif
 
@@ -2122,7 +2391,7 @@ void scsiDiskStartWrite(uint32_t lba, uint32_t blocks)
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
     uint32_t capacity = img.file.size() / bytesPerSector;
 
-    dbgmsg("------ Write ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    dbgmsg<LOG_SUBSYS_DISK>("------ Write ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
 
     if (unlikely(blockDev.state & DISK_WP) ||
         unlikely(scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL) ||
@@ -2204,7 +2473,7 @@ static void scsiDiskStartVerify(uint32_t lba, uint32_t blocks)
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
     uint32_t capacity = img.file.size() / bytesPerSector;
 
-    dbgmsg("------ Verify ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    dbgmsg<LOG_SUBSYS_DISK>("------ Verify ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
 
     if (unlikely(((uint64_t) lba) + blocks > capacity))
     {
@@ -2253,7 +2522,7 @@ static void scsiDiskStartWriteAndVerify(uint32_t lba, uint32_t blocks)
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
     uint32_t capacity = img.file.size() / bytesPerSector;
 
-    dbgmsg("------ Write and verify ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    dbgmsg<LOG_SUBSYS_DISK>("------ Write and verify ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
 
     if (unlikely(blockDev.state & DISK_WP) ||
         unlikely(scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL) ||
@@ -2312,7 +2581,7 @@ static void scsiDiskVerifyMedium(uint32_t lba, uint32_t blocks)
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
     uint32_t capacity = img.file.size() / bytesPerSector;
 
-    dbgmsg("------ Verify medium ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    dbgmsg<LOG_SUBSYS_DISK>("------ Verify medium ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
 
     if (unlikely(((uint64_t) lba) + blocks > capacity))
     {
@@ -2594,7 +2863,7 @@ void diskDataOut_callback(uint32_t bytes_complete)
         if (len == 0)
             return;
 
-        // dbgmsg("SCSI read ", (int)start, " + ", (int)len);
+        // dbgmsg<LOG_SUBSYS_DISK>("SCSI read ", (int)start, " + ", (int)len);
         scsiStartRead(&scsiDev.data[start], len, &g_disk_transfer.parityError);
         g_disk_transfer.bytes_scsi_started += len;
     }
@@ -2708,7 +2977,7 @@ void diskDataOut()
             // when buffer space is freed.
             uint8_t *buf = &scsiDev.data[start];
             g_disk_transfer.sd_transfer_start = start;
-            // dbgmsg("SD write ", (int)start, " + ", (int)len, " ", bytearray(buf, len));
+            // dbgmsg<LOG_SUBSYS_DISK>("SD write ", (int)start, " + ", (int)len, " ", bytearray(buf, len));
             platform_set_sd_callback(&diskDataOut_callback, buf);
             if (img.file.write(buf, len) != len)
             {
@@ -2760,7 +3029,7 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
     uint32_t capacity = img.file.size() / bytesPerSector;
 
-    dbgmsg("------ Read ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
+    dbgmsg<LOG_SUBSYS_DISK>("------ Read ", (int)blocks, "x", (int)bytesPerSector, " starting at ", (int)lba);
 
     if (unlikely(((uint64_t) lba) + blocks > capacity))
     {
@@ -2785,17 +3054,19 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks)
 #ifdef PREFETCH_BUFFER_SIZE
         uint32_t sectors_in_prefetch = g_scsi_prefetch.bytes / bytesPerSector;
         if (img.getTargetId() == g_scsi_prefetch.scsiId &&
+            img.lun == g_scsi_prefetch.lun &&
             transfer.lba >= g_scsi_prefetch.sector &&
             transfer.lba < g_scsi_prefetch.sector + sectors_in_prefetch)
         {
-            // We have the some sectors already in prefetch cache
+            // We have the some sectors already in prefetch cache,
+            // which is as staged as the data gets.
             scsiEnterPhase(DATA_IN);
 
             uint32_t start_offset = transfer.lba - g_scsi_prefetch.sector;
             uint32_t count = sectors_in_prefetch - start_offset;
             if (count > transfer.blocks) count = transfer.blocks;
             scsiStartWrite(g_scsi_prefetch.buffer + start_offset * bytesPerSector, count * bytesPerSector);
-            dbgmsg("------ Found ", (int)count, " sectors in prefetch cache");
+            dbgmsg<LOG_SUBSYS_DISK>("------ Found ", (int)count, " sectors in prefetch cache");
             transfer.currentBlock += count;
         }
 
@@ -2884,6 +3155,7 @@ static void start_dataInTransfer(uint8_t *buffer, uint32_t count)
 
     // Start transferring from SD card
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    sd_arbiter_scsi_read_started();
     platform_set_sd_callback(&diskDataIn_callback, buffer);
 
     // Use direct sector I/O when fastseek is enabled (for fragmented files).
@@ -2952,6 +3224,7 @@ static void diskDataIn()
     if (remain > 0)
     {
         uint32_t transfer_blocks = std::min(remain, maxblocks_half);
+        transfer_blocks = sd_arbiter_scsi_read_blocks(transfer_blocks, bytesPerSector);
         uint32_t transfer_bytes = transfer_blocks * bytesPerSector;
         start_dataInTransfer(&scsiDev.data[0], transfer_bytes);
         transfer.currentBlock += transfer_blocks;
@@ -2963,6 +3236,7 @@ static void diskDataIn()
     if (remain > 0)
     {
         uint32_t transfer_blocks = std::min(remain, maxblocks_half);
+        transfer_blocks = sd_arbiter_scsi_read_blocks(transfer_blocks, bytesPerSector);
         uint32_t transfer_bytes = transfer_blocks * bytesPerSector;
         start_dataInTransfer(&scsiDev.data[maxblocks_half * bytesPerSector], transfer_bytes);
         transfer.currentBlock += transfer_blocks;
@@ -2981,6 +3255,7 @@ static void diskDataIn()
         g_scsi_prefetch.sector = transfer.lba + transfer.blocks;
         g_scsi_prefetch.bytes = 0;
         g_scsi_prefetch.scsiId = s2s_getTargetId(scsiDev.target->cfg);
+        g_scsi_prefetch.lun = scsiDev.target->lun;
 
         if (g_scsi_prefetch.sector + prefetch_sectors > img_sector_count)
         {
@@ -3035,408 +3310,573 @@ static void diskDataIn()
 /********************/
 
 // Handle direct-access scsi device commands
+// Called after the CDB has been received, decides whether the command
+// releases the bus while it waits on the SD card.
 extern "C"
-int scsiDiskCommand()
+int scsiDiskDisconnectAllowed()
 {
-    int commandHandled = 1;
+#ifdef PLATFORM_SCSIPHY_HAS_RESELECT
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-
-    g_disk_data_out.verify = false;
-    g_disk_data_out.write_and_verify = false;
-
-    uint8_t command = scsiDev.cdb[0];
-    if (unlikely(command == 0x1B))
+    if (img.disconnect_mode == DISCONNECT_NEVER || !img.file.isOpen())
     {
-        // START STOP UNIT
-        // Enable or disable media access operations.
-        //int immed = scsiDev.cdb[1] & 1;
-        int start = scsiDev.cdb[4] & 1;
-        if ((scsiDev.cdb[4] & 2) || img.deviceType != S2S_CFG_FIXED)
-        {
-            // Device load & eject
-            if (start)
-            {
-                doCloseTray(img);
-            }
-            else
-            {
-                // Eject and switch image
-                doPerformEject(img);
-            }
-        }
-        else if (start)
-        {
-            scsiDev.target->started = 1;
-        }
-        else
-        {
-            scsiDev.target->started = 0;
-        }
+        return 0;
+    }
 
+    uint8_t command = scsiDev.cdb[0];
+    switch (command)
+    {
+        case 0x0B: // SEEK(6)
+        case 0x2B: // SEEK(10)
+        case 0x1B: // START STOP UNIT, may switch images
+            return 1;
+
+        case 0x2F: // VERIFY(10)
+        case 0xAF: // VERIFY(12)
+        case 0x8F: // VERIFY(16)
+            // Without BYTCHK the whole range is read from the SD card
+            return (scsiDev.cdb[1] & 0x02) == 0;
+
+        case 0x08: // READ(6)
+        case 0x28: // READ(10)
+        case 0xA8: // READ(12)
+        case 0x88: // READ(16)
+            // CD-ROM and tape reads have their own transfer code
+            return img.disconnect_mode >= DISCONNECT_READS &&
+                   img.deviceType != S2S_CFG_OPTICAL &&
+                   img.deviceType != S2S_CFG_SEQUENTIAL;
+
+        default:
+            return 0;
     }
-    else if (likely(command == 0x08))
+#else
+    return 0;
+#endif
+}
+
+// Stage the start of a read that waits in the target queue, so the data
+// phase can begin as soon as the initiator answers the reselection.
+extern "C"
+void scsiDiskPrepareRead(uint32_t lba, uint32_t blocks)
+{
+#ifdef PREFETCH_BUFFER_SIZE
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t capacity = img.file.size() / bytesPerSector;
+    uint8_t scsiId = s2s_getTargetId(scsiDev.target->cfg);
+
+    if (scsiId == g_scsi_prefetch.scsiId &&
+        scsiDev.target->lun == g_scsi_prefetch.lun &&
+        lba >= g_scsi_prefetch.sector &&
+        lba < g_scsi_prefetch.sector + g_scsi_prefetch.bytes / bytesPerSector)
     {
-        // READ(6)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
-            (((uint32_t) scsiDev.cdb[2]) << 8) +
-            scsiDev.cdb[3];
-        uint32_t blocks = scsiDev.cdb[4];
-        if (unlikely(blocks == 0)) blocks = 256;
-        scsiDiskStartRead(lba, blocks);
+        // Already staged by an earlier attempt or the previous read
+        return;
     }
-    else if (likely(command == 0x28))
+
+    uint32_t sectors = PREFETCH_BUFFER_SIZE / bytesPerSector;
+    if (sectors > blocks) sectors = blocks;
+    if (lba >= capacity || sectors == 0)
     {
-        // READ(10)
-        // Ignore all cache control bits - we don't support a memory cache.
+        // Out of range reads fail in scsiDiskStartRead()
+        return;
+    }
+    if (sectors > capacity - lba) sectors = capacity - lba;
 
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
+    g_scsi_prefetch.sector = lba;
+    g_scsi_prefetch.bytes = 0;
+    g_scsi_prefetch.scsiId = scsiId;
+    g_scsi_prefetch.lun = scsiDev.target->lun;
 
-        scsiDiskStartRead(lba, blocks);
+    uint32_t bytes = sectors * bytesPerSector;
+    if (img.file.seek((uint64_t)lba * bytesPerSector) &&
+        img.file.read(g_scsi_prefetch.buffer, bytes) == (int)bytes)
+    {
+        g_scsi_prefetch.bytes = bytes;
     }
-    else if (unlikely(command == 0xA8))
+    platform_reset_watchdog();
+#endif
+}
+
+// Number of tagged commands the current target accepts. Zero keeps queue
+// tag messages rejected and the CmdQue bit out of INQUIRY.
+extern "C"
+int scsiDiskQueueDepth()
+{
+#ifdef PLATFORM_SCSIPHY_HAS_RESELECT
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    switch (img.deviceType)
     {
-        // READ(12)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[6]) << 24) +
-            (((uint32_t) scsiDev.cdb[7]) << 16) +
-            (((uint32_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
+        case S2S_CFG_FIXED:
+        case S2S_CFG_REMOVABLE:
+        case S2S_CFG_OPTICAL:
+        case S2S_CFG_FLOPPY_14MB:
+        case S2S_CFG_MO:
+            return std::min<int>(img.queue_depth, SCSI_QUEUE_DEPTH);
 
-        scsiDiskStartRead(lba, blocks);
+        default:
+            return 0;
     }
-    else if (unlikely(command == 0x88))
-    {
-        // READ(16)
-        uint64_t lba =
-            (((uint64_t) scsiDev.cdb[2]) << 56) +
-            (((uint64_t) scsiDev.cdb[3]) << 48) +
-            (((uint64_t) scsiDev.cdb[4]) << 40) +
-            (((uint64_t) scsiDev.cdb[5]) << 32) +
-            (((uint64_t) scsiDev.cdb[6]) << 24) +
-            (((uint64_t) scsiDev.cdb[7]) << 16) +
-            (((uint64_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[10]) << 24) +
-            (((uint32_t) scsiDev.cdb[11]) << 16) +
-            (((uint32_t) scsiDev.cdb[12]) << 8) +
-            scsiDev.cdb[13];
-
-        if (lba > UINT32_MAX)
+#else
+    return 0;
+#endif
+}
+
+/*********************************/
+/* Disk command dispatching      */
+/*********************************/
+
+static int diskCommandStartStop(image_config_t &img)
+{
+    // START STOP UNIT
+    // Enable or disable media access operations.
+    //int immed = scsiDev.cdb[1] & 1;
+    int start = scsiDev.cdb[4] & 1;
+    if ((scsiDev.cdb[4] & 2) || img.deviceType != S2S_CFG_FIXED)
+    {
+        // Device load & eject
+        if (start)
         {
-            scsiDev.status = CHECK_CONDITION;
-            scsiDev.target->sense.code = ILLEGAL_REQUEST;
-            scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
-            scsiDev.phase = STATUS;
+            doCloseTray(img);
         }
         else
         {
-            scsiDiskStartRead((uint32_t)lba, blocks);
+            // Eject and switch image
+            doPerformEject(img);
         }
     }
-    else if (likely(command == 0x0A))
+    else if (start)
     {
-        // WRITE(6)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
-            (((uint32_t) scsiDev.cdb[2]) << 8) +
-            scsiDev.cdb[3];
-        uint32_t blocks = scsiDev.cdb[4];
-        if (unlikely(blocks == 0)) blocks = 256;
-        scsiDiskStartWrite(lba, blocks);
+        scsiDev.target->started = 1;
     }
-    else if (likely(command == 0x2A))
+    else
     {
-        // WRITE(10)
-        // Ignore all cache control bits - we don't support a memory cache.
+        scsiDev.target->started = 0;
+    }
+    return 1;
+}
 
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
+static int diskCommandRead6(image_config_t &img)
+{
+    // READ(6)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
+        (((uint32_t) scsiDev.cdb[2]) << 8) +
+        scsiDev.cdb[3];
+    uint32_t blocks = scsiDev.cdb[4];
+    if (unlikely(blocks == 0)) blocks = 256;
+    scsiDiskStartRead(lba, blocks);
+    return 1;
+}
 
-        scsiDiskStartWrite(lba, blocks);
-    }
-    else if (unlikely(command == 0xAA))
-    {
-        // WRITE(12)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[6]) << 24) +
-            (((uint32_t) scsiDev.cdb[7]) << 16) +
-            (((uint32_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
+static int diskCommandRead10(image_config_t &img)
+{
+    // READ(10)
+    // Ignore all cache control bits - we don't support a memory cache.
 
-        scsiDiskStartWrite(lba, blocks);
-    }
-    else if (unlikely(command == 0x8A))
-    {
-        // WRITE(16)
-        uint64_t lba =
-            (((uint64_t) scsiDev.cdb[2]) << 56) +
-            (((uint64_t) scsiDev.cdb[3]) << 48) +
-            (((uint64_t) scsiDev.cdb[4]) << 40) +
-            (((uint64_t) scsiDev.cdb[5]) << 32) +
-            (((uint64_t) scsiDev.cdb[6]) << 24) +
-            (((uint64_t) scsiDev.cdb[7]) << 16) +
-            (((uint64_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[10]) << 24) +
-            (((uint32_t) scsiDev.cdb[11]) << 16) +
-            (((uint32_t) scsiDev.cdb[12]) << 8) +
-            scsiDev.cdb[13];
-
-        if (lba > UINT32_MAX)
-        {
-            scsiDev.status = CHECK_CONDITION;
-            scsiDev.target->sense.code = ILLEGAL_REQUEST;
-            scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
-            scsiDev.phase = STATUS;
-        }
-        else
-        {
-            scsiDiskStartWrite((uint32_t)lba, blocks);
-        }
-    }
-    else if (unlikely(command == 0x2E || command == 0xAE || command == 0x8E))
-    {
-        // WRITE AND VERIFY (10/12/16)
-        uint64_t lba = 0;
-        uint32_t blocks = 0;
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
 
-        if (command == 0x2E)
-        {
-            lba =
-                (((uint32_t) scsiDev.cdb[2]) << 24) +
-                (((uint32_t) scsiDev.cdb[3]) << 16) +
-                (((uint32_t) scsiDev.cdb[4]) << 8) +
-                scsiDev.cdb[5];
-            blocks =
-                (((uint32_t) scsiDev.cdb[7]) << 8) +
-                scsiDev.cdb[8];
-        }
-        else if (command == 0xAE)
-        {
-            lba =
-                (((uint32_t) scsiDev.cdb[2]) << 24) +
-                (((uint32_t) scsiDev.cdb[3]) << 16) +
-                (((uint32_t) scsiDev.cdb[4]) << 8) +
-                scsiDev.cdb[5];
-            blocks =
-                (((uint32_t) scsiDev.cdb[6]) << 24) +
-                (((uint32_t) scsiDev.cdb[7]) << 16) +
-                (((uint32_t) scsiDev.cdb[8]) << 8) +
-                scsiDev.cdb[9];
-        }
-        else
-        {
-            lba =
-                (((uint64_t) scsiDev.cdb[2]) << 56) +
-                (((uint64_t) scsiDev.cdb[3]) << 48) +
-                (((uint64_t) scsiDev.cdb[4]) << 40) +
-                (((uint64_t) scsiDev.cdb[5]) << 32) +
-                (((uint64_t) scsiDev.cdb[6]) << 24) +
-                (((uint64_t) scsiDev.cdb[7]) << 16) +
-                (((uint64_t) scsiDev.cdb[8]) << 8) +
-                scsiDev.cdb[9];
-            blocks =
-                (((uint32_t) scsiDev.cdb[10]) << 24) +
-                (((uint32_t) scsiDev.cdb[11]) << 16) +
-                (((uint32_t) scsiDev.cdb[12]) << 8) +
-                scsiDev.cdb[13];
-        }
+    scsiDiskStartRead(lba, blocks);
+    return 1;
+}
 
-        if (lba > UINT32_MAX)
-        {
-            scsiDev.status = CHECK_CONDITION;
-            scsiDev.target->sense.code = ILLEGAL_REQUEST;
-            scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
-            scsiDev.phase = STATUS;
-        }
-        else
-        {
-            scsiDiskStartWriteAndVerify((uint32_t)lba, blocks);
-        }
-    }
-    else if (unlikely(command == 0x04))
-    {
-        // FORMAT UNIT
-        // We don't really do any formatting, but we need to read the correct
-        // number of bytes in the DATA_OUT phase to make the SCSI host happy.
+static int diskCommandRead12(image_config_t &img)
+{
+    // READ(12)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 24) +
+        (((uint32_t) scsiDev.cdb[7]) << 16) +
+        (((uint32_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
 
-        int fmtData = (scsiDev.cdb[1] & 0x10) ? 1 : 0;
-        if (fmtData)
-        {
-            // We need to read the parameter list, but we don't know how
-            // big it is yet. Start with the header.
-            scsiDev.dataLen = 4;
-            scsiDev.phase = DATA_OUT;
-            scsiDev.postDataOutHook = doFormatUnitHeader;
-        }
-        else
-        {
-            // No data to read, we're already finished!
-        }
-    }
-    else if (unlikely(command == 0x25))
+    scsiDiskStartRead(lba, blocks);
+    return 1;
+}
+
+// LBA and transfer length of the 16 byte READ, WRITE and VERIFY commands.
+// Returns false after setting CHECK CONDITION if the LBA does not fit
+// in the 32 bit addressing used for images.
+static bool diskCommandLBA16(uint32_t *lba, uint32_t *blocks)
+{
+    uint64_t lba64 =
+        (((uint64_t) scsiDev.cdb[2]) << 56) +
+        (((uint64_t) scsiDev.cdb[3]) << 48) +
+        (((uint64_t) scsiDev.cdb[4]) << 40) +
+        (((uint64_t) scsiDev.cdb[5]) << 32) +
+        (((uint64_t) scsiDev.cdb[6]) << 24) +
+        (((uint64_t) scsiDev.cdb[7]) << 16) +
+        (((uint64_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+    *blocks =
+        (((uint32_t) scsiDev.cdb[10]) << 24) +
+        (((uint32_t) scsiDev.cdb[11]) << 16) +
+        (((uint32_t) scsiDev.cdb[12]) << 8) +
+        scsiDev.cdb[13];
+
+    if (lba64 > UINT32_MAX)
     {
-        // READ CAPACITY
-        doReadCapacity();
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE;
+        scsiDev.phase = STATUS;
+        return false;
     }
-    else if (unlikely(command == 0x9E))
+
+    *lba = (uint32_t)lba64;
+    return true;
+}
+
+static int diskCommandRead16(image_config_t &img)
+{
+    // READ(16)
+    uint32_t lba, blocks;
+    if (diskCommandLBA16(&lba, &blocks))
     {
-        // SERVICE ACTION IN(16)
-        if ((scsiDev.cdb[1] & 0x1F) == 0x10)
-        {
-            // READ CAPACITY(16)
-            doReadCapacity16();
-        }
-        else
-        {
-            scsiDev.status = CHECK_CONDITION;
-            scsiDev.target->sense.code = ILLEGAL_REQUEST;
-            scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
-            scsiDev.phase = STATUS;
-        }
+        scsiDiskStartRead(lba, blocks);
     }
-    else if (unlikely(command == 0x0B))
-    {
-        // SEEK(6)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
-            (((uint32_t) scsiDev.cdb[2]) << 8) +
-            scsiDev.cdb[3];
+    return 1;
+}
 
-        doSeek(lba);
-    }
+static int diskCommandWrite6(image_config_t &img)
+{
+    // WRITE(6)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
+        (((uint32_t) scsiDev.cdb[2]) << 8) +
+        scsiDev.cdb[3];
+    uint32_t blocks = scsiDev.cdb[4];
+    if (unlikely(blocks == 0)) blocks = 256;
+    scsiDiskStartWrite(lba, blocks);
+    return 1;
+}
 
-    else if (unlikely(command == 0x2B))
-    {
-        // SEEK(10)
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
+static int diskCommandWrite10(image_config_t &img)
+{
+    // WRITE(10)
+    // Ignore all cache control bits - we don't support a memory cache.
 
-        doSeek(lba);
-    }
-    else if (unlikely(command == 0x36))
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+
+    scsiDiskStartWrite(lba, blocks);
+    return 1;
+}
+
+static int diskCommandWrite12(image_config_t &img)
+{
+    // WRITE(12)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 24) +
+        (((uint32_t) scsiDev.cdb[7]) << 16) +
+        (((uint32_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+
+    scsiDiskStartWrite(lba, blocks);
+    return 1;
+}
+
+static int diskCommandWrite16(image_config_t &img)
+{
+    // WRITE(16)
+    uint32_t lba, blocks;
+    if (diskCommandLBA16(&lba, &blocks))
     {
-        // LOCK UNLOCK CACHE
-        // We don't have a cache to lock data into. do nothing.
+        scsiDiskStartWrite(lba, blocks);
     }
-    else if (unlikely(command == 0x34))
+    return 1;
+}
+
+static int diskCommandWriteAndVerify10(image_config_t &img)
+{
+    // WRITE AND VERIFY(10)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+
+    scsiDiskStartWriteAndVerify(lba, blocks);
+    return 1;
+}
+
+static int diskCommandWriteAndVerify12(image_config_t &img)
+{
+    // WRITE AND VERIFY(12)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 24) +
+        (((uint32_t) scsiDev.cdb[7]) << 16) +
+        (((uint32_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+
+    scsiDiskStartWriteAndVerify(lba, blocks);
+    return 1;
+}
+
+static int diskCommandWriteAndVerify16(image_config_t &img)
+{
+    // WRITE AND VERIFY(16)
+    uint32_t lba, blocks;
+    if (diskCommandLBA16(&lba, &blocks))
     {
-        // PRE-FETCH.
-        // We don't have a cache to pre-fetch into. do nothing.
+        scsiDiskStartWriteAndVerify(lba, blocks);
     }
-    else if (unlikely(command == 0x1E))
+    return 1;
+}
+
+static int diskCommandFormatUnit(image_config_t &img)
+{
+    // FORMAT UNIT
+    // We don't really do any formatting, but we need to read the correct
+    // number of bytes in the DATA_OUT phase to make the SCSI host happy.
+
+    int fmtData = (scsiDev.cdb[1] & 0x10) ? 1 : 0;
+    if (fmtData)
     {
-        // PREVENT ALLOW MEDIUM REMOVAL
-        // Not much we can do to prevent the user removing the SD card.
-        // do nothing.
+        // We need to read the parameter list, but we don't know how
+        // big it is yet. Start with the header.
+        scsiDev.dataLen = 4;
+        scsiDev.phase = DATA_OUT;
+        scsiDev.postDataOutHook = doFormatUnitHeader;
     }
-    else if (unlikely(command == 0x01))
+    else
     {
-        // REZERO UNIT
-        // Set the lun to a vendor-specific state. Ignore.
+        // No data to read, we're already finished!
     }
-    else if (unlikely(command == 0x35))
+    return 1;
+}
+
+static int diskCommandReadCapacity(image_config_t &img)
+{
+    // READ CAPACITY
+    doReadCapacity();
+    return 1;
+}
+
+static int diskCommandServiceActionIn16(image_config_t &img)
+{
+    // SERVICE ACTION IN(16)
+    if ((scsiDev.cdb[1] & 0x1F) == 0x10)
     {
-        // SYNCHRONIZE CACHE
-        // We don't have a cache. do nothing.
+        // READ CAPACITY(16)
+        doReadCapacity16();
     }
-    else if (unlikely(command == 0x2F))
+    else
     {
-        // VERIFY(10)
-        uint64_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[7]) << 8) +
-            scsiDev.cdb[8];
-
-        scsiDiskHandleVerify(lba, blocks, (scsiDev.cdb[1] & 0x02) != 0);
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
     }
-    else if (unlikely(command == 0xAF))
-    {
-        // VERIFY(12)
-        uint64_t lba =
-            (((uint32_t) scsiDev.cdb[2]) << 24) +
-            (((uint32_t) scsiDev.cdb[3]) << 16) +
-            (((uint32_t) scsiDev.cdb[4]) << 8) +
-            scsiDev.cdb[5];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[6]) << 24) +
-            (((uint32_t) scsiDev.cdb[7]) << 16) +
-            (((uint32_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
+    return 1;
+}
 
-        scsiDiskHandleVerify(lba, blocks, (scsiDev.cdb[1] & 0x02) != 0);
-    }
-    else if (unlikely(command == 0x8F))
+static int diskCommandSeek6(image_config_t &img)
+{
+    // SEEK(6)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[1] & 0x1F) << 16) +
+        (((uint32_t) scsiDev.cdb[2]) << 8) +
+        scsiDev.cdb[3];
+
+    doSeek(lba);
+    return 1;
+}
+
+static int diskCommandSeek10(image_config_t &img)
+{
+    // SEEK(10)
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+
+    doSeek(lba);
+    return 1;
+}
+
+static int diskCommandNoOp(image_config_t &img)
+{
+    // Commands that have nothing to do on an SD card image:
+    // LOCK UNLOCK CACHE, PRE-FETCH and SYNCHRONIZE CACHE - we don't have a cache.
+    // PREVENT ALLOW MEDIUM REMOVAL - not much we can do to prevent the user
+    // removing the SD card.
+    // REZERO UNIT - sets the lun to a vendor-specific state.
+    return 1;
+}
+
+static int diskCommandVerify10(image_config_t &img)
+{
+    // VERIFY(10)
+    uint64_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[7]) << 8) +
+        scsiDev.cdb[8];
+
+    scsiDiskHandleVerify(lba, blocks, (scsiDev.cdb[1] & 0x02) != 0);
+    return 1;
+}
+
+static int diskCommandVerify12(image_config_t &img)
+{
+    // VERIFY(12)
+    uint64_t lba =
+        (((uint32_t) scsiDev.cdb[2]) << 24) +
+        (((uint32_t) scsiDev.cdb[3]) << 16) +
+        (((uint32_t) scsiDev.cdb[4]) << 8) +
+        scsiDev.cdb[5];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[6]) << 24) +
+        (((uint32_t) scsiDev.cdb[7]) << 16) +
+        (((uint32_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+
+    scsiDiskHandleVerify(lba, blocks, (scsiDev.cdb[1] & 0x02) != 0);
+    return 1;
+}
+
+static int diskCommandVerify16(image_config_t &img)
+{
+    // VERIFY(16)
+    // scsiDiskHandleVerify() range checks the full 64 bit LBA itself
+    uint64_t lba =
+        (((uint64_t) scsiDev.cdb[2]) << 56) +
+        (((uint64_t) scsiDev.cdb[3]) << 48) +
+        (((uint64_t) scsiDev.cdb[4]) << 40) +
+        (((uint64_t) scsiDev.cdb[5]) << 32) +
+        (((uint64_t) scsiDev.cdb[6]) << 24) +
+        (((uint64_t) scsiDev.cdb[7]) << 16) +
+        (((uint64_t) scsiDev.cdb[8]) << 8) +
+        scsiDev.cdb[9];
+    uint32_t blocks =
+        (((uint32_t) scsiDev.cdb[10]) << 24) +
+        (((uint32_t) scsiDev.cdb[11]) << 16) +
+        (((uint32_t) scsiDev.cdb[12]) << 8) +
+        scsiDev.cdb[13];
+
+    scsiDiskHandleVerify(lba, blocks, (scsiDev.cdb[1] & 0x02) != 0);
+    return 1;
+}
+
+static int diskCommandReadDefectData(image_config_t &img)
+{
+    // READ DEFECT DATA
+    uint32_t allocLength = (((uint16_t)scsiDev.cdb[7]) << 8) |
+        scsiDev.cdb[8];
+
+    scsiDev.data[0] = 0;
+    scsiDev.data[1] = scsiDev.cdb[2];
+    scsiDev.data[2] = 0;
+    scsiDev.data[3] = 0;
+    scsiDev.dataLen = 4;
+
+    if (scsiDev.dataLen > allocLength)
     {
-        // VERIFY(16)
-        uint64_t lba =
-            (((uint64_t) scsiDev.cdb[2]) << 56) +
-            (((uint64_t) scsiDev.cdb[3]) << 48) +
-            (((uint64_t) scsiDev.cdb[4]) << 40) +
-            (((uint64_t) scsiDev.cdb[5]) << 32) +
-            (((uint64_t) scsiDev.cdb[6]) << 24) +
-            (((uint64_t) scsiDev.cdb[7]) << 16) +
-            (((uint64_t) scsiDev.cdb[8]) << 8) +
-            scsiDev.cdb[9];
-        uint32_t blocks =
-            (((uint32_t) scsiDev.cdb[10]) << 24) +
-            (((uint32_t) scsiDev.cdb[11]) << 16) +
-            (((uint32_t) scsiDev.cdb[12]) << 8) +
-            scsiDev.cdb[13];
+        scsiDev.dataLen = allocLength;
+    }
+
+    scsiDev.phase = DATA_IN;
+    return 1;
+}
+
+static constexpr scsi_opcode_t g_disk_opcodes[] = {
+    {0x08, OPCODE_NEEDS_MEDIUM, diskCommandRead6},
+    {0x28, OPCODE_NEEDS_MEDIUM, diskCommandRead10},
+    {0xA8, OPCODE_NEEDS_MEDIUM, diskCommandRead12},
+    {0x88, OPCODE_NEEDS_MEDIUM, diskCommandRead16},
+    {0x0A, OPCODE_NEEDS_MEDIUM, diskCommandWrite6},
+    {0x2A, OPCODE_NEEDS_MEDIUM, diskCommandWrite10},
+    {0xAA, OPCODE_NEEDS_MEDIUM, diskCommandWrite12},
+    {0x8A, OPCODE_NEEDS_MEDIUM, diskCommandWrite16},
+    {0x2E, OPCODE_NEEDS_MEDIUM, diskCommandWriteAndVerify10},
+    {0xAE, OPCODE_NEEDS_MEDIUM, diskCommandWriteAndVerify12},
+    {0x8E, OPCODE_NEEDS_MEDIUM, diskCommandWriteAndVerify16},
+    {0x2F, OPCODE_NEEDS_MEDIUM, diskCommandVerify10},
+    {0xAF, OPCODE_NEEDS_MEDIUM, diskCommandVerify12},
+    {0x8F, OPCODE_NEEDS_MEDIUM, diskCommandVerify16},
+    {0x0B, OPCODE_NEEDS_MEDIUM, diskCommandSeek6},
+    {0x2B, OPCODE_NEEDS_MEDIUM, diskCommandSeek10},
+    {0x1B, 0, diskCommandStartStop},
+    {0x04, 0, diskCommandFormatUnit},
+    {0x25, 0, diskCommandReadCapacity},
+    {0x9E, 0, diskCommandServiceActionIn16},
+    {0x37, 0, diskCommandReadDefectData},
+    {0x36, 0, diskCommandNoOp}, // LOCK UNLOCK CACHE
+    {0x34, 0, diskCommandNoOp}, // PRE-FETCH
+    {0x1E, 0, diskCommandNoOp}, // PREVENT ALLOW MEDIUM REMOVAL
+    {0x01, 0, diskCommandNoOp}, // REZERO UNIT
+    {0x35, 0, diskCommandNoOp}, // SYNCHRONIZE CACHE
+};
+
+static constexpr scsi_opcode_table_t g_disk_opcode_table = scsiOpcodeTable(g_disk_opcodes);
 
-        scsiDiskHandleVerify(lba, blocks, (scsiDev.cdb[1] & 0x02) != 0);
+int scsiOpcodeDispatch(const scsi_opcode_table_t &table, image_config_t &img)
+{
+    uint8_t entry = table.index[scsiDev.cdb[0]];
+    if (entry == 0)
+    {
+        return 0;
     }
-    else if (unlikely(command == 0x37))
+
+    const scsi_opcode_t &op = table.entries[entry - 1];
+    if ((op.flags & OPCODE_NEEDS_MEDIUM) && unlikely(img.ejected))
     {
-        // READ DEFECT DATA
-        uint32_t allocLength = (((uint16_t)scsiDev.cdb[7]) << 8) |
-            scsiDev.cdb[8];
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = NOT_READY;
+        scsiDev.target->sense.asc = MEDIUM_NOT_PRESENT;
+        scsiDev.phase = STATUS;
+        return 1;
+    }
 
-        scsiDev.data[0] = 0;
-        scsiDev.data[1] = scsiDev.cdb[2];
-        scsiDev.data[2] = 0;
-        scsiDev.data[3] = 0;
-        scsiDev.dataLen = 4;
+    return op.handler(img);
+}
 
-        if (scsiDev.dataLen > allocLength)
-        {
-            scsiDev.dataLen = allocLength;
-        }
+extern "C"
+int scsiDiskCommand()
+{
+    int commandHandled = 1;
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
 
-        scsiDev.phase = DATA_IN;
+    g_disk_data_out.verify = false;
+    g_disk_data_out.write_and_verify = false;
+
+    if (likely(scsiOpcodeDispatch(g_disk_opcode_table, img)))
+    {
+        // Already handled.
     }
     else if (!img.file.isWritable())
     {
@@ -3526,6 +3966,10 @@ void scsiDiskReset()
 
 #ifdef ENABLE_AUDIO_OUTPUT
     audio_stop();
+#endif
+#ifdef BLUESCSI_NETWORK
+    // ABORT or reset while a READ(6) had a packet pinned
+    scsiNetworkAbort();
 #endif
     // Reinsert any ejected CD-ROMs on BUS RESET and restart from first image
     for (int i = 0; i < S2S_MAX_TARGETS; ++i)
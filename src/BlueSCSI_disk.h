@@ -31,6 +31,7 @@
 #define BLUESCSI_DISK_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <scsi2sd.h>
 #include <scsiPhy.h>
 #include "ImageBackingStore.h"
@@ -38,21 +39,34 @@
 #include <CUEParser.h>
 
 extern "C" {
-#include <disk.h>
 #include <config.h>
 #include <scsi.h>
+#include <disk.h>
 }
 
+// One file of a multi-file tape folder, each file is followed by a filemark
+struct tape_file_t
+{
+    char name[MAX_FILE_PATH + 1];
+    uint64_t size;
+    uint32_t start_block; // Tape position of the first block, the sum of the previous files
+    uint32_t blocks;
+};
+
 // Extended configuration stored alongside the normal SCSI2SD target information
 struct image_config_t: public S2S_TargetCfg
 {
     image_config_t() {};
+    ~image_config_t() { delete[] tape_files; delete[] cdrom_binfile_sizes; }
 
     uint8_t getTargetId() const { return scsiId & S2S_CFG_TARGET_ID_BITS; }
     bool isTargetEnabled() const { return (scsiId & S2S_CFG_TARGET_ENABLED) != 0; }
 
     ImageBackingStore file;
 
+    // Logical unit number of the image, 0 for the entries of g_DiskImages
+    uint8_t lun;
+
     // For CD-ROM drive ejection
     bool ejected;
     uint8_t cdrom_events;
@@ -69,6 +83,22 @@ struct image_config_t: public S2S_TargetCfg
     uint32_t tape_mark_count; // the number of marks
     uint32_t tape_mark_block_offset; // Sum of the the previous image file sizes at the current mark
     bool     tape_load_next_file;
+
+    // Files of a multi-file tape folder in tape order, tape_mark_count entries.
+    // Built when the tape is loaded, nullptr for single file tapes.
+    tape_file_t *tape_files;
+    uint32_t tape_files_blocksize; // Block size the start blocks were computed for
+
+    // Sidecar record index of a .tap tape image, closed for other tape images
+    FsFile tape_index;
+    uint32_t tape_records; // Records and filemarks in the index
+    uint32_t tape_filemarks;
+    uint64_t tape_data_end; // Offset where the next record is appended
+    uint32_t tape_write_length; // Length of the record being appended
+    bool tape_index_dirty; // Index header not updated since the last append
+
+    inline bool is_tape_container() {return tape_index.isOpen();}
+
     // True if there is a subdirectory of images for this target
     bool image_directory;
 
@@ -91,6 +121,10 @@ struct image_config_t: public S2S_TargetCfg
     // Matches trackinfo.file_index
     int cdrom_binfile_index;
 
+    // Track layout sizes of the .bin files by file index, for .cue/.bin with
+    // multiple files. Filled in as the files are first used, 0 if not known.
+    uint64_t *cdrom_binfile_sizes;
+
     // Cue sheet file for CD-ROM images
     FsFile cuesheetfile;
 
@@ -109,6 +143,12 @@ struct image_config_t: public S2S_TargetCfg
     // Maximum amount of bytes to prefetch
     int prefetchbytes;
 
+    // When to release the bus during commands, bluescsi_disconnect_mode_t
+    uint8_t disconnect_mode;
+
+    // Tagged commands accepted while another one runs, 0 disables queuing
+    uint8_t queue_depth;
+
     // Warning about geometry settings
     bool geometrywarningprinted;
 
@@ -185,6 +225,16 @@ int scsiDiskGetNextImageName(image_config_t &img, char *buf, size_t buflen);
 // Get pointer to extended image configuration based on target idx
 image_config_t &scsiDiskGetImageConfig(int target_idx);
 
+// Same for a logical unit of the target, nullptr if the LUN has no image
+image_config_t *scsiDiskGetLunImageConfig(int target_idx, int lun);
+
+// Moves the lowest LUN image of targets without a LUN 0 image to LUN 0, so
+// that an image such as HD11.img alone still appears at its ID.
+void scsiDiskPromoteLunImages();
+
+// Set the unit attention condition reported on the next command to the image's LUN
+void scsiDiskPostUnitAttention(image_config_t &img, uint16_t asc);
+
 // Start data transfer from disk image to SCSI bus
 // Can be called by device type specific command implementations (such as READ CD)
 void scsiDiskStartRead(uint32_t lba, uint32_t blocks);
@@ -192,6 +242,48 @@ void scsiDiskStartRead(uint32_t lba, uint32_t blocks);
 // Start data transfer from SCSI bus to disk image
 void scsiDiskStartWrite(uint32_t lba, uint32_t blocks);
 
+// Opcode tables for the device type command handlers.
+// Each handler returns 1 if it handled the command, or 0 to pass it on to
+// the next handler in scsi.c (e.g. CD-ROM SEEK falls through to the disk one).
+typedef int (*scsi_opcode_handler_t)(image_config_t &img);
+
+enum scsi_opcode_flags_t {
+    OPCODE_NEEDS_MEDIUM = 0x01, // NOT READY / MEDIUM NOT PRESENT while ejected
+};
+
+struct scsi_opcode_t
+{
+    uint8_t opcode;
+    uint8_t flags;
+    scsi_opcode_handler_t handler;
+};
+
+struct scsi_opcode_table_t
+{
+    // Entry number + 1 for each opcode, 0 for opcodes not in the table
+    uint8_t index[256];
+    const scsi_opcode_t *entries;
+};
+
+// Builds the opcode lookup at compile time from a list of entries:
+// static constexpr scsi_opcode_table_t g_table = scsiOpcodeTable(g_entries);
+template <size_t N>
+constexpr scsi_opcode_table_t scsiOpcodeTable(const scsi_opcode_t (&entries)[N])
+{
+    static_assert(N < 256, "Too many entries for opcode table");
+    scsi_opcode_table_t table = {};
+    table.entries = entries;
+    for (size_t i = 0; i < N; i++)
+    {
+        table.index[entries[i].opcode] = i + 1;
+    }
+    return table;
+}
+
+// Run the handler for scsiDev.cdb[0] from the table.
+// Returns 0 if the opcode is not in the table or the handler passed it on.
+int scsiOpcodeDispatch(const scsi_opcode_table_t &table, image_config_t &img);
+
 // Returns true if there is at least one network device active
 bool scsiDiskCheckAnyNetworkDevicesConfigured();
 
@@ -31,6 +31,10 @@
 #include "BlueSCSI_log.h"
 #include "BlueSCSI_log_trace.h"
 #include "BlueSCSI_initiator.h"
+#include "BlueSCSI_initiator_rescue.h"
+#include "BlueSCSI_initiator_hash.h"
+#include "BlueSCSI_initiator_sparse.h"
+#include "BlueSCSI_initiator_restore.h"
 #include "BlueSCSI_msc_initiator.h"
 #include "BlueSCSI_msc.h"
 #include "BlueSCSI_vhd.h"
@@ -91,6 +95,7 @@ static struct {
 
     // Is imaging a drive in progress, or are we scanning?
     bool imaging;
+    bool restoring; // Writing an image to the drive instead (InitiatorRestoreImage)
 
     // Information about currently selected drive
     int target_id;
@@ -115,6 +120,19 @@ static struct {
     // VHD output format (opt-in via InitiatorVHD=1)
     bool use_vhd_format;
 
+    // Dynamic VHD that leaves out zero blocks (opt-in via InitiatorSparse=1)
+    bool use_sparse;
+
+    // Multi-pass imaging of failing drives (opt-in via InitiatorRescue=1)
+    bool use_rescue;
+
+    // Image hash sidecar (InitiatorHash) and read-back check (InitiatorVerify)
+    uint8_t hash_algorithm;
+    bool verify_image;
+
+    // Read back blocks written in restore mode (InitiatorRestoreVerify)
+    bool restore_verify;
+
     // Negotiated bus width for targets
     int targetBusWidth[NUM_SCSIID];
     uint32_t start_sector[NUM_SCSIID];
@@ -122,6 +140,45 @@ static struct {
     FsFile target_file;
 } g_initiator_state;
 
+// Transfer size autotuning for imaging (InitiatorAutoTune, enabled by default).
+// Each candidate setting is measured over a fixed amount of data and the
+// fastest one is kept for the rest of the drive. Read errors halve the
+// transfer size, it grows back after a run of clean transfers.
+#define INITIATOR_TUNE_PROBE_BYTES (1024 * 1024)
+#define INITIATOR_TUNE_MIN_TRANSFER_BYTES 4096
+#define INITIATOR_TUNE_RECOVER_BATCHES 64
+
+enum initiator_tune_stage_t {
+    TUNE_TRANSFER_SIZE, // Sectors per READ command
+    TUNE_SD_WRITE_SIZE, // Largest SD write issued while SCSI data is streaming in
+    TUNE_COMMAND,       // READ(6) against READ(10)
+    TUNE_DONE
+};
+
+static const uint32_t g_tune_sd_write_sizes[] = {PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE, 32768, 16384};
+
+static struct {
+    bool enabled;
+    initiator_tune_stage_t stage;
+    uint8_t candidate;
+    bool read10_supported;
+
+    // Measurement of the current candidate
+    uint32_t probe_bytes;
+    uint32_t probe_us;
+
+    // Best setting found so far, rate in bytes per ms
+    uint32_t best_rate;
+    uint32_t best_transfer;
+    uint32_t best_sd_write;
+    bool best_read10;
+
+    // Setting in use
+    uint32_t transfer;
+    uint32_t sd_write;
+    uint32_t clean_batches;
+} g_initiator_tune;
+
 extern SdFs SD;
 
 // Initialization of initiator mode
@@ -143,11 +200,29 @@ void scsiInitiatorInit()
     g_initiator_state.use_read10 = ini_getbool("SCSI", "InitiatorUseRead10", false, CONFIGFILE);
     g_initiator_state.use_identify = ini_getbool("SCSI", "InitiatorIdentify", true, CONFIGFILE);
     g_initiator_state.use_vhd_format = ini_getbool("SCSI", "InitiatorVHD", false, CONFIGFILE);
+    g_initiator_state.use_sparse = ini_getbool("SCSI", "InitiatorSparse", false, CONFIGFILE);
+    g_initiator_state.use_rescue = ini_getbool("SCSI", "InitiatorRescue", false, CONFIGFILE);
+    g_initiator_state.hash_algorithm = ini_getl("SCSI", "InitiatorHash", INITIATOR_HASH_CRC32, CONFIGFILE);
+    g_initiator_state.verify_image = ini_getbool("SCSI", "InitiatorVerify", false, CONFIGFILE);
+    g_initiator_state.restore_verify = ini_getbool("SCSI", "InitiatorRestoreVerify", false, CONFIGFILE);
+    if (g_initiator_state.hash_algorithm > INITIATOR_HASH_SHA256)
+    {
+        logmsg("InitiatorHash set to illegal value in, ", CONFIGFILE, ", defaulting to CRC32");
+        g_initiator_state.hash_algorithm = INITIATOR_HASH_CRC32;
+    }
+    if (g_initiator_state.verify_image && g_initiator_state.hash_algorithm == INITIATOR_HASH_NONE)
+    {
+        // Verification compares hashes
+        g_initiator_state.hash_algorithm = INITIATOR_HASH_CRC32;
+    }
+    g_initiator_tune.enabled = ini_getbool("SCSI", "InitiatorAutoTune", true, CONFIGFILE);
+    g_initiator_tune.sd_write = PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE;
 
     // treat initiator id as already imaged drive so it gets skipped
     g_initiator_state.drives_imaged = 1 << g_initiator_state.initiator_id;
 
     g_initiator_state.imaging = false;
+    g_initiator_state.restoring = false;
     g_initiator_state.target_id = -1;
     g_initiator_state.sectorsize = 0;
     g_initiator_state.sectorcount = 0;
@@ -269,6 +344,166 @@ static bool initiatorShouldWriteVhd()
            g_initiator_state.sectorsize == 512;
 }
 
+// Sparse output is a dynamic VHD, written strictly in order, so it is not
+// available for rescue imaging.
+static bool initiatorShouldWriteSparse()
+{
+    return g_initiator_state.use_sparse &&
+           !g_initiator_state.use_rescue &&
+           initiatorShouldWriteVhd();
+}
+
+// Position the image at a drive byte offset, used after failed reads
+static bool initiatorImageSeek(uint64_t pos)
+{
+    if (initiatorShouldWriteSparse())
+        return initiatorSparseSeek(g_initiator_state.target_file, pos);
+    else
+        return g_initiator_state.target_file.seek(pos);
+}
+
+static void initiatorTuneLogSetting(const char *prefix)
+{
+    logmsg(prefix, (int)g_initiator_tune.transfer, " sectors per command, ",
+           (int)(g_initiator_tune.sd_write / 1024), " kB SD writes, ",
+           g_initiator_state.use_read10 ? "READ10" : "READ6");
+}
+
+static void initiatorTuneApply(uint32_t transfer, uint32_t sd_write, bool read10)
+{
+    g_initiator_tune.transfer = transfer;
+    g_initiator_tune.sd_write = sd_write;
+    g_initiator_state.use_read10 = read10;
+    g_initiator_tune.probe_bytes = 0;
+    g_initiator_tune.probe_us = 0;
+}
+
+// Moves to the next candidate, returns false when the stage has no more
+static bool initiatorTuneNextCandidate()
+{
+    uint8_t k = ++g_initiator_tune.candidate;
+    if (g_initiator_tune.stage == TUNE_TRANSFER_SIZE)
+    {
+        uint32_t transfer = g_initiator_state.max_sector_per_transfer >> k;
+        if (transfer == 0 || transfer * g_initiator_state.sectorsize < INITIATOR_TUNE_MIN_TRANSFER_BYTES)
+            return false;
+        initiatorTuneApply(transfer, g_initiator_tune.best_sd_write, g_initiator_tune.best_read10);
+    }
+    else if (g_initiator_tune.stage == TUNE_SD_WRITE_SIZE)
+    {
+        if (k >= sizeof(g_tune_sd_write_sizes) / sizeof(g_tune_sd_write_sizes[0]))
+            return false;
+        initiatorTuneApply(g_initiator_tune.best_transfer, g_tune_sd_write_sizes[k], g_initiator_tune.best_read10);
+    }
+    else if (g_initiator_tune.stage == TUNE_COMMAND)
+    {
+        // READ6 is only an alternative if it can address the whole drive
+        if (k > 1 || !g_initiator_tune.read10_supported ||
+            g_initiator_state.sectorcount > 0x1FFFFF || g_initiator_tune.best_transfer > 256)
+            return false;
+        initiatorTuneApply(g_initiator_tune.best_transfer, g_initiator_tune.best_sd_write, false);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static void initiatorTuneFinish()
+{
+    g_initiator_tune.stage = TUNE_DONE;
+    initiatorTuneApply(g_initiator_tune.best_transfer, g_initiator_tune.best_sd_write, g_initiator_tune.best_read10);
+    g_initiator_tune.clean_batches = 0;
+    initiatorTuneLogSetting("Transfer tuning done: ");
+    logmsg("-- Measured ", (int)g_initiator_tune.best_rate, " kB/s");
+}
+
+// Called when imaging of a drive starts, the first candidate is the
+// setting imaging would use without tuning.
+static void initiatorTuneStart()
+{
+    g_initiator_tune.stage = g_initiator_tune.enabled ? TUNE_TRANSFER_SIZE : TUNE_DONE;
+    g_initiator_tune.candidate = 0;
+    g_initiator_tune.read10_supported = g_initiator_state.use_read10;
+    g_initiator_tune.best_rate = 0;
+    g_initiator_tune.best_transfer = g_initiator_state.max_sector_per_transfer;
+    g_initiator_tune.best_sd_write = PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE;
+    g_initiator_tune.best_read10 = g_initiator_state.use_read10;
+    g_initiator_tune.clean_batches = 0;
+    initiatorTuneApply(g_initiator_tune.best_transfer, g_initiator_tune.best_sd_write, g_initiator_tune.best_read10);
+}
+
+// Account a successful read of sectors that took elapsed_us
+static void initiatorTuneBatchDone(uint32_t sectors, uint32_t elapsed_us)
+{
+    if (g_initiator_tune.stage == TUNE_DONE)
+    {
+        // Grow back towards the tuned size after errors
+        if (g_initiator_tune.transfer < g_initiator_tune.best_transfer &&
+            ++g_initiator_tune.clean_batches >= INITIATOR_TUNE_RECOVER_BATCHES)
+        {
+            g_initiator_tune.transfer *= 2;
+            if (g_initiator_tune.transfer > g_initiator_tune.best_transfer)
+                g_initiator_tune.transfer = g_initiator_tune.best_transfer;
+            g_initiator_tune.clean_batches = 0;
+            dbgmsg<LOG_SUBSYS_INITIATOR>("Transfer size raised to ", (int)g_initiator_tune.transfer, " sectors");
+        }
+        return;
+    }
+
+    // Only full sized transfers are comparable
+    if (sectors != g_initiator_tune.transfer) return;
+
+    g_initiator_tune.probe_bytes += sectors * g_initiator_state.sectorsize;
+    g_initiator_tune.probe_us += elapsed_us;
+    if (g_initiator_tune.probe_bytes < INITIATOR_TUNE_PROBE_BYTES) return;
+
+    uint32_t rate = (uint64_t)g_initiator_tune.probe_bytes * 1000 / (g_initiator_tune.probe_us + 1);
+    dbgmsg<LOG_SUBSYS_INITIATOR>("Transfer tuning: ", (int)g_initiator_tune.transfer, " sectors, ",
+        (int)(g_initiator_tune.sd_write / 1024), " kB SD writes, ",
+        g_initiator_state.use_read10 ? "READ10: " : "READ6: ", (int)rate, " kB/s");
+
+    // Changing the setting has to be clearly better to be worth it
+    if (g_initiator_tune.best_rate == 0 || rate > g_initiator_tune.best_rate + g_initiator_tune.best_rate / 32)
+    {
+        g_initiator_tune.best_rate = rate;
+        g_initiator_tune.best_transfer = g_initiator_tune.transfer;
+        g_initiator_tune.best_sd_write = g_initiator_tune.sd_write;
+        g_initiator_tune.best_read10 = g_initiator_state.use_read10;
+    }
+
+    while (!initiatorTuneNextCandidate())
+    {
+        if (g_initiator_tune.stage + 1 == TUNE_DONE)
+        {
+            initiatorTuneFinish();
+            return;
+        }
+        g_initiator_tune.stage = (initiator_tune_stage_t)(g_initiator_tune.stage + 1);
+        g_initiator_tune.candidate = 0;
+    }
+}
+
+// Back off after a failed read
+static void initiatorTuneBatchFailed()
+{
+    if (g_initiator_tune.stage != TUNE_DONE)
+    {
+        // The candidate may be what the drive does not like, go back to the
+        // best known setting before backing off
+        logmsg("Read error during transfer tuning, keeping best setting so far");
+        initiatorTuneFinish();
+    }
+
+    if (g_initiator_tune.transfer > 1)
+    {
+        g_initiator_tune.transfer /= 2;
+        dbgmsg<LOG_SUBSYS_INITIATOR>("Transfer size lowered to ", (int)g_initiator_tune.transfer, " sectors");
+    }
+    g_initiator_tune.clean_batches = 0;
+}
+
 // High level logic of the initiator mode
 void scsiInitiatorMainLoop()
 {
@@ -363,14 +598,17 @@ void scsiInitiatorMainLoop()
                 scsiInitiatorReadCapacity(g_initiator_state.target_id,
                                           &g_initiator_state.sectorcount,
                                           &g_initiator_state.sectorsize);
-            dbgmsg("read capacity: ", readcapok ? "OK" : "FAILED");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("read capacity: ", readcapok ? "OK" : "FAILED");
 
             bool inquiryok = startstopok &&
                 scsiInquiry(g_initiator_state.target_id, inquiry_data);
-            dbgmsg("inquiry: ", inquiryok ? "OK" : "FAILED");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("inquiry: ", inquiryok ? "OK" : "FAILED");
 
             LED_OFF();
 
+            char restore_image[MAX_FILE_PATH + 1];
+            bool restore = initiatorRestoreImageName(g_initiator_state.target_id, restore_image, sizeof(restore_image));
+
             uint64_t total_bytes = 0;
             if (readcapok)
             {
@@ -382,7 +620,7 @@ void scsiInitiatorMainLoop()
 
                 total_bytes = (uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize;
                 logmsg("Drive total size is ", (int)(total_bytes / (1024 * 1024)), " MiB");
-                if (total_bytes >= 0xFFFFFFFF && SD.fatType() != FAT_TYPE_EXFAT)
+                if (total_bytes >= 0xFFFFFFFF && SD.fatType() != FAT_TYPE_EXFAT && !restore)
                 {
                     // Note: the FAT32 limit is 4 GiB - 1 byte
                     logmsg("Target SCSI ID ", g_initiator_state.target_id, " image size is equal or larger than 4 GiB.");
@@ -402,7 +640,7 @@ void scsiInitiatorMainLoop()
             }
             else
             {
-                dbgmsg("Failed to connect to SCSI ID ", g_initiator_state.target_id);
+                dbgmsg<LOG_SUBSYS_INITIATOR>("Failed to connect to SCSI ID ", g_initiator_state.target_id);
                 g_initiator_state.sectorsize = 0;
                 g_initiator_state.sectorcount = g_initiator_state.sectorcount_all = 0;
             }
@@ -500,6 +738,44 @@ void scsiInitiatorMainLoop()
                 g_initiator_state.removable_count[g_initiator_state.target_id] = 1;
             }
 
+            if (restore && g_initiator_state.sectorcount > 0)
+            {
+                // Restore runs once per boot, whatever the outcome
+                g_initiator_state.drives_imaged |= 1 << g_initiator_state.target_id;
+
+                if (!readcapok || !inquiryok || g_initiator_state.device_type == SCSI_DEVICE_TYPE_CD)
+                {
+                    logmsg("SCSI ID ", g_initiator_state.target_id, " can not be written, not restoring ", restore_image);
+                    return;
+                }
+
+                g_initiator_state.target_file = SD.open(restore_image, O_RDONLY);
+                if (!g_initiator_state.target_file.isOpen())
+                {
+                    logmsg("Failed to open file for reading: ", restore_image,
+                           ", a restored image is renamed with a _restored suffix");
+                    return;
+                }
+
+                if (!initiatorRestoreStart(g_initiator_state.target_file, restore_image,
+                                           g_initiator_state.sectorcount, g_initiator_state.sectorsize,
+                                           g_initiator_state.max_sector_per_transfer,
+                                           g_initiator_state.max_retry_count,
+                                           g_initiator_state.restore_verify,
+                                           g_initiator_state.use_read10))
+                {
+                    g_initiator_state.target_file.close();
+                    return;
+                }
+
+                logmsg("Starting to restore ", restore_image, " to SCSI ID ", g_initiator_state.target_id);
+                g_initiator_state.sectorcount = initiatorRestoreSectorCount();
+                g_initiator_state.eject_when_done = false;
+                g_initiator_state.restoring = true;
+                g_initiator_state.imaging = true;
+                return;
+            }
+
             if (g_initiator_state.sectorcount > 0)
             {
                 char filename[32] = {0};
@@ -518,8 +794,23 @@ void scsiInitiatorMainLoop()
                 {
                     handling = ini_getl("SCSI", "InitiatorImageHandling", INITIATOR_IMAGE_INCREMENT_IF_EXISTS, CONFIGFILE);
                 }
+                // An unfinished rescue of the same drive is continued instead,
+                // unless the existing image is to be overwritten
+                bool resume = false;
+                auto can_resume = [&]() {
+                    resume = g_initiator_state.use_rescue &&
+                             handling != INITIATOR_IMAGE_OVERWRITE_IF_EXISTS &&
+                             SD.exists(filename) &&
+                             initiatorRescueCanResume(filename, g_initiator_state.sectorcount,
+                                                      g_initiator_state.sectorsize);
+                    return resume;
+                };
+                if (can_resume())
+                {
+                    logmsg("Resuming rescue imaging into ", filename);
+                }
                 // Stop if a file already exists
-                if (handling == INITIATOR_IMAGE_SKIP_IF_EXISTS)
+                else if (handling == INITIATOR_IMAGE_SKIP_IF_EXISTS)
                 {
                     if (SD.exists(filename))
                     {
@@ -556,6 +847,11 @@ void scsiInitiatorMainLoop()
                             snprintf(filename, sizeof(filename), "%s-%03lu%s", filename_base, i, filename_extension);
                         }
                         snprintf(filename_copy, sizeof(filename_copy), "-%03lu", i);
+                        if (can_resume())
+                        {
+                            logmsg("Resuming rescue imaging into ", filename);
+                            break;
+                        }
                         if (SD.exists(filename))
                             continue;
                         break;
@@ -584,8 +880,10 @@ void scsiInitiatorMainLoop()
                 }
 
                 uint64_t vhd_overhead = initiatorShouldWriteVhd() ? VHD_FOOTER_SIZE : 0;
+                if (initiatorShouldWriteSparse())
+                    vhd_overhead = initiatorSparseOverhead(total_bytes);
                 uint64_t sd_card_free_bytes = (uint64_t)SD.vol()->freeClusterCount() * SD.vol()->bytesPerCluster();
-                if (sd_card_free_bytes < total_bytes + vhd_overhead)
+                if (!resume && sd_card_free_bytes < total_bytes + vhd_overhead)
                 {
                     logmsg("SD Card only has ", (int)(sd_card_free_bytes / (1024 * 1024)),
                            " MiB - not enough free space to image SCSI ID ", g_initiator_state.target_id);
@@ -593,14 +891,17 @@ void scsiInitiatorMainLoop()
                     return;
                 }
 
-                g_initiator_state.target_file = SD.open(filename, O_WRONLY | O_CREAT | O_TRUNC);
+                if (resume)
+                    g_initiator_state.target_file = SD.open(filename, O_RDWR);
+                else
+                    g_initiator_state.target_file = SD.open(filename, O_RDWR | O_CREAT | O_TRUNC);
                 if (!g_initiator_state.target_file.isOpen())
                 {
                     logmsg("Failed to open file for writing: ", filename);
                     return;
                 }
 
-                if (SD.fatType() == FAT_TYPE_EXFAT)
+                if (!resume && SD.fatType() == FAT_TYPE_EXFAT && !initiatorShouldWriteSparse())
                 {
                     // Only preallocate on exFAT, on FAT32 preallocating can result in false garbage data in the
                     // file if write is interrupted.
@@ -609,22 +910,90 @@ void scsiInitiatorMainLoop()
                         (uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize + vhd_overhead);
                 }
 
+                if (initiatorShouldWriteSparse() &&
+                    !initiatorSparseStart(g_initiator_state.target_file,
+                        (uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize,
+                        g_initiator_state.target_id))
+                {
+                    g_initiator_state.target_file.close();
+                    return;
+                }
+
                 logmsg("Starting to copy drive data to ", filename);
                 g_initiator_state.imaging = true;
+                initiatorTuneStart();
 
+                // Sparse images differ from the drive data stream, they are hashed from the SD card
+                bool hash_streaming = !g_initiator_state.use_rescue && !initiatorShouldWriteSparse();
+                initiatorHashStart(filename, g_initiator_state.hash_algorithm, hash_streaming);
+
+                if (g_initiator_state.use_rescue)
+                {
+                    if (g_initiator_state.start_sector[g_initiator_state.target_id] != 0)
+                    {
+                        logmsg("InitiatorStartSector is ignored in rescue mode");
+                    }
+                    initiatorRescueStart(filename, g_initiator_state.sectorcount, g_initiator_state.sectorsize,
+                                         g_initiator_state.max_sector_per_transfer,
+                                         g_initiator_state.max_retry_count, resume);
+                }
                 // Initiator start sector override
-                if (g_initiator_state.start_sector[g_initiator_state.target_id] != 0) {
+                else if (g_initiator_state.start_sector[g_initiator_state.target_id] != 0) {
                     g_initiator_state.sectors_done = g_initiator_state.start_sector[g_initiator_state.target_id];
+                    if (initiatorShouldWriteSparse())
+                    {
+                        // Skipped part of the drive reads as zeros in the VHD
+                        initiatorImageSeek((uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize);
+                    }
                     logmsg("Using Alternate Start Sector ", g_initiator_state.start_sector[g_initiator_state.target_id],
                         " For SCSI ID ", g_initiator_state.target_id);
                 }
             }
         }
     }
+    else if (g_initiator_state.restoring)
+    {
+        // Copy sectors from file to SCSI drive
+        scsiInitiatorUpdateLed();
+        bool finished = !initiatorRestoreStep(g_initiator_state.target_id, g_initiator_state.target_file);
+        g_initiator_state.sectors_done = initiatorRestoreSectorsDone();
+
+        if (finished)
+        {
+            scsiStartStopUnit(g_initiator_state.target_id, false);
+            g_initiator_state.target_file.close();
+            if (initiatorRestoreSucceeded())
+            {
+                logmsg("Finished restoring drive with id ", g_initiator_state.target_id);
+                initiatorRestoreMarkDone();
+            }
+            else
+            {
+                logmsg("Restoring drive with id ", g_initiator_state.target_id, " FAILED after ",
+                       (int)g_initiator_state.sectors_done, " sectors");
+            }
+            LED_OFF();
+
+            g_initiator_state.restoring = false;
+            g_initiator_state.imaging = false;
+        }
+    }
     else
     {
         // Copy sectors from SCSI drive to file
-        if (g_initiator_state.sectors_done >= g_initiator_state.sectorcount)
+        bool finished;
+        if (g_initiator_state.use_rescue)
+        {
+            finished = !initiatorRescueStep(g_initiator_state.target_id, g_initiator_state.target_file);
+            g_initiator_state.sectors_done = initiatorRescueSectorsTried();
+            g_initiator_state.bad_sector_count = initiatorRescueBadSectors();
+        }
+        else
+        {
+            finished = (g_initiator_state.sectors_done >= g_initiator_state.sectorcount);
+        }
+
+        if (finished)
         {
             scsiStartStopUnit(g_initiator_state.target_id, false);
             logmsg("Finished imaging drive with id ", g_initiator_state.target_id);
@@ -648,7 +1017,14 @@ void scsiInitiatorMainLoop()
             }
 
             // Write VHD footer if enabled for this target
-            if (initiatorShouldWriteVhd())
+            if (initiatorShouldWriteSparse())
+            {
+                if (initiatorSparseFinish(g_initiator_state.target_file))
+                {
+                    logmsg("VHD footer written successfully");
+                }
+            }
+            else if (initiatorShouldWriteVhd())
             {
                 uint64_t raw_bytes = (uint64_t)g_initiator_state.sectorcount * g_initiator_state.sectorsize;
                 uint8_t vhd_footer[VHD_FOOTER_SIZE];
@@ -656,9 +1032,11 @@ void scsiInitiatorMainLoop()
                 vhd_build_fixed_footer(vhd_footer, raw_bytes,
                                        g_initiator_state.sectorcount, 0,
                                        g_initiator_state.target_id);
-                if (g_initiator_state.target_file.write(vhd_footer, VHD_FOOTER_SIZE) == VHD_FOOTER_SIZE)
+                if (g_initiator_state.target_file.seek(raw_bytes) &&
+                    g_initiator_state.target_file.write(vhd_footer, VHD_FOOTER_SIZE) == VHD_FOOTER_SIZE)
                 {
                     logmsg("VHD footer written successfully");
+                    initiatorHashData(vhd_footer, VHD_FOOTER_SIZE);
                 }
                 else
                 {
@@ -666,6 +1044,9 @@ void scsiInitiatorMainLoop()
                 }
             }
 
+            g_initiator_state.target_file.flush();
+            initiatorHashFinish(g_initiator_state.target_file, g_initiator_state.verify_image);
+
             g_initiator_state.imaging = false;
             g_initiator_state.target_file.close();
             return;
@@ -673,16 +1054,23 @@ void scsiInitiatorMainLoop()
 
         scsiInitiatorUpdateLed();
 
+        if (g_initiator_state.use_rescue)
+        {
+            return;
+        }
+
         // How many sectors to read in one batch?
         int numtoread = g_initiator_state.sectorcount - g_initiator_state.sectors_done;
-        if (numtoread > g_initiator_state.max_sector_per_transfer)
-            numtoread = g_initiator_state.max_sector_per_transfer;
+        if (numtoread > g_initiator_tune.transfer)
+            numtoread = g_initiator_tune.transfer;
 
         // Retry sector-by-sector after failure
         if (g_initiator_state.sectors_done < g_initiator_state.failposition)
             numtoread = 1;
 
         uint32_t time_start = platform_millis();
+        uint32_t time_start_us = time_us_32();
+        initiatorHashCheckpoint();
         bool status = scsiInitiatorReadDataToFile(g_initiator_state.target_id,
             g_initiator_state.sectors_done, numtoread, g_initiator_state.sectorsize,
             g_initiator_state.target_file);
@@ -690,6 +1078,8 @@ void scsiInitiatorMainLoop()
         if (!status)
         {
             logmsg("Failed to transfer ", numtoread, " sectors starting at ", (int)g_initiator_state.sectors_done);
+            initiatorTuneBatchFailed();
+            initiatorHashRollback();
 
             if (g_initiator_state.retrycount < g_initiator_state.max_retry_count)
             {
@@ -700,7 +1090,7 @@ void scsiInitiatorMainLoop()
                 delay_with_poll(200);
 
                 g_initiator_state.retrycount++;
-                g_initiator_state.target_file.seek((uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize);
+                initiatorImageSeek((uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize);
 
                 if (g_initiator_state.retrycount > 1 && numtoread > 1)
                 {
@@ -711,10 +1101,23 @@ void scsiInitiatorMainLoop()
             else
             {
                 logmsg("Retry limit exceeded, skipping one sector");
+
+                // Fill the sector with zeros so that the following data stays
+                // at its offset and the image hash covers what is in the file
+                uint32_t sectorsize = g_initiator_state.sectorsize;
+                memset(scsiDev.data, 0, sectorsize);
+                initiatorImageSeek((uint64_t)g_initiator_state.sectors_done * sectorsize);
+                if (initiatorShouldWriteSparse())
+                    initiatorSparseWrite(g_initiator_state.target_file, scsiDev.data, sectorsize);
+                else
+                    g_initiator_state.target_file.write(scsiDev.data, sectorsize);
+                initiatorHashData(scsiDev.data, sectorsize);
+                initiatorHashCommit();
+
                 g_initiator_state.retrycount = 0;
                 g_initiator_state.sectors_done++;
                 g_initiator_state.bad_sector_count++;
-                g_initiator_state.target_file.seek((uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize);
+                initiatorImageSeek((uint64_t)g_initiator_state.sectors_done * g_initiator_state.sectorsize);
             }
         }
         else
@@ -722,6 +1125,8 @@ void scsiInitiatorMainLoop()
             g_initiator_state.retrycount = 0;
             g_initiator_state.sectors_done += numtoread;
             g_initiator_state.target_file.flush();
+            initiatorHashCommit();
+            initiatorTuneBatchDone(numtoread, time_us_32() - time_start_us);
 
             int speed_kbps = numtoread * g_initiator_state.sectorsize / (platform_millis() - time_start);
             logmsg("SCSI read succeeded, sectors done: ",
@@ -756,7 +1161,7 @@ int scsiInitiatorRunCommand(int target_id,
     if (!scsiHostPhySelect(target_id, g_initiator_state.initiator_id))
     {
         scsiHostPhySetATN(false);
-        dbgmsg("------ Target ", target_id, " did not respond");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("------ Target ", target_id, " did not respond");
         scsiHostPhyRelease();
         return -1;
     }
@@ -850,7 +1255,7 @@ int scsiInitiatorRunCommand(int target_id,
             uint8_t tmp = -1;
             scsiHostRead(&tmp, 1);
             status = tmp;
-            dbgmsg("------ STATUS: ", tmp);
+            dbgmsg<LOG_SUBSYS_INITIATOR>("------ STATUS: ", tmp);
         }
     }
 
@@ -873,12 +1278,12 @@ bool scsiInitiatorTestSupportsRead10(int target_id, uint32_t sectorsize)
 
     if (status == 0)
     {
-        dbgmsg("Target supports READ10 command");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("Target supports READ10 command");
         return true;
     }
     else
     {
-        dbgmsg("Target does not support READ10 command");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("Target does not support READ10 command");
         return false;
     }
 }
@@ -979,7 +1384,7 @@ bool scsiStartStopUnit(int target_id, bool start)
 
         if (sense_key == NOT_READY)
         {
-            dbgmsg("--- Device reports NOT_READY, running STOP to attempt restart");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("--- Device reports NOT_READY, running STOP to attempt restart");
             // Some devices will only leave NOT_READY state after they have been
             // commanded to stop state first.
             platform_delay_ms(1000);
@@ -1033,7 +1438,7 @@ bool scsiTestUnitReady(int target_id)
             if (sense_key == UNIT_ATTENTION)
             {
                 uint8_t inquiry[36];
-                dbgmsg("Target ", target_id, " reports UNIT_ATTENTION, running INQUIRY");
+                dbgmsg<LOG_SUBSYS_INITIATOR>("Target ", target_id, " reports UNIT_ATTENTION, running INQUIRY");
                 scsiInquiry(target_id, inquiry);
             }
             else if (sense_key == NOT_READY)
@@ -1046,14 +1451,14 @@ bool scsiTestUnitReady(int target_id)
                 if (!g_msc_initiator)
 #endif
                 {
-                    dbgmsg("Target ", target_id, " reports NOT_READY, running STARTSTOPUNIT");
+                    dbgmsg<LOG_SUBSYS_INITIATOR>("Target ", target_id, " reports NOT_READY, running STARTSTOPUNIT");
                     scsiStartStopUnit(target_id, true);
                 }
             }
         }
         else
         {
-            dbgmsg("Target ", target_id, " TEST UNIT READY response: ", status);
+            dbgmsg<LOG_SUBSYS_INITIATOR>("Target ", target_id, " TEST UNIT READY response: ", status);
         }
     }
 
@@ -1071,7 +1476,7 @@ int scsiInitiatorMessage(int target_id,
 
     if (!scsiHostPhySelect(target_id, g_initiator_state.initiator_id))
     {
-        dbgmsg("------ Target ", target_id, " did not respond");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("------ Target ", target_id, " did not respond");
         scsiHostPhyRelease();
         return -1;
     }
@@ -1133,7 +1538,7 @@ int scsiInitiatorMessage(int target_id,
             uint8_t tmp = -1;
             scsiHostRead(&tmp, 1);
             status = tmp;
-            dbgmsg("------ STATUS: ", tmp);
+            dbgmsg<LOG_SUBSYS_INITIATOR>("------ STATUS: ", tmp);
         }
     }
 
@@ -1170,7 +1575,7 @@ bool scsiInitiatorSetBusWidth(int target_id, int busWidth)
     uint8_t msgIn[16] = {0};
     size_t msgInLen = 0;
 
-    dbgmsg("---- Negotiating bus width = ", (uint8_t)busWidth);
+    dbgmsg<LOG_SUBSYS_INITIATOR>("---- Negotiating bus width = ", (uint8_t)busWidth);
     int status = scsiInitiatorMessage(target_id, msgOut, sizeof(msgOut), msgIn, sizeof(msgIn), &msgInLen);
     if (status != 0)
     {
@@ -1193,7 +1598,7 @@ bool scsiInitiatorSetBusWidth(int target_id, int busWidth)
 
             if (extMsg[0] == 0x03)
             {
-                dbgmsg("-- Target bus width response: ", extMsg[1]);
+                dbgmsg<LOG_SUBSYS_INITIATOR>("-- Target bus width response: ", extMsg[1]);
                 agreedMode = extMsg[1];
             }
         }
@@ -1212,7 +1617,7 @@ bool scsiInitiatorSetBusWidth(int target_id, int busWidth)
     }
     else if (agreedMode == busWidth)
     {
-        dbgmsg("-- Negotiated bus width ", 8 << busWidth, " bits, testing with Inquiry command");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("-- Negotiated bus width ", 8 << busWidth, " bits, testing with Inquiry command");
         g_initiator_state.targetBusWidth[target_id] = busWidth;
         uint8_t inquiryData[36];
         if (!scsiInquiry(target_id, inquiryData))
@@ -1263,7 +1668,7 @@ static void initiatorReadSDCallback(uint32_t bytes_complete)
         uint32_t limit = g_initiator_transfer.bytes_scsi / 8;
         uint32_t bytesPerSector = g_initiator_transfer.bytes_per_sector;
         if (limit < PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE) limit = PLATFORM_OPTIMAL_MIN_SD_WRITE_SIZE;
-        if (limit > PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE) limit = PLATFORM_OPTIMAL_MAX_SD_WRITE_SIZE;
+        if (limit > g_initiator_tune.sd_write) limit = g_initiator_tune.sd_write;
         if (limit > len) limit = PLATFORM_OPTIMAL_LAST_SD_WRITE_SIZE;
         if (limit < bytesPerSector) limit = bytesPerSector;
 
@@ -1278,8 +1683,11 @@ static void initiatorReadSDCallback(uint32_t bytes_complete)
         if (start + len > bufsize)
             len = bufsize - start;
 
-        // Don't overwrite data that has not yet been written to SD card
+        // Don't overwrite data that has not yet been written to SD card or hashed
         uint32_t sd_ready_cnt = g_initiator_transfer.bytes_sd + bytes_complete;
+        uint32_t hashed = initiatorHashProgress();
+        if (hashed < bytes_complete)
+            sd_ready_cnt = g_initiator_transfer.bytes_sd + hashed;
         if (g_initiator_transfer.bytes_scsi_done + len > sd_ready_cnt + bufsize)
             len = sd_ready_cnt + bufsize - g_initiator_transfer.bytes_scsi_done;
 
@@ -1302,7 +1710,7 @@ static void initiatorReadSDCallback(uint32_t bytes_complete)
         }
 
         scsiHostSetBusWidth(g_initiator_state.targetBusWidth[g_initiator_transfer.target_id]);
-        // dbgmsg("SCSI read ", (int)start, " + ", (int)len, ", sd ready cnt ", (int)sd_ready_cnt, " ", (int)bytes_complete, ", scsi done ", (int)g_initiator_transfer.bytes_scsi_done);
+        // dbgmsg<LOG_SUBSYS_INITIATOR>("SCSI read ", (int)start, " + ", (int)len, ", sd ready cnt ", (int)sd_ready_cnt, " ", (int)bytes_complete, ", scsi done ", (int)g_initiator_transfer.bytes_scsi_done);
         if (scsiHostRead(&scsiDev.data[start], len) != len)
         {
             logmsg("Read failed at byte ", (int)g_initiator_transfer.bytes_scsi_done);
@@ -1344,7 +1752,7 @@ static void scsiInitiatorWriteDataToSd(FsFile &file, bool use_callback)
 
     // Start writing to SD card and simultaneously reading more from SCSI bus
     uint8_t *buf = &scsiDev.data[start];
-    // dbgmsg("SD write ", (int)start, " + ", (int)len);
+    // dbgmsg<LOG_SUBSYS_INITIATOR>("SD write ", (int)start, " + ", (int)len);
 
     if (use_callback)
     {
@@ -1352,15 +1760,59 @@ static void scsiInitiatorWriteDataToSd(FsFile &file, bool use_callback)
     }
 
     g_initiator_transfer.bytes_sd_scheduled = g_initiator_transfer.bytes_sd + len;
-    if (file.write(buf, len) != len)
+    initiatorHashSubmit(buf, len);
+    bool written;
+    if (initiatorShouldWriteSparse())
+        written = initiatorSparseWrite(file, buf, len);
+    else
+        written = (file.write(buf, len) == len);
+    if (!written)
     {
         logmsg("scsiInitiatorReadDataToFile: SD card write failed");
         g_initiator_transfer.all_ok = false;
     }
     platform_set_sd_callback(NULL, NULL);
+    initiatorHashWait();
     g_initiator_transfer.bytes_sd += len;
 }
 
+// Run the phases after data transfer until the target releases the bus.
+// Returns the status byte, or status unchanged if the target sent none.
+static int scsiInitiatorCompleteCommand(int status)
+{
+    SCSI_PHASE phase;
+    while ((phase = (SCSI_PHASE)scsiHostPhyGetPhase()) != BUS_FREE)
+    {
+        platform_poll();
+
+        if (phase == MESSAGE_IN)
+        {
+            uint8_t msg = 0;
+            scsiHostRead(&msg, 1);
+
+            if (msg == MSG_COMMAND_COMPLETE)
+            {
+                break;
+            }
+        }
+        else if (phase == MESSAGE_OUT)
+        {
+            uint8_t identify_msg = 0x80;
+            scsiHostWrite(&identify_msg, 1);
+        }
+        else if (phase == STATUS)
+        {
+            uint8_t tmp = 0;
+            scsiHostRead(&tmp, 1);
+            status = tmp;
+            dbgmsg<LOG_SUBSYS_INITIATOR>("------ STATUS: ", tmp);
+        }
+    }
+
+    scsiHostWaitBusFree();
+    return status;
+}
+
 bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize,
                                  FsFile &file)
 {
@@ -1458,39 +1910,233 @@ bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t
         g_initiator_transfer.all_ok = false;
     }
 
-    while ((phase = (SCSI_PHASE)scsiHostPhyGetPhase()) != BUS_FREE)
+    status = scsiInitiatorCompleteCommand(status);
+
+    if (!g_initiator_transfer.all_ok)
+    {
+        dbgmsg<LOG_SUBSYS_INITIATOR>("scsiInitiatorReadDataToFile: Incomplete transfer");
+        return false;
+    }
+    else if (status == 2)
+    {
+        uint8_t sense_key;
+        scsiRequestSense(target_id, &sense_key);
+
+        if (sense_key == RECOVERED_ERROR)
+        {
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsiInitiatorReadDataToFile: RECOVERED_ERROR at ", (int)start_sector);
+            return true;
+        }
+        else if (sense_key == UNIT_ATTENTION)
+        {
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsiInitiatorReadDataToFile: UNIT_ATTENTION");
+            return true;
+        }
+        else
+        {
+            scsiLogInitiatorCommandFailure("scsiInitiatorReadDataToFile data phase", target_id, status, sense_key);
+            return false;
+        }
+    }
+    else
+    {
+        return status == 0;
+    }
+}
+
+// Restore direction of the transfer above: the SD card is read into the same
+// ring buffer while the callback sends the data that has arrived so far.
+// Reads are limited to half of the buffer so that one half can go out on the
+// SCSI bus while the other is filled.
+#define INITIATOR_WRITE_SD_READ_SIZE (sizeof(scsiDev.data) / 2)
+#define INITIATOR_WRITE_SCSI_CHUNK 8192
+
+static void initiatorWriteSDCallback(uint32_t bytes_complete)
+{
+    if (!g_initiator_transfer.all_ok)
+    {
+        return;
+    }
+
+    // Data that has been read from SD card but not yet sent to SCSI bus
+    uint32_t sd_ready_cnt = g_initiator_transfer.bytes_sd + bytes_complete;
+    if (g_initiator_transfer.bytes_scsi_done >= sd_ready_cnt)
+    {
+        return;
+    }
+
+    if (bytes_complete > 0 && sd_ready_cnt == g_initiator_transfer.bytes_sd_scheduled &&
+        g_initiator_transfer.bytes_sd_scheduled < g_initiator_transfer.bytes_scsi)
+    {
+        // Current SD read is complete, it is better we return now and let the
+        // next read begin. The remaining data goes out in its callbacks.
+        return;
+    }
+
+    uint32_t len = sd_ready_cnt - g_initiator_transfer.bytes_scsi_done;
+    if (len > INITIATOR_WRITE_SCSI_CHUNK)
+    {
+        len = INITIATOR_WRITE_SCSI_CHUNK;
+    }
+
+    // Split write so that it doesn't wrap around buffer edge
+    uint32_t bufsize = sizeof(scsiDev.data);
+    uint32_t start = (g_initiator_transfer.bytes_scsi_done % bufsize);
+    if (start + len > bufsize)
+        len = bufsize - start;
+
+    scsiHostSetBusWidth(g_initiator_state.targetBusWidth[g_initiator_transfer.target_id]);
+    uint32_t written = scsiHostWrite(&scsiDev.data[start], len);
+    scsiHostSetBusWidth(0);
+    if (written != len)
+    {
+        logmsg("Write failed at byte ", (int)(g_initiator_transfer.bytes_scsi_done + written));
+        g_initiator_transfer.all_ok = false;
+    }
+    g_initiator_transfer.bytes_scsi_done += written;
+}
+
+// Length of the next SD card read, 0 if the buffer has no room for one yet
+static uint32_t scsiInitiatorSdReadLength()
+{
+    uint32_t bufsize = sizeof(scsiDev.data);
+    uint32_t start = g_initiator_transfer.bytes_sd % bufsize;
+    uint32_t remain = g_initiator_transfer.bytes_scsi - g_initiator_transfer.bytes_sd;
+    uint32_t len = bufsize - (g_initiator_transfer.bytes_sd - g_initiator_transfer.bytes_scsi_done);
+
+    if (len > INITIATOR_WRITE_SD_READ_SIZE) len = INITIATOR_WRITE_SD_READ_SIZE;
+    if (start + len > bufsize) len = bufsize - start;
+    if (len >= remain) return remain;
+
+    // Keep reads in whole SD card sectors, except for the last one
+    return len - len % 512;
+}
+
+static void scsiInitiatorReadDataFromSd(FsFile &file, uint32_t len)
+{
+    uint8_t *buf = &scsiDev.data[g_initiator_transfer.bytes_sd % sizeof(scsiDev.data)];
+    // dbgmsg<LOG_SUBSYS_INITIATOR>("SD read ", (int)(buf - scsiDev.data), " + ", (int)len);
+
+    // Start reading from SD card and simultaneously writing to SCSI bus
+    platform_set_sd_callback(&initiatorWriteSDCallback, buf);
+    g_initiator_transfer.bytes_sd_scheduled = g_initiator_transfer.bytes_sd + len;
+    ssize_t count = file.read(buf, len);
+    platform_set_sd_callback(NULL, NULL);
+
+    if (count < 0)
+    {
+        logmsg("scsiInitiatorWriteDataFromFile: SD card read failed");
+        g_initiator_transfer.all_ok = false;
+        count = 0;
+    }
+
+    if ((uint32_t)count < len)
+    {
+        // Image file ends in the middle of a sector, the rest is zeros
+        memset(buf + count, 0, len - count);
+    }
+    g_initiator_transfer.bytes_sd += len;
+}
+
+bool scsiInitiatorWriteDataFromFile(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize,
+                                    FsFile &file)
+{
+    int status = -1;
+
+    // Same command selection as scsiInitiatorReadDataToFile(), WRITE6 has the same 21 bit LBA limit
+    bool fits_write6 = (start_sector < 0x1FFFFF && sectorcount <= 256);
+    if (!g_initiator_state.use_read10 && fits_write6)
+    {
+        uint8_t command[6] = {0x0A,
+            (uint8_t)(start_sector >> 16),
+            (uint8_t)(start_sector >> 8),
+            (uint8_t)start_sector,
+            (uint8_t)sectorcount,
+            0x00
+        };
+
+        // Start executing command, return in data phase
+        status = scsiInitiatorRunCommand(target_id, command, sizeof(command), NULL, 0, NULL, 0, true);
+    }
+    else
+    {
+        uint8_t command[10] = {0x2A, 0x00,
+            (uint8_t)(start_sector >> 24), (uint8_t)(start_sector >> 16),
+            (uint8_t)(start_sector >> 8), (uint8_t)start_sector,
+            0x00,
+            (uint8_t)(sectorcount >> 8), (uint8_t)(sectorcount),
+            0x00
+        };
+
+        // Start executing command, return in data phase
+        status = scsiInitiatorRunCommand(target_id, command, sizeof(command), NULL, 0, NULL, 0, true);
+    }
+
+    if (status != 0)
+    {
+        uint8_t sense_key;
+        scsiRequestSense(target_id, &sense_key);
+
+        scsiLogInitiatorCommandFailure("scsiInitiatorWriteDataFromFile command phase", target_id, status, sense_key);
+        scsiHostPhyRelease();
+        return false;
+    }
+
+    SCSI_PHASE phase;
+
+    g_initiator_transfer.bytes_scsi = sectorcount * sectorsize;
+    g_initiator_transfer.bytes_per_sector = sectorsize;
+    g_initiator_transfer.bytes_sd = 0;
+    g_initiator_transfer.bytes_sd_scheduled = 0;
+    g_initiator_transfer.bytes_scsi_done = 0;
+    g_initiator_transfer.all_ok = true;
+    g_initiator_transfer.target_id = target_id;
+
+    while (g_initiator_transfer.all_ok)
     {
         platform_poll();
 
-        if (phase == MESSAGE_IN)
+        phase = (SCSI_PHASE)scsiHostPhyGetPhase();
+        if (phase != DATA_OUT && phase != BUS_BUSY)
         {
-            uint8_t msg = 0;
-            scsiHostRead(&msg, 1);
+            break;
+        }
 
-            if (msg == MSG_COMMAND_COMPLETE)
+        uint32_t sd_len = scsiInitiatorSdReadLength();
+        if (g_initiator_transfer.bytes_scsi_done == g_initiator_transfer.bytes_scsi)
+        {
+            if (phase == DATA_OUT)
             {
-                break;
+                logmsg("SCSI write to sector ", (int)start_sector, ": target requests more than ",
+                       (int)g_initiator_transfer.bytes_scsi, " bytes");
+                g_initiator_transfer.all_ok = false;
             }
         }
-        else if (phase == MESSAGE_OUT)
+        else if (sd_len > 0)
         {
-            uint8_t identify_msg = 0x80;
-            scsiHostWrite(&identify_msg, 1);
+            // Read data from SD card and simultaneously write to SCSI
+            scsiInitiatorUpdateLed();
+            scsiInitiatorReadDataFromSd(file, sd_len);
         }
-        else if (phase == STATUS)
+        else
         {
-            uint8_t tmp = 0;
-            scsiHostRead(&tmp, 1);
-            status = tmp;
-            dbgmsg("------ STATUS: ", tmp);
+            // Buffer full, write next block to SCSI bus
+            initiatorWriteSDCallback(0);
         }
     }
 
-    scsiHostWaitBusFree();
+    if (g_initiator_transfer.bytes_scsi_done != g_initiator_transfer.bytes_scsi)
+    {
+        logmsg("SCSI write to sector ", (int)start_sector, " was incomplete: expected ",
+             (int)g_initiator_transfer.bytes_scsi, " sent ", (int)g_initiator_transfer.bytes_scsi_done, " bytes");
+        g_initiator_transfer.all_ok = false;
+    }
+
+    status = scsiInitiatorCompleteCommand(status);
 
     if (!g_initiator_transfer.all_ok)
     {
-        dbgmsg("scsiInitiatorReadDataToFile: Incomplete transfer");
+        dbgmsg<LOG_SUBSYS_INITIATOR>("scsiInitiatorWriteDataFromFile: Incomplete transfer");
         return false;
     }
     else if (status == 2)
@@ -1500,17 +2146,12 @@ bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t
 
         if (sense_key == RECOVERED_ERROR)
         {
-            dbgmsg("scsiInitiatorReadDataToFile: RECOVERED_ERROR at ", (int)start_sector);
-            return true;
-        }
-        else if (sense_key == UNIT_ATTENTION)
-        {
-            dbgmsg("scsiInitiatorReadDataToFile: UNIT_ATTENTION");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("scsiInitiatorWriteDataFromFile: RECOVERED_ERROR at ", (int)start_sector);
             return true;
         }
         else
         {
-            scsiLogInitiatorCommandFailure("scsiInitiatorReadDataToFile data phase", target_id, status, sense_key);
+            scsiLogInitiatorCommandFailure("scsiInitiatorWriteDataFromFile data phase", target_id, status, sense_key);
             return false;
         }
     }
@@ -88,6 +88,11 @@ class FsFile;
 bool scsiInitiatorReadDataToFile(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize,
                                  FsFile &file);
 
+// Read a block of data from file on SD card and write to SCSI device.
+// If the block fits in scsiDev.data, the data written is left at its start.
+bool scsiInitiatorWriteDataFromFile(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize,
+                                    FsFile &file);
+
 // Execute MESSAGE OUT/MESSAGE IN phases
 int scsiInitiatorMessage(int target_id, const uint8_t *msgOut, size_t msgOutLen, uint8_t *msgIn, size_t msgInBufSize, size_t *msgInLen, uint32_t timeout = 30000);
 
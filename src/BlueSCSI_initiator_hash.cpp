@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Image hashing and verification for initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_initiator_hash.h"
+
+#ifdef PLATFORM_HAS_INITIATOR_MODE
+
+#include <string.h>
+#include "BlueSCSI_log.h"
+#include "BlueSCSI_crc32.h"
+#include "BlueSCSI_sha256.h"
+#include <BlueSCSI_platform.h>
+#include "SdFat.h"
+
+extern "C" {
+#include <scsi.h>
+}
+
+extern SdFs SD;
+
+// core1 reports progress in pieces of this size, so the SCSI side can
+// refill the buffer behind it
+#define INITIATOR_HASH_PIECE 4096
+
+// Completed chunks waiting to be written to the sidecar. One transfer is
+// always smaller than a chunk, so there is at most one between commits.
+#define INITIATOR_HASH_MAX_PENDING 4
+
+struct initiator_hash_state_t {
+    uint32_t crc;
+    sha256_ctx_t sha;
+    uint64_t pos;
+    uint32_t chunk_crc;
+    uint8_t pending;
+    uint32_t pending_crc[INITIATOR_HASH_MAX_PENDING];
+};
+
+static struct {
+    bool enabled;
+    bool streaming;
+    bool write_failed;
+    uint8_t algorithm;
+    uint32_t chunks_written;
+    char imagefile[40];
+    FsFile sidecar;
+
+    initiator_hash_state_t state;
+    initiator_hash_state_t checkpoint;
+
+    // Work handed to core1
+    const uint8_t *job_buf;
+    uint32_t job_len;
+    volatile uint32_t job_done;
+    volatile bool job_busy;
+} g_hash;
+
+static void hash_update(initiator_hash_state_t *st, const uint8_t *buf, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t n = INITIATOR_HASH_CHUNK_SIZE - (uint32_t)(st->pos % INITIATOR_HASH_CHUNK_SIZE);
+        if (n > len) n = len;
+
+        if (g_hash.algorithm == INITIATOR_HASH_SHA256)
+            sha256_update(&st->sha, buf, n);
+        else
+            st->crc = crc32_update(st->crc, buf, n);
+        st->chunk_crc = crc32_update(st->chunk_crc, buf, n);
+
+        st->pos += n;
+        if (st->pos % INITIATOR_HASH_CHUNK_SIZE == 0 && st->pending < INITIATOR_HASH_MAX_PENDING)
+        {
+            st->pending_crc[st->pending++] = st->chunk_crc;
+            st->chunk_crc = 0;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+static void hash_reset(initiator_hash_state_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    sha256_init(&st->sha);
+}
+
+static void hash_core1_job()
+{
+    const uint8_t *buf = g_hash.job_buf;
+    uint32_t len = g_hash.job_len;
+    uint32_t done = 0;
+    while (done < len)
+    {
+        uint32_t n = len - done;
+        if (n > INITIATOR_HASH_PIECE) n = INITIATOR_HASH_PIECE;
+        hash_update(&g_hash.state, buf + done, n);
+        done += n;
+        __sync_synchronize();
+        g_hash.job_done = done;
+    }
+    __sync_synchronize();
+    g_hash.job_busy = false;
+}
+
+static void hash_submit(const uint8_t *buf, uint32_t len)
+{
+    initiatorHashWait();
+    if (len == 0) return;
+
+    g_hash.job_buf = buf;
+    g_hash.job_len = len;
+    g_hash.job_done = 0;
+    g_hash.job_busy = true;
+    __sync_synchronize();
+    platform_run_on_core1(hash_core1_job);
+}
+
+static void sidecar_write(const char *line)
+{
+    if (!g_hash.sidecar.isOpen() || g_hash.write_failed) return;
+
+    size_t len = strlen(line);
+    if (g_hash.sidecar.write(line, len) != len)
+    {
+        logmsg("Failed to write image hash file");
+        g_hash.write_failed = true;
+    }
+}
+
+// Writes completed chunk checksums, or drops them when only verifying
+static void hash_flush_chunks(bool write)
+{
+    initiator_hash_state_t *st = &g_hash.state;
+    for (uint8_t i = 0; i < st->pending; i++)
+    {
+        if (write)
+        {
+            char line[40];
+            snprintf(line, sizeof(line), "0x%08lX%08lX  %08lx\n",
+                     (unsigned long)((uint64_t)g_hash.chunks_written * INITIATOR_HASH_CHUNK_SIZE >> 32),
+                     (unsigned long)((uint64_t)g_hash.chunks_written * INITIATOR_HASH_CHUNK_SIZE),
+                     (unsigned long)st->pending_crc[i]);
+            sidecar_write(line);
+            g_hash.chunks_written++;
+        }
+    }
+    st->pending = 0;
+}
+
+// Formats the final hash as lowercase hex, which resets the state
+static void hash_digest(initiator_hash_state_t *st, char *hex)
+{
+    if (g_hash.algorithm == INITIATOR_HASH_SHA256)
+    {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_final(&st->sha, digest);
+        for (int i = 0; i < SHA256_DIGEST_SIZE; i++)
+        {
+            snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+        }
+    }
+    else
+    {
+        snprintf(hex, 9, "%08lx", (unsigned long)st->crc);
+    }
+}
+
+// Hashes the image from the SD card, reading one half of the buffer while
+// core1 hashes the other
+static bool hash_read_back(FsFile &image, bool write_chunks)
+{
+    hash_reset(&g_hash.state);
+
+    uint64_t remain = image.fileSize();
+    uint32_t half = sizeof(scsiDev.data) / 2;
+    uint8_t *bufs[2] = {scsiDev.data, scsiDev.data + half};
+    int cur = 0;
+
+    if (!image.seek(0))
+    {
+        return false;
+    }
+
+    while (remain > 0)
+    {
+        platform_poll();
+        uint32_t len = (remain > half) ? half : remain;
+        if (image.read(bufs[cur], len) != (int)len)
+        {
+            initiatorHashWait();
+            logmsg("Failed to read image back from SD card at ", image.curPosition() - len);
+            return false;
+        }
+
+        initiatorHashWait();
+        hash_flush_chunks(write_chunks);
+        hash_submit(bufs[cur], len);
+        cur ^= 1;
+        remain -= len;
+    }
+
+    initiatorHashWait();
+    hash_flush_chunks(write_chunks);
+    return true;
+}
+
+void initiatorHashStart(const char *imagefile, uint8_t algorithm, bool streaming)
+{
+    g_hash.enabled = (algorithm != INITIATOR_HASH_NONE);
+    if (!g_hash.enabled) return;
+
+    g_hash.algorithm = algorithm;
+    g_hash.streaming = streaming;
+    g_hash.write_failed = false;
+    g_hash.chunks_written = 0;
+    g_hash.job_busy = false;
+    strncpy(g_hash.imagefile, imagefile, sizeof(g_hash.imagefile) - 1);
+    g_hash.imagefile[sizeof(g_hash.imagefile) - 1] = '\0';
+    hash_reset(&g_hash.state);
+
+    char name[sizeof(g_hash.imagefile) + 8];
+    snprintf(name, sizeof(name), "%s.%s", imagefile, algorithm == INITIATOR_HASH_SHA256 ? "sha256" : "crc32");
+    g_hash.sidecar = SD.open(name, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!g_hash.sidecar.isOpen())
+    {
+        logmsg("Failed to create image hash file ", name);
+    }
+
+    char line[64];
+    snprintf(line, sizeof(line), "# BlueSCSI image hash, CRC32 of each %lu byte chunk\n",
+             (unsigned long)INITIATOR_HASH_CHUNK_SIZE);
+    sidecar_write(line);
+    sidecar_write("#             offset     crc32\n");
+    logmsg("Hashing image with ", algorithm == INITIATOR_HASH_SHA256 ? "SHA-256" : "CRC32", " into ", name);
+}
+
+void initiatorHashSubmit(const uint8_t *buf, uint32_t len)
+{
+    if (g_hash.enabled && g_hash.streaming)
+    {
+        hash_submit(buf, len);
+    }
+}
+
+uint32_t initiatorHashProgress()
+{
+    return g_hash.job_busy ? g_hash.job_done : UINT32_MAX;
+}
+
+void initiatorHashWait()
+{
+    while (g_hash.job_busy)
+    {
+        // core1 clears the flag when done
+    }
+    __sync_synchronize();
+}
+
+void initiatorHashData(const uint8_t *buf, uint32_t len)
+{
+    initiatorHashSubmit(buf, len);
+    initiatorHashWait();
+}
+
+void initiatorHashCheckpoint()
+{
+    if (!g_hash.enabled || !g_hash.streaming) return;
+    initiatorHashWait();
+    g_hash.checkpoint = g_hash.state;
+}
+
+void initiatorHashRollback()
+{
+    if (!g_hash.enabled || !g_hash.streaming) return;
+    initiatorHashWait();
+    g_hash.state = g_hash.checkpoint;
+}
+
+void initiatorHashCommit()
+{
+    if (!g_hash.enabled || !g_hash.streaming) return;
+    initiatorHashWait();
+    hash_flush_chunks(true);
+}
+
+bool initiatorHashFinish(FsFile &image, bool verify)
+{
+    if (!g_hash.enabled) return true;
+    initiatorHashWait();
+
+    bool ok = true;
+    char hex[SHA256_DIGEST_SIZE * 2 + 1];
+    if (g_hash.streaming)
+    {
+        // The last partial chunk
+        if (g_hash.state.pos % INITIATOR_HASH_CHUNK_SIZE != 0)
+        {
+            g_hash.state.pending_crc[g_hash.state.pending++] = g_hash.state.chunk_crc;
+        }
+        hash_flush_chunks(true);
+        hash_digest(&g_hash.state, hex);
+    }
+    else
+    {
+        logmsg("Computing image hash from SD card");
+        ok = hash_read_back(image, true);
+        if (g_hash.state.pos % INITIATOR_HASH_CHUNK_SIZE != 0)
+        {
+            g_hash.state.pending_crc[g_hash.state.pending++] = g_hash.state.chunk_crc;
+        }
+        hash_flush_chunks(true);
+        hash_digest(&g_hash.state, hex);
+        verify = false;
+    }
+
+    const char *name = (g_hash.algorithm == INITIATOR_HASH_SHA256) ? "SHA256" : "CRC32";
+    char line[128];
+    snprintf(line, sizeof(line), "%s (%s) = %s\n", name, g_hash.imagefile, hex);
+    sidecar_write(line);
+    logmsg("Image ", name, ": ", hex);
+
+    if (verify && ok)
+    {
+        logmsg("Verifying image against SD card");
+        char check[sizeof(hex)];
+        ok = hash_read_back(image, false);
+        hash_digest(&g_hash.state, check);
+        ok = ok && strcmp(hex, check) == 0;
+        if (ok)
+        {
+            logmsg("Image verified OK");
+            sidecar_write("# Verified by reading back from SD card: OK\n");
+        }
+        else
+        {
+            logmsg("ERROR: Image read back from SD card does not match, ", name, " ", check);
+            snprintf(line, sizeof(line), "# Verified by reading back from SD card: MISMATCH %s\n", check);
+            sidecar_write(line);
+        }
+    }
+
+    g_hash.sidecar.close();
+    g_hash.enabled = false;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Image hashing and verification for initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Data is hashed on core1 while it streams from the SCSI bus to the SD card,
+// so the copy is not slowed down and no second pass over the image is needed.
+// The result goes into a sidecar file next to the image (image name +
+// ".crc32" or ".sha256") with a CRC32 for each chunk of the image, to locate
+// damage later, and a final line that "sha256sum -c" understands.
+//
+// InitiatorHash selects the algorithm: 0 = off, 1 = CRC32 (default),
+// 2 = SHA-256. InitiatorVerify=1 reads the finished image back from the SD
+// card and checks it against the hash computed while copying.
+
+#pragma once
+
+#include <stdint.h>
+
+class FsFile;
+
+#define INITIATOR_HASH_NONE 0
+#define INITIATOR_HASH_CRC32 1
+#define INITIATOR_HASH_SHA256 2
+
+// Size of the chunks with their own CRC32 in the sidecar file
+#define INITIATOR_HASH_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * Starts hashing a new image and creates the sidecar file.
+ *
+ * \param algorithm  INITIATOR_HASH_*, INITIATOR_HASH_NONE disables hashing
+ * \param streaming  Data is written sequentially from the start of the image
+ *                   and is hashed as it passes. If false, the hash is computed
+ *                   from the SD card once imaging is done.
+ */
+void initiatorHashStart(const char *imagefile, uint8_t algorithm, bool streaming);
+
+// Starts hashing buf on core1, it must stay untouched until
+// initiatorHashProgress() reports it done or initiatorHashWait() returns.
+void initiatorHashSubmit(const uint8_t *buf, uint32_t len);
+
+// Bytes of the last submitted buffer that have been hashed, UINT32_MAX when idle
+uint32_t initiatorHashProgress();
+
+void initiatorHashWait();
+
+// Hashes buf before returning
+void initiatorHashData(const uint8_t *buf, uint32_t len);
+
+// Saves the hash state before a transfer that may fail, so that the data
+// of a failed transfer can be dropped when it is read again.
+void initiatorHashCheckpoint();
+void initiatorHashRollback();
+
+// Transfer succeeded, writes checksums of completed chunks to the sidecar
+void initiatorHashCommit();
+
+/**
+ * Completes the sidecar file once all data is written to image.
+ *
+ * \param verify  Read the image back and compare against the streamed hash
+ * \return        False if verification failed
+ */
+bool initiatorHashFinish(FsFile &image, bool verify);
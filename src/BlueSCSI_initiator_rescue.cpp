@@ -0,0 +1,619 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Multi-pass rescue imaging for initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_initiator_rescue.h"
+
+#ifdef PLATFORM_HAS_INITIATOR_MODE
+
+#include <string.h>
+#include <stdlib.h>
+#include "BlueSCSI_log.h"
+#include "BlueSCSI_initiator.h"
+#include <BlueSCSI_platform.h>
+#include "SdFat.h"
+
+extern "C" {
+#include <scsi.h>
+}
+
+extern SdFs SD;
+
+// Range states, same characters as in ddrescue mapfiles
+#define RESCUE_UNTRIED   '?'
+#define RESCUE_UNTRIMMED '*'
+#define RESCUE_UNSCRAPED '/'
+#define RESCUE_BAD       '-'
+#define RESCUE_FINISHED  '+'
+
+// A range extends from start to the start of the next range
+struct rescue_range_t {
+    uint32_t start;
+    char status;
+};
+
+static struct {
+    rescue_range_t ranges[RESCUE_MAP_MAX_RANGES];
+    uint16_t count;
+    bool full_logged;
+
+    uint32_t sectorcount;
+    uint32_t sectorsize;
+    uint32_t max_transfer;
+    uint8_t retry_passes;
+
+    // Current pass, uses the state characters of the ranges it works on
+    // ('+' once done) like the current_status field of ddrescue
+    char phase;
+    uint8_t pass;
+    uint32_t pos; // Next sector to look at in this pass
+    uint32_t skip; // Sectors to skip after the next read error in pass 1
+    bool trim_back; // Trimming the trailing edge of a failed block
+
+    char mapfile[48];
+    uint32_t last_save;
+} g_rescue;
+
+/***********************
+ * Map of sector states *
+ ***********************/
+
+static uint32_t range_end(int i)
+{
+    return (i + 1 < g_rescue.count) ? g_rescue.ranges[i + 1].start : g_rescue.sectorcount;
+}
+
+// Index of the range that contains sector
+static int range_find(uint32_t sector)
+{
+    int lo = 0, hi = g_rescue.count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (g_rescue.ranges[mid].start <= sector)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static void range_insert(int i, uint32_t start, char status)
+{
+    memmove(&g_rescue.ranges[i + 1], &g_rescue.ranges[i], (g_rescue.count - i) * sizeof(rescue_range_t));
+    g_rescue.ranges[i].start = start;
+    g_rescue.ranges[i].status = status;
+    g_rescue.count++;
+}
+
+static void range_remove(int i)
+{
+    memmove(&g_rescue.ranges[i], &g_rescue.ranges[i + 1], (g_rescue.count - i - 1) * sizeof(rescue_range_t));
+    g_rescue.count--;
+}
+
+// Set the state of sectors [start, start + count). Returns false if the map
+// is too full to record it, in which case nothing changes.
+static bool range_set(uint32_t start, uint32_t count, char status)
+{
+    uint32_t end = start + count;
+    int first = range_find(start);
+    int last = range_find(end - 1);
+    int splits = (g_rescue.ranges[first].start != start) + (end < g_rescue.sectorcount && range_end(last) != end);
+    if (g_rescue.count + splits > RESCUE_MAP_MAX_RANGES)
+    {
+        if (!g_rescue.full_logged)
+        {
+            logmsg("Rescue map is full, later results are recorded less precisely");
+            g_rescue.full_logged = true;
+        }
+        return false;
+    }
+
+    // Split off the part after the end, then the part before the start
+    if (end < g_rescue.sectorcount && range_end(last) != end)
+    {
+        range_insert(last + 1, end, g_rescue.ranges[last].status);
+    }
+    if (g_rescue.ranges[first].start != start)
+    {
+        range_insert(first + 1, start, g_rescue.ranges[first].status);
+        first++;
+    }
+
+    // Collapse everything inside into one range
+    while (first + 1 < g_rescue.count && g_rescue.ranges[first + 1].start < end)
+    {
+        range_remove(first + 1);
+    }
+    g_rescue.ranges[first].status = status;
+
+    // Merge with neighbours in the same state
+    if (first + 1 < g_rescue.count && g_rescue.ranges[first + 1].status == status)
+    {
+        range_remove(first + 1);
+    }
+    if (first > 0 && g_rescue.ranges[first - 1].status == status)
+    {
+        range_remove(first);
+    }
+    return true;
+}
+
+// Find the first sectors in the given state at or after from
+static bool range_next(char status, uint32_t from, uint32_t *start, uint32_t *count)
+{
+    if (from >= g_rescue.sectorcount) return false;
+
+    for (int i = range_find(from); i < g_rescue.count; i++)
+    {
+        if (g_rescue.ranges[i].status == status)
+        {
+            uint32_t s = g_rescue.ranges[i].start;
+            if (s < from) s = from;
+            *start = s;
+            *count = range_end(i) - s;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t range_total(char status)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < g_rescue.count; i++)
+    {
+        if (g_rescue.ranges[i].status == status)
+        {
+            total += range_end(i) - g_rescue.ranges[i].start;
+        }
+    }
+    return total;
+}
+
+/*************************
+ * Map file load and save *
+ *************************/
+
+static char *format_hex(char *p, uint64_t value)
+{
+    int digits = 8;
+    while (digits < 16 && (value >> (digits * 4)) != 0) digits++;
+
+    *p++ = '0';
+    *p++ = 'x';
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        *p++ = "0123456789ABCDEF"[(value >> (i * 4)) & 0xF];
+    }
+    return p;
+}
+
+static bool write_line(FsFile &f, const char *line)
+{
+    size_t len = strlen(line);
+    return f.write(line, len) == len;
+}
+
+// The map is written to a temporary file first, so an interrupted save
+// leaves either the old or the new map behind.
+static bool rescue_save_map(FsFile &image)
+{
+    image.flush(); // Map must never claim data that is not on the card yet
+
+    char tmpname[sizeof(g_rescue.mapfile) + 4];
+    strcpy(tmpname, g_rescue.mapfile);
+    strcat(tmpname, ".tmp");
+
+    FsFile f = SD.open(tmpname, O_WRONLY | O_CREAT | O_TRUNC);
+    if (!f.isOpen())
+    {
+        logmsg("Failed to write rescue map ", tmpname);
+        return false;
+    }
+
+    char line[64];
+    bool ok = write_line(f, "# Mapfile. Created by BlueSCSI rescue imaging\n");
+    snprintf(line, sizeof(line), "# BlueSCSI sectorsize %lu sectorcount %lu\n",
+             (unsigned long)g_rescue.sectorsize, (unsigned long)g_rescue.sectorcount);
+    ok = ok && write_line(f, line);
+    ok = ok && write_line(f, "# current_pos  current_status  current_pass\n");
+
+    char *p = format_hex(line, (uint64_t)g_rescue.pos * g_rescue.sectorsize);
+    snprintf(p, sizeof(line) - (p - line), "     %c               %d\n", g_rescue.phase, (int)g_rescue.pass);
+    ok = ok && write_line(f, line);
+    ok = ok && write_line(f, "#      pos        size  status\n");
+
+    for (int i = 0; i < g_rescue.count && ok; i++)
+    {
+        uint32_t start = g_rescue.ranges[i].start;
+        p = format_hex(line, (uint64_t)start * g_rescue.sectorsize);
+        *p++ = ' ';
+        *p++ = ' ';
+        p = format_hex(p, (uint64_t)(range_end(i) - start) * g_rescue.sectorsize);
+        *p++ = ' ';
+        *p++ = ' ';
+        *p++ = g_rescue.ranges[i].status;
+        *p++ = '\n';
+        *p = '\0';
+        ok = write_line(f, line);
+    }
+
+    ok = f.close() && ok;
+    if (!ok)
+    {
+        logmsg("Failed to write rescue map ", tmpname);
+        return false;
+    }
+
+    SD.remove(g_rescue.mapfile);
+    if (!SD.rename(tmpname, g_rescue.mapfile))
+    {
+        logmsg("Failed to rename ", tmpname, " to ", g_rescue.mapfile);
+        return false;
+    }
+
+    g_rescue.last_save = platform_millis();
+    return true;
+}
+
+static bool rescue_load_map(const char *mapfile, uint32_t sectorcount, uint32_t sectorsize)
+{
+    FsFile f = SD.open(mapfile, O_RDONLY);
+    if (!f.isOpen())
+    {
+        return false;
+    }
+
+    bool geometry_ok = false;
+    bool have_status = false;
+    bool ok = true;
+    uint64_t expect = 0;
+    uint64_t total = (uint64_t)sectorcount * sectorsize;
+    char line[80];
+    g_rescue.count = 0;
+
+    while (ok && f.fgets(line, sizeof(line)) > 0)
+    {
+        if (line[0] == '#')
+        {
+            const char *geometry = "# BlueSCSI sectorsize ";
+            if (strncmp(line, geometry, strlen(geometry)) == 0)
+            {
+                char *p = line + strlen(geometry);
+                uint32_t size = strtoul(p, &p, 10);
+                p = strstr(p, "sectorcount ");
+                uint32_t count = p ? strtoul(p + 12, NULL, 10) : 0;
+                geometry_ok = (size == sectorsize && count == sectorcount);
+            }
+            continue;
+        }
+
+        char *p = line;
+        uint64_t pos = strtoull(p, &p, 0);
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0' || *p == '\n' || *p == '\r') continue;
+
+        if (!have_status)
+        {
+            // current_pos current_status current_pass
+            g_rescue.pos = pos / sectorsize;
+            g_rescue.phase = *p++;
+            g_rescue.pass = strtoul(p, NULL, 10);
+            have_status = true;
+            continue;
+        }
+
+        // pos size status
+        uint64_t size = strtoull(p, &p, 0);
+        while (*p == ' ' || *p == '\t') p++;
+        char status = *p;
+        if (pos != expect || size == 0 || pos % sectorsize != 0 || size % sectorsize != 0 ||
+            !strchr("?*/-+", status) || g_rescue.count >= RESCUE_MAP_MAX_RANGES)
+        {
+            ok = false;
+            break;
+        }
+
+        if (g_rescue.count == 0 || g_rescue.ranges[g_rescue.count - 1].status != status)
+        {
+            g_rescue.ranges[g_rescue.count].start = pos / sectorsize;
+            g_rescue.ranges[g_rescue.count].status = status;
+            g_rescue.count++;
+        }
+        expect = pos + size;
+    }
+    f.close();
+
+    if (!geometry_ok)
+    {
+        logmsg("Rescue map ", mapfile, " is for a different drive, not resuming");
+        return false;
+    }
+
+    if (!ok || !have_status || expect != total || !strchr("?*/-+", g_rescue.phase))
+    {
+        logmsg("Rescue map ", mapfile, " is damaged, not resuming");
+        return false;
+    }
+
+    return true;
+}
+
+/***********
+ * Imaging *
+ ***********/
+
+// Grow the image with zeros up to size bytes. Areas skipped or not readable
+// stay zero, and all later seeks stay inside the file.
+static bool rescue_extend(FsFile &file, uint64_t size)
+{
+    uint64_t cur = file.fileSize();
+    if (cur >= size)
+    {
+        return true;
+    }
+
+    memset(scsiDev.data, 0, sizeof(scsiDev.data));
+    if (!file.seek(cur))
+    {
+        return false;
+    }
+
+    // A skipped area can be hundreds of megabytes on large drives
+    while (cur < size)
+    {
+        platform_poll();
+        platform_reset_watchdog();
+        uint32_t len = sizeof(scsiDev.data);
+        if (len > size - cur) len = size - cur;
+        if (file.write(scsiDev.data, len) != len)
+        {
+            return false;
+        }
+        cur += len;
+    }
+    return true;
+}
+
+static bool rescue_read(int target_id, FsFile &file, uint32_t sector, uint32_t count)
+{
+    uint64_t pos = (uint64_t)sector * g_rescue.sectorsize;
+    if (!rescue_extend(file, pos) || !file.seek(pos))
+    {
+        logmsg("Rescue: failed to extend image file to ", pos, " bytes");
+        return false;
+    }
+
+    return scsiInitiatorReadDataToFile(target_id, sector, count, g_rescue.sectorsize, file);
+}
+
+static void rescue_next_phase(FsFile &file)
+{
+    if (g_rescue.phase == RESCUE_UNTRIED && g_rescue.pass == 1)
+    {
+        g_rescue.pass = 2;
+    }
+    else if (g_rescue.phase == RESCUE_UNTRIED)
+    {
+        g_rescue.phase = RESCUE_UNTRIMMED;
+        g_rescue.pass = 1;
+    }
+    else if (g_rescue.phase == RESCUE_UNTRIMMED)
+    {
+        g_rescue.phase = RESCUE_UNSCRAPED;
+    }
+    else if (g_rescue.phase == RESCUE_UNSCRAPED)
+    {
+        g_rescue.phase = g_rescue.retry_passes > 0 ? RESCUE_BAD : RESCUE_FINISHED;
+    }
+    else if (g_rescue.phase == RESCUE_BAD && g_rescue.pass < g_rescue.retry_passes)
+    {
+        g_rescue.pass++;
+    }
+    else
+    {
+        g_rescue.phase = RESCUE_FINISHED;
+    }
+
+    g_rescue.pos = 0;
+    g_rescue.skip = g_rescue.max_transfer;
+    g_rescue.trim_back = false;
+
+    if (g_rescue.phase == RESCUE_FINISHED)
+    {
+        rescue_extend(file, (uint64_t)g_rescue.sectorcount * g_rescue.sectorsize);
+    }
+    rescue_save_map(file);
+
+    static const char *const names[] = {"copying", "trimming", "scraping", "retrying"};
+    int name = (g_rescue.phase == RESCUE_UNTRIED) ? 0 : (g_rescue.phase == RESCUE_UNTRIMMED) ? 1 :
+               (g_rescue.phase == RESCUE_UNSCRAPED) ? 2 : 3;
+    if (g_rescue.phase != RESCUE_FINISHED)
+    {
+        logmsg("Rescue: ", names[name], " pass ", (int)g_rescue.pass, ", ",
+               (int)range_total(RESCUE_FINISHED), " sectors rescued, ",
+               (int)(g_rescue.sectorcount - range_total(RESCUE_FINISHED) - range_total(RESCUE_UNTRIED)),
+               " sectors in failed areas");
+    }
+}
+
+bool initiatorRescueCanResume(const char *imagefile, uint32_t sectorcount, uint32_t sectorsize)
+{
+    char mapfile[sizeof(g_rescue.mapfile)];
+    snprintf(mapfile, sizeof(mapfile), "%s.map", imagefile);
+
+    if (!SD.exists(mapfile))
+    {
+        // Interrupted between writing the new map and renaming it
+        char tmpname[sizeof(mapfile) + 4];
+        snprintf(tmpname, sizeof(tmpname), "%s.tmp", mapfile);
+        if (!SD.exists(tmpname) || !SD.rename(tmpname, mapfile))
+        {
+            return false;
+        }
+    }
+
+    g_rescue.sectorcount = sectorcount;
+    if (!rescue_load_map(mapfile, sectorcount, sectorsize) || g_rescue.phase == RESCUE_FINISHED)
+    {
+        return false;
+    }
+
+    logmsg("Found unfinished rescue map ", mapfile, ", ", (int)range_total(RESCUE_FINISHED),
+           " of ", (int)sectorcount, " sectors already rescued");
+    return true;
+}
+
+void initiatorRescueStart(const char *imagefile, uint32_t sectorcount, uint32_t sectorsize,
+                          uint32_t max_transfer, uint8_t retry_passes, bool resume)
+{
+    snprintf(g_rescue.mapfile, sizeof(g_rescue.mapfile), "%s.map", imagefile);
+    g_rescue.sectorcount = sectorcount;
+    g_rescue.sectorsize = sectorsize;
+    g_rescue.max_transfer = max_transfer;
+    g_rescue.retry_passes = retry_passes;
+    g_rescue.skip = max_transfer;
+    g_rescue.trim_back = false;
+    g_rescue.full_logged = false;
+    g_rescue.last_save = platform_millis();
+
+    if (resume)
+    {
+        logmsg("Rescue: resuming from ", g_rescue.mapfile, " at sector ", g_rescue.pos);
+    }
+    else
+    {
+        g_rescue.count = 1;
+        g_rescue.ranges[0].start = 0;
+        g_rescue.ranges[0].status = RESCUE_UNTRIED;
+        g_rescue.phase = RESCUE_UNTRIED;
+        g_rescue.pass = 1;
+        g_rescue.pos = 0;
+        logmsg("Rescue: imaging in multiple passes, map saved to ", g_rescue.mapfile);
+    }
+}
+
+bool initiatorRescueStep(int target_id, FsFile &file)
+{
+    if (g_rescue.phase == RESCUE_FINISHED)
+    {
+        return false;
+    }
+
+    uint32_t start, count;
+    if (!range_next(g_rescue.phase, g_rescue.pos, &start, &count))
+    {
+        rescue_next_phase(file);
+        return g_rescue.phase != RESCUE_FINISHED;
+    }
+
+    if (g_rescue.phase == RESCUE_UNTRIED)
+    {
+        // Copy passes read large blocks, a failed block is left for trimming
+        if (count > g_rescue.max_transfer) count = g_rescue.max_transfer;
+
+        if (rescue_read(target_id, file, start, count))
+        {
+            range_set(start, count, RESCUE_FINISHED);
+            g_rescue.pos = start + count;
+            g_rescue.skip = g_rescue.max_transfer;
+        }
+        else
+        {
+            range_set(start, count, RESCUE_UNTRIMMED);
+            g_rescue.pos = start + count;
+
+            if (g_rescue.pass == 1)
+            {
+                // Get away from the damaged area quickly, it is likely to be
+                // larger than one block. The skipped sectors wait for pass 2.
+                logmsg("Rescue: read error at sector ", start, ", skipping ", g_rescue.skip, " sectors");
+                g_rescue.pos += g_rescue.skip;
+                uint32_t max_skip = g_rescue.sectorcount / 100;
+                if (max_skip < g_rescue.max_transfer) max_skip = g_rescue.max_transfer;
+                g_rescue.skip = (g_rescue.skip * 2 > max_skip) ? max_skip : g_rescue.skip * 2;
+            }
+        }
+    }
+    else if (g_rescue.phase == RESCUE_UNTRIMMED)
+    {
+        // Read a failed block from the front until a sector fails, then
+        // from the back. What is left in between is scraped later.
+        uint32_t sector = g_rescue.trim_back ? start + count - 1 : start;
+        bool success = rescue_read(target_id, file, sector, 1);
+        if (!range_set(sector, 1, success ? RESCUE_FINISHED : RESCUE_BAD))
+        {
+            // Map full, leave the rest of this block as it is
+            g_rescue.trim_back = false;
+            g_rescue.pos = start + count;
+        }
+        else if (success)
+        {
+            if (count == 1) g_rescue.trim_back = false;
+        }
+        else if (g_rescue.trim_back || count == 1)
+        {
+            if (count > 1)
+            {
+                range_set(start, count - 1, RESCUE_UNSCRAPED);
+            }
+            g_rescue.trim_back = false;
+            g_rescue.pos = start + count;
+        }
+        else
+        {
+            g_rescue.trim_back = true;
+        }
+    }
+    else
+    {
+        // Scraping and retrying go sector by sector
+        if (rescue_read(target_id, file, start, 1))
+        {
+            range_set(start, 1, RESCUE_FINISHED);
+        }
+        else if (g_rescue.phase == RESCUE_UNSCRAPED)
+        {
+            range_set(start, 1, RESCUE_BAD);
+        }
+        g_rescue.pos = start + 1;
+    }
+
+    if ((uint32_t)(platform_millis() - g_rescue.last_save) > RESCUE_MAP_SAVE_INTERVAL_MS)
+    {
+        rescue_save_map(file);
+        logmsg("Rescue: at sector ", g_rescue.pos, ", ", (int)range_total(RESCUE_FINISHED), " of ",
+               (int)g_rescue.sectorcount, " sectors rescued, ", (int)range_total(RESCUE_BAD), " bad");
+    }
+
+    return true;
+}
+
+uint32_t initiatorRescueSectorsTried()
+{
+    return g_rescue.sectorcount - range_total(RESCUE_UNTRIED);
+}
+
+uint32_t initiatorRescueBadSectors()
+{
+    return g_rescue.sectorcount - range_total(RESCUE_FINISHED) - range_total(RESCUE_UNTRIED);
+}
+
+#endif
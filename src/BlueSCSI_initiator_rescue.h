@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Multi-pass rescue imaging for initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Rescue imaging copies the healthy parts of a failing drive first and
+// only then spends time on the damaged areas, in the spirit of GNU ddrescue:
+//
+//   1. Copy, skipping ahead after each read error with a growing skip size
+//   2. Copy the areas skipped in pass 1, without skipping
+//   3. Trim failed blocks from both ends, sector by sector
+//   4. Scrape the rest of the failed blocks sector by sector
+//   5. Retry bad sectors, InitiatorMaxRetry passes
+//
+// Progress is kept in a map file next to the image (image name + ".map")
+// in ddrescue mapfile format, so imaging resumes after a reset or power
+// loss and the map can be inspected with tools such as ddrescueview.
+// Enabled with InitiatorRescue=1 in the [SCSI] section.
+
+#pragma once
+
+#include <stdint.h>
+
+class FsFile;
+
+// Maximum number of ranges in the map, each costs 8 bytes of RAM. When the map
+// is full, results are recorded less precisely and some areas are read again.
+#ifndef RESCUE_MAP_MAX_RANGES
+#define RESCUE_MAP_MAX_RANGES 256
+#endif
+
+// How often the map file is updated during imaging
+#define RESCUE_MAP_SAVE_INTERVAL_MS 10000
+
+/**
+ * Checks for a map left by an unfinished rescue of a drive with the same
+ * geometry and loads it. Must be followed by initiatorRescueStart() with
+ * resume set to continue from the loaded map.
+ *
+ * \param imagefile  Image file name, the map is imagefile + ".map"
+ * \return           True if imaging can resume into this image
+ */
+bool initiatorRescueCanResume(const char *imagefile, uint32_t sectorcount, uint32_t sectorsize);
+
+/**
+ * Prepares rescue imaging into imagefile.
+ *
+ * \param max_transfer  Sectors per read in the copy passes
+ * \param retry_passes  Number of passes over bad sectors at the end
+ * \param resume        Continue from the map loaded by initiatorRescueCanResume()
+ */
+void initiatorRescueStart(const char *imagefile, uint32_t sectorcount, uint32_t sectorsize,
+                          uint32_t max_transfer, uint8_t retry_passes, bool resume);
+
+/**
+ * Runs one read of the rescue. Called from the initiator main loop.
+ *
+ * \return False once all passes are done and the map is saved
+ */
+bool initiatorRescueStep(int target_id, FsFile &file);
+
+// Sectors that have been read at least once, for progress indication
+uint32_t initiatorRescueSectorsTried();
+
+// Sectors that could not be read so far
+uint32_t initiatorRescueBadSectors();
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Restore disk images onto drives in initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_initiator_restore.h"
+
+#ifdef PLATFORM_HAS_INITIATOR_MODE
+
+#include <string.h>
+#include "BlueSCSI_config.h"
+#include "BlueSCSI_log.h"
+#include "BlueSCSI_initiator.h"
+#include "BlueSCSI_crc32.h"
+#include "BlueSCSI_vhd.h"
+#include <BlueSCSI_platform.h>
+#include <minIni.h>
+#include "SdFat.h"
+
+#include <scsi2sd.h>
+extern "C" {
+#include <scsi.h>
+}
+
+extern SdFs SD;
+
+static struct {
+    char filename[MAX_FILE_PATH + 1];
+    uint32_t sectorcount; // Sectors in the image
+    uint32_t sectorsize;
+    uint32_t max_transfer;
+    uint8_t retry_count;
+    bool verify;
+    bool use_read10;
+
+    uint32_t sectors_done;
+    uint8_t retries;
+    bool failed;
+} g_restore;
+
+bool initiatorRestoreImageName(int target_id, char *filename, size_t len)
+{
+    char section[8];
+    snprintf(section, sizeof(section), "SCSI%d", target_id);
+    return ini_gets(section, "InitiatorRestoreImage", "", filename, len, CONFIGFILE) > 0;
+}
+
+// Size of the disk data in the image, without the footer of a fixed VHD.
+// Returns false for images that can not be written as they are.
+static bool restore_image_data_size(FsFile &file, const char *filename, uint64_t *data_bytes)
+{
+    uint64_t filesize = file.size();
+    *data_bytes = filesize;
+
+    if (filesize >= VHD_FOOTER_SIZE)
+    {
+        uint8_t footer[VHD_FOOTER_SIZE];
+        vhd_footer_info_t info;
+        if (!file.seek(filesize - VHD_FOOTER_SIZE) ||
+            file.read(footer, VHD_FOOTER_SIZE) != (ssize_t)VHD_FOOTER_SIZE)
+        {
+            logmsg("Restore: failed to read ", filename);
+            return false;
+        }
+
+        int rc = vhd_parse_fixed_footer(footer, VHD_FOOTER_SIZE, &info);
+        if (rc == VHD_PARSE_OK)
+        {
+            *data_bytes = filesize - VHD_FOOTER_SIZE;
+            if (info.current_size < *data_bytes) *data_bytes = info.current_size;
+            logmsg("Restore: ", filename, " is a fixed VHD, writing its ", (int)(*data_bytes / 1024), " KiB of disk data");
+        }
+        else if (rc == VHD_PARSE_ERR_TYPE_DYNAMIC || rc == VHD_PARSE_ERR_TYPE_DIFF)
+        {
+            logmsg("Restore: ", filename, " is a dynamic or differencing VHD, only fixed VHD and raw images can be restored");
+            return false;
+        }
+    }
+
+    return file.seek(0);
+}
+
+bool initiatorRestoreStart(FsFile &file, const char *filename,
+                           uint32_t sectorcount, uint32_t sectorsize,
+                           uint32_t max_transfer, uint8_t retry_count,
+                           bool verify, bool use_read10)
+{
+    uint64_t data_bytes;
+    if (!restore_image_data_size(file, filename, &data_bytes))
+    {
+        return false;
+    }
+
+    if (data_bytes == 0)
+    {
+        logmsg("Restore: ", filename, " is empty");
+        return false;
+    }
+
+    if (data_bytes != file.size() && data_bytes % sectorsize != 0)
+    {
+        logmsg("Restore: VHD data size of ", filename, " is not a multiple of the ",
+               (int)sectorsize, " byte drive sectors");
+        return false;
+    }
+
+    // A raw image may end in a partial sector, it is padded with zeros
+    uint64_t image_sectors = (data_bytes + sectorsize - 1) / sectorsize;
+    if (image_sectors > sectorcount)
+    {
+        logmsg("Restore: ", filename, " has ", (int)image_sectors, " sectors of ", (int)sectorsize,
+               " bytes, the drive only has ", (int)sectorcount);
+        return false;
+    }
+    else if (image_sectors < sectorcount)
+    {
+        logmsg("Restore: image is smaller than the drive, the last ",
+               (int)(sectorcount - image_sectors), " sectors are left as they are");
+    }
+
+    // Verification needs the whole block in the transfer buffer
+    uint32_t max_by_buffer = sizeof(scsiDev.data) / sectorsize;
+    if (max_transfer > max_by_buffer) max_transfer = max_by_buffer;
+    if (max_transfer == 0) max_transfer = 1;
+
+    strlcpy(g_restore.filename, filename, sizeof(g_restore.filename));
+    g_restore.sectorcount = image_sectors;
+    g_restore.sectorsize = sectorsize;
+    g_restore.max_transfer = max_transfer;
+    g_restore.retry_count = retry_count;
+    g_restore.verify = verify;
+    g_restore.use_read10 = use_read10;
+    g_restore.sectors_done = 0;
+    g_restore.retries = 0;
+    g_restore.failed = false;
+
+    logmsg("Restore: writing ", (int)image_sectors, " sectors",
+           verify ? ", verifying each block" : "");
+    return true;
+}
+
+// Read back a block that was just written and compare with the data left in
+// scsiDev.data by scsiInitiatorWriteDataFromFile().
+static bool restore_verify(int target_id, uint32_t start_sector, uint32_t count)
+{
+    uint32_t len = count * g_restore.sectorsize;
+    uint32_t written_crc = crc32(scsiDev.data, len);
+
+    int status;
+    bool fits_read6 = (start_sector < 0x1FFFFF && count <= 256);
+    if (!g_restore.use_read10 && fits_read6)
+    {
+        uint8_t command[6] = {0x08,
+            (uint8_t)(start_sector >> 16),
+            (uint8_t)(start_sector >> 8),
+            (uint8_t)start_sector,
+            (uint8_t)count,
+            0x00
+        };
+        status = scsiInitiatorRunCommand(target_id, command, sizeof(command), scsiDev.data, len, NULL, 0);
+    }
+    else
+    {
+        uint8_t command[10] = {0x28, 0x00,
+            (uint8_t)(start_sector >> 24), (uint8_t)(start_sector >> 16),
+            (uint8_t)(start_sector >> 8), (uint8_t)start_sector,
+            0x00,
+            (uint8_t)(count >> 8), (uint8_t)(count),
+            0x00
+        };
+        status = scsiInitiatorRunCommand(target_id, command, sizeof(command), scsiDev.data, len, NULL, 0);
+    }
+
+    if (status != 0)
+    {
+        logmsg("Restore: verify read failed at sector ", (int)start_sector, ", status ", status);
+        return false;
+    }
+
+    if (crc32(scsiDev.data, len) != written_crc)
+    {
+        logmsg("Restore: verify mismatch in ", (int)count, " sectors starting at ", (int)start_sector);
+        return false;
+    }
+
+    return true;
+}
+
+bool initiatorRestoreStep(int target_id, FsFile &file)
+{
+    if (g_restore.failed || g_restore.sectors_done >= g_restore.sectorcount)
+    {
+        return false;
+    }
+
+    uint32_t start = g_restore.sectors_done;
+    uint32_t count = g_restore.sectorcount - start;
+    if (count > g_restore.max_transfer) count = g_restore.max_transfer;
+
+    uint32_t time_start = platform_millis();
+    bool status = scsiInitiatorWriteDataFromFile(target_id, start, count, g_restore.sectorsize, file);
+    if (status && g_restore.verify)
+    {
+        status = restore_verify(target_id, start, count);
+    }
+
+    if (!status)
+    {
+        logmsg("Failed to restore ", (int)count, " sectors starting at ", (int)start);
+        if (g_restore.retries >= g_restore.retry_count)
+        {
+            logmsg("Restore: retry limit exceeded, giving up at sector ", (int)start);
+            g_restore.failed = true;
+            return false;
+        }
+
+        g_restore.retries++;
+        logmsg("Retrying.. ", (int)g_restore.retries, "/", (int)g_restore.retry_count);
+        file.seek((uint64_t)start * g_restore.sectorsize);
+        return true;
+    }
+
+    g_restore.retries = 0;
+    g_restore.sectors_done += count;
+
+    if (g_restore.sectors_done >= g_restore.sectorcount)
+    {
+        // Get the data out of the drive's write cache before it is stopped.
+        // SCSI-1 drives don't have the command and write through anyway.
+        uint8_t command[10] = {0x35, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        int sync_status = scsiInitiatorRunCommand(target_id, command, sizeof(command), NULL, 0, NULL, 0, false, 60000);
+        dbgmsg<LOG_SUBSYS_INITIATOR>("Restore: SYNCHRONIZE CACHE status ", sync_status);
+    }
+
+    uint32_t elapsed = platform_millis() - time_start;
+    int speed_kbps = count * g_restore.sectorsize / (elapsed ? elapsed : 1);
+    logmsg("SCSI write succeeded, sectors done: ",
+           (int)g_restore.sectors_done, " / ", (int)g_restore.sectorcount,
+           " speed ", speed_kbps, " kB/s - ",
+           (int)(100 * (int64_t)g_restore.sectors_done / g_restore.sectorcount), "%");
+    return g_restore.sectors_done < g_restore.sectorcount;
+}
+
+uint32_t initiatorRestoreSectorsDone()
+{
+    return g_restore.sectors_done;
+}
+
+uint32_t initiatorRestoreSectorCount()
+{
+    return g_restore.sectorcount;
+}
+
+bool initiatorRestoreSucceeded()
+{
+    return !g_restore.failed && g_restore.sectors_done >= g_restore.sectorcount;
+}
+
+void initiatorRestoreMarkDone()
+{
+    char newname[MAX_FILE_PATH * 2] = "";
+    strlcat(newname, g_restore.filename, sizeof(newname));
+    strlcat(newname, "_restored", sizeof(newname));
+    if (SD.rename(g_restore.filename, newname))
+    {
+        logmsg("Restore: image file renamed to ", newname);
+    }
+    else
+    {
+        logmsg("Restore: failed to rename ", g_restore.filename, ", remove InitiatorRestoreImage from "
+               CONFIGFILE " or the drive is written again on the next boot");
+    }
+}
+
+#endif // PLATFORM_HAS_INITIATOR_MODE
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Restore disk images onto drives in initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Restore mode writes an image file from the SD card onto a drive instead of
+// imaging the drive. It is enabled per target by naming the image:
+//
+//   [SCSI2]
+//   InitiatorRestoreImage=System7.hda
+//
+// Raw images and fixed VHD images are accepted, the VHD footer is not written
+// to the drive. An image smaller than the drive leaves the rest of the drive
+// as it was. InitiatorRestoreVerify=1 in the [SCSI] section reads each block
+// back and compares it with what was written.
+// Writing to a drive destroys its contents, the restore happens only once
+// per boot and the drive is not imaged afterwards. After a successful restore
+// the image is renamed with a "_restored" suffix, so that the next boot does
+// not overwrite whatever drive is connected then.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class FsFile;
+
+/**
+ * Gets the image file configured for restoring onto target_id.
+ *
+ * \return False if the target has no InitiatorRestoreImage setting
+ */
+bool initiatorRestoreImageName(int target_id, char *filename, size_t len);
+
+/**
+ * Checks that the opened image fits the drive and prepares the restore.
+ *
+ * \param max_transfer  Sectors per WRITE command, limited to the transfer buffer
+ * \param retry_count   Attempts per block before the restore is abandoned
+ * \param verify        Read each block back and compare it after writing
+ * \param use_read10    Use READ(10) for verification and WRITE(10) for writing
+ * \return              False if the image can not be written to the drive
+ */
+bool initiatorRestoreStart(FsFile &file, const char *filename,
+                           uint32_t sectorcount, uint32_t sectorsize,
+                           uint32_t max_transfer, uint8_t retry_count,
+                           bool verify, bool use_read10);
+
+/**
+ * Writes one block to the drive. Called from the initiator main loop.
+ *
+ * \return False once the whole image is written or the restore has failed
+ */
+bool initiatorRestoreStep(int target_id, FsFile &file);
+
+// Sectors written so far and sectors in the image, for progress indication
+uint32_t initiatorRestoreSectorsDone();
+uint32_t initiatorRestoreSectorCount();
+
+// True if the whole image was written (and verified if enabled)
+bool initiatorRestoreSucceeded();
+
+// Renames the image after a successful restore. The file must be closed.
+void initiatorRestoreMarkDone();
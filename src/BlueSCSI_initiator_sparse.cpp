@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Sparse image output for initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_initiator_sparse.h"
+
+#ifdef PLATFORM_HAS_INITIATOR_MODE
+
+#include <string.h>
+#include "BlueSCSI_log.h"
+#include "BlueSCSI_vhd.h"
+#include <BlueSCSI_platform.h>
+#include "SdFat.h"
+
+#define SPARSE_BAT_UNUSED 0xFFFFFFFF
+
+// Allocation table entries kept in RAM, one sector of the table
+#define SPARSE_BAT_CACHE (512 / 4)
+
+// Zeros written ahead of the first data in a block
+#define SPARSE_FILL_SIZE 4096
+
+static struct {
+    uint64_t disk_bytes;
+    uint64_t disk_pos;
+    uint64_t table_offset;
+    uint32_t table_entries;
+    uint64_t next_free; // File offset of the next block to allocate
+
+    // Block at disk_pos and its file sector from the table
+    bool block_valid;
+    uint32_t block;
+    uint32_t block_sector;
+    bool file_pos_valid;
+
+    // One sector of the allocation table, entries big-endian as in the file
+    uint32_t bat_first;
+    bool bat_dirty;
+    uint8_t bat[SPARSE_BAT_CACHE * 4];
+
+    uint64_t skipped;
+    uint8_t footer[VHD_FOOTER_SIZE];
+} g_sparse;
+
+static uint8_t g_sparse_fill[SPARSE_FILL_SIZE];
+
+static uint64_t sparse_table_bytes(uint32_t entries)
+{
+    return ((uint64_t)entries * 4 + 511) & ~(uint64_t)511;
+}
+
+static bool sparse_write_fill(FsFile &file, uint8_t value, uint32_t len)
+{
+    memset(g_sparse_fill, value, sizeof(g_sparse_fill));
+    while (len > 0)
+    {
+        uint32_t n = (len > sizeof(g_sparse_fill)) ? sizeof(g_sparse_fill) : len;
+        if (file.write(g_sparse_fill, n) != n)
+        {
+            return false;
+        }
+        len -= n;
+    }
+    return true;
+}
+
+static bool sparse_bat_flush(FsFile &file)
+{
+    if (!g_sparse.bat_dirty) return true;
+
+    g_sparse.file_pos_valid = false;
+    if (!file.seek(g_sparse.table_offset + (uint64_t)g_sparse.bat_first * 4) ||
+        file.write(g_sparse.bat, sizeof(g_sparse.bat)) != sizeof(g_sparse.bat))
+    {
+        logmsg("Failed to write VHD block allocation table");
+        return false;
+    }
+    g_sparse.bat_dirty = false;
+    return true;
+}
+
+// Brings the table sector holding block into the cache
+static bool sparse_bat_load(FsFile &file, uint32_t block)
+{
+    uint32_t first = block - block % SPARSE_BAT_CACHE;
+    if (first == g_sparse.bat_first) return true;
+
+    if (!sparse_bat_flush(file)) return false;
+
+    g_sparse.file_pos_valid = false;
+    g_sparse.bat_first = first;
+    if (!file.seek(g_sparse.table_offset + (uint64_t)first * 4) ||
+        file.read(g_sparse.bat, sizeof(g_sparse.bat)) != (int)sizeof(g_sparse.bat))
+    {
+        logmsg("Failed to read VHD block allocation table");
+        return false;
+    }
+    return true;
+}
+
+static uint32_t sparse_bat_get(uint32_t block)
+{
+    const uint8_t *p = &g_sparse.bat[(block % SPARSE_BAT_CACHE) * 4];
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void sparse_bat_set(uint32_t block, uint32_t sector)
+{
+    uint8_t *p = &g_sparse.bat[(block % SPARSE_BAT_CACHE) * 4];
+    p[0] = sector >> 24;
+    p[1] = sector >> 16;
+    p[2] = sector >> 8;
+    p[3] = sector;
+    g_sparse.bat_dirty = true;
+}
+
+static bool sparse_is_zero(const uint8_t *buf, uint32_t len)
+{
+    // Buffers come from scsiDev.data at sector offsets, but check anyway
+    while (len > 0 && ((uintptr_t)buf & 3) != 0)
+    {
+        if (*buf++ != 0) return false;
+        len--;
+    }
+
+    const uint32_t *w = (const uint32_t*)buf;
+    for (; len >= 16; len -= 16, w += 4)
+    {
+        if ((w[0] | w[1] | w[2] | w[3]) != 0) return false;
+    }
+
+    const uint8_t *p = (const uint8_t*)w;
+    while (len--)
+    {
+        if (*p++ != 0) return false;
+    }
+    return true;
+}
+
+uint64_t initiatorSparseOverhead(uint64_t disk_bytes)
+{
+    uint32_t entries = vhd_dynamic_table_entries(disk_bytes);
+    uint64_t allocated = (uint64_t)entries * (VHD_DYNAMIC_BITMAP_SIZE + VHD_DYNAMIC_BLOCK_SIZE);
+    return VHD_FOOTER_SIZE * 2 + VHD_DYNAMIC_HEADER_SIZE + sparse_table_bytes(entries) + allocated - disk_bytes;
+}
+
+bool initiatorSparseStart(FsFile &file, uint64_t disk_bytes, uint8_t scsi_id)
+{
+    memset(&g_sparse, 0, sizeof(g_sparse));
+    g_sparse.disk_bytes = disk_bytes;
+    g_sparse.table_entries = vhd_dynamic_table_entries(disk_bytes);
+    g_sparse.table_offset = VHD_FOOTER_SIZE + VHD_DYNAMIC_HEADER_SIZE;
+    uint64_t table_bytes = sparse_table_bytes(g_sparse.table_entries);
+    g_sparse.next_free = g_sparse.table_offset + table_bytes;
+
+    // Use 0 for timestamp — embedded device has no RTC epoch reference
+    vhd_build_dynamic_footer(g_sparse.footer, disk_bytes, 0, scsi_id);
+    uint8_t header[VHD_DYNAMIC_HEADER_SIZE];
+    vhd_build_dynamic_header(header, g_sparse.table_offset, g_sparse.table_entries);
+
+    if (!file.seek(0) ||
+        file.write(g_sparse.footer, VHD_FOOTER_SIZE) != VHD_FOOTER_SIZE ||
+        file.write(header, VHD_DYNAMIC_HEADER_SIZE) != VHD_DYNAMIC_HEADER_SIZE ||
+        !sparse_write_fill(file, 0xFF, table_bytes))
+    {
+        logmsg("Failed to write VHD header");
+        return false;
+    }
+
+    // Table sector 0 is in the cache, all entries unused
+    memset(g_sparse.bat, 0xFF, sizeof(g_sparse.bat));
+    g_sparse.bat_first = 0;
+    g_sparse.bat_dirty = false;
+
+    logmsg("Writing sparse VHD, blocks with only zeros are skipped");
+    return true;
+}
+
+bool initiatorSparseWrite(FsFile &file, const uint8_t *buf, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t offset = g_sparse.disk_pos % VHD_DYNAMIC_BLOCK_SIZE;
+        uint32_t n = VHD_DYNAMIC_BLOCK_SIZE - offset;
+        if (n > len) n = len;
+
+        uint32_t block = g_sparse.disk_pos / VHD_DYNAMIC_BLOCK_SIZE;
+        if (!g_sparse.block_valid || g_sparse.block != block)
+        {
+            if (!sparse_bat_load(file, block)) return false;
+            g_sparse.block = block;
+            g_sparse.block_sector = sparse_bat_get(block);
+            g_sparse.block_valid = true;
+            g_sparse.file_pos_valid = false;
+        }
+
+        if (g_sparse.block_sector == SPARSE_BAT_UNUSED)
+        {
+            if (sparse_is_zero(buf, n))
+            {
+                g_sparse.skipped += n;
+                g_sparse.disk_pos += n;
+                buf += n;
+                len -= n;
+                continue;
+            }
+
+            // First data in this block, allocate it at the end of the file
+            // with all sectors marked present and the zeros so far written out
+            g_sparse.block_sector = g_sparse.next_free / 512;
+            g_sparse.next_free += VHD_DYNAMIC_BITMAP_SIZE + VHD_DYNAMIC_BLOCK_SIZE;
+            sparse_bat_set(block, g_sparse.block_sector);
+            g_sparse.skipped -= offset;
+
+            if (!file.seek((uint64_t)g_sparse.block_sector * 512) ||
+                !sparse_write_fill(file, 0xFF, VHD_DYNAMIC_BITMAP_SIZE) ||
+                !sparse_write_fill(file, 0, offset))
+            {
+                logmsg("Failed to allocate VHD block ", (int)block);
+                return false;
+            }
+            g_sparse.file_pos_valid = true;
+        }
+
+        if (!g_sparse.file_pos_valid)
+        {
+            uint64_t pos = (uint64_t)g_sparse.block_sector * 512 + VHD_DYNAMIC_BITMAP_SIZE + offset;
+            if (!file.seek(pos)) return false;
+            g_sparse.file_pos_valid = true;
+        }
+
+        if (file.write(buf, n) != n)
+        {
+            g_sparse.file_pos_valid = false;
+            return false;
+        }
+
+        g_sparse.disk_pos += n;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool initiatorSparseSeek(FsFile &file, uint64_t disk_pos)
+{
+    (void)file;
+    g_sparse.disk_pos = disk_pos;
+    g_sparse.block_valid = false;
+    g_sparse.file_pos_valid = false;
+    return true;
+}
+
+bool initiatorSparseFinish(FsFile &file)
+{
+    // Every allocated block must be complete in the file, which only
+    // matters for a last block that extends past the end of the drive
+    uint32_t offset = g_sparse.disk_pos % VHD_DYNAMIC_BLOCK_SIZE;
+    if (offset != 0)
+    {
+        uint32_t block = g_sparse.disk_pos / VHD_DYNAMIC_BLOCK_SIZE;
+        if (!sparse_bat_load(file, block)) return false;
+        uint32_t sector = sparse_bat_get(block);
+        if (sector != SPARSE_BAT_UNUSED)
+        {
+            uint64_t pos = (uint64_t)sector * 512 + VHD_DYNAMIC_BITMAP_SIZE + offset;
+            if (!file.seek(pos) || !sparse_write_fill(file, 0, VHD_DYNAMIC_BLOCK_SIZE - offset))
+            {
+                logmsg("Failed to complete last VHD block");
+                return false;
+            }
+        }
+    }
+
+    if (!sparse_bat_flush(file) ||
+        !file.seek(g_sparse.next_free) ||
+        file.write(g_sparse.footer, VHD_FOOTER_SIZE) != VHD_FOOTER_SIZE)
+    {
+        logmsg("WARNING: Failed to write VHD footer");
+        return false;
+    }
+
+    logmsg("Sparse VHD written, skipped ", (int)(g_sparse.skipped / (1024 * 1024)), " MiB of zeros out of ",
+           (int)(g_sparse.disk_bytes / (1024 * 1024)), " MiB");
+    return true;
+}
+
+#endif
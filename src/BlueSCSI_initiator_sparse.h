@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - Sparse image output for initiator mode
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// FAT and exFAT have no sparse files, so zero runs are skipped by writing
+// the image as a Dynamic VHD instead: a 2 MiB block that holds only zeros
+// is never written, it stays unallocated in the Block Allocation Table.
+// Mostly empty drives image faster and wear the SD card less.
+//
+// Enabled with InitiatorSparse=1 together with InitiatorVHD=1. BlueSCSI
+// itself only loads fixed VHDs, convert the image to use it as a target.
+
+#pragma once
+
+#include <stdint.h>
+
+class FsFile;
+
+// Writes the headers and an empty allocation table to the start of file
+bool initiatorSparseStart(FsFile &file, uint64_t disk_bytes, uint8_t scsi_id);
+
+// Writes drive data at the current drive position and advances it
+bool initiatorSparseWrite(FsFile &file, const uint8_t *buf, uint32_t len);
+
+// Moves the drive position, used to read data again after a failed transfer
+bool initiatorSparseSeek(FsFile &file, uint64_t disk_pos);
+
+// Writes the allocation table and the footer once all data is written
+bool initiatorSparseFinish(FsFile &file);
+
+// Largest file size over the drive data size, for the free space check
+uint64_t initiatorSparseOverhead(uint64_t disk_bytes);
@@ -33,6 +33,7 @@ const char *g_log_firmwareversion = BLUE_FW_VERSION " " __DATE__ " " __TIME__;
 bool g_log_debug = false;
 bool g_log_ignore_busy_free = false;
 uint32_t g_scsi_log_mask = BLUESCSI_DEFAULT_LOG_MASK;
+uint32_t g_log_subsystem_mask = LOG_SUBSYS_ALL;
 
 // This memory buffer can be read by debugger and is also saved to log.txt
 #define LOGBUFMASK (LOGBUFSIZE - 1)
@@ -315,7 +316,7 @@ static void log_va(bool debug, const char *format, va_list ap)
     vsnprintf(shared_log_buf, sizeof(shared_log_buf), format, ap);
     if (debug)
     {
-        dbgmsg(shared_log_buf);
+        dbgmsg<LOG_SUBSYS_NET>(shared_log_buf);
     }
     else
     {
@@ -358,7 +359,7 @@ void log_hex_buf(const unsigned char *buf, unsigned long size, bool debug)
         shared_log_buf[o] = 0;
     }
     if (debug)
-        dbgmsg(shared_log_buf);
+        dbgmsg<LOG_SUBSYS_NET>(shared_log_buf);
     else
         logmsg(shared_log_buf);
 }
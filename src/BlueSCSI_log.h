@@ -49,6 +49,37 @@ extern "C" bool g_log_debug;
 extern "C" bool g_log_ignore_busy_free;
 extern "C" uint32_t g_scsi_log_mask;
 
+// Subsystems that debug messages can be attributed to.
+// Messages logged with plain dbgmsg() belong to LOG_SUBSYS_GENERAL.
+enum log_subsystem_t {
+    LOG_SUBSYS_GENERAL   = 0,
+    LOG_SUBSYS_DISK      = 1,
+    LOG_SUBSYS_CDROM     = 2,
+    LOG_SUBSYS_TAPE      = 3,
+    LOG_SUBSYS_NET       = 4,
+    LOG_SUBSYS_SDIO      = 5,
+    LOG_SUBSYS_INITIATOR = 6,
+    LOG_SUBSYS_AUDIO     = 7,
+};
+
+#define LOG_SUBSYS_BIT(subsys) (1UL << (subsys))
+#define LOG_SUBSYS_ALL 0xFFUL
+
+// Debug messages of subsystems not included in this mask are removed at
+// compile time, e.g. -DBLUESCSI_LOG_DEBUG_SUBSYSTEMS=0x01 keeps only
+// the general debug messages. Normal log messages are always compiled in.
+#ifndef BLUESCSI_LOG_DEBUG_SUBSYSTEMS
+#define BLUESCSI_LOG_DEBUG_SUBSYSTEMS LOG_SUBSYS_ALL
+#endif
+
+// Runtime selection among the compiled in subsystems, from DebugLogSubsystems in ini
+extern "C" uint32_t g_log_subsystem_mask;
+
+constexpr bool log_debug_compiled(log_subsystem_t subsys)
+{
+    return (BLUESCSI_LOG_DEBUG_SUBSYSTEMS & LOG_SUBSYS_BIT(subsys)) != 0;
+}
+
 // Firmware version string
 extern const char *g_log_firmwareversion;
 
@@ -114,17 +145,29 @@ inline void logmsg(Params... params)
     logmsg_end();
 }
 
-// Format a complete debug message
-template<typename... Params>
+// Format a complete debug message belonging to a subsystem, e.g.
+// dbgmsg<LOG_SUBSYS_CDROM>("Track ", track);
+// Compiles to nothing if the subsystem is excluded from BLUESCSI_LOG_DEBUG_SUBSYSTEMS.
+template<log_subsystem_t subsys, typename... Params>
 inline void dbgmsg(Params... params)
 {
-    if (g_log_debug && dbgmsg_start())
+    if constexpr (log_debug_compiled(subsys))
     {
-        log_raw(params...);
-        dbgmsg_end();
+        if (g_log_debug && (g_log_subsystem_mask & LOG_SUBSYS_BIT(subsys)) && dbgmsg_start())
+        {
+            log_raw(params...);
+            dbgmsg_end();
+        }
     }
 }
 
+// Format a complete debug message
+template<typename... Params>
+inline void dbgmsg(Params... params)
+{
+    dbgmsg<LOG_SUBSYS_GENERAL>(params...);
+}
+
 // Shared log for preserving bootloader logs across reset
 #ifndef SHARED_LOG_SIZE
 #define SHARED_LOG_SIZE 2048
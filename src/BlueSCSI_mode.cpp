@@ -95,104 +95,76 @@ static const uint8_t CDROMCapabilitiesPage[] =
 0x05, 0x62, // current read speed, matching max speed
 };
 
-static void pageIn(int pc, int dataIdx, const uint8_t* pageData, int pageLen)
-{
-    memcpy(&scsiDev.data[dataIdx], pageData, pageLen);
-
-    if (pc == 0x01) // Mask out (un)changable values
-    {
-        memset(&scsiDev.data[dataIdx+2], 0, pageLen - 2);
-    }
-}
-
 extern "C"
-int modeSenseCDDevicePage(int pc, int idx, int pageCode, int* pageFound)
+void modeSenseCDDevicePage(ModePageImage* image)
 {
-    if ((scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL)
-        && (pageCode == 0x0D || pageCode == 0x3F))
+    if (scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL)
     {
-        *pageFound = 1;
-        pageIn(
-            pc,
-            idx,
+        modePageAdd(
+            image,
             CDROMCDParametersPage,
-            sizeof(CDROMCDParametersPage));
-        return sizeof(CDROMCDParametersPage);
-    }
-    else
-    {
-        return 0;
+            sizeof(CDROMCDParametersPage),
+            0);
     }
 }
 
 extern "C"
-int modeSenseCDAudioControlPage(int pc, int idx, int pageCode, int* pageFound)
+void modeSenseCDAudioControlPage(ModePageImage* image)
 {
 #ifdef ENABLE_AUDIO_OUTPUT
-    if ((scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL)
-        && (pageCode == 0x0E || pageCode == 0x3F))
+    if (scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL)
     {
-        *pageFound = 1;
-        pageIn(
-            pc,
-            idx,
+        uint8_t *page = modePageAdd(
+            image,
             CDROMAudioControlParametersPage,
-            sizeof(CDROMAudioControlParametersPage));
-        if (pc == 0x00)
+            sizeof(CDROMAudioControlParametersPage),
+            MODE_PAGE_VOLATILE);
+        if (page)
         {
-            // report current port assignments and volume level
-            uint16_t chn = audio_get_channel(scsiDev.target->targetId);
-            uint16_t vol = audio_get_volume(scsiDev.target->targetId);
-            scsiDev.data[idx+8] = chn & 0xFF;
-            scsiDev.data[idx+9] = vol & 0xFF;
-            scsiDev.data[idx+10] = chn >> 8;
-            scsiDev.data[idx+11] = vol >> 8;
-        }
-        else if (pc == 0x01)
-        {
-            // report bits that can be set
-            scsiDev.data[idx+8] = 0xFF;
-            scsiDev.data[idx+9] = 0xFF;
-            scsiDev.data[idx+10] = 0xFF;
-            scsiDev.data[idx+11] = 0xFF;
-        }
-        else
-        {
-            // report defaults for 0x02
-            // also report same for 0x03, though we are actually supposed
+            // report defaults, modeSenseCDAudioControlCurrent() replaces
+            // them for current values.
+            // also report same for saved values, though we are actually supposed
             // to terminate with CHECK CONDITION and SAVING PARAMETERS NOT SUPPORTED
-            scsiDev.data[idx+8] = AUDIO_CHANNEL_ENABLE_MASK & 0xFF;
-            scsiDev.data[idx+9] = DEFAULT_VOLUME_LEVEL & 0xFF;
-            scsiDev.data[idx+10] = AUDIO_CHANNEL_ENABLE_MASK >> 8;
-            scsiDev.data[idx+11] = DEFAULT_VOLUME_LEVEL >> 8;
+            page[8] = AUDIO_CHANNEL_ENABLE_MASK & 0xFF;
+            page[9] = DEFAULT_VOLUME_LEVEL & 0xFF;
+            page[10] = AUDIO_CHANNEL_ENABLE_MASK >> 8;
+            page[11] = DEFAULT_VOLUME_LEVEL >> 8;
+
+            // report bits that can be set
+            uint8_t *mask = modePageMask(image, page);
+            mask[8] = 0xFF;
+            mask[9] = 0xFF;
+            mask[10] = 0xFF;
+            mask[11] = 0xFF;
         }
-        return sizeof(CDROMAudioControlParametersPage);
     }
-    else
-    {
-        return 0;
-    }
-#else
-    return 0;
 #endif
 }
 
-int modeSenseCDCapabilitiesPage(int pc, int idx, int pageCode, int* pageFound)
+extern "C"
+void modeSenseCDAudioControlCurrent(uint8_t* page)
+{
+#ifdef ENABLE_AUDIO_OUTPUT
+    // report current port assignments and volume level
+    uint16_t chn = audio_get_channel(scsiDev.target->targetId);
+    uint16_t vol = audio_get_volume(scsiDev.target->targetId);
+    page[8] = chn & 0xFF;
+    page[9] = vol & 0xFF;
+    page[10] = chn >> 8;
+    page[11] = vol >> 8;
+#endif
+}
+
+extern "C"
+void modeSenseCDCapabilitiesPage(ModePageImage* image)
 {
-    if ((scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL)
-        && (pageCode == 0x2A || pageCode == 0x3F))
+    if (scsiDev.target->cfg->deviceType == S2S_CFG_OPTICAL)
     {
-        *pageFound = 1;
-        pageIn(
-            pc,
-            idx,
+        modePageAdd(
+            image,
             CDROMCapabilitiesPage,
-            sizeof(CDROMCapabilitiesPage));
-        return sizeof(CDROMCapabilitiesPage);
-    }
-    else
-    {
-        return 0;
+            sizeof(CDROMCapabilitiesPage),
+            0);
     }
 }
 
@@ -21,8 +21,14 @@
 
 #pragma once
 
-int modeSenseCDDevicePage(int pc, int idx, int pageCode, int* pageFound);
-int modeSenseCDAudioControlPage(int pc, int idx, int pageCode, int* pageFound);
-int modeSenseCDCapabilitiesPage(int pc, int idx, int pageCode, int* pageFound);
+#include <mode.h>
+
+// Add the CD-ROM pages to the compiled mode pages of the current target
+void modeSenseCDDevicePage(ModePageImage* image);
+void modeSenseCDAudioControlPage(ModePageImage* image);
+void modeSenseCDCapabilitiesPage(ModePageImage* image);
+
+// Fill in the current values of the audio control page at MODE SENSE time
+void modeSenseCDAudioControlCurrent(uint8_t* page);
 
 int modeSelectCDAudioControlPage(int pageLen, int idx);
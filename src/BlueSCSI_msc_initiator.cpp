@@ -67,34 +67,59 @@ static struct {
 } g_msc_initiator_targets[NUM_SCSIID];
 static int g_msc_initiator_target_count;
 
-// Sectors to read ahead of the host. The USB endpoint buffer is only one sector,
+// Sectors to read ahead of the host at start. The USB endpoint buffer is only one sector,
 // so without read-ahead every host read costs a full SCSI command round trip.
 #define MSC_PREFETCH_SECTORS 32
 
+// With adaptive prefetch, a window holds what the drive delivers in this time.
+// Fast drives get large windows that amortize command overhead, slow drives
+// get small ones so a window fetch does not keep USB waiting for long.
+#define MSC_PREFETCH_WINDOW_MS 40
+
+// The main loop fetches a window in pieces of about this long, so USB
+// requests for the other window are served in between.
+#define MSC_PREFETCH_PIECE_MS 8
+
 // Extra reads to serve without prefetching after a prefetch fails, on top of the
 // failed window itself. The bad sector can be anywhere in the window, so the host
 // has to walk the whole window before read-ahead is worth re-arming.
 #define MSC_PREFETCH_BACKOFF_READS 64
 
-// Prefetch next sectors in main loop while USB is transferring previous one.
+// Collected writes go to the drive once the host has not continued them for this long
+#define MSC_WRITE_BEHIND_MS 2
+
+// One half of the double buffered read-ahead. While the host reads one
+// window, the main loop fetches the next into the other.
+struct msc_prefetch_window_t {
+    uint8_t *buffer;
+    uint32_t lba; // First sector in the window
+    int target_id;
+    uint32_t sectorsize;
+    uint32_t sectorcount; // Sectors in the window, 0 if unused
+    uint32_t filled; // Sectors fetched so far, the rest is pending
+    bool use_read10;
+};
+
 static struct {
     uint8_t *prefetch_buffer; // Buffer to use for storing the data
     uint32_t prefetch_bufsize;
-    uint32_t prefetch_lba; // First sector to fetch
-    int prefetch_target_id; // Target to read from
-    size_t prefetch_sectorcount; // Number of sectors to fetch
-    size_t prefetch_sectorsize;
+    msc_prefetch_window_t prefetch[2]; // Each uses half of the buffer
     uint32_t prefetch_depth; // Sectors to read ahead of the host
     uint32_t prefetch_backoff; // Reads left to skip after a failed prefetch
-    bool prefetch_use_read10;
-    bool prefetch_done; // True after prefetch is complete
-
-    // Write staging for targets whose sector is larger than the USB chunk:
-    // chunks accumulate in the prefetch buffer until a full sector is ready.
-    uint32_t stage_lba;
-    uint32_t stage_bytes;
-    int stage_target_id;
-    bool stage_active;
+    bool prefetch_adaptive; // Size windows by measured drive speed
+    uint32_t drive_rate; // Measured read speed in bytes per ms, 0 until known
+
+    // Write coalescing: consecutive host writes, including chunks of sectors
+    // larger than the USB chunk, collect in the prefetch buffer and are sent
+    // as one WRITE command when the host moves on or the buffer is full.
+    uint32_t write_lba;
+    uint32_t write_bytes; // 0 if nothing is buffered
+    int write_target_id;
+    uint32_t write_sectorsize;
+    bool write_use_write10;
+    bool write_complete; // Host has finished the WRITE command
+    bool write_error; // A buffered write failed, fail the next host command
+    uint32_t write_time;
 
     bool readonly; // Disable writing to any drives
 
@@ -110,6 +135,8 @@ static struct {
 
 static int do_read6_or_10(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize, void *buffer, bool use_read10);
 static int do_write6_or_10(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize, const uint8_t *buffer, bool use_write10);
+static int prefetch_fetch(msc_prefetch_window_t *w, uint32_t max_sectors);
+static int write_flush();
 
 static void scan_targets()
 {
@@ -197,12 +224,19 @@ bool setup_msc_initiator()
     // the USB endpoint buffer are bounced through it one chunk at a time.
     g_msc_initiator_state.prefetch_buffer = scsiDev.data;
     g_msc_initiator_state.prefetch_bufsize = sizeof(scsiDev.data);
+    for (int i = 0; i < 2; i++)
+    {
+        g_msc_initiator_state.prefetch[i].buffer = scsiDev.data + i * sizeof(scsiDev.data) / 2;
+        g_msc_initiator_state.prefetch[i].sectorcount = 0;
+    }
 
     if (!ini_getbool("SCSI", "InitiatorMSCDisablePrefetch", false, CONFIGFILE))
     {
         g_msc_initiator_state.prefetch_depth = ini_getl("SCSI", "InitiatorMSCPrefetchSectors",
                                                         MSC_PREFETCH_SECTORS, CONFIGFILE);
-        logmsg("--- Initiator prefetch: ", (int)g_msc_initiator_state.prefetch_depth, " sectors read-ahead");
+        g_msc_initiator_state.prefetch_adaptive = ini_getbool("SCSI", "InitiatorMSCAdaptivePrefetch", true, CONFIGFILE);
+        logmsg("--- Initiator prefetch: ", (int)g_msc_initiator_state.prefetch_depth, " sectors read-ahead",
+               g_msc_initiator_state.prefetch_adaptive ? ", adapting to drive speed" : "");
     }
     else
     {
@@ -246,7 +280,8 @@ void poll_msc_initiator()
         if (g_msc_initiator_state.status_reqcount > 0)
         {
             logmsg("USB MSC: ", (int)g_msc_initiator_state.status_reqcount, " commands, ",
-                   (int)(g_msc_initiator_state.status_bytecount / delta), " kB/s");
+                   (int)(g_msc_initiator_state.status_bytecount / delta), " kB/s, drive reads at ",
+                   (int)g_msc_initiator_state.drive_rate, " kB/s");
         }
 
         g_msc_initiator_state.status_reqcount = 0;
@@ -257,39 +292,54 @@ void poll_msc_initiator()
 
     platform_poll();
     platform_msc_lock_set(true); // Cannot handle new MSC commands while running prefetch
-    if (g_msc_initiator_state.prefetch_sectorcount > 0
-        && !g_msc_initiator_state.prefetch_done)
-    {
-        LED_ON();
-
-        dbgmsg("Prefetch ", (int)g_msc_initiator_state.prefetch_lba, " + ",
-                (int)g_msc_initiator_state.prefetch_sectorcount, "x",
-                (int)g_msc_initiator_state.prefetch_sectorsize);
-        // Read next block while USB is transferring
-        int status = do_read6_or_10(g_msc_initiator_state.prefetch_target_id,
-                                    g_msc_initiator_state.prefetch_lba,
-                                    g_msc_initiator_state.prefetch_sectorcount,
-                                    g_msc_initiator_state.prefetch_sectorsize,
-                                    g_msc_initiator_state.prefetch_buffer,
-                                    g_msc_initiator_state.prefetch_use_read10);
-        if (status == 0)
+
+    if (g_msc_initiator_state.write_bytes > 0)
+    {
+        // Write-behind: the host already has its status, send the data once
+        // it is clear that the next command does not continue it
+        if (g_msc_initiator_state.write_complete &&
+            (uint32_t)(platform_millis() - g_msc_initiator_state.write_time) >= MSC_WRITE_BEHIND_MS)
         {
-            g_msc_initiator_state.prefetch_done = true;
+            if (write_flush() != 0)
+            {
+                g_msc_initiator_state.write_error = true;
+            }
         }
-        else
+    }
+    else
+    {
+        for (int i = 0; i < 2; i++)
         {
-            // The failure may be a bad sector anywhere in the window, so serve reads
-            // directly until the host has walked past the whole window. Backing off
-            // less than the window re-arms into the same bad sector and fails again.
-            logmsg("Prefetch of sector ", g_msc_initiator_state.prefetch_lba, " + ",
-                   (int)g_msc_initiator_state.prefetch_sectorcount, " failed: status ", status);
-            g_msc_initiator_state.prefetch_backoff = g_msc_initiator_state.prefetch_sectorcount
-                                                   + MSC_PREFETCH_BACKOFF_READS;
-            g_msc_initiator_state.prefetch_sectorcount = 0;
+            msc_prefetch_window_t *w = &g_msc_initiator_state.prefetch[i];
+            if (w->filled >= w->sectorcount) continue;
+
+            // Piece size follows the drive speed, the whole window until it is known
+            uint32_t piece = g_msc_initiator_state.drive_rate * MSC_PREFETCH_PIECE_MS / w->sectorsize;
+            if (g_msc_initiator_state.drive_rate == 0) piece = w->sectorcount;
+            if (piece < 1) piece = 1;
+
+            LED_ON();
+            dbgmsg<LOG_SUBSYS_INITIATOR>("Prefetch ", (int)(w->lba + w->filled), " + ",
+                    (int)piece, " of ", (int)w->sectorcount, "x", (int)w->sectorsize);
+            int status = prefetch_fetch(w, piece);
+            if (status != 0)
+            {
+                // The failure may be a bad sector anywhere in the rest of the window, so
+                // serve reads directly until the host has walked past it. Backing off less
+                // than the window re-arms into the same bad sector and fails again.
+                uint8_t sense_key;
+                scsiRequestSense(w->target_id, &sense_key);
+                logmsg("Prefetch of sector ", w->lba + w->filled, " + ",
+                       (int)(w->sectorcount - w->filled), " failed: status ", status);
+                g_msc_initiator_state.prefetch_backoff = w->sectorcount - w->filled
+                                                       + MSC_PREFETCH_BACKOFF_READS;
+                w->sectorcount = w->filled;
+            }
+            LED_OFF();
+            break;
         }
-
-        LED_OFF();
     }
+
     platform_msc_lock_set(false);
 }
 
@@ -323,7 +373,7 @@ static bool is_removable_device(uint8_t lun)
 
 void init_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4])
 {
-    dbgmsg("-- MSC Inquiry");
+    dbgmsg<LOG_SUBSYS_INITIATOR>("-- MSC Inquiry");
 
     if (g_msc_initiator_target_count == 0)
     {
@@ -382,13 +432,19 @@ bool init_msc_is_writable_cb (uint8_t lun)
 
 bool init_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject)
 {
-    dbgmsg("-- MSC Start Stop, start: ", (int)start, ", load_eject: ", (int)load_eject);
+    dbgmsg<LOG_SUBSYS_INITIATOR>("-- MSC Start Stop, start: ", (int)start, ", load_eject: ", (int)load_eject);
 
     if (g_msc_initiator_target_count == 0)
     {
         return false;
     }
 
+    // Buffered writes must reach the media before it stops or is ejected
+    if (write_flush() != 0)
+    {
+        return false;
+    }
+
     LED_ON();
     g_msc_initiator_state.status_reqcount++;
 
@@ -429,7 +485,7 @@ bool init_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bo
 
 bool init_msc_test_unit_ready_cb(uint8_t lun)
 {
-    dbgmsg("-- MSC Test Unit Ready");
+    dbgmsg<LOG_SUBSYS_INITIATOR>("-- MSC Test Unit Ready");
 
     if (g_msc_initiator_target_count == 0)
     {
@@ -442,7 +498,7 @@ bool init_msc_test_unit_ready_cb(uint8_t lun)
 
 void init_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
 {
-    dbgmsg("-- MSC Get Capacity");
+    dbgmsg<LOG_SUBSYS_INITIATOR>("-- MSC Get Capacity");
     g_msc_initiator_state.status_reqcount++;
 
     if (g_msc_initiator_target_count == 0 || lun >= g_msc_initiator_target_count)
@@ -470,7 +526,7 @@ void init_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_si
         // stored capacity keeps the host from flapping the device to 0 blocks
         *block_count = g_msc_initiator_targets[lun].sectorcount;
         *block_size = g_msc_initiator_targets[lun].sectorsize;
-        dbgmsg("---- Using stored capacity: ", (int)*block_count, " x ", (int)*block_size);
+        dbgmsg<LOG_SUBSYS_INITIATOR>("---- Using stored capacity: ", (int)*block_count, " x ", (int)*block_size);
     }
 }
 
@@ -481,7 +537,14 @@ int32_t init_msc_scsi_cb(uint8_t lun, const uint8_t scsi_cmd[16], void *buffer,
         return -1;
     }
 
-    dbgmsg("-- MSC Raw SCSI command ", bytearray(scsi_cmd, 16));
+    dbgmsg<LOG_SUBSYS_INITIATOR>("-- MSC Raw SCSI command ", bytearray(scsi_cmd, 16));
+
+    // E.g. SYNCHRONIZE CACHE, which must see the buffered writes
+    if (write_flush() != 0)
+    {
+        return -1;
+    }
+
     LED_ON();
     g_msc_initiator_state.status_reqcount++;
 
@@ -543,158 +606,120 @@ static int do_read6_or_10(int target_id, uint32_t start_sector, uint32_t sectorc
     return status;
 }
 
-// Serve a host read chunk smaller than one device sector, e.g. 2048-byte
-// MO media behind a 512-byte USB endpoint buffer. TinyUSB chunks such
-// transfers and passes the byte offset inside the current sector; the
-// sector is read into the prefetch buffer once and handed out chunk by
-// chunk. Must not return 0: TinyUSB treats that as "retry" and re-invokes
-// the callback in a loop that starves the watchdog.
-static int32_t init_msc_read_partial(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
+// Read sectors and keep track of how fast the drive delivers data,
+// command overhead included, for sizing the prefetch windows.
+static int timed_read(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize, uint8_t *buffer, bool use_read10)
 {
-    int target_id = get_target(lun);
-    uint32_t sectorsize = g_msc_initiator_targets[lun].sectorsize;
-    uint32_t disk_sectorcount = g_msc_initiator_targets[lun].sectorcount;
-    bool use_read10 = g_msc_initiator_targets[lun].use_read10;
+    uint32_t start = time_us_32();
+    int status = do_read6_or_10(target_id, start_sector, sectorcount, sectorsize, buffer, use_read10);
+    uint32_t elapsed = time_us_32() - start;
 
-    if (g_msc_initiator_state.prefetch_bufsize < sectorsize || lba >= disk_sectorcount)
+    if (status == 0 && elapsed > 0)
     {
-        logmsg("USB read of ", (int)bufsize, " bytes at LBA ", (int)lba, " offset ", (int)offset,
-               " failed: sector size ", (int)sectorsize, " unsupported");
-        return -1;
+        uint32_t rate = (uint32_t)((uint64_t)sectorcount * sectorsize * 1000 / elapsed);
+        if (rate == 0) rate = 1;
+        uint32_t prev = g_msc_initiator_state.drive_rate;
+        g_msc_initiator_state.drive_rate = prev ? (prev * 3 + rate) / 4 : rate;
     }
 
-    bool covered = g_msc_initiator_state.prefetch_done
-                && g_msc_initiator_state.prefetch_target_id == target_id
-                && g_msc_initiator_state.prefetch_sectorsize == sectorsize
-                && lba >= g_msc_initiator_state.prefetch_lba
-                && lba < g_msc_initiator_state.prefetch_lba + g_msc_initiator_state.prefetch_sectorcount;
-
-    if (!covered)
-    {
-        LED_ON();
-        uint32_t depth = g_msc_initiator_state.prefetch_depth;
-        uint32_t max_by_buffer = g_msc_initiator_state.prefetch_bufsize / sectorsize;
-        uint32_t max_by_disk = disk_sectorcount - lba;
-        if (depth < 1) depth = 1;
-        if (depth > max_by_buffer) depth = max_by_buffer;
-        if (depth > max_by_disk) depth = max_by_disk;
-
-        dbgmsg("USB Read command ", (int)lba, " offset ", (int)offset, ", reading ",
-               (int)depth, "x", (int)sectorsize, " into bounce buffer");
-        int status = do_read6_or_10(target_id, lba, depth, sectorsize,
-                                    g_msc_initiator_state.prefetch_buffer, use_read10);
-        if (status != 0 && depth > 1)
-        {
-            // A bad sector later in the window should not fail this chunk
-            uint8_t sense_key;
-            scsiRequestSense(target_id, &sense_key);
-            depth = 1;
-            status = do_read6_or_10(target_id, lba, depth, sectorsize,
-                                    g_msc_initiator_state.prefetch_buffer, use_read10);
-        }
-        LED_OFF();
+    return status;
+}
 
-        if (status != 0)
-        {
-            uint8_t sense_key;
-            scsiRequestSense(target_id, &sense_key);
-            if (sense_key == RECOVERED_ERROR)
-            {
-                dbgmsg("SCSI Initiator read: RECOVERED_ERROR at ", (int)lba);
-            }
-            else
-            {
-                scsiLogInitiatorCommandFailure("SCSI Initiator read", target_id, status, sense_key);
-                g_msc_initiator_state.prefetch_sectorcount = 0;
-                g_msc_initiator_state.prefetch_done = false;
-                return -1;
-            }
-        }
+// Continue filling a prefetch window, at most max_sectors at a time
+static int prefetch_fetch(msc_prefetch_window_t *w, uint32_t max_sectors)
+{
+    uint32_t count = w->sectorcount - w->filled;
+    if (count > max_sectors) count = max_sectors;
 
-        g_msc_initiator_state.prefetch_lba = lba;
-        g_msc_initiator_state.prefetch_target_id = target_id;
-        g_msc_initiator_state.prefetch_sectorcount = depth;
-        g_msc_initiator_state.prefetch_sectorsize = sectorsize;
-        g_msc_initiator_state.prefetch_use_read10 = use_read10;
-        g_msc_initiator_state.prefetch_done = true;
+    int status = timed_read(w->target_id, w->lba + w->filled, count, w->sectorsize,
+                            w->buffer + w->filled * w->sectorsize, w->use_read10);
+    if (status == 0)
+    {
+        w->filled += count;
     }
+    return status;
+}
 
-    uint32_t len = sectorsize - offset;
-    if (len > bufsize) len = bufsize;
-    memcpy(buffer, g_msc_initiator_state.prefetch_buffer
-                   + (lba - g_msc_initiator_state.prefetch_lba) * sectorsize + offset, len);
+static void prefetch_invalidate()
+{
+    g_msc_initiator_state.prefetch[0].sectorcount = 0;
+    g_msc_initiator_state.prefetch[1].sectorcount = 0;
+}
 
-    if (offset == 0)
+// The prefetch buffer is shared by all targets, so a window is only valid for
+// the target it was filled from - and only at the sector size it was read
+// with, which can change when removable media is swapped.
+static msc_prefetch_window_t *prefetch_find(int target_id, uint32_t sectorsize, uint32_t lba)
+{
+    for (int i = 0; i < 2; i++)
     {
-        g_msc_initiator_state.status_reqcount++;
+        msc_prefetch_window_t *w = &g_msc_initiator_state.prefetch[i];
+        if (w->sectorcount > 0 && w->target_id == target_id && w->sectorsize == sectorsize &&
+            lba >= w->lba && lba < w->lba + w->sectorcount)
+        {
+            return w;
+        }
     }
-    g_msc_initiator_state.status_bytecount += len;
-    return len;
+    return NULL;
 }
 
-int32_t init_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize)
+static uint32_t prefetch_window_sectors(uint32_t sectorsize)
 {
-    if (g_msc_initiator_target_count == 0)
+    uint32_t depth = g_msc_initiator_state.prefetch_depth;
+    if (g_msc_initiator_state.prefetch_adaptive && g_msc_initiator_state.drive_rate > 0)
     {
-        return -1;
+        depth = g_msc_initiator_state.drive_rate * MSC_PREFETCH_WINDOW_MS / sectorsize;
     }
 
-    if (g_msc_initiator_targets[lun].sectorsize == 0)
+    uint32_t max_by_buffer = g_msc_initiator_state.prefetch_bufsize / 2 / sectorsize;
+    if (depth > max_by_buffer) depth = max_by_buffer;
+    if (depth < 1) depth = 1;
+    return depth;
+}
+
+// Once the host reads from a window, queue the window after it into the
+// other half of the buffer, for the main loop to fetch while USB transfers.
+static void prefetch_schedule(uint8_t lun, uint32_t last_lba)
+{
+    if (g_msc_initiator_state.prefetch_depth == 0)
     {
-        return -1;
+        return;
     }
 
-    if (offset != 0 || bufsize < g_msc_initiator_targets[lun].sectorsize)
+    if (g_msc_initiator_state.prefetch_backoff > 0)
     {
-        return init_msc_read_partial(lun, lba, offset, (uint8_t*)buffer, bufsize);
+        g_msc_initiator_state.prefetch_backoff--;
+        return;
     }
 
-    LED_ON();
-    int status = 0;
-
     int target_id = get_target(lun);
-    int sectorsize = g_msc_initiator_targets[lun].sectorsize;
-    bool use_read10 = g_msc_initiator_targets[lun].use_read10;
-    uint32_t sectorcount = bufsize / sectorsize;
-    uint32_t total_sectorcount = sectorcount;
-    uint32_t orig_lba = lba;
-
-    // Prefetch buffer is shared by all targets, so it is only valid for the
-    // target it was filled from - and only at the sector size it was read
-    // with, which can change when removable media is swapped.
-    if (g_msc_initiator_state.prefetch_done &&
-        g_msc_initiator_state.prefetch_target_id == target_id &&
-        g_msc_initiator_state.prefetch_sectorsize == (size_t)sectorsize)
-    {
-        int32_t offset = (int32_t)lba - (int32_t)g_msc_initiator_state.prefetch_lba;
-        uint8_t *dest = (uint8_t*)buffer;
-        while (offset >= 0 && offset < g_msc_initiator_state.prefetch_sectorcount && sectorcount > 0)
-        {
-            // Copy sectors from prefetch
-            memcpy(dest, g_msc_initiator_state.prefetch_buffer + sectorsize * offset, sectorsize);
-            dest += sectorsize;
-            offset += 1;
-            lba += 1;
-            sectorcount -= 1;
-        }
-    }
+    uint32_t sectorsize = g_msc_initiator_targets[lun].sectorsize;
+    uint32_t disk_sectorcount = g_msc_initiator_targets[lun].sectorcount;
+    msc_prefetch_window_t *cur = prefetch_find(target_id, sectorsize, last_lba);
+    if (!cur) return;
 
-    if (sectorcount > 0)
+    uint32_t next_lba = cur->lba + cur->sectorcount;
+    if (next_lba >= disk_sectorcount || prefetch_find(target_id, sectorsize, next_lba))
     {
-        dbgmsg("USB Read command ", (int)orig_lba, " + ", (int)total_sectorcount, "x", (int)sectorsize,
-               " got ", (int)(total_sectorcount - sectorcount), " sectors from prefetch");
-        status = do_read6_or_10(target_id, lba, sectorcount, sectorsize, buffer, use_read10);
-        lba += sectorcount;
-    }
-    else
-    {
-        dbgmsg("USB Read command ", (int)orig_lba, " + ", (int)total_sectorcount, "x", (int)sectorsize, " fully satisfied from prefetch");
+        return;
     }
 
-    g_msc_initiator_state.status_reqcount++;
-    g_msc_initiator_state.status_bytecount += total_sectorcount * sectorsize;
-    LED_OFF();
+    uint32_t depth = prefetch_window_sectors(sectorsize);
+    if (depth > disk_sectorcount - next_lba) depth = disk_sectorcount - next_lba;
+
+    msc_prefetch_window_t *w = (cur == &g_msc_initiator_state.prefetch[0]) ?
+                               &g_msc_initiator_state.prefetch[1] : &g_msc_initiator_state.prefetch[0];
+    w->lba = next_lba;
+    w->target_id = target_id;
+    w->sectorsize = sectorsize;
+    w->sectorcount = depth;
+    w->filled = 0;
+    w->use_read10 = g_msc_initiator_targets[lun].use_read10;
+}
 
+// Check read status and decide whether the data can be used.
+static int32_t check_read_status(int target_id, int status, uint32_t start_sector)
+{
     if (status != 0)
     {
         uint8_t sense_key;
@@ -702,11 +727,11 @@ int32_t init_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buf
 
         if (sense_key == RECOVERED_ERROR)
         {
-            dbgmsg("SCSI Initiator read: RECOVERED_ERROR at ", (int)orig_lba);
+            dbgmsg<LOG_SUBSYS_INITIATOR>("SCSI Initiator read: RECOVERED_ERROR at ", (int)start_sector);
         }
         else if (sense_key == UNIT_ATTENTION)
         {
-            dbgmsg("SCSI Initiator read: UNIT_ATTENTION");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("SCSI Initiator read: UNIT_ATTENTION");
         }
         else
         {
@@ -715,41 +740,140 @@ int32_t init_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buf
         }
     }
 
-    // Keep the current prefetch while it still covers the sectors the host is
-    // walking towards, so a read-ahead window is fetched once and then served
-    // from RAM instead of being discarded and re-read on every request.
+    return 0;
+}
+
+// Host reads are always served through the prefetch windows. This also
+// covers chunks smaller than one device sector, e.g. 2048-byte MO media
+// behind a 512-byte USB endpoint buffer, where TinyUSB passes the byte
+// offset inside the current sector. Must not return 0: TinyUSB treats that
+// as "retry" and re-invokes the callback in a loop that starves the watchdog.
+int32_t init_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void* buffer, uint32_t bufsize)
+{
+    if (g_msc_initiator_target_count == 0)
+    {
+        return -1;
+    }
+
+    if (g_msc_initiator_targets[lun].sectorsize == 0)
+    {
+        return -1;
+    }
+
+    if (g_msc_initiator_state.write_error || write_flush() != 0)
+    {
+        g_msc_initiator_state.write_error = false;
+        return -1;
+    }
+
+    int target_id = get_target(lun);
+    uint32_t sectorsize = g_msc_initiator_targets[lun].sectorsize;
     uint32_t disk_sectorcount = g_msc_initiator_targets[lun].sectorcount;
-    bool covered = g_msc_initiator_state.prefetch_done
-                && g_msc_initiator_state.prefetch_target_id == target_id
-                && g_msc_initiator_state.prefetch_sectorsize == (size_t)sectorsize
-                && lba >= g_msc_initiator_state.prefetch_lba
-                && lba < g_msc_initiator_state.prefetch_lba + g_msc_initiator_state.prefetch_sectorcount;
+    bool use_read10 = g_msc_initiator_targets[lun].use_read10;
+    uint32_t window_sectors = g_msc_initiator_state.prefetch_bufsize / 2 / sectorsize;
+    uint32_t end_lba = lba + (offset + bufsize + sectorsize - 1) / sectorsize;
 
-    if (g_msc_initiator_state.prefetch_backoff > 0)
+    if (window_sectors == 0 || lba >= disk_sectorcount)
     {
-        g_msc_initiator_state.prefetch_backoff--;
+        logmsg("USB read of ", (int)bufsize, " bytes at LBA ", (int)lba, " offset ", (int)offset,
+               " failed: sector size ", (int)sectorsize, " unsupported");
+        return -1;
     }
-    else if (!covered && lba < disk_sectorcount)
+    if (end_lba > disk_sectorcount) end_lba = disk_sectorcount;
+
+    LED_ON();
+    uint8_t *dest = (uint8_t*)buffer;
+    uint32_t copied = 0;
+    uint32_t cur_lba = lba;
+    while (copied < bufsize)
     {
-        uint32_t depth = g_msc_initiator_state.prefetch_depth;
-        uint32_t max_by_buffer = g_msc_initiator_state.prefetch_bufsize / sectorsize;
-        uint32_t max_by_disk = disk_sectorcount - lba;
-        if (depth > max_by_buffer) depth = max_by_buffer;
-        if (depth > max_by_disk) depth = max_by_disk;
+        uint32_t pos = offset + copied;
+        cur_lba = lba + pos / sectorsize;
+        uint32_t cur_offset = pos % sectorsize;
+        if (cur_lba >= end_lba) break;
+
+        msc_prefetch_window_t *w = prefetch_find(target_id, sectorsize, cur_lba);
+        if (w && cur_lba >= w->lba + w->filled)
+        {
+            // Window is still being fetched in the background, get the part needed now
+            uint32_t need = end_lba - (w->lba + w->filled);
+            int status = prefetch_fetch(w, need);
+            if (status != 0)
+            {
+                uint8_t sense_key;
+                scsiRequestSense(target_id, &sense_key);
+                w->sectorcount = w->filled;
+                w = NULL;
+            }
+        }
 
-        if (depth > 0)
+        if (!w)
         {
-            // Request prefetch of the next block while USB transfers the previous one
-            g_msc_initiator_state.prefetch_lba = lba;
-            g_msc_initiator_state.prefetch_target_id = target_id;
-            g_msc_initiator_state.prefetch_sectorcount = depth;
-            g_msc_initiator_state.prefetch_sectorsize = sectorsize;
-            g_msc_initiator_state.prefetch_use_read10 = use_read10;
-            g_msc_initiator_state.prefetch_done = false;
+            // Not prefetched, read just the sectors of this request
+            uint32_t need = end_lba - cur_lba;
+            if (need > window_sectors) need = window_sectors;
+
+            w = &g_msc_initiator_state.prefetch[0];
+            if (w->filled < w->sectorcount) w = &g_msc_initiator_state.prefetch[1];
+            w->lba = cur_lba;
+            w->target_id = target_id;
+            w->sectorsize = sectorsize;
+            w->sectorcount = need;
+            w->filled = 0;
+            w->use_read10 = use_read10;
+
+            dbgmsg<LOG_SUBSYS_INITIATOR>("USB Read command ", (int)cur_lba, " offset ", (int)cur_offset,
+                   ", reading ", (int)need, "x", (int)sectorsize);
+            int status = prefetch_fetch(w, need);
+            if (status != 0 && need > 1)
+            {
+                // A bad sector later in the request should not fail this chunk
+                uint8_t sense_key;
+                scsiRequestSense(target_id, &sense_key);
+                w->sectorcount = 1;
+                status = prefetch_fetch(w, 1);
+            }
+
+            if (status != 0 && check_read_status(target_id, status, cur_lba) == 0)
+            {
+                // UNIT ATTENTION or RECOVERED ERROR, which don't say whether
+                // the buffer got the data. Read the sectors again.
+                status = prefetch_fetch(w, w->sectorcount);
+                if (status != 0)
+                {
+                    check_read_status(target_id, status, cur_lba);
+                }
+            }
+
+            // Only sectors of successful reads are counted in w->filled
+            if (status != 0)
+            {
+                w->sectorcount = 0;
+                break;
+            }
         }
+
+        uint32_t avail = (w->lba + w->filled - cur_lba) * sectorsize - cur_offset;
+        uint32_t len = bufsize - copied;
+        if (len > avail) len = avail;
+        memcpy(dest + copied, w->buffer + (cur_lba - w->lba) * sectorsize + cur_offset, len);
+        copied += len;
     }
+    LED_OFF();
 
-    return total_sectorcount * sectorsize;
+    if (copied == 0)
+    {
+        return -1;
+    }
+
+    if (offset == 0)
+    {
+        g_msc_initiator_state.status_reqcount++;
+    }
+    g_msc_initiator_state.status_bytecount += copied;
+
+    prefetch_schedule(lun, lba + (offset + copied - 1) / sectorsize);
+    return copied;
 }
 
 static int do_write6_or_10(int target_id, uint32_t start_sector, uint32_t sectorcount, uint32_t sectorsize, const uint8_t *buffer, bool use_write10)
@@ -798,11 +922,11 @@ static int32_t check_write_status(int target_id, int status, uint32_t start_sect
 
         if (sense_key == RECOVERED_ERROR)
         {
-            dbgmsg("SCSI Initiator write: RECOVERED_ERROR at ", (int)start_sector);
+            dbgmsg<LOG_SUBSYS_INITIATOR>("SCSI Initiator write: RECOVERED_ERROR at ", (int)start_sector);
         }
         else if (sense_key == UNIT_ATTENTION)
         {
-            dbgmsg("SCSI Initiator write: UNIT_ATTENTION");
+            dbgmsg<LOG_SUBSYS_INITIATOR>("SCSI Initiator write: UNIT_ATTENTION");
         }
         else
         {
@@ -814,71 +938,46 @@ static int32_t check_write_status(int target_id, int status, uint32_t start_sect
     return 0;
 }
 
-// Accept a host write chunk smaller than one device sector. Chunks are
-// staged in the prefetch buffer and the sector is written out once the
-// last chunk arrives. Must not return 0 for the same reason as reads:
-// TinyUSB retries a zero return forever.
-static int32_t init_msc_write_partial(uint8_t lun, uint32_t lba, uint32_t offset, const uint8_t *buffer, uint32_t bufsize)
+// Send the whole sectors collected from host writes to the drive.
+// A partial sector stays buffered until the rest of it arrives.
+static int write_flush()
 {
-    int target_id = get_target(lun);
-    uint32_t sectorsize = g_msc_initiator_targets[lun].sectorsize;
-    bool use_read10 = g_msc_initiator_targets[lun].use_read10;
-    uint8_t *stage = g_msc_initiator_state.prefetch_buffer;
-
-    if (g_msc_initiator_state.prefetch_bufsize < sectorsize)
-    {
-        logmsg("USB write of ", (int)bufsize, " bytes at LBA ", (int)lba,
-               " failed: sector size ", (int)sectorsize, " unsupported");
-        return -1;
-    }
-
-    if (offset == 0)
-    {
-        // Staging reuses the prefetch buffer, so drop any cached read data
-        g_msc_initiator_state.prefetch_sectorcount = 0;
-        g_msc_initiator_state.prefetch_done = false;
-        g_msc_initiator_state.stage_active = true;
-        g_msc_initiator_state.stage_lba = lba;
-        g_msc_initiator_state.stage_target_id = target_id;
-        g_msc_initiator_state.stage_bytes = 0;
-    }
-    else if (!g_msc_initiator_state.stage_active ||
-             g_msc_initiator_state.stage_lba != lba ||
-             g_msc_initiator_state.stage_target_id != target_id ||
-             g_msc_initiator_state.stage_bytes != offset)
+    uint32_t sectorsize = g_msc_initiator_state.write_sectorsize;
+    uint32_t sectorcount = sectorsize ? g_msc_initiator_state.write_bytes / sectorsize : 0;
+    if (sectorcount == 0)
     {
-        logmsg("USB write chunk out of sequence at LBA ", (int)lba, " offset ", (int)offset);
-        g_msc_initiator_state.stage_active = false;
-        return -1;
-    }
-
-    uint32_t len = sectorsize - offset;
-    if (len > bufsize) len = bufsize;
-    memcpy(stage + offset, buffer, len);
-    g_msc_initiator_state.stage_bytes += len;
-
-    if (g_msc_initiator_state.stage_bytes < sectorsize)
-    {
-        // More chunks needed before the sector can be written out
-        return len;
+        return 0;
     }
 
-    g_msc_initiator_state.stage_active = false;
+    int target_id = g_msc_initiator_state.write_target_id;
+    uint32_t start_sector = g_msc_initiator_state.write_lba;
+    uint8_t *buffer = g_msc_initiator_state.prefetch_buffer;
 
     LED_ON();
-    int status = do_write6_or_10(target_id, lba, 1, sectorsize, stage, use_read10);
+    dbgmsg<LOG_SUBSYS_INITIATOR>("USB Write ", (int)start_sector, " + ", (int)sectorcount, "x", (int)sectorsize);
+    int status = do_write6_or_10(target_id, start_sector, sectorcount, sectorsize, buffer,
+                                 g_msc_initiator_state.write_use_write10);
     LED_OFF();
 
-    if (check_write_status(target_id, status, lba) != 0)
+    uint32_t rest = g_msc_initiator_state.write_bytes - sectorcount * sectorsize;
+    memmove(buffer, buffer + sectorcount * sectorsize, rest);
+    g_msc_initiator_state.write_lba += sectorcount;
+    g_msc_initiator_state.write_bytes = rest;
+    g_msc_initiator_state.status_reqcount++;
+
+    if (check_write_status(target_id, status, start_sector) != 0)
     {
+        g_msc_initiator_state.write_bytes = 0;
         return -1;
     }
 
-    g_msc_initiator_state.status_reqcount++;
-    g_msc_initiator_state.status_bytecount += sectorsize;
-    return len;
+    return 0;
 }
 
+// Host writes are collected in the prefetch buffer and acknowledged right
+// away. They are sent as one WRITE command when the buffer is full, when the
+// host writes elsewhere or reads, or from the main loop shortly after the
+// command completes. A failed buffered write fails the next host command.
 int32_t init_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
 {
     if (g_msc_initiator_target_count == 0)
@@ -897,41 +996,90 @@ int32_t init_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t
         return -1;
     }
 
-    if (offset != 0 || bufsize < g_msc_initiator_targets[lun].sectorsize)
+    if (g_msc_initiator_state.write_error)
     {
-        return init_msc_write_partial(lun, lba, offset, buffer, bufsize);
+        g_msc_initiator_state.write_error = false;
+        return -1;
     }
 
     int target_id = get_target(lun);
-    int sectorsize = g_msc_initiator_targets[lun].sectorsize;
-    bool use_read10 = g_msc_initiator_targets[lun].use_read10;
-    uint32_t start_sector = lba;
-    uint32_t sectorcount = bufsize / sectorsize;
+    uint32_t sectorsize = g_msc_initiator_targets[lun].sectorsize;
+    uint32_t bufcapacity = g_msc_initiator_state.prefetch_bufsize / sectorsize * sectorsize;
 
-    LED_ON();
+    if (bufcapacity == 0 || bufsize > bufcapacity)
+    {
+        logmsg("USB write of ", (int)bufsize, " bytes at LBA ", (int)lba,
+               " failed: sector size ", (int)sectorsize, " unsupported");
+        return -1;
+    }
 
-    int status = do_write6_or_10(target_id, start_sector, sectorcount, sectorsize, buffer, use_read10);
+    // Writes reuse the prefetch buffer, so drop any cached read data
+    prefetch_invalidate();
 
-    g_msc_initiator_state.prefetch_sectorcount = 0; // Invalidate prefetch cache
-    g_msc_initiator_state.prefetch_done = false;
-    g_msc_initiator_state.stage_active = false;
+    uint64_t pos = (uint64_t)lba * sectorsize + offset;
+    if (g_msc_initiator_state.write_bytes > 0 &&
+        (g_msc_initiator_state.write_target_id != target_id ||
+         g_msc_initiator_state.write_sectorsize != sectorsize ||
+         pos != (uint64_t)g_msc_initiator_state.write_lba * sectorsize + g_msc_initiator_state.write_bytes ||
+         g_msc_initiator_state.write_bytes + bufsize > bufcapacity))
+    {
+        if (write_flush() != 0)
+        {
+            return -1;
+        }
+    }
 
-    g_msc_initiator_state.status_reqcount++;
-    g_msc_initiator_state.status_bytecount += sectorcount * sectorsize;
-    LED_OFF();
+    if (g_msc_initiator_state.write_bytes == 0)
+    {
+        if (offset != 0)
+        {
+            logmsg("USB write chunk out of sequence at LBA ", (int)lba, " offset ", (int)offset);
+            return -1;
+        }
 
-    if (check_write_status(target_id, status, start_sector) != 0)
+        g_msc_initiator_state.write_lba = lba;
+        g_msc_initiator_state.write_target_id = target_id;
+        g_msc_initiator_state.write_sectorsize = sectorsize;
+        g_msc_initiator_state.write_use_write10 = g_msc_initiator_targets[lun].use_read10;
+    }
+    else if (g_msc_initiator_state.write_bytes + bufsize > bufcapacity)
     {
+        // Partial sector left over by the flush and no room for this chunk
+        logmsg("USB write chunk out of sequence at LBA ", (int)lba, " offset ", (int)offset);
+        g_msc_initiator_state.write_bytes = 0;
         return -1;
     }
 
-    return sectorcount * sectorsize;
+    memcpy(g_msc_initiator_state.prefetch_buffer + g_msc_initiator_state.write_bytes, buffer, bufsize);
+    g_msc_initiator_state.write_bytes += bufsize;
+    g_msc_initiator_state.write_complete = false;
+    g_msc_initiator_state.write_time = platform_millis();
+    g_msc_initiator_state.status_bytecount += bufsize;
+
+    if (g_msc_initiator_state.write_bytes == bufcapacity)
+    {
+        if (write_flush() != 0)
+        {
+            return -1;
+        }
+    }
+
+    return bufsize;
 }
 
 void init_msc_write10_complete_cb(uint8_t lun)
 {
     (void)lun;
-    g_msc_initiator_state.stage_active = false;
+
+    // A sector the host did not finish can never be completed
+    uint32_t sectorsize = g_msc_initiator_state.write_sectorsize;
+    if (sectorsize && g_msc_initiator_state.write_bytes % sectorsize != 0)
+    {
+        logmsg("USB write ended in the middle of a sector, dropping partial sector");
+        g_msc_initiator_state.write_bytes -= g_msc_initiator_state.write_bytes % sectorsize;
+    }
+
+    g_msc_initiator_state.write_complete = true;
 }
 
 
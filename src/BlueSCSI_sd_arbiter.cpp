@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - SD card bandwidth arbitration between SCSI reads and CD audio
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#ifdef ENABLE_AUDIO_OUTPUT
+
+#include "BlueSCSI_sd_arbiter.h"
+#include "BlueSCSI_audio.h"
+#include "BlueSCSI_log.h"
+#include <hardware/timer.h>
+
+static struct {
+    bool scsi_read_seen;
+    uint32_t last_scsi_read_us;
+
+    // Measured SD read time of audio refills, starts out pessimistic
+    uint32_t us_per_kb;
+    uint32_t refill_bytes;
+
+    uint32_t refills;
+    uint32_t deferred;
+    uint32_t scsi_splits;
+    uint32_t deadline_misses;
+    volatile uint32_t underruns;
+} g_sd_arbiter = {false, 0, 400, 32768};
+
+static bool scsi_read_active()
+{
+    return g_sd_arbiter.scsi_read_seen &&
+           (uint32_t)(time_us_32() - g_sd_arbiter.last_scsi_read_us) < SD_ARBITER_SCSI_IDLE_US;
+}
+
+static uint32_t refill_time_us(uint32_t bytes)
+{
+    return (uint32_t)(((uint64_t)bytes * g_sd_arbiter.us_per_kb) >> 10) + SD_ARBITER_MARGIN_US;
+}
+
+void sd_arbiter_scsi_read_started()
+{
+    g_sd_arbiter.scsi_read_seen = true;
+    g_sd_arbiter.last_scsi_read_us = time_us_32();
+}
+
+uint32_t sd_arbiter_scsi_read_limit(uint32_t bytes)
+{
+    uint32_t deadline_us = audio_refill_deadline_us();
+    if (deadline_us == UINT32_MAX)
+        return bytes;
+
+    uint32_t needed_us = refill_time_us(g_sd_arbiter.refill_bytes);
+    if (deadline_us <= needed_us)
+    {
+        g_sd_arbiter.scsi_splits++;
+        return 0;
+    }
+
+    uint64_t allowed = ((uint64_t)(deadline_us - needed_us) << 10) / g_sd_arbiter.us_per_kb;
+    if (allowed < bytes)
+    {
+        g_sd_arbiter.scsi_splits++;
+        return (uint32_t)allowed;
+    }
+    return bytes;
+}
+
+bool sd_arbiter_audio_refill_now(uint32_t deadline_us, uint32_t bytes)
+{
+    // Refill early while the SD card is otherwise idle, but let an
+    // ongoing SCSI read go first while there is plenty of slack.
+    if (scsi_read_active() && deadline_us / 2 > refill_time_us(bytes))
+    {
+        g_sd_arbiter.deferred++;
+        return false;
+    }
+    return true;
+}
+
+void sd_arbiter_audio_refill_done(uint32_t bytes, uint32_t elapsed_us, uint32_t deadline_us)
+{
+    g_sd_arbiter.refills++;
+    g_sd_arbiter.refill_bytes = bytes;
+
+    if (bytes >= 1024)
+    {
+        // Exponential moving average, weight 1/4 for the new sample
+        uint32_t sample = (uint32_t)(((uint64_t)elapsed_us << 10) / bytes);
+        if (sample == 0) sample = 1;
+        g_sd_arbiter.us_per_kb = (g_sd_arbiter.us_per_kb * 3 + sample) / 4;
+        if (g_sd_arbiter.us_per_kb == 0) g_sd_arbiter.us_per_kb = 1;
+    }
+
+    if (elapsed_us > deadline_us)
+    {
+        g_sd_arbiter.deadline_misses++;
+    }
+}
+
+void sd_arbiter_audio_underrun()
+{
+    g_sd_arbiter.underruns++;
+}
+
+void sd_arbiter_report()
+{
+    if (g_sd_arbiter.refills == 0)
+        return;
+
+    if (g_sd_arbiter.underruns != 0 || g_sd_arbiter.deadline_misses != 0)
+    {
+        logmsg("Audio playback had ", (int)g_sd_arbiter.underruns, " buffer underruns and ",
+               (int)g_sd_arbiter.deadline_misses, " late refills out of ", (int)g_sd_arbiter.refills);
+    }
+    dbgmsg<LOG_SUBSYS_AUDIO>("------ Audio SD refills ", (int)g_sd_arbiter.refills,
+        ", deferred ", (int)g_sd_arbiter.deferred,
+        ", SCSI reads split ", (int)g_sd_arbiter.scsi_splits,
+        ", SD speed ", (int)g_sd_arbiter.us_per_kb, " us/kB");
+
+    g_sd_arbiter.refills = 0;
+    g_sd_arbiter.deferred = 0;
+    g_sd_arbiter.scsi_splits = 0;
+    g_sd_arbiter.deadline_misses = 0;
+    g_sd_arbiter.underruns = 0;
+}
+
+#endif // ENABLE_AUDIO_OUTPUT
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - SD card bandwidth arbitration between SCSI reads and CD audio
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// CD audio playback and SCSI data reads share the SD card. Audio refills
+// have a deadline given by how much the output DMA still has queued, SCSI
+// reads just want as much bandwidth as possible. The arbiter lets audio
+// refills wait while a SCSI read is in progress and the deadline is far
+// away, and limits SCSI read chunks so that the audio refill still fits
+// before its deadline.
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ENABLE_AUDIO_OUTPUT
+
+// Extra time reserved on top of the estimated audio refill duration
+#ifndef SD_ARBITER_MARGIN_US
+#define SD_ARBITER_MARGIN_US 2000
+#endif
+
+// SCSI transfer is considered finished if no SD read has started for this long
+#ifndef SD_ARBITER_SCSI_IDLE_US
+#define SD_ARBITER_SCSI_IDLE_US 2000
+#endif
+
+// Called by the SCSI data path before each SD card read
+void sd_arbiter_scsi_read_started();
+
+// Returns how many of the requested bytes the SCSI data path can read from
+// the SD card before the pending audio refill has to run.
+uint32_t sd_arbiter_scsi_read_limit(uint32_t bytes);
+
+// Called by the audio backend when a sample buffer needs refilling.
+// Returns false if the refill should be postponed in favor of SCSI reads.
+bool sd_arbiter_audio_refill_now(uint32_t deadline_us, uint32_t bytes);
+
+// Called by the audio backend after a refill read, updates the SD speed estimate
+void sd_arbiter_audio_refill_done(uint32_t bytes, uint32_t elapsed_us, uint32_t deadline_us);
+
+// Called by the audio backend when the output ran out of samples during playback.
+// Safe to call from interrupt context.
+void sd_arbiter_audio_underrun();
+
+// Log and reset the underrun and deadline miss counters, called when playback stops
+void sd_arbiter_report();
+
+#else
+
+static inline void sd_arbiter_scsi_read_started() {}
+static inline uint32_t sd_arbiter_scsi_read_limit(uint32_t bytes) { return bytes; }
+
+#endif // ENABLE_AUDIO_OUTPUT
+
+// Limit a SCSI read of the given number of blocks, always allowing at least one
+static inline uint32_t sd_arbiter_scsi_read_blocks(uint32_t blocks, uint32_t bytesPerSector)
+{
+    uint32_t allowed = sd_arbiter_scsi_read_limit(blocks * bytesPerSector) / bytesPerSector;
+    if (allowed == 0) allowed = 1;
+    return (allowed < blocks) ? allowed : blocks;
+}
@@ -272,6 +272,9 @@ static void readIniSCSIDeviceSetting(scsi_device_settings_t &cfg, const char *se
 
     cfg.blockSize = ini_getl(section, "BlockSize", cfg.blockSize, CONFIGFILE);
 
+    cfg.disconnectMode = ini_getl(section, "DisconnectMode", cfg.disconnectMode, CONFIGFILE);
+    cfg.queueDepth = ini_getl(section, "QueueDepth", cfg.queueDepth, CONFIGFILE);
+
     char tmp[32];
     ini_gets(section, "Vendor", "", tmp, sizeof(tmp), CONFIGFILE);
     if (tmp[0])
@@ -369,6 +372,10 @@ static void logNonDefaultSystemSettings(const scsi_system_settings_t &defaults,
         logmsg("-- DataPhaseDelay = ", (int)current.dataPhaseDelayUs, " us");
     if (current.busFreeDelayUs != defaults.busFreeDelayUs)
         logmsg("-- BusFreeDelay = ", (int)current.busFreeDelayUs, " us");
+    if (current.networkHeaderDelayUs != defaults.networkHeaderDelayUs)
+        logmsg("-- NetworkHeaderDelay = ", (int)current.networkHeaderDelayUs, " us");
+    if (current.networkPacketDelayUs != defaults.networkPacketDelayUs)
+        logmsg("-- NetworkPacketDelay = ", (int)current.networkPacketDelayUs, " us");
 }
 
 // Compare device settings and log fields that differ from defaults.
@@ -410,6 +417,8 @@ static void logNonDefaultDeviceSettings(int scsiId, const scsi_device_settings_t
     LOG_DEV_INT(sectorSDEnd, "SectorSDEnd");
     LOG_DEV_INT(vendorExtensions, "VendorExtensions");
     LOG_DEV_INT(blockSize, "BlockSize");
+    LOG_DEV_INT(disconnectMode, "DisconnectMode");
+    LOG_DEV_INT(queueDepth, "QueueDepth");
     LOG_DEV_FIELD(vendor, "Vendor");
     LOG_DEV_FIELD(prodId, "Product");
     LOG_DEV_FIELD(revision, "Version");
@@ -472,6 +481,8 @@ scsi_system_settings_t *BlueSCSISettings::initSystem(const char *presetName)
     cfgSys.phaseChangeDelayUs = 0;
     cfgSys.dataPhaseDelayUs = 0;
     cfgSys.busFreeDelayUs = 0;
+    cfgSys.networkHeaderDelayUs = 0xFFFF;
+    cfgSys.networkPacketDelayUs = 0xFFFF;
 
     // setting set for all or specific devices
     cfgDev.deviceType = S2S_CFG_NOT_SET;
@@ -498,6 +509,9 @@ scsi_system_settings_t *BlueSCSISettings::initSystem(const char *presetName)
 
     cfgDev.blockSize = 0;
 
+    cfgDev.disconnectMode = DISCONNECT_NEVER;
+    cfgDev.queueDepth = 0;
+
     // System-specific defaults
 
     if (strequals(systemPresetName[SYS_PRESET_NONE], presetName))
@@ -624,6 +638,8 @@ scsi_system_settings_t *BlueSCSISettings::initSystem(const char *presetName)
     cfgSys.phaseChangeDelayUs = ini_getl("SCSI", "PhaseChangeDelay", cfgSys.phaseChangeDelayUs, CONFIGFILE);
     cfgSys.dataPhaseDelayUs = ini_getl("SCSI", "DataPhaseDelay", cfgSys.dataPhaseDelayUs, CONFIGFILE);
     cfgSys.busFreeDelayUs = ini_getl("SCSI", "BusFreeDelay", cfgSys.busFreeDelayUs, CONFIGFILE);
+    cfgSys.networkHeaderDelayUs = ini_getl("SCSI", "NetworkHeaderDelay", cfgSys.networkHeaderDelayUs, CONFIGFILE);
+    cfgSys.networkPacketDelayUs = ini_getl("SCSI", "NetworkPacketDelay", cfgSys.networkPacketDelayUs, CONFIGFILE);
 
     char tmp[32];
     ini_gets("SCSI", "SpeedGrade", "", tmp, sizeof(tmp), CONFIGFILE);
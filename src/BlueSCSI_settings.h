@@ -52,6 +52,16 @@ typedef enum
     WIFI_SECURITY_WPA3_WPA2,// WPA3 SAE, also programming the WPA2 PSK
 } bluescsi_wifi_security_t;
 
+// Values for the per-device DisconnectMode setting. Disconnecting also
+// needs the host to allow it in the IDENTIFY message. Disconnected commands
+// wait in the target queue and other selections are answered meanwhile.
+typedef enum
+{
+    DISCONNECT_NEVER = 0, // Hold the bus for the whole command
+    DISCONNECT_SLOW,      // SEEK, START STOP UNIT and medium VERIFY run with the bus released
+    DISCONNECT_READS,     // Also reads, reselecting once the first data is read from the SD card
+} bluescsi_disconnect_mode_t;
+
 #ifdef __cplusplus
 
 #include <stdint.h>
@@ -120,6 +130,11 @@ typedef struct __attribute__((__packed__)) scsi_system_settings_t
     uint16_t phaseChangeDelayUs;  // Phase change delay (EMU EMAX needs 100)
     uint16_t dataPhaseDelayUs;    // Data phase entry delay (Akai S1000/S3000 needs 400)
     uint8_t busFreeDelayUs;       // Bus free delay
+
+    // DaynaPORT multi-packet READ(6) pacing (microseconds)
+    // 0xFFFF = use default for the host quirks
+    uint16_t networkHeaderDelayUs; // After each packet header
+    uint16_t networkPacketDelayUs; // Between packets
 } scsi_system_settings_t;
 
 // This struct should only have new setting added to the end
@@ -155,6 +170,12 @@ typedef struct __attribute__((__packed__)) scsi_device_settings_t
     uint32_t vendorExtensions;
 
     uint32_t blockSize;
+
+    uint8_t disconnectMode; // bluescsi_disconnect_mode_t
+    // Tagged commands accepted, 0 disables tagged queuing. Commands only
+    // queue up and get reordered while others are disconnected, so this
+    // needs DisconnectMode.
+    uint8_t queueDepth;
 } scsi_device_settings_t;
 
 
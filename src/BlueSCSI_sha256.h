@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - SHA-256 (FIPS 180-4) implementation
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#ifndef BLUESCSI_SHA256_H
+#define BLUESCSI_SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Incremental hashing state. Plain data, so a copy of it can be kept
+ * and restored to undo updates.
+ */
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;   /* Total bytes hashed */
+    uint8_t block[64]; /* Partial input block, length % 64 bytes used */
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const void *buf, size_t len);
+
+/* Writes the digest, ctx must be initialized again before reuse */
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLUESCSI_SHA256_H */
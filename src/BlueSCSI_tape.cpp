@@ -24,6 +24,7 @@
  */
 
 #include "BlueSCSI_disk.h"
+#include "BlueSCSI_tape_image.h"
 #include "BlueSCSI_log.h"
 #include "BlueSCSI_config.h"
 #include <BlueSCSI_platform.h>
@@ -35,15 +36,389 @@ extern "C" {
 #ifdef PREFETCH_BUFFER_SIZE
 
 #endif
+
+// Sequential access sense codes, not in the direct access list of sense.h
+#define TAPE_ASC_FILEMARK_DETECTED      0x0001
+#define TAPE_ASC_BEGINNING_OF_MEDIUM    0x0004
+#define TAPE_ASC_END_OF_DATA            0x0005
+#define TAPE_ASC_WRITE_ERROR            0x0C00
+
+static void tapeCheckCondition(uint8_t code, uint16_t asc, uint32_t info)
+{
+    scsiDev.status = CHECK_CONDITION;
+    scsiDev.target->sense.code = code;
+    scsiDev.target->sense.asc = asc;
+    scsiDev.target->sense.info = info;
+    scsiDev.phase = STATUS;
+}
+
+// Streams part of a .tap record to the host, alternating between
+// the two halves of scsiDev.data so that the SD card read of the next
+// chunk overlaps with the transfer of the previous one.
+static bool tapeImageSendData(image_config_t &img, const tape_record_t &record, uint32_t length, uint32_t *bufsel)
+{
+    const uint32_t chunk_max = sizeof(scsiDev.data) / 2;
+    uint32_t done = 0;
+    while (done < length && !scsiDev.resetFlag)
+    {
+        uint32_t chunk = length - done;
+        if (chunk > chunk_max) chunk = chunk_max;
+
+        uint8_t *buf = scsiDev.data + ((*bufsel)++ & 1) * chunk_max;
+        uint32_t start = platform_millis();
+        while (!scsiIsWriteFinished(buf + chunk - 1) && !scsiDev.resetFlag)
+        {
+            if ((uint32_t)(platform_millis() - start) > 5000)
+            {
+                logmsg("Tape read timeout waiting for previous to finish");
+                scsiDev.resetFlag = 1;
+            }
+            platform_poll();
+        }
+        if (scsiDev.resetFlag) break;
+
+        if (!tapeImageReadData(img, record, done, buf, chunk))
+        {
+            return false;
+        }
+        scsiStartWrite(buf, chunk);
+        platform_reset_watchdog();
+        done += chunk;
+    }
+    return true;
+}
+
+// READ(6) from a .tap image.
+// In fixed mode length is the number of blocks, each record must be one block long.
+// In variable mode one record of up to length bytes is returned.
+static void doTapeImageRead(image_config_t &img, bool fixed, bool sili, uint32_t length)
+{
+    uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t records = fixed ? length : 1;
+    uint32_t max_length = fixed ? blocklen : length;
+    bool data_phase = false;
+    uint32_t bufsel = 0;
+    bool check_condition = false;
+
+    for (uint32_t i = 0; i < records && !check_condition; i++)
+    {
+        // Information field is the residue in blocks (fixed) or bytes (variable)
+        uint32_t residue = fixed ? records - i : length;
+
+        tape_record_t record;
+        if (!tapeImageGetRecord(img, img.tape_pos, &record))
+        {
+            dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape reached end of data at ", (int)img.tape_pos);
+            tapeCheckCondition(BLANK_CHECK, TAPE_ASC_END_OF_DATA, residue);
+            check_condition = true;
+        }
+        else if (record.isFilemark())
+        {
+            dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape reached filemark ", (int)record.filemarks_before, " at ", (int)img.tape_pos);
+            img.tape_pos++;
+            scsiDev.target->sense.filemark = true;
+            tapeCheckCondition(NO_SENSE, TAPE_ASC_FILEMARK_DETECTED, residue);
+            check_condition = true;
+        }
+        else if (record.error)
+        {
+            logmsg("Tape image record ", (int)img.tape_pos, " is marked bad");
+            img.tape_pos++;
+            tapeCheckCondition(MEDIUM_ERROR, UNRECOVERED_READ_ERROR, residue);
+            check_condition = true;
+        }
+        else
+        {
+            uint32_t transfer = record.length < max_length ? record.length : max_length;
+            if (fixed && record.length != blocklen)
+            {
+                // Incorrect length block is not transferred in fixed mode
+                transfer = 0;
+            }
+
+            if (transfer > 0)
+            {
+                if (!data_phase)
+                {
+                    scsiDev.phase = DATA_IN;
+                    scsiDev.dataLen = 0;
+                    scsiDev.dataPtr = 0;
+                    scsiEnterPhase(DATA_IN);
+                    data_phase = true;
+                }
+
+                if (!tapeImageSendData(img, record, transfer, &bufsel))
+                {
+                    logmsg("Tape image read failed at record ", (int)img.tape_pos);
+                    tapeCheckCondition(MEDIUM_ERROR, UNRECOVERED_READ_ERROR, residue);
+                    check_condition = true;
+                    break;
+                }
+            }
+            img.tape_pos++;
+
+            // Overlength (record longer than requested) is always reported,
+            // underlength is suppressed by SILI in variable mode.
+            if (record.length > max_length || (record.length < max_length && (fixed || !sili)))
+            {
+                dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape record of ", (int)record.length, " bytes, requested ", (int)max_length);
+                scsiDev.target->sense.ili = true;
+                tapeCheckCondition(NO_SENSE, NO_ADDITIONAL_SENSE_INFORMATION,
+                                   fixed ? residue : length - record.length);
+                check_condition = true;
+            }
+        }
+    }
+
+    if (data_phase)
+    {
+        scsiFinishWrite();
+    }
+
+    if (!check_condition)
+    {
+        scsiDev.status = GOOD;
+        scsiDev.phase = STATUS;
+    }
+}
+
+// WRITE(6) to a .tap image, the data is appended as records at the current
+// position and everything after it is discarded.
+static void doTapeImageWrite(image_config_t &img, bool fixed, uint32_t length)
+{
+    uint32_t records = fixed ? length : 1;
+    uint32_t record_length = fixed ? scsiDev.target->liveCfg.bytesPerSector : length;
+
+    if (!img.file.isWritable())
+    {
+        logmsg("WARNING: Host attempted write to read-only tape ID ", (int)img.getTargetId());
+        tapeCheckCondition(DATA_PROTECT, WRITE_PROTECTED, 0);
+        return;
+    }
+
+    if (record_length > TAPE_IMAGE_MAX_RECORD)
+    {
+        tapeCheckCondition(ILLEGAL_REQUEST, INVALID_FIELD_IN_CDB, 0);
+        return;
+    }
+
+    bool ok = tapeImageTruncate(img, img.tape_pos);
+    uint32_t written = 0;
+    scsiEnterPhase(DATA_OUT);
+    for (uint32_t i = 0; i < records; i++)
+    {
+        ok = ok && tapeImageBeginRecord(img, record_length);
+
+        // Data is received even after a failed write to finish the transfer
+        uint32_t remaining = record_length;
+        while (remaining > 0)
+        {
+            uint32_t chunk = remaining;
+            if (chunk > sizeof(scsiDev.data)) chunk = sizeof(scsiDev.data);
+
+            int parityError = 0;
+            scsiRead(scsiDev.data, chunk, &parityError);
+            if (parityError && (scsiDev.boardCfg.flags & S2S_CFG_ENABLE_PARITY))
+            {
+                tapeImageAbortRecord(img);
+                tapeCheckCondition(ABORTED_COMMAND, SCSI_PARITY_ERROR, records - written);
+                return;
+            }
+
+            ok = ok && tapeImageWriteData(img, scsiDev.data, chunk);
+            remaining -= chunk;
+            platform_reset_watchdog();
+        }
+
+        ok = ok && tapeImageEndRecord(img);
+        if (ok)
+        {
+            img.tape_pos++;
+            written++;
+        }
+    }
+
+    if (ok)
+    {
+        scsiDev.status = GOOD;
+        scsiDev.phase = STATUS;
+    }
+    else
+    {
+        logmsg("Tape image write failed at record ", (int)img.tape_pos);
+        tapeImageAbortRecord(img);
+        tapeCheckCondition(MEDIUM_ERROR, TAPE_ASC_WRITE_ERROR, fixed ? records - written : length);
+    }
+}
+
+static void doTapeImageSpace(image_config_t &img, uint8_t code, int32_t count)
+{
+    uint32_t pos = img.tape_pos;
+    uint32_t marks = tapeImageFilemarksBefore(img, pos);
+
+    if (code == 0 && count > 0)
+    {
+        // Blocks forward, stopping after a filemark
+        uint32_t target = pos + count;
+        if (target > img.tape_records) target = img.tape_records;
+
+        if (tapeImageFilemarksBefore(img, target) > marks)
+        {
+            uint32_t filemark = tapeImageFindFilemark(img, marks);
+            img.tape_pos = filemark + 1;
+            scsiDev.target->sense.filemark = true;
+            tapeCheckCondition(NO_SENSE, TAPE_ASC_FILEMARK_DETECTED, count - (filemark - pos));
+        }
+        else if (pos + (uint32_t)count > img.tape_records)
+        {
+            img.tape_pos = img.tape_records;
+            tapeCheckCondition(BLANK_CHECK, TAPE_ASC_END_OF_DATA, count - (img.tape_records - pos));
+        }
+        else
+        {
+            img.tape_pos = target;
+        }
+    }
+    else if (code == 0 && count < 0)
+    {
+        // Blocks in reverse, stopping before a filemark
+        uint32_t n = -count;
+        uint32_t target = n > pos ? 0 : pos - n;
+
+        if (marks > tapeImageFilemarksBefore(img, target))
+        {
+            uint32_t filemark = tapeImageFindFilemark(img, marks - 1);
+            img.tape_pos = filemark;
+            scsiDev.target->sense.filemark = true;
+            tapeCheckCondition(NO_SENSE, TAPE_ASC_FILEMARK_DETECTED, n - (pos - filemark - 1));
+        }
+        else if (n > pos)
+        {
+            img.tape_pos = 0;
+            scsiDev.target->sense.eom = true;
+            tapeCheckCondition(NO_SENSE, TAPE_ASC_BEGINNING_OF_MEDIUM, n - pos);
+        }
+        else
+        {
+            img.tape_pos = target;
+        }
+    }
+    else if (code == 1 && count > 0)
+    {
+        // Filemarks forward, positioned after the last one
+        if (marks + count > img.tape_filemarks)
+        {
+            img.tape_pos = img.tape_records;
+            tapeCheckCondition(BLANK_CHECK, TAPE_ASC_END_OF_DATA, count - (img.tape_filemarks - marks));
+        }
+        else
+        {
+            img.tape_pos = tapeImageFindFilemark(img, marks + count - 1) + 1;
+        }
+    }
+    else if (code == 1 && count < 0)
+    {
+        // Filemarks in reverse, positioned before the last one
+        uint32_t n = -count;
+        if (n > marks)
+        {
+            img.tape_pos = 0;
+            scsiDev.target->sense.eom = true;
+            tapeCheckCondition(NO_SENSE, TAPE_ASC_BEGINNING_OF_MEDIUM, n - marks);
+        }
+        else
+        {
+            img.tape_pos = tapeImageFindFilemark(img, marks - n);
+        }
+    }
+    else if (code == 3)
+    {
+        // End-of-data.
+        img.tape_pos = img.tape_records;
+    }
+    else if (code != 0 && code != 1)
+    {
+        tapeCheckCondition(ILLEGAL_REQUEST, INVALID_FIELD_IN_CDB, 0);
+    }
+
+    dbgmsg<LOG_SUBSYS_TAPE>("------ Space tape code ", (int)code, " count ", (int)count, " from ", (int)pos, " to ", (int)img.tape_pos);
+}
+
+// File table of a multi-file tape with the start blocks for the current
+// block size, nullptr if the table is not available.
+static tape_file_t *tapeFiles(image_config_t &img)
+{
+    uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
+    if (img.tape_files && img.tape_files_blocksize != bytesPerSector)
+    {
+        uint32_t start = 0;
+        for (uint32_t i = 0; i < img.tape_mark_count; i++)
+        {
+            img.tape_files[i].start_block = start;
+            img.tape_files[i].blocks = img.tape_files[i].size / bytesPerSector;
+            start += img.tape_files[i].blocks;
+        }
+        img.tape_files_blocksize = bytesPerSector;
+    }
+    return img.tape_files;
+}
+
+// Blocks on a multi-file tape, not counting filemarks
+static uint32_t tapeFilesCapacity(image_config_t &img)
+{
+    tape_file_t *files = tapeFiles(img);
+    const tape_file_t &last = files[img.tape_mark_count - 1];
+    return last.start_block + last.blocks;
+}
+
+// Moves to the file containing lba on a multi-file tape,
+// the file is opened by the next read.
+static void tapeFilesLocate(image_config_t &img, uint32_t lba)
+{
+    tape_file_t *files = tapeFiles(img);
+
+    // Last file starting at or before lba, which skips empty files
+    uint32_t low = 0;
+    uint32_t high = img.tape_mark_count;
+    while (high - low > 1)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (files[mid].start_block <= lba)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    img.tape_pos = lba;
+    img.tape_mark_index = low;
+    img.tape_mark_block_offset = files[low].start_block;
+    img.tape_load_next_file = true;
+}
+
 static void doSeek(uint32_t lba)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
     uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
-    uint32_t capacity = img.file.size() / bytesPerSector;
+    uint32_t capacity = img.tape_files ? tapeFilesCapacity(img) : img.file.size() / bytesPerSector;
 
-    dbgmsg("------ Locate tape to LBA ", (int)lba);
+    dbgmsg<LOG_SUBSYS_TAPE>("------ Locate tape to LBA ", (int)lba);
 
-    if (lba >= capacity)
+    if (img.is_tape_container())
+    {
+        // The end of data is a valid position for appending
+        if (lba > img.tape_records)
+        {
+            img.tape_pos = img.tape_records;
+            tapeCheckCondition(BLANK_CHECK, TAPE_ASC_END_OF_DATA, 0);
+        }
+        else
+        {
+            img.tape_pos = lba;
+            scsiDev.status = GOOD;
+            scsiDev.phase = STATUS;
+        }
+    }
+    else if (lba >= capacity)
     {
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = ILLEGAL_REQUEST;
@@ -53,7 +428,10 @@ static void doSeek(uint32_t lba)
     else
     {
         platform_delay_ms(10);
-        img.tape_pos = lba;
+        if (img.tape_files)
+            tapeFilesLocate(img, lba);
+        else
+            img.tape_pos = lba;
 
         scsiDev.status = GOOD;
         scsiDev.phase = STATUS;
@@ -63,9 +441,39 @@ static void doSeek(uint32_t lba)
 static void doTapeRead(uint32_t blocks)
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    uint32_t capacity_lba = img.get_capacity_lba();
+    tape_file_t *files = tapeFiles(img);
+    uint32_t capacity_lba;
+    if (files)
+    {
+        // After the last filemark the position stays at the end of the last file
+        uint32_t index = img.tape_mark_index;
+        if (index >= img.tape_mark_count) index = img.tape_mark_count - 1;
+        capacity_lba = files[index].blocks;
+    }
+    else
+    {
+        capacity_lba = img.get_capacity_lba();
+    }
 
-    if (img.tape_load_next_file && img.bin_container.isOpen())
+    if (img.tape_load_next_file && files && img.tape_mark_index < img.tape_mark_count)
+    {
+        // multifile tape - the file after each filemark is looked up from the table
+        const tape_file_t &file = files[img.tape_mark_index];
+        img.tape_load_next_file = false;
+        if (!img.file.selectImageFile(file.name))
+        {
+            logmsg("Tape element image ", file.name, " could not be opened");
+            scsiDev.status = CHECK_CONDITION;
+            scsiDev.target->sense.code = MEDIUM_ERROR;
+            scsiDev.target->sense.asc = MEDIUM_NOT_PRESENT;
+            scsiDev.phase = STATUS;
+            return;
+        }
+        img.tape_mark_block_offset = file.start_block;
+
+        dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape loaded file ", file.name, " has ", (int) capacity_lba, " sectors with filemark ", (int) img.tape_mark_index ," at the end");
+    }
+    else if (img.tape_load_next_file && img.bin_container.isOpen())
     {
         // multifile tape - multiple file markers
         char dir_name[MAX_FILE_PATH + 1];
@@ -90,7 +498,7 @@ static void doTapeRead(uint32_t blocks)
             }
             capacity_lba = img.get_capacity_lba();
 
-            dbgmsg("------ Read tape loaded file ", next_filename, " has ", (int) capacity_lba, " sectors with filemark ", (int) img.tape_mark_index ," at the end");
+            dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape loaded file ", next_filename, " has ", (int) capacity_lba, " sectors with filemark ", (int) img.tape_mark_index ," at the end");
         }
         else
         {
@@ -116,14 +524,14 @@ static void doTapeRead(uint32_t blocks)
             // SCSI-2 Spec: "If the fixed bit is one, the information field shall be set to the requested transfer length minus the
             //               actual number of blocks read (not including the filemark)"
             scsiDev.target->sense.info = blocks - blocks_till_eof;
-            dbgmsg("------ Read tape went past file marker, blocks left to be read ", (int) blocks_till_eof, " out of ", (int) blocks, " sense info set to ", (int) scsiDev.target->sense.info);
+            dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape went past file marker, blocks left to be read ", (int) blocks_till_eof, " out of ", (int) blocks, " sense info set to ", (int) scsiDev.target->sense.info);
 
             blocks = blocks_till_eof;
         }
 
         if (blocks > 0)
         {
-            dbgmsg("------ Read tape ", (int)blocks, "x", (int)scsiDev.target->liveCfg.bytesPerSector, " tape position ",(int)img.tape_pos,
+            dbgmsg<LOG_SUBSYS_TAPE>("------ Read tape ", (int)blocks, "x", (int)scsiDev.target->liveCfg.bytesPerSector, " tape position ",(int)img.tape_pos,
                             " file position ", (int)(img.tape_pos - img.tape_mark_block_offset), " ends with file mark ",
                             (int)(img.tape_mark_index + 1), "/", (int) img.tape_mark_count, passed_filemarker ? " reached" : " not reached");
             scsiDiskStartRead(img.tape_pos - img.tape_mark_block_offset, blocks);
@@ -148,7 +556,7 @@ static void doTapeRead(uint32_t blocks)
             }
             else if (blocks_till_eof == 0)
             {
-                dbgmsg("------ Reached end of tape");
+                dbgmsg<LOG_SUBSYS_TAPE>("------ Reached end of tape");
                 scsiDev.target->sense.eom = true;
                 scsiDev.status = CHECK_CONDITION;
                 scsiDev.target->sense.code = BLANK_CHECK;
@@ -159,7 +567,7 @@ static void doTapeRead(uint32_t blocks)
     }
     else
     {
-        dbgmsg("------ No image open");
+        dbgmsg<LOG_SUBSYS_TAPE>("------ No image open");
         scsiDev.target->sense.filemark = true;
         scsiDev.status = CHECK_CONDITION;
         scsiDev.target->sense.code = MEDIUM_ERROR;
@@ -171,104 +579,62 @@ static void doTapeRead(uint32_t blocks)
 static void doRewind()
 {
     image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    tapeImageFlush(img);
     img.tape_mark_block_offset = 0;
     img.tape_mark_index = 0;
     img.tape_pos = 0;
     img.tape_load_next_file = true;
 }
 
-extern "C" int scsiTapeCommand()
+static int tapeCommandRead6(image_config_t &img)
 {
-    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
-    int commandHandled = 1;
+    // READ6
+    bool fixed = scsiDev.cdb[1] & 1;
+    bool supress_invalid_length = scsiDev.cdb[1] & 2;
 
-    uint8_t command = scsiDev.cdb[0];
-    if (command == 0x08)
+    if (img.quirks == S2S_CFG_QUIRKS_OMTI)
     {
-        // READ6
-        bool fixed = scsiDev.cdb[1] & 1;
-        bool supress_invalid_length = scsiDev.cdb[1] & 2;
-
-        if (img.quirks == S2S_CFG_QUIRKS_OMTI)
-        {
-            fixed = true;
-        }
-
-        uint32_t length =
-            (((uint32_t) scsiDev.cdb[2]) << 16) +
-            (((uint32_t) scsiDev.cdb[3]) << 8) +
-            scsiDev.cdb[4];
-
-        // Host can request either multiple fixed-length blocks, or a single variable length one.
-        // If host requests variable length block, we return one blocklen sized block.
-        uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
-        uint32_t blocks_to_read = length;
-        if (!fixed)
-        {
-            blocks_to_read = 1;
-
-            // SCSI-2 §10.2.4: a transfer length of zero is not an error —
-            // no data is transferred and position is unchanged.
-            if (length == 0)
-            {
-                blocks_to_read = 0;
-            }
-            else
-            {
-                // SCSI-2 Section 10.2.4: variable-block length checking
-                // Underlength: block is larger than host's requested length.
-                // Error unless SILI (Suppress Incorrect Length Indicator) is set.
-                // Overlength (host wants more than block has) is not an error.
-                bool underlength = (length < blocklen);
-                if (underlength && !supress_invalid_length)
-                {
-                    dbgmsg("------ Host requested variable block max ", (int)length, " bytes, blocksize is ", (int)blocklen);
-                    scsiDev.status = CHECK_CONDITION;
-                    scsiDev.target->sense.code = ILLEGAL_REQUEST;
-                    scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
-                    scsiDev.phase = STATUS;
-                    return 1;
-                }
-            }
-        }
+        fixed = true;
+    }
 
+    uint32_t length =
+        (((uint32_t) scsiDev.cdb[2]) << 16) +
+        (((uint32_t) scsiDev.cdb[3]) << 8) +
+        scsiDev.cdb[4];
 
-        if (blocks_to_read > 0)
+    if (img.is_tape_container())
+    {
+        if (length > 0)
         {
-            doTapeRead(blocks_to_read);
+            doTapeImageRead(img, fixed, supress_invalid_length, length);
         }
+        return 1;
     }
-    else if (command == 0x0A)
+
+    // Host can request either multiple fixed-length blocks, or a single variable length one.
+    // If host requests variable length block, we return one blocklen sized block.
+    uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t blocks_to_read = length;
+    if (!fixed)
     {
-        // WRITE6
-        bool fixed = scsiDev.cdb[1] & 1;
+        blocks_to_read = 1;
 
-        if (img.quirks == S2S_CFG_QUIRKS_OMTI)
+        // SCSI-2 §10.2.4: a transfer length of zero is not an error —
+        // no data is transferred and position is unchanged.
+        if (length == 0)
         {
-            fixed = true;
+            blocks_to_read = 0;
         }
-
-        uint32_t length =
-            (((uint32_t) scsiDev.cdb[2]) << 16) +
-            (((uint32_t) scsiDev.cdb[3]) << 8) +
-            scsiDev.cdb[4];
-
-        // Host can request either multiple fixed-length blocks, or a single variable length one.
-        // Only single block length is supported currently.
-        uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
-        uint32_t blocks_to_write = length;
-        if (!fixed)
+        else
         {
-            blocks_to_write = 1;
-
-            // SCSI-2 §10.2.14: transfer length of zero is not an error.
-            if (length == 0)
-            {
-                blocks_to_write = 0;
-            }
-            else if (length != blocklen)
+            // SCSI-2 Section 10.2.4: variable-block length checking
+            // Underlength: block is larger than host's requested length.
+            // Error unless SILI (Suppress Incorrect Length Indicator) is set.
+            // Overlength (host wants more than block has) is not an error.
+            bool underlength = (length < blocklen);
+            if (underlength && !supress_invalid_length)
             {
-                dbgmsg("------ Host requested variable block ", (int)length, " bytes, blocksize is ", (int)blocklen);
+                dbgmsg<LOG_SUBSYS_TAPE>("------ Host requested variable block max ", (int)length, " bytes, blocksize is ", (int)blocklen);
                 scsiDev.status = CHECK_CONDITION;
                 scsiDev.target->sense.code = ILLEGAL_REQUEST;
                 scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
@@ -276,184 +642,402 @@ extern "C" int scsiTapeCommand()
                 return 1;
             }
         }
+    }
 
-        if (blocks_to_write > 0)
-        {
-            scsiDiskStartWrite(img.tape_pos, blocks_to_write);
-            img.tape_pos += blocks_to_write;
-        }
+
+    if (blocks_to_read > 0)
+    {
+        doTapeRead(blocks_to_read);
     }
-    else if (command == 0x13)
+    return 1;
+}
+
+static int tapeCommandWrite6(image_config_t &img)
+{
+    // WRITE6
+    bool fixed = scsiDev.cdb[1] & 1;
+
+    if (img.quirks == S2S_CFG_QUIRKS_OMTI)
     {
-        // VERIFY
-        bool fixed = scsiDev.cdb[1] & 1;
+        fixed = true;
+    }
 
-        if (img.quirks == S2S_CFG_QUIRKS_OMTI)
+    uint32_t length =
+        (((uint32_t) scsiDev.cdb[2]) << 16) +
+        (((uint32_t) scsiDev.cdb[3]) << 8) +
+        scsiDev.cdb[4];
+
+    if (img.is_tape_container())
+    {
+        if (length > 0)
         {
-            fixed = true;
+            doTapeImageWrite(img, fixed, length);
         }
+        return 1;
+    }
 
-        bool byte_compare = scsiDev.cdb[1] & 2;
-        uint32_t length =
-            (((uint32_t) scsiDev.cdb[2]) << 16) +
-            (((uint32_t) scsiDev.cdb[3]) << 8) +
-            scsiDev.cdb[4];
+    // Host can request either multiple fixed-length blocks, or a single variable length one.
+    // Only the block length is supported for variable length blocks of plain images.
+    uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t blocks_to_write = length;
+    if (!fixed)
+    {
+        blocks_to_write = 1;
 
-        if (!fixed)
+        // SCSI-2 §10.2.14: transfer length of zero is not an error.
+        if (length == 0)
         {
-            length = 1;
+            blocks_to_write = 0;
         }
-
-        if (byte_compare)
+        else if (length != blocklen)
         {
-            dbgmsg("------ Verify with byte compare is not implemented");
+            dbgmsg<LOG_SUBSYS_TAPE>("------ Host requested variable block ", (int)length, " bytes, blocksize is ", (int)blocklen);
             scsiDev.status = CHECK_CONDITION;
             scsiDev.target->sense.code = ILLEGAL_REQUEST;
             scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
             scsiDev.phase = STATUS;
-        }
-        else
-        {
-            // Host requests ECC check, report that it passed.
-            scsiDev.status = GOOD;
-            scsiDev.phase = STATUS;
-            img.tape_pos += length;
+            return 1;
         }
     }
-    else if (command == 0x19)
+
+    if (blocks_to_write > 0)
     {
-        // Erase
-        // Just a stub implementation, fake erase to end of tape
-        img.tape_pos = img.scsiSectors;
+        scsiDiskStartWrite(img.tape_pos, blocks_to_write);
+        img.tape_pos += blocks_to_write;
     }
-    else if (command == 0x01)
+    return 1;
+}
+
+static int tapeCommandVerify(image_config_t &img)
+{
+    // VERIFY
+    bool fixed = scsiDev.cdb[1] & 1;
+
+    if (img.quirks == S2S_CFG_QUIRKS_OMTI)
     {
-        // REWIND
-        // Set tape position back to 0.
-        doRewind();
+        fixed = true;
     }
-    else if (command == 0x05)
+
+    bool byte_compare = scsiDev.cdb[1] & 2;
+    uint32_t length =
+        (((uint32_t) scsiDev.cdb[2]) << 16) +
+        (((uint32_t) scsiDev.cdb[3]) << 8) +
+        scsiDev.cdb[4];
+
+    if (!fixed)
     {
-        // READ BLOCK LIMITS
-        uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
-        scsiDev.data[0] = 0; // Reserved
-        scsiDev.data[1] = (blocklen >> 16) & 0xFF; // Maximum block length (MSB)
-        scsiDev.data[2] = (blocklen >>  8) & 0xFF;
-        scsiDev.data[3] = (blocklen >>  0) & 0xFF; // Maximum block length (LSB)
-        // SCSI-2 Section 10.2.4: Bytes 4-5 = minimum block length (16-bit big-endian)
-        scsiDev.data[4] = (blocklen >>  8) & 0xFF; // Minimum block length (MSB)
-        scsiDev.data[5] = (blocklen >>  0) & 0xFF; // Minimum block length (LSB)
-        scsiDev.dataLen = 6;
-        scsiDev.phase = DATA_IN;
+        length = 1;
     }
-    else if (command == 0x10)
+
+    if (byte_compare)
     {
-        // WRITE FILEMARKS
-        dbgmsg("------ Filemarks storage not implemented, reporting ok");
+        dbgmsg<LOG_SUBSYS_TAPE>("------ Verify with byte compare is not implemented");
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = ILLEGAL_REQUEST;
+        scsiDev.target->sense.asc = INVALID_FIELD_IN_CDB;
+        scsiDev.phase = STATUS;
+    }
+    else
+    {
+        // Host requests ECC check, report that it passed.
         scsiDev.status = GOOD;
         scsiDev.phase = STATUS;
+        img.tape_pos += length;
+        if (img.is_tape_container() && img.tape_pos > img.tape_records)
+        {
+            img.tape_pos = img.tape_records;
+        }
+    }
+    return 1;
+}
+
+static int tapeCommandErase(image_config_t &img)
+{
+    // Erase
+    if (img.is_tape_container())
+    {
+        // Erasing from the current position discards the rest of the image
+        if (!img.file.isWritable())
+        {
+            tapeCheckCondition(DATA_PROTECT, WRITE_PROTECTED, 0);
+        }
+        else if (!tapeImageTruncate(img, img.tape_pos))
+        {
+            logmsg("Tape image erase failed at record ", (int)img.tape_pos);
+            tapeCheckCondition(MEDIUM_ERROR, TAPE_ASC_WRITE_ERROR, 0);
+        }
+        else
+        {
+            tapeImageFlush(img);
+        }
+        return 1;
     }
-    else if (command == 0x11)
-    {
-        // SPACE
-        // SCSI-2 Section 10.2.11: Count is a 24-bit two's complement value
-        // in CDB bytes 2-4. Byte 5 is the control byte. Negative values
-        // mean space in the reverse direction. The count is relative to
-        // the current position.
-        uint8_t code = scsiDev.cdb[1] & 7;
-        uint32_t raw_count =
-            (((uint32_t) scsiDev.cdb[2]) << 16) |
-            (((uint32_t) scsiDev.cdb[3]) << 8) |
+
+    // Just a stub implementation for plain images, fake erase to end of tape
+    img.tape_pos = img.scsiSectors;
+    return 1;
+}
+
+static int tapeCommandRewind(image_config_t &img)
+{
+    // REWIND
+    // Set tape position back to 0.
+    doRewind();
+    return 1;
+}
+
+static int tapeCommandReadBlockLimits(image_config_t &img)
+{
+    // READ BLOCK LIMITS
+    uint32_t blocklen = scsiDev.target->liveCfg.bytesPerSector;
+    uint32_t maxlen = blocklen;
+    uint32_t minlen = blocklen;
+    if (img.is_tape_container())
+    {
+        // Any record length fits in a .tap image
+        maxlen = TAPE_IMAGE_MAX_RECORD;
+        minlen = 1;
+    }
+    scsiDev.data[0] = 0; // Reserved
+    scsiDev.data[1] = (maxlen >> 16) & 0xFF; // Maximum block length (MSB)
+    scsiDev.data[2] = (maxlen >>  8) & 0xFF;
+    scsiDev.data[3] = (maxlen >>  0) & 0xFF; // Maximum block length (LSB)
+    // SCSI-2 Section 10.2.4: Bytes 4-5 = minimum block length (16-bit big-endian)
+    scsiDev.data[4] = (minlen >>  8) & 0xFF; // Minimum block length (MSB)
+    scsiDev.data[5] = (minlen >>  0) & 0xFF; // Minimum block length (LSB)
+    scsiDev.dataLen = 6;
+    scsiDev.phase = DATA_IN;
+    return 1;
+}
+
+static int tapeCommandWriteFilemarks(image_config_t &img)
+{
+    // WRITE FILEMARKS
+    if (img.is_tape_container())
+    {
+        uint32_t count =
+            (((uint32_t) scsiDev.cdb[2]) << 16) +
+            (((uint32_t) scsiDev.cdb[3]) << 8) +
             scsiDev.cdb[4];
-        // Sign-extend from 24-bit two's complement
-        int32_t count = (raw_count & 0x800000) ? (int32_t)(raw_count | 0xFF000000) : (int32_t)raw_count;
-        if (code == 0)
+
+        if (!img.file.isWritable())
         {
-            // Blocks.
-            uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
-            uint32_t capacity = img.file.size() / bytesPerSector;
-            int32_t new_pos = (int32_t)img.tape_pos + count;
+            tapeCheckCondition(DATA_PROTECT, WRITE_PROTECTED, count);
+            return 1;
+        }
 
-            if (new_pos >= 0 && (uint32_t)new_pos < capacity)
-            {
-                img.tape_pos = (uint32_t)new_pos;
-            }
-            else
+        bool ok = tapeImageTruncate(img, img.tape_pos);
+        uint32_t written = 0;
+        while (ok && written < count)
+        {
+            ok = tapeImageAppendFilemark(img);
+            if (ok)
             {
-                // Clamp to valid range before reporting error
-                if (new_pos < 0)
-                    img.tape_pos = 0;
-                else
-                    img.tape_pos = capacity;
-                scsiDev.status = CHECK_CONDITION;
-                scsiDev.target->sense.code = BLANK_CHECK;
-                scsiDev.target->sense.asc = 0; // END-OF-DATA DETECTED
-                scsiDev.phase = STATUS;
+                img.tape_pos++;
+                written++;
             }
         }
-        else if (code == 1)
+
+        // Writing filemarks is a synchronization point, a count of zero only flushes
+        tapeImageFlush(img);
+        if (ok)
         {
-            // Filemarks.
-            // For now just indicate end of data
-            scsiDev.status = CHECK_CONDITION;
-            scsiDev.target->sense.code = BLANK_CHECK;
-            scsiDev.target->sense.asc = 0; // END-OF-DATA DETECTED
+            scsiDev.status = GOOD;
             scsiDev.phase = STATUS;
         }
-        else if (code == 3)
+        else
+        {
+            logmsg("Tape image filemark write failed at record ", (int)img.tape_pos);
+            tapeCheckCondition(MEDIUM_ERROR, TAPE_ASC_WRITE_ERROR, count - written);
+        }
+        return 1;
+    }
+
+    dbgmsg<LOG_SUBSYS_TAPE>("------ Filemarks storage not implemented, reporting ok");
+    scsiDev.status = GOOD;
+    scsiDev.phase = STATUS;
+    return 1;
+}
+
+static int tapeCommandSpace(image_config_t &img)
+{
+    // SPACE
+    // SCSI-2 Section 10.2.11: Count is a 24-bit two's complement value
+    // in CDB bytes 2-4. Byte 5 is the control byte. Negative values
+    // mean space in the reverse direction. The count is relative to
+    // the current position.
+    uint8_t code = scsiDev.cdb[1] & 7;
+    uint32_t raw_count =
+        (((uint32_t) scsiDev.cdb[2]) << 16) |
+        (((uint32_t) scsiDev.cdb[3]) << 8) |
+        scsiDev.cdb[4];
+    // Sign-extend from 24-bit two's complement
+    int32_t count = (raw_count & 0x800000) ? (int32_t)(raw_count | 0xFF000000) : (int32_t)raw_count;
+    if (img.is_tape_container())
+    {
+        doTapeImageSpace(img, code, count);
+    }
+    else if (code == 0)
+    {
+        // Blocks.
+        uint32_t bytesPerSector = scsiDev.target->liveCfg.bytesPerSector;
+        uint32_t capacity = img.file.size() / bytesPerSector;
+        int32_t new_pos = (int32_t)img.tape_pos + count;
+        if (img.tape_files)
+        {
+            capacity = tapeFilesCapacity(img);
+        }
+
+        if (new_pos >= 0 && (uint32_t)new_pos < capacity)
         {
-            // End-of-data.
+            if (img.tape_files)
+                tapeFilesLocate(img, (uint32_t)new_pos);
+            else
+                img.tape_pos = (uint32_t)new_pos;
+        }
+        else
+        {
+            // Clamp to valid range before reporting error
+            if (new_pos < 0)
+                img.tape_pos = 0;
+            else
+                img.tape_pos = capacity;
             scsiDev.status = CHECK_CONDITION;
             scsiDev.target->sense.code = BLANK_CHECK;
             scsiDev.target->sense.asc = 0; // END-OF-DATA DETECTED
             scsiDev.phase = STATUS;
         }
     }
-    else if (command == 0x2B)
-    {
-        // Seek/Locate 10
-        uint32_t lba =
-            (((uint32_t) scsiDev.cdb[3]) << 24) +
-            (((uint32_t) scsiDev.cdb[4]) << 16) +
-            (((uint32_t) scsiDev.cdb[5]) << 8) +
-            scsiDev.cdb[6];
-
-        doSeek(lba);
-    }
-    else if (command == 0x34)
-    {
-        // ReadPosition
-        uint32_t lba = img.tape_pos;
-        scsiDev.data[0] = 0x00;
-        if (lba == 0) scsiDev.data[0] |= 0x80;
-        if (lba >= img.scsiSectors) scsiDev.data[0] |= 0x40;
-        scsiDev.data[1] = 0x00;
-        scsiDev.data[2] = 0x00;
-        scsiDev.data[3] = 0x00;
-        scsiDev.data[4] = (lba >> 24) & 0xFF; // Next block on tape
-        scsiDev.data[5] = (lba >> 16) & 0xFF;
-        scsiDev.data[6] = (lba >>  8) & 0xFF;
-        scsiDev.data[7] = (lba >>  0) & 0xFF;
-        scsiDev.data[8] = (lba >> 24) & 0xFF; // Last block in buffer
-        scsiDev.data[9] = (lba >> 16) & 0xFF;
-        scsiDev.data[10] = (lba >>  8) & 0xFF;
-        scsiDev.data[11] = (lba >>  0) & 0xFF;
-        scsiDev.data[12] = 0x00;
-        scsiDev.data[13] = 0x00;
-        scsiDev.data[14] = 0x00;
-        scsiDev.data[15] = 0x00;
-        scsiDev.data[16] = 0x00;
-        scsiDev.data[17] = 0x00;
-        scsiDev.data[18] = 0x00;
-        scsiDev.data[19] = 0x00;
-
-        scsiDev.phase = DATA_IN;
-        scsiDev.dataLen = 20;
+    else if (code == 1 && img.tape_files)
+    {
+        // Filemarks on a multi-file tape, there is one at the end of each file.
+        // tape_mark_index is the number of filemarks before the position.
+        tape_file_t *files = tapeFiles(img);
+        uint32_t marks = img.tape_mark_index;
+        if (count == 0)
+        {
+            // Nothing to do
+        }
+        else if (count > 0 && marks + count >= img.tape_mark_count)
+        {
+            // After the last filemark is the end of data
+            const tape_file_t &last = files[img.tape_mark_count - 1];
+            img.tape_pos = last.start_block + last.blocks;
+            img.tape_mark_index = img.tape_mark_count;
+            img.tape_mark_block_offset = last.start_block;
+            img.tape_load_next_file = false;
+            if (marks + count > img.tape_mark_count)
+            {
+                tapeCheckCondition(BLANK_CHECK, TAPE_ASC_END_OF_DATA, marks + count - img.tape_mark_count);
+            }
+        }
+        else if (count > 0)
+        {
+            // Beginning of the file after the filemark
+            img.tape_mark_index = marks + count;
+            img.tape_mark_block_offset = files[img.tape_mark_index].start_block;
+            img.tape_pos = img.tape_mark_block_offset;
+            img.tape_load_next_file = true;
+        }
+        else if ((uint32_t)-count > marks)
+        {
+            doRewind();
+            scsiDev.target->sense.eom = true;
+            tapeCheckCondition(NO_SENSE, TAPE_ASC_BEGINNING_OF_MEDIUM, -count - marks);
+        }
+        else
+        {
+            // End of the file before the filemark, the next read reports the filemark
+            img.tape_mark_index = marks + count;
+            img.tape_mark_block_offset = files[img.tape_mark_index].start_block;
+            img.tape_pos = img.tape_mark_block_offset + files[img.tape_mark_index].blocks;
+            img.tape_load_next_file = true;
+        }
+        dbgmsg<LOG_SUBSYS_TAPE>("------ Space ", (int)count, " filemarks to file ", (int)img.tape_mark_index, " position ", (int)img.tape_pos);
     }
-    else
+    else if (code == 1)
     {
-        commandHandled = 0;
+        // Filemarks.
+        // For now just indicate end of data
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = BLANK_CHECK;
+        scsiDev.target->sense.asc = 0; // END-OF-DATA DETECTED
+        scsiDev.phase = STATUS;
     }
+    else if (code == 3)
+    {
+        // End-of-data.
+        scsiDev.status = CHECK_CONDITION;
+        scsiDev.target->sense.code = BLANK_CHECK;
+        scsiDev.target->sense.asc = 0; // END-OF-DATA DETECTED
+        scsiDev.phase = STATUS;
+    }
+    return 1;
+}
 
-    return commandHandled;
+static int tapeCommandLocate(image_config_t &img)
+{
+    // Seek/Locate 10
+    uint32_t lba =
+        (((uint32_t) scsiDev.cdb[3]) << 24) +
+        (((uint32_t) scsiDev.cdb[4]) << 16) +
+        (((uint32_t) scsiDev.cdb[5]) << 8) +
+        scsiDev.cdb[6];
+
+    doSeek(lba);
+    return 1;
+}
+
+static int tapeCommandReadPosition(image_config_t &img)
+{
+    // ReadPosition
+    uint32_t lba = img.tape_pos;
+    scsiDev.data[0] = 0x00;
+    if (lba == 0) scsiDev.data[0] |= 0x80;
+    if (!img.is_tape_container() && lba >= img.scsiSectors) scsiDev.data[0] |= 0x40;
+    scsiDev.data[1] = 0x00;
+    scsiDev.data[2] = 0x00;
+    scsiDev.data[3] = 0x00;
+    scsiDev.data[4] = (lba >> 24) & 0xFF; // Next block on tape
+    scsiDev.data[5] = (lba >> 16) & 0xFF;
+    scsiDev.data[6] = (lba >>  8) & 0xFF;
+    scsiDev.data[7] = (lba >>  0) & 0xFF;
+    scsiDev.data[8] = (lba >> 24) & 0xFF; // Last block in buffer
+    scsiDev.data[9] = (lba >> 16) & 0xFF;
+    scsiDev.data[10] = (lba >>  8) & 0xFF;
+    scsiDev.data[11] = (lba >>  0) & 0xFF;
+    scsiDev.data[12] = 0x00;
+    scsiDev.data[13] = 0x00;
+    scsiDev.data[14] = 0x00;
+    scsiDev.data[15] = 0x00;
+    scsiDev.data[16] = 0x00;
+    scsiDev.data[17] = 0x00;
+    scsiDev.data[18] = 0x00;
+    scsiDev.data[19] = 0x00;
+
+    scsiDev.phase = DATA_IN;
+    scsiDev.dataLen = 20;
+    return 1;
+}
+
+// Commands that move the tape are rejected after LOAD UNLOAD has unloaded it.
+static constexpr scsi_opcode_t g_tape_opcodes[] = {
+    {0x08, OPCODE_NEEDS_MEDIUM, tapeCommandRead6},
+    {0x0A, OPCODE_NEEDS_MEDIUM, tapeCommandWrite6},
+    {0x13, OPCODE_NEEDS_MEDIUM, tapeCommandVerify},
+    {0x19, OPCODE_NEEDS_MEDIUM, tapeCommandErase},
+    {0x10, OPCODE_NEEDS_MEDIUM, tapeCommandWriteFilemarks},
+    {0x11, OPCODE_NEEDS_MEDIUM, tapeCommandSpace},
+    {0x2B, OPCODE_NEEDS_MEDIUM, tapeCommandLocate},
+    {0x01, 0, tapeCommandRewind},
+    {0x05, 0, tapeCommandReadBlockLimits},
+    {0x34, 0, tapeCommandReadPosition},
+};
+
+static constexpr scsi_opcode_table_t g_tape_opcode_table = scsiOpcodeTable(g_tape_opcodes);
+
+extern "C" int scsiTapeCommand()
+{
+    image_config_t &img = *(image_config_t*)scsiDev.target->cfg;
+    return scsiOpcodeDispatch(g_tape_opcode_table, img);
 }
\ No newline at end of file
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - SIMH .tap tape images
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "BlueSCSI_tape_image.h"
+#include "BlueSCSI_disk.h"
+#include "BlueSCSI_log.h"
+#include "BlueSCSI_config.h"
+#include <BlueSCSI_platform.h>
+#include <SdFat.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+extern SdFs SD;
+
+// Length field values with a special meaning in .tap files
+#define TAP_FILEMARK        0x00000000
+#define TAP_ERASE_GAP       0xFFFFFFFE
+#define TAP_END_OF_MEDIUM   0xFFFFFFFF
+#define TAP_ERROR_FLAG      0x80000000
+#define TAP_CLASS_MASK      0x7F000000 // Private and reserved record classes
+
+#define TAPE_INDEX_MAGIC    "BSTAPIDX"
+#define TAPE_INDEX_VERSION  1
+
+// image_size of an index that has records not yet committed with tapeImageFlush()
+#define TAPE_INDEX_DIRTY    0xFFFFFFFFFFFFFFFFULL
+
+// The index file is written and read by the firmware only, so the structures
+// are stored in the native little endian byte order.
+struct tape_index_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t records; // Records and filemarks in the index
+    uint32_t filemarks;
+    uint32_t reserved;
+    uint64_t image_size; // Size of the .tap file the index was written for
+    uint64_t data_end; // End of the last record in the .tap file
+};
+
+struct tape_index_entry_t
+{
+    uint64_t offset;
+    uint32_t filemarks_before;
+    uint32_t length; // .tap length field, including TAP_ERROR_FLAG
+};
+
+static_assert(sizeof(tape_index_header_t) == 40, "Tape index header layout changed");
+static_assert(sizeof(tape_index_entry_t) == 16, "Tape index entry layout changed");
+
+static inline uint64_t entryOffset(uint32_t pos)
+{
+    return sizeof(tape_index_header_t) + (uint64_t)pos * sizeof(tape_index_entry_t);
+}
+
+bool tapeImageIsContainer(const char *filename)
+{
+    const char *extension = strrchr(filename, '.');
+    return extension && strcasecmp(extension, TAPE_IMAGE_EXTENSION) == 0;
+}
+
+static bool tapeImageWriteHeader(image_config_t &img, uint64_t image_size)
+{
+    tape_index_header_t hdr = {};
+    memcpy(hdr.magic, TAPE_INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = TAPE_INDEX_VERSION;
+    hdr.records = img.tape_records;
+    hdr.filemarks = img.tape_filemarks;
+    hdr.image_size = image_size;
+    hdr.data_end = img.tape_data_end;
+
+    return img.tape_index.seekSet(0) &&
+           img.tape_index.write(&hdr, sizeof(hdr)) == sizeof(hdr);
+}
+
+// Invalidates the index header before the first change after a flush,
+// so that an interrupted write is detected on the next load.
+static bool tapeImageMarkDirty(image_config_t &img)
+{
+    if (img.tape_index_dirty)
+    {
+        return true;
+    }
+
+    img.tape_index_dirty = true;
+    return tapeImageWriteHeader(img, TAPE_INDEX_DIRTY) && img.tape_index.sync();
+}
+
+// Scans the whole .tap file and writes an index entry for each record and filemark.
+// Fails if the file doesn't parse as records up to its end or an end of medium
+// marker, which is the case for raw images that happen to use the extension.
+// With recover set the file is known to be a .tap container that was being
+// written, and it is truncated after the last complete record instead.
+static bool tapeImageBuildIndex(image_config_t &img, FsFile *tap, bool recover)
+{
+    tape_index_entry_t entries[32];
+    uint32_t count = 0;
+    uint64_t size = tap->size();
+    uint64_t pos = 0;
+
+    img.tape_records = 0;
+    img.tape_filemarks = 0;
+    if (!img.tape_index.truncate(0) || !img.tape_index.seekSet(entryOffset(0)))
+    {
+        return false;
+    }
+
+    bool end_of_medium = false;
+    while (pos + 4 <= size)
+    {
+        uint32_t marker;
+        if (!tap->seekSet(pos) || tap->read(&marker, 4) != 4)
+        {
+            logmsg("---- Read failed at offset ", (int)pos, " of tape image");
+            return false;
+        }
+
+        if (marker == TAP_END_OF_MEDIUM)
+        {
+            end_of_medium = true;
+            break;
+        }
+        else if (marker == TAP_ERASE_GAP)
+        {
+            pos += 4;
+            continue;
+        }
+        else if (marker & TAP_CLASS_MASK)
+        {
+            if (recover) break;
+            logmsg("---- Unsupported record type ", marker, " at offset ", (int)pos, ", not a SIMH tape image");
+            return false;
+        }
+
+        tape_index_entry_t &entry = entries[count];
+        entry.offset = pos;
+        entry.filemarks_before = img.tape_filemarks;
+        entry.length = marker;
+
+        if (marker == TAP_FILEMARK)
+        {
+            img.tape_filemarks++;
+            pos += 4;
+        }
+        else
+        {
+            uint32_t length = marker & TAPE_IMAGE_MAX_RECORD;
+            uint64_t next = pos + 4 + ((length + 1) & ~1) + 4;
+            uint32_t trailer = 0;
+            if (next > size || !tap->seekSet(next - 4) || tap->read(&trailer, 4) != 4 || trailer != marker)
+            {
+                if (recover) break;
+                logmsg("---- Tape image record at offset ", (int)pos, " is truncated or corrupt, not a SIMH tape image");
+                return false;
+            }
+            pos = next;
+        }
+        count++;
+        img.tape_records++;
+
+        if (count == sizeof(entries) / sizeof(entries[0]))
+        {
+            if (img.tape_index.write(entries, sizeof(entries)) != sizeof(entries))
+            {
+                return false;
+            }
+            count = 0;
+            platform_reset_watchdog();
+        }
+    }
+
+    if (pos < size && !end_of_medium)
+    {
+        if (!recover)
+        {
+            logmsg("---- Tape image has ", (int)(size - pos), " bytes after the last record, not a SIMH tape image");
+            return false;
+        }
+
+        // Left over from a write that was interrupted by power loss
+        logmsg("---- Tape image has an incomplete record at offset ", (int)pos, ", discarding ", (int)(size - pos), " bytes");
+        if (!tap->truncate(pos) || !tap->sync())
+        {
+            return false;
+        }
+        size = pos;
+    }
+
+    if (count > 0 && img.tape_index.write(entries, count * sizeof(entries[0])) != count * sizeof(entries[0]))
+    {
+        return false;
+    }
+
+    img.tape_data_end = pos;
+    return tapeImageWriteHeader(img, size) && img.tape_index.sync();
+}
+
+// Data ends at the end of the file, or at an end of medium marker
+static bool tapeImageDataEndValid(FsFile *tap, uint64_t data_end)
+{
+    uint32_t marker;
+    return data_end == tap->size() ||
+        (tap->seekSet(data_end) && tap->read(&marker, 4) == 4 && marker == TAP_END_OF_MEDIUM);
+}
+
+bool tapeImageOpen(image_config_t &img, const char *filename)
+{
+    FsFile *tap = img.file.getFsFile();
+    if (!tap)
+    {
+        return false;
+    }
+
+    char path[MAX_FILE_PATH + 8];
+    snprintf(path, sizeof(path), "%s%s", filename, TAPE_IMAGE_INDEX_EXTENSION);
+    img.tape_index = SD.open(path, O_RDWR | O_CREAT);
+    if (!img.tape_index.isOpen())
+    {
+        logmsg("---- Failed to open tape index ", path);
+        return false;
+    }
+
+    img.tape_index_dirty = false;
+    tape_index_header_t hdr;
+    bool valid = img.tape_index.read(&hdr, sizeof(hdr)) == sizeof(hdr) &&
+                 memcmp(hdr.magic, TAPE_INDEX_MAGIC, sizeof(hdr.magic)) == 0 &&
+                 hdr.version == TAPE_INDEX_VERSION;
+    if (valid &&
+        hdr.image_size == tap->size() &&
+        img.tape_index.size() == entryOffset(hdr.records) &&
+        tapeImageDataEndValid(tap, hdr.data_end))
+    {
+        img.tape_records = hdr.records;
+        img.tape_filemarks = hdr.filemarks;
+        img.tape_data_end = hdr.data_end;
+    }
+    else
+    {
+        // An index with uncommitted records belongs to a .tap container,
+        // even if the last record was cut short.
+        bool recover = valid && hdr.image_size == TAPE_INDEX_DIRTY;
+        logmsg("---- Building tape index ", path);
+        if (!tapeImageBuildIndex(img, tap, recover))
+        {
+            logmsg("---- Failed to build tape index ", path);
+            img.tape_index.remove();
+            return false;
+        }
+    }
+
+    logmsg("---- Tape image has ", (int)img.tape_records, " records and filemarks, ", (int)img.tape_filemarks, " of them filemarks");
+    return true;
+}
+
+void tapeImageFlush(image_config_t &img)
+{
+    FsFile *tap = img.file.getFsFile();
+    if (!img.tape_index.isOpen() || !tap)
+    {
+        return;
+    }
+
+    if (img.tape_index_dirty)
+    {
+        tap->sync();
+        if (tapeImageWriteHeader(img, tap->size()))
+        {
+            img.tape_index_dirty = false;
+        }
+        img.tape_index.sync();
+    }
+}
+
+void tapeImageClose(image_config_t &img)
+{
+    tapeImageFlush(img);
+    img.tape_index.close();
+}
+
+bool tapeImageGetRecord(image_config_t &img, uint32_t pos, tape_record_t *record)
+{
+    tape_index_entry_t entry;
+    if (pos >= img.tape_records ||
+        !img.tape_index.seekSet(entryOffset(pos)) ||
+        img.tape_index.read(&entry, sizeof(entry)) != sizeof(entry))
+    {
+        return false;
+    }
+
+    record->offset = entry.offset;
+    record->filemarks_before = entry.filemarks_before;
+    record->length = entry.length & TAPE_IMAGE_MAX_RECORD;
+    record->error = (entry.length & TAP_ERROR_FLAG) != 0;
+    return true;
+}
+
+uint32_t tapeImageFilemarksBefore(image_config_t &img, uint32_t pos)
+{
+    tape_record_t record;
+    if (tapeImageGetRecord(img, pos, &record))
+    {
+        return record.filemarks_before;
+    }
+    return img.tape_filemarks;
+}
+
+uint32_t tapeImageFindFilemark(image_config_t &img, uint32_t mark)
+{
+    if (mark >= img.tape_filemarks)
+    {
+        return img.tape_records;
+    }
+
+    // The filemark is the entry before the first one with more filemarks before it
+    uint32_t low = 0;
+    uint32_t high = img.tape_records;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        if (tapeImageFilemarksBefore(img, mid) > mark)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    return low - 1;
+}
+
+bool tapeImageReadData(image_config_t &img, const tape_record_t &record, uint32_t offset, uint8_t *buf, uint32_t count)
+{
+    FsFile *tap = img.file.getFsFile();
+    return tap &&
+           tap->seekSet(record.offset + 4 + offset) &&
+           tap->read(buf, count) == (int)count;
+}
+
+bool tapeImageTruncate(image_config_t &img, uint32_t pos)
+{
+    FsFile *tap = img.file.getFsFile();
+    if (!tap || pos > img.tape_records)
+    {
+        return false;
+    }
+
+    uint64_t data_end = img.tape_data_end;
+    uint32_t filemarks = img.tape_filemarks;
+    if (pos < img.tape_records)
+    {
+        tape_record_t record;
+        if (!tapeImageGetRecord(img, pos, &record))
+        {
+            return false;
+        }
+        data_end = record.offset;
+        filemarks = record.filemarks_before;
+    }
+
+    // Appending at the end of data is the common case and needs no changes
+    if (tap->size() == data_end && pos == img.tape_records)
+    {
+        return true;
+    }
+
+    if (!tapeImageMarkDirty(img) ||
+        !tap->truncate(data_end) ||
+        !img.tape_index.truncate(entryOffset(pos)))
+    {
+        return false;
+    }
+
+    img.tape_records = pos;
+    img.tape_filemarks = filemarks;
+    img.tape_data_end = data_end;
+    return true;
+}
+
+// Adds the index entry for the record at the end of data
+static bool tapeImageAppendEntry(image_config_t &img, uint32_t marker)
+{
+    tape_index_entry_t entry;
+    entry.offset = img.tape_data_end;
+    entry.filemarks_before = img.tape_filemarks;
+    entry.length = marker;
+
+    return img.tape_index.seekSet(entryOffset(img.tape_records)) &&
+           img.tape_index.write(&entry, sizeof(entry)) == sizeof(entry);
+}
+
+bool tapeImageAppendFilemark(image_config_t &img)
+{
+    FsFile *tap = img.file.getFsFile();
+    uint32_t marker = TAP_FILEMARK;
+    if (!tap || !tapeImageMarkDirty(img) ||
+        !tap->seekSet(img.tape_data_end) ||
+        tap->write(&marker, 4) != 4 ||
+        !tapeImageAppendEntry(img, marker))
+    {
+        return false;
+    }
+
+    img.tape_data_end += 4;
+    img.tape_records++;
+    img.tape_filemarks++;
+    return true;
+}
+
+bool tapeImageBeginRecord(image_config_t &img, uint32_t length)
+{
+    FsFile *tap = img.file.getFsFile();
+    if (!tap || length == 0 || length > TAPE_IMAGE_MAX_RECORD || !tapeImageMarkDirty(img))
+    {
+        return false;
+    }
+
+    img.tape_write_length = length;
+    return tap->seekSet(img.tape_data_end) && tap->write(&length, 4) == 4;
+}
+
+bool tapeImageWriteData(image_config_t &img, const uint8_t *buf, uint32_t count)
+{
+    FsFile *tap = img.file.getFsFile();
+    return tap && tap->write(buf, count) == count;
+}
+
+bool tapeImageAbortRecord(image_config_t &img)
+{
+    // The record is only added to the index by tapeImageEndRecord()
+    return tapeImageTruncate(img, img.tape_records);
+}
+
+bool tapeImageEndRecord(image_config_t &img)
+{
+    FsFile *tap = img.file.getFsFile();
+    uint32_t length = img.tape_write_length;
+    uint8_t pad = 0;
+    if (!tap ||
+        ((length & 1) && tap->write(&pad, 1) != 1) ||
+        tap->write(&length, 4) != 4 ||
+        !tapeImageAppendEntry(img, length))
+    {
+        return false;
+    }
+
+    img.tape_data_end += 4 + ((length + 1) & ~1) + 4;
+    img.tape_records++;
+    return true;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026 Eric Helgeson
+ *
+ * BlueSCSI - SIMH .tap tape images
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Tape images in the SIMH .tap container format.
+//
+// Each record is stored as a 32-bit little endian length, the data padded
+// to an even number of bytes and the length again. A zero length is a
+// filemark and 0xFFFFFFFF marks the end of the medium. Records with bit 31
+// of the length set were recorded with an error.
+//
+// The position of each record and the number of filemarks before it is kept
+// in a sidecar index file next to the image (e.g. "TP0.tap.idx"), so that
+// locating a record is a single read from the index. The index is rebuilt by
+// scanning the image if it is missing or was not updated with the image. A
+// record cut short by power loss during a write is discarded on the rebuild.
+// The tape position of a .tap image is the number of records and filemarks
+// before it.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct image_config_t;
+
+#define TAPE_IMAGE_EXTENSION ".tap"
+#define TAPE_IMAGE_INDEX_EXTENSION ".idx"
+
+// Largest record length that fits in the .tap length field
+#define TAPE_IMAGE_MAX_RECORD 0x00FFFFFF
+
+struct tape_record_t
+{
+    uint64_t offset; // Offset of the leading length field in the .tap file
+    uint32_t filemarks_before; // Filemarks between the beginning of tape and the record
+    uint32_t length; // Data length, 0 for a filemark
+    bool error; // Record was marked bad in the image
+
+    bool isFilemark() const { return length == 0 && !error; }
+};
+
+// Checks if the image file name is a .tap container
+bool tapeImageIsContainer(const char *filename);
+
+// Opens the index of a .tap image, rebuilding it if needed.
+// Returns false if the index could not be opened or created.
+bool tapeImageOpen(image_config_t &img, const char *filename);
+void tapeImageClose(image_config_t &img);
+
+// Gets a record or filemark by its position, false past the end of data
+bool tapeImageGetRecord(image_config_t &img, uint32_t pos, tape_record_t *record);
+
+// Number of filemarks before a position, pos may be the end of data
+uint32_t tapeImageFilemarksBefore(image_config_t &img, uint32_t pos);
+
+// Position of filemark number mark (counting from 0) by binary search in the index,
+// or img.tape_records if the tape has fewer filemarks.
+uint32_t tapeImageFindFilemark(image_config_t &img, uint32_t mark);
+
+// Reads part of the data of a record
+bool tapeImageReadData(image_config_t &img, const tape_record_t &record, uint32_t offset, uint8_t *buf, uint32_t count);
+
+// Discards the records from pos onwards, which is done before writing at pos
+bool tapeImageTruncate(image_config_t &img, uint32_t pos);
+
+// Appends a filemark at the end of data
+bool tapeImageAppendFilemark(image_config_t &img);
+
+// Appends a record of length bytes, the data is written with tapeImageWriteData()
+// in between the calls. tapeImageAbortRecord() removes a record that was begun
+// but not ended.
+bool tapeImageBeginRecord(image_config_t &img, uint32_t length);
+bool tapeImageWriteData(image_config_t &img, const uint8_t *buf, uint32_t count);
+bool tapeImageEndRecord(image_config_t &img);
+bool tapeImageAbortRecord(image_config_t &img);
+
+// Writes the index header and the directory entries of the image and index.
+// Appended records are only committed to the index header here, an index
+// that was not flushed is rebuilt when the image is loaded.
+void tapeImageFlush(image_config_t &img);
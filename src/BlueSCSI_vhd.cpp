@@ -162,12 +162,10 @@ static void vhd_generate_uuid(uint8_t *uuid, uint32_t timestamp,
     write_be32(&uuid[12], h3);
 }
 
-void vhd_build_fixed_footer(uint8_t *footer, uint64_t total_bytes,
-                             uint32_t sectorcount, uint32_t timestamp,
-                             uint8_t scsi_id)
+static void vhd_build_footer(uint8_t *footer, uint64_t total_bytes,
+                             uint32_t timestamp, uint8_t scsi_id,
+                             uint32_t disk_type, uint64_t data_offset)
 {
-    (void)sectorcount; /* Reserved for future use / geometry fallback */
-
     /* Zero entire footer first */
     memset(footer, 0, VHD_FOOTER_SIZE);
 
@@ -180,8 +178,8 @@ void vhd_build_fixed_footer(uint8_t *footer, uint64_t total_bytes,
     /* Offset 12: File Format Version (1.0) */
     write_be32(&footer[12], 0x00010000);
 
-    /* Offset 16: Data Offset (fixed disk = no dynamic header) */
-    write_be64(&footer[16], 0xFFFFFFFFFFFFFFFFULL);
+    /* Offset 16: Data Offset (dynamic header, all ones for a fixed disk) */
+    write_be64(&footer[16], data_offset);
 
     /* Offset 24: Time Stamp */
     write_be32(&footer[24], timestamp);
@@ -207,8 +205,8 @@ void vhd_build_fixed_footer(uint8_t *footer, uint64_t total_bytes,
     footer[58] = geo.heads;
     footer[59] = geo.sectors_per_track;
 
-    /* Offset 60: Disk Type (2 = Fixed) */
-    write_be32(&footer[60], 0x00000002);
+    /* Offset 60: Disk Type */
+    write_be32(&footer[60], disk_type);
 
     /* Offset 64: Checksum — must be computed last */
     /* Leave as zero for now */
@@ -224,6 +222,59 @@ void vhd_build_fixed_footer(uint8_t *footer, uint64_t total_bytes,
     write_be32(&footer[64], checksum);
 }
 
+void vhd_build_fixed_footer(uint8_t *footer, uint64_t total_bytes,
+                             uint32_t sectorcount, uint32_t timestamp,
+                             uint8_t scsi_id)
+{
+    (void)sectorcount; /* Reserved for future use / geometry fallback */
+
+    vhd_build_footer(footer, total_bytes, timestamp, scsi_id,
+                     VHD_DISK_TYPE_FIXED, 0xFFFFFFFFFFFFFFFFULL);
+}
+
+void vhd_build_dynamic_footer(uint8_t *footer, uint64_t total_bytes,
+                               uint32_t timestamp, uint8_t scsi_id)
+{
+    /* Dynamic header follows the footer copy at the start of the file */
+    vhd_build_footer(footer, total_bytes, timestamp, scsi_id,
+                     VHD_DISK_TYPE_DYNAMIC, VHD_FOOTER_SIZE);
+}
+
+uint32_t vhd_dynamic_table_entries(uint64_t total_bytes)
+{
+    return (uint32_t)((total_bytes + VHD_DYNAMIC_BLOCK_SIZE - 1) / VHD_DYNAMIC_BLOCK_SIZE);
+}
+
+void vhd_build_dynamic_header(uint8_t *header, uint64_t table_offset,
+                               uint32_t max_table_entries)
+{
+    memset(header, 0, VHD_DYNAMIC_HEADER_SIZE);
+
+    /* Offset 0: Cookie "cxsparse" */
+    memcpy(&header[0], "cxsparse", 8);
+
+    /* Offset 8: Data Offset (unused, all ones) */
+    write_be64(&header[8], 0xFFFFFFFFFFFFFFFFULL);
+
+    /* Offset 16: Table Offset, absolute file offset of the BAT */
+    write_be64(&header[16], table_offset);
+
+    /* Offset 24: Header Version (1.0) */
+    write_be32(&header[24], 0x00010000);
+
+    /* Offset 28: Max Table Entries */
+    write_be32(&header[28], max_table_entries);
+
+    /* Offset 32: Block Size */
+    write_be32(&header[32], VHD_DYNAMIC_BLOCK_SIZE);
+
+    /* Offset 40-1023: parent information and reserved, zero for a dynamic disk */
+
+    /* Offset 36: Checksum over the whole header */
+    uint32_t checksum = vhd_compute_checksum(header, VHD_DYNAMIC_HEADER_SIZE);
+    write_be32(&header[36], checksum);
+}
+
 int vhd_parse_fixed_footer(const uint8_t *footer, size_t len,
                            vhd_footer_info_t *out)
 {
@@ -25,6 +25,11 @@
 
 #define VHD_FOOTER_SIZE 512
 
+/* Dynamic (sparse) VHD layout */
+#define VHD_DYNAMIC_HEADER_SIZE 1024
+#define VHD_DYNAMIC_BLOCK_SIZE  (2 * 1024 * 1024)
+#define VHD_DYNAMIC_BITMAP_SIZE 512 /* One bit per sector of a block, padded to a sector */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -82,6 +87,31 @@ void vhd_build_fixed_footer(uint8_t *footer, uint64_t total_bytes,
                              uint32_t sectorcount, uint32_t timestamp,
                              uint8_t scsi_id);
 
+/**
+ * Build the 512-byte footer of a Dynamic VHD. The same footer is stored
+ * at the start of the file, followed by the dynamic disk header.
+ *
+ * @param footer      Output buffer, must be at least VHD_FOOTER_SIZE bytes
+ * @param total_bytes Raw disk data size in bytes
+ * @param timestamp   Seconds since 2000-01-01 00:00:00 UTC
+ * @param scsi_id     SCSI target ID (used in UUID generation)
+ */
+void vhd_build_dynamic_footer(uint8_t *footer, uint64_t total_bytes,
+                               uint32_t timestamp, uint8_t scsi_id);
+
+/**
+ * Build the 1024-byte dynamic disk header with VHD_DYNAMIC_BLOCK_SIZE blocks.
+ *
+ * @param header            Output buffer of VHD_DYNAMIC_HEADER_SIZE bytes
+ * @param table_offset      File offset of the Block Allocation Table
+ * @param max_table_entries Number of blocks, see vhd_dynamic_table_entries()
+ */
+void vhd_build_dynamic_header(uint8_t *header, uint64_t table_offset,
+                               uint32_t max_table_entries);
+
+/* Number of Block Allocation Table entries needed for total_bytes */
+uint32_t vhd_dynamic_table_entries(uint64_t total_bytes);
+
 /**
  * Compute CHS geometry per the Microsoft VHD specification algorithm.
  *
@@ -195,6 +195,11 @@ bool ImageBackingStore::isWritable()
     return !m_isrom && !m_isreadonly_attr;
 }
 
+void ImageBackingStore::setReadOnly()
+{
+    m_isreadonly_attr = true;
+}
+
 bool ImageBackingStore::isRaw()
 {
     return m_israw;
@@ -449,6 +454,15 @@ size_t ImageBackingStore::getFilename(char* buf, size_t buflen)
     return 0;
 }
 
+FsFile *ImageBackingStore::getFsFile()
+{
+    if (!m_israw && !m_isrom && m_fsfile.isOpen())
+    {
+        return &m_fsfile;
+    }
+    return nullptr;
+}
+
 bool ImageBackingStore::selectImageFile(const char *filename)
 {
     if (!m_isfolder)
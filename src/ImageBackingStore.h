@@ -70,6 +70,9 @@ public:
     // Can the image be written?
     bool isWritable();
 
+    // Refuse writes from now on, the image stays open for reading
+    void setReadOnly();
+
     // Is this in Raw mode? by passing the file system
     bool isRaw();
 
@@ -120,6 +123,10 @@ public:
 
     size_t getFilename(char* buf, size_t buflen);
 
+    // Underlying file for formats that need their own parsing, such as
+    // WAVE and FLAC audio tracks. Returns nullptr for raw and ROM images.
+    FsFile *getFsFile();
+
     // Change image if the image is a folder (used for .cue with multiple .bin)
     bool selectImageFile(const char *filename);
     size_t getFoldername(char* buf, size_t buflen);
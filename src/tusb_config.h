@@ -54,8 +54,12 @@ extern "C" {
 #define CFG_TUD_CDC_TX_BUFSIZE 256
 #define CFG_TUD_CDC_EP_BUFSIZE 64
 
-// MSC buffer size
+// MSC buffer size, each read/write callback handles at most this much.
+// Can be raised at build time (BLUESCSI_MSC_EP_BUFSIZE in CMake), must be
+// a multiple of 512 and below 64 kB.
+#ifndef CFG_TUD_MSC_EP_BUFSIZE
 #define CFG_TUD_MSC_EP_BUFSIZE 512
+#endif
 
 #ifdef __cplusplus
 }
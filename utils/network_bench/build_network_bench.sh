@@ -0,0 +1,55 @@
+#!/usr/bin/env bash
+
+# BlueSCSI - Copyright (c) 2026 Eric Helgeson
+#
+# BlueSCSI file is licensed under the GPL version 3 or any later version.
+#
+# https://www.gnu.org/licenses/gpl-3.0.html
+# ----
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+# Builds the DaynaPORT emulation for the build host with the loopback
+# backend, and the network_bench replay driver around it.
+#
+# Usage: utils/network_bench/build_network_bench.sh [compiler flags]
+#   Extra flags are passed to the compiler, e.g. to compare queue settings:
+#   utils/network_bench/build_network_bench.sh -DNETWORK_PACKET_QUEUE_SIZE=8
+#   utils/network_bench/build_network_bench.sh -DNETWORK_QUEUE_DROP_POLICY=0
+#
+# Then run build/network_bench/network_bench -h for the benchmark options.
+
+set -euo pipefail
+
+SCRIPT_DIR=$(dirname "$(readlink -f "$0")")
+cd "$SCRIPT_DIR/../.." || exit 1
+OUT_DIR=./build/network_bench
+mkdir -p "$OUT_DIR"
+
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+FLAGS=(-O2 -g -Wall -DBLUESCSI_NETWORK -DNETWORK_DEBUG_LOGGING
+    -I utils/network_bench/host
+    -I lib/SCSI2SD/src/firmware
+    -I lib/SCSI2SD/include
+    -I src
+    -I lib/BlueSCSI_platform_RP2MCU
+    "$@")
+
+"$CC" -std=gnu11 "${FLAGS[@]}" -c lib/SCSI2SD/src/firmware/network.c -o "$OUT_DIR/network.o"
+"$CC" -std=gnu11 "${FLAGS[@]}" -c lib/SCSI2SD/src/firmware/network_loopback.c -o "$OUT_DIR/network_loopback.o"
+"$CC" -std=gnu11 "${FLAGS[@]}" -c utils/network_bench/network_bench.c -o "$OUT_DIR/network_bench.o"
+"$CXX" -std=c++17 "${FLAGS[@]}" -c src/BlueSCSI_crc32.cpp -o "$OUT_DIR/BlueSCSI_crc32.o"
+"$CXX" "$OUT_DIR"/*.o -o "$OUT_DIR/network_bench"
+
+echo "Built $OUT_DIR/network_bench"
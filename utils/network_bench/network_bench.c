@@ -0,0 +1,611 @@
+/*
+ * Copyright (c) 2026 Eric Helgeson <eric@bluescsi.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// DaynaPORT benchmark on the build host. network.c and the loopback backend
+// are built natively and driven by an in-memory initiator that replays
+// READ(6) and WRITE(6) command sequences, so queue and batching changes can
+// be measured before flashing a board. The loopback backend generates the
+// inbound traffic and reflects the frames the initiator writes.
+//
+// Build and run with utils/network_bench/build_network_bench.sh.
+//
+// A replay file has one command per line and is repeated until the run
+// time is over:
+//   read <allocation length> [cdb5]   READ(6), cdb5 0xc0 = blind, 0x80 = polled
+//   write <frame size> [frames]       WRITE(6), with the length preamble if frames > 1
+//   wait <us>                         initiator idle, the main loop keeps polling
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "scsi.h"
+#include "scsiPhy.h"
+#include "scsi2sd_time.h"
+#include "network.h"
+#include "BlueSCSI_crc32.h"
+
+#define BENCH_ETHERTYPE 0x88b5 // Same as the loopback generator
+#define BENCH_MAX_STEPS 64
+#define BENCH_MAX_SAMPLES (1 << 20)
+
+ScsiDevice scsiDev;
+bool g_log_debug = false;
+
+static S2S_TargetCfg benchTargetCfg;
+static TargetState benchTarget;
+
+/* Host platform */
+
+static struct timespec benchStart;
+static uint32_t busKBs; // Simulated SCSI bus speed, 0 = no transfer time
+static uint32_t busBusyUntil;
+
+uint32_t time_us_32(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((now.tv_sec - benchStart.tv_sec) * 1000000LL +
+		(now.tv_nsec - benchStart.tv_nsec) / 1000);
+}
+
+uint32_t platform_millis(void)
+{
+	return time_us_32() / 1000;
+}
+
+void sleep_us(uint64_t us)
+{
+	// Busy wait like the firmware, a real sleep overshoots by far too much
+	uint32_t start = time_us_32();
+	while (time_us_32() - start < us) {}
+}
+
+void platform_poll(void)
+{
+	scsiNetworkPoll();
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+	if (size)
+	{
+		size_t n = (len >= size ? size - 1 : len);
+		memcpy(dst, src, n);
+		dst[n] = '\0';
+	}
+	return len;
+}
+
+void logmsg_f(const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	fputs("firmware: ", stdout);
+	vprintf(format, ap);
+	putchar('\n');
+	va_end(ap);
+}
+
+void dbgmsg_f(const char *format, ...)
+{
+	if (!g_log_debug)
+		return;
+
+	va_list ap;
+	va_start(ap, format);
+	fputs("firmware: ", stdout);
+	vprintf(format, ap);
+	putchar('\n');
+	va_end(ap);
+}
+
+void logmsg_buf(const unsigned char *buf, unsigned long size) { (void)buf; (void)size; }
+void dbgmsg_buf(const unsigned char *buf, unsigned long size) { (void)buf; (void)size; }
+
+// Wi-Fi is not used with the loopback backend
+int platform_network_send(uint8_t *buf, size_t len) { (void)buf; (void)len; return -1; }
+void platform_network_add_multicast_address(uint8_t *mac) { (void)mac; }
+bool platform_network_wifi_join(char *ssid, char *password, bool reconnect) { (void)ssid; (void)password; (void)reconnect; return false; }
+int platform_network_wifi_start_scan() { return -1; }
+int platform_network_wifi_scan_finished() { return 1; }
+int platform_network_wifi_rssi() { return 0; }
+char *platform_network_wifi_ssid() { return NULL; }
+char *platform_network_wifi_bssid() { return NULL; }
+uint8_t platform_network_wifi_flags() { return 0; }
+int platform_network_wifi_channel() { return 0; }
+
+/* In-memory initiator */
+
+static uint8_t hostIn[SCSI2SD_BUFFER_SIZE * 2]; // DATA IN of the current command
+static uint32_t hostInLen;
+static uint8_t hostOut[SCSI2SD_BUFFER_SIZE * 2]; // DATA OUT of the current command
+static uint32_t hostOutLen;
+static uint32_t hostOutPos;
+
+static void busTransfer(uint32_t count)
+{
+	if (busKBs)
+		busBusyUntil = time_us_32() + (uint32_t)((uint64_t)count * 1000 / busKBs);
+}
+
+void scsiEnterPhase(int phase)
+{
+	(void)phase;
+}
+
+void scsiWrite(const uint8_t *data, uint32_t count)
+{
+	if (hostInLen + count <= sizeof(hostIn))
+	{
+		memcpy(hostIn + hostInLen, data, count);
+		hostInLen += count;
+	}
+	busTransfer(count);
+}
+
+bool scsiIsWriteFinished(const uint8_t *data)
+{
+	(void)data;
+	return (int32_t)(time_us_32() - busBusyUntil) >= 0;
+}
+
+void scsiFinishWrite(void)
+{
+	while (!scsiIsWriteFinished(NULL)) {}
+}
+
+void scsiStartRead(uint8_t *data, uint32_t count, int *parityError)
+{
+	(void)parityError;
+	uint32_t avail = hostOutLen - hostOutPos;
+	uint32_t n = (count < avail ? count : avail);
+	memcpy(data, hostOut + hostOutPos, n);
+	memset(data + n, 0, count - n);
+	hostOutPos += n;
+	busTransfer(count);
+}
+
+void scsiFinishRead(uint8_t *data, uint32_t count, int *parityError)
+{
+	(void)data;
+	(void)count;
+	(void)parityError;
+	while (!scsiIsWriteFinished(NULL)) {}
+}
+
+void scsiRead(uint8_t *data, uint32_t count, int *parityError)
+{
+	scsiStartRead(data, count, parityError);
+	scsiFinishRead(data, count, parityError);
+}
+
+static void runCommand(const uint8_t *cdb)
+{
+	memcpy(scsiDev.cdb, cdb, 6);
+	scsiDev.cdbLen = 6;
+	scsiDev.phase = COMMAND;
+	scsiDev.status = GOOD;
+	scsiDev.dataLen = 0;
+	hostInLen = 0;
+	hostOutPos = 0;
+	scsiNetworkCommand();
+}
+
+/* Benchmark */
+
+enum { STEP_READ, STEP_WRITE, STEP_WAIT };
+
+struct benchStep {
+	int type;
+	uint32_t arg;
+	uint32_t arg2;
+};
+
+static struct benchStep steps[BENCH_MAX_STEPS];
+static int stepCount;
+
+static const uint8_t benchHostMAC[6] = { 0x02, 0x00, 0x5e, 0x10, 0x00, 0x02 };
+
+struct latencySamples {
+	uint32_t *us;
+	uint32_t count;
+	uint64_t total;
+	uint32_t max;
+};
+
+static struct {
+	uint32_t reads;
+	uint32_t writes;
+	uint32_t emptyReads;
+	uint32_t packets;
+	uint64_t bytes;
+	uint32_t generated;
+	uint32_t reflected;
+	uint32_t other;
+	uint32_t crcErrors;
+	uint32_t framingErrors;
+	uint32_t reordered;	// generated frames older than one already received
+	uint32_t nextSeq;	// next expected generated sequence number
+	uint32_t written;	// frames the initiator sent
+	struct latencySamples genLatency;
+	struct latencySamples rttLatency;
+} bench;
+
+static void sampleAdd(struct latencySamples *s, uint32_t us)
+{
+	if (s->count < BENCH_MAX_SAMPLES)
+		s->us[s->count] = us;
+	s->count++;
+	s->total += us;
+	if (us > s->max)
+		s->max = us;
+}
+
+static int compareU32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void samplePrint(const char *name, struct latencySamples *s)
+{
+	if (s->count == 0)
+		return;
+
+	uint32_t n = (s->count < BENCH_MAX_SAMPLES ? s->count : BENCH_MAX_SAMPLES);
+	qsort(s->us, n, sizeof(s->us[0]), compareU32);
+	printf("%s latency: average %lu us, median %lu us, 99th percentile %lu us, max %lu us\n", name,
+		(unsigned long)(s->total / s->count), (unsigned long)s->us[n / 2],
+		(unsigned long)s->us[(uint64_t)n * 99 / 100], (unsigned long)s->max);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Splits the DATA IN of a READ(6) into packets like the host driver does
+static void parseReadData(void)
+{
+	uint32_t now = time_us_32();
+	uint32_t pos = 0;
+	for (;;)
+	{
+		if (pos + 6 > hostInLen)
+		{
+			bench.framingErrors++;
+			return;
+		}
+
+		const uint8_t *hdr = hostIn + pos;
+		uint32_t len = (hdr[0] << 8) | hdr[1];
+		int more = (hdr[5] & 0x10) != 0;
+		pos += 6;
+		if (len == 0)
+		{
+			if (pos == 6)
+				bench.emptyReads++;
+			return;
+		}
+		if (len < 4 || pos + len > hostInLen)
+		{
+			bench.framingErrors++;
+			return;
+		}
+
+		const uint8_t *frame = hostIn + pos;
+		uint32_t crc = crc32(frame, len - 4);
+		const uint8_t *fcs = frame + len - 4;
+		if (fcs[0] != (crc & 0xff) || fcs[1] != ((crc >> 8) & 0xff) ||
+			fcs[2] != ((crc >> 16) & 0xff) || fcs[3] != (crc >> 24))
+		{
+			bench.crcErrors++;
+		}
+
+		bench.packets++;
+		bench.bytes += len;
+		if (len >= 22 && frame[12] == (BENCH_ETHERTYPE >> 8) && frame[13] == (BENCH_ETHERTYPE & 0xff))
+		{
+			uint32_t seq = get32(frame + 14);
+			uint32_t sent = get32(frame + 18);
+			if (frame[0] & 1)
+			{
+				// Generated by the loopback backend
+				bench.generated++;
+				if (seq < bench.nextSeq)
+					bench.reordered++;
+				else
+					bench.nextSeq = seq + 1;
+				sampleAdd(&bench.genLatency, now - sent);
+			}
+			else
+			{
+				bench.reflected++;
+				sampleAdd(&bench.rttLatency, now - sent);
+			}
+		}
+		else
+		{
+			bench.other++;
+		}
+		pos += len;
+
+		if (!more)
+			return;
+	}
+}
+
+static void doRead(uint32_t alloc, uint8_t flags)
+{
+	uint8_t cdb[6] = { 0x08, 0, 0, (uint8_t)(alloc >> 8), (uint8_t)alloc, flags };
+	runCommand(cdb);
+	bench.reads++;
+	parseReadData();
+}
+
+static void buildFrame(uint8_t *f, uint32_t size)
+{
+	// Addressed to ourselves, the loopback backend answers to the source
+	memcpy(f, benchHostMAC, 6);
+	memcpy(f + 6, benchHostMAC, 6);
+	f[12] = BENCH_ETHERTYPE >> 8;
+	f[13] = BENCH_ETHERTYPE & 0xff;
+	put32(f + 14, bench.written++);
+	put32(f + 18, time_us_32());
+	memset(f + 22, 0x5a, size - 22);
+}
+
+static void doWrite(uint32_t size, uint32_t frames)
+{
+	if (size < 60) size = 60;
+	if (size > NETWORK_PACKET_MAX_SIZE - 4) size = NETWORK_PACKET_MAX_SIZE - 4;
+	if (frames < 1) frames = 1;
+
+	hostOutLen = 0;
+	if (frames == 1)
+	{
+		buildFrame(hostOut, size);
+		hostOutLen = size;
+		uint8_t cdb[6] = { 0x0a, 0, 0, (uint8_t)(size >> 8), (uint8_t)size, 0x00 };
+		runCommand(cdb);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < frames && hostOutLen + 4 + size + 4 <= sizeof(hostOut); i++)
+		{
+			uint8_t *hdr = hostOut + hostOutLen;
+			hdr[0] = size >> 8;
+			hdr[1] = size & 0xff;
+			hdr[2] = 0;
+			hdr[3] = 0;
+			buildFrame(hdr + 4, size);
+			hostOutLen += 4 + size;
+		}
+		memset(hostOut + hostOutLen, 0, 4);
+		hostOutLen += 4;
+		uint8_t cdb[6] = { 0x0a, 0, 0, (uint8_t)(hostOutLen >> 8), (uint8_t)hostOutLen, 0x80 };
+		runCommand(cdb);
+	}
+	bench.writes++;
+}
+
+static void doWait(uint32_t us)
+{
+	uint32_t start = time_us_32();
+	while (time_us_32() - start < us)
+	{
+		platform_poll();
+	}
+}
+
+static int loadReplay(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	char line[128];
+	int lineNo = 0;
+	while (fgets(line, sizeof(line), f))
+	{
+		char cmd[16];
+		long a = 0, b = 0;
+		lineNo++;
+		int n = sscanf(line, "%15s %li %li", cmd, &a, &b);
+		if (n <= 0 || cmd[0] == '#')
+			continue;
+
+		if (stepCount >= BENCH_MAX_STEPS)
+		{
+			fprintf(stderr, "%s:%d: more than %d commands\n", path, lineNo, BENCH_MAX_STEPS);
+			fclose(f);
+			return -1;
+		}
+
+		struct benchStep *s = &steps[stepCount++];
+		s->arg = a;
+		s->arg2 = b;
+		if (strcmp(cmd, "read") == 0 && n >= 2)
+		{
+			s->type = STEP_READ;
+			if (n < 3) s->arg2 = 0xc0;
+		}
+		else if (strcmp(cmd, "write") == 0 && n >= 2)
+		{
+			s->type = STEP_WRITE;
+			if (n < 3) s->arg2 = 1;
+		}
+		else if (strcmp(cmd, "wait") == 0 && n >= 2)
+		{
+			s->type = STEP_WAIT;
+		}
+		else
+		{
+			fprintf(stderr, "%s:%d: unknown command: %s", path, lineNo, line);
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+	return stepCount > 0 ? 0 : -1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -t <seconds>   run time (default 5)\n"
+		"  -r <pps>       inbound frames generated per second (default 1000, 0 = off)\n"
+		"  -s <bytes>     size of generated and written frames (default 590)\n"
+		"  -a <bytes>     READ(6) allocation length (default 1524)\n"
+		"  -m             blind mode READ(6), several packets per command\n"
+		"  -p <us>        initiator idle time between commands (default 1000)\n"
+		"  -w <frames>    frames written per WRITE(6) after each READ(6) (default 0)\n"
+		"  -q             Apple host quirks, changes the READ(6) pacing\n"
+		"  -b <KB/s>      simulated SCSI bus speed (default 0 = no transfer time)\n"
+		"  -f <file>      replay file instead of the options above\n"
+		"  -v             firmware debug messages\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = 5;
+	uint32_t rate = 1000;
+	uint32_t size = 590;
+	uint32_t alloc = DAYNAPORT_SCSI_PACKET_MAX;
+	uint8_t readFlags = 0x80;
+	uint32_t pollUs = 1000;
+	uint32_t writeFrames = 0;
+	const char *replay = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:r:s:a:mp:w:qb:f:v")) != -1)
+	{
+		switch (opt)
+		{
+		case 't': seconds = atof(optarg); break;
+		case 'r': rate = strtoul(optarg, NULL, 0); break;
+		case 's': size = strtoul(optarg, NULL, 0); break;
+		case 'a': alloc = strtoul(optarg, NULL, 0); break;
+		case 'm': readFlags = 0xc0; break;
+		case 'p': pollUs = strtoul(optarg, NULL, 0); break;
+		case 'w': writeFrames = strtoul(optarg, NULL, 0); break;
+		case 'q': benchTargetCfg.quirks = S2S_CFG_QUIRKS_APPLE; break;
+		case 'b': busKBs = strtoul(optarg, NULL, 0); break;
+		case 'f': replay = optarg; break;
+		case 'v': g_log_debug = true; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (replay)
+	{
+		if (loadReplay(replay) != 0)
+			return 1;
+	}
+	else
+	{
+		steps[stepCount++] = (struct benchStep){ STEP_READ, alloc, readFlags };
+		if (writeFrames)
+			steps[stepCount++] = (struct benchStep){ STEP_WRITE, size, writeFrames };
+		if (pollUs)
+			steps[stepCount++] = (struct benchStep){ STEP_WAIT, pollUs, 0 };
+	}
+
+	bench.genLatency.us = calloc(BENCH_MAX_SAMPLES, sizeof(uint32_t));
+	bench.rttLatency.us = calloc(BENCH_MAX_SAMPLES, sizeof(uint32_t));
+	if (!bench.genLatency.us || !bench.rttLatency.us)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &benchStart);
+	benchTarget.cfg = &benchTargetCfg;
+	benchTarget.targetId = 4;
+	scsiDev.target = &benchTarget;
+	memcpy(scsiDev.boardCfg.wifiMACAddress, benchHostMAC, 6);
+
+	printf("Queue %d bytes, drop %s, %lu frames/s of %lu bytes generated\n",
+		NETWORK_QUEUE_BYTES, NETWORK_QUEUE_DROP_POLICY == NETWORK_QUEUE_DROP_OLDEST ? "oldest" : "newest",
+		(unsigned long)rate, (unsigned long)size);
+	if (replay)
+		printf("Replaying %s\n", replay);
+	else
+		printf("%s READ(6) of %lu bytes\n", readFlags == 0xc0 ? "Blind" : "Polled", (unsigned long)alloc);
+
+	scsiNetworkSetBackend(&scsiNetworkLoopbackBackend);
+	scsiNetworkLoopbackConfig(rate, size);
+	uint8_t enable[6] = { 0x0e, 0, 0, 0, 0, 0x80 };
+	runCommand(enable);
+
+	uint32_t start = time_us_32();
+	uint32_t duration = (uint32_t)(seconds * 1000000);
+	while (time_us_32() - start < duration)
+	{
+		for (int i = 0; i < stepCount; i++)
+		{
+			struct benchStep *s = &steps[i];
+			if (s->type == STEP_READ)
+				doRead(s->arg, s->arg2);
+			else if (s->type == STEP_WRITE)
+				doWrite(s->arg, s->arg2);
+			else
+				doWait(s->arg);
+		}
+	}
+	uint32_t elapsed = time_us_32() - start;
+
+	// Stop the generator and collect what is still queued
+	scsiNetworkLoopbackConfig(0, size);
+	for (int i = 0; i < 1000 && !scsiNetworkQueueEmpty(); i++)
+		doRead(alloc, readFlags);
+
+	double secs = elapsed / 1e6;
+	printf("%.2f s: %lu READ(6) (%lu empty), %lu WRITE(6) with %lu frames\n", secs,
+		(unsigned long)bench.reads, (unsigned long)bench.emptyReads,
+		(unsigned long)bench.writes, (unsigned long)bench.written);
+	printf("Received %lu packets, %.0f packets/s, %.0f bytes/s: %lu generated, %lu reflected, %lu other\n",
+		(unsigned long)bench.packets, bench.packets / secs, bench.bytes / secs,
+		(unsigned long)bench.generated, (unsigned long)bench.reflected, (unsigned long)bench.other);
+	printf("Dropped %lu of %lu generated and %lu of %lu written frames\n",
+		(unsigned long)(scsiNetworkLoopbackGenerated() - bench.generated),
+		(unsigned long)scsiNetworkLoopbackGenerated(),
+		(unsigned long)(bench.written - bench.reflected), (unsigned long)bench.written);
+	printf("%lu out of order, %lu CRC errors, %lu framing errors\n",
+		(unsigned long)bench.reordered, (unsigned long)bench.crcErrors, (unsigned long)bench.framingErrors);
+	samplePrint("Generated frame", &bench.genLatency);
+	samplePrint("Round trip", &bench.rttLatency);
+
+	// Firmware side statistics
+	scsiNetworkQueueReset();
+	return (bench.crcErrors || bench.framingErrors || bench.reordered) ? 2 : 0;
+}